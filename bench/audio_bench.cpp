@@ -0,0 +1,221 @@
+// Benchmarks of the audio engine, run by hand rather than by ctest:
+//
+//   lege-audio-bench [blocks]
+//
+// Times each set of mixing kernels this CPU supports, then rendering many
+// spatialized voices through the mixer offline, from PCM and compressed sounds,
+// then convolving a bus with a long impulse response
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "audio/convolver.hpp"
+#include "audio/kernels.hpp"
+#include "audio/mixer.hpp"
+#include "audio/sound.hpp"
+
+namespace audio = lege::audio;
+using Clock = std::chrono::steady_clock;
+
+static constexpr unsigned SAMPLE_RATE = 48000;
+static constexpr std::size_t BLOCK_FRAMES = 512;
+static constexpr unsigned HRTF_VOICES = 128;
+// Rendered before timing starts, so every voice is playing
+static constexpr std::size_t WARMUP_BLOCKS = 16;
+// Samples each kernel processes per call, and how long it's timed for
+static constexpr std::size_t KERNEL_SAMPLES = 2048;
+static constexpr double KERNEL_SECONDS = 0.2;
+// Length of the impulse response convolved with, like a large hall
+static constexpr double IMPULSE_SECONDS = 3.0;
+
+// Calls f repeatedly for about KERNEL_SECONDS, and prints how many samples it
+// got through per second, given it processes samples each call
+template <class F>
+static void time_kernel(const char *kernel, std::size_t samples, F &&f) {
+  std::size_t calls = 0;
+  auto start = Clock::now();
+  std::chrono::duration<double> taken{};
+  do {
+    for (int i = 0; i < 64; ++i) {
+      f();
+    }
+    calls += 64;
+    taken = Clock::now() - start;
+  } while (taken.count() < KERNEL_SECONDS);
+  std::printf("  %-12s %10.1f M samples/s\n", kernel,
+              (double)(calls * samples) / taken.count() / 1e6);
+}
+
+static void bench_kernels() {
+  constexpr std::size_t frames = KERNEL_SAMPLES / 2;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> in(KERNEL_SAMPLES * 2 + 4), out(KERNEL_SAMPLES);
+  std::vector<float> re(KERNEL_SAMPLES), im(KERNEL_SAMPLES);
+  std::vector<float> tw_re(KERNEL_SAMPLES / 2), tw_im(KERNEL_SAMPLES / 2);
+  for (auto *v : {&in, &out, &re, &im, &tw_re, &tw_im}) {
+    std::generate(v->begin(), v->end(), [&] { return dist(rng); });
+  }
+  std::vector<std::int8_t> codes(KERNEL_SAMPLES);
+  std::generate(codes.begin(), codes.end(),
+                [&] { return (std::int8_t)(dist(rng) * 127.0f); });
+  std::vector<float> scales(KERNEL_SAMPLES / audio::EXPAND_BLOCK, 1.0f / 127);
+  std::vector<std::int16_t> pcm(KERNEL_SAMPLES);
+  const float start[2] = {0.0f, 0.5f}, end[2] = {0.5f, 0.0f};
+
+  for (const audio::Kernels *k : audio::supported_kernels()) {
+    std::printf("%s kernels, %zu samples per call:\n", k->name,
+                KERNEL_SAMPLES);
+    // Resampling stereo by a little, as when a source is pitched up
+    time_kernel("resample", KERNEL_SAMPLES, [&] {
+      k->resample(out.data(), in.data(), 2, 0.25, 1.0884, frames);
+    });
+    time_kernel("mix", KERNEL_SAMPLES, [&] {
+      k->mix(out.data(), in.data(), 2, frames, start, end, frames);
+    });
+    time_kernel("ramp", KERNEL_SAMPLES, [&] {
+      k->ramp(out.data(), KERNEL_SAMPLES, 1.0f, 1.0f, KERNEL_SAMPLES);
+    });
+    time_kernel("add_planar", KERNEL_SAMPLES, [&] {
+      k->add_planar(out.data(), re.data(), im.data(), frames);
+    });
+    time_kernel("clamp", KERNEL_SAMPLES,
+                [&] { k->clamp(out.data(), KERNEL_SAMPLES); });
+    time_kernel("to_s16", KERNEL_SAMPLES,
+                [&] { k->to_s16(pcm.data(), out.data(), KERNEL_SAMPLES); });
+    // The last pass of an FFT of KERNEL_SAMPLES complex values
+    time_kernel("fft_pass", KERNEL_SAMPLES, [&] {
+      k->fft_pass(re.data(), im.data(), KERNEL_SAMPLES, KERNEL_SAMPLES / 2,
+                  tw_re.data(), tw_im.data());
+    });
+    time_kernel("complex_mac", KERNEL_SAMPLES / 2, [&] {
+      k->complex_mac(re.data(), im.data(), in.data(), out.data(),
+                     tw_re.data(), tw_im.data(), KERNEL_SAMPLES / 2);
+    });
+    time_kernel("expand", KERNEL_SAMPLES, [&] {
+      k->expand(out.data(), codes.data(), scales.data(), scales.size());
+    });
+  }
+}
+
+// A second of mono white noise, looped by the sources playing it
+static std::shared_ptr<const audio::Sound> make_noise() {
+  auto sound = std::make_shared<audio::Sound>();
+  sound->channels = 1;
+  sound->rate = SAMPLE_RATE;
+  sound->samples.resize(SAMPLE_RATE);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+  std::generate(sound->samples.begin(), sound->samples.end(),
+                [&] { return dist(rng); });
+  return sound;
+}
+
+// Renders HRTF_VOICES mono sources placed in a ring around the listener, and
+// reports the CPU time each block takes against the time it lasts. Compressed
+// sources show what expanding them while mixing costs
+static void bench_hrtf(std::size_t blocks, bool compressed) {
+  auto mixer = std::make_unique<audio::Mixer>();
+  mixer->start(SAMPLE_RATE, BLOCK_FRAMES, false);
+  mixer->setMaxVoices(HRTF_VOICES);
+  auto noise = make_noise();
+  if (compressed) {
+    noise = audio::compress(*noise);
+  }
+  std::vector<std::unique_ptr<audio::Source>> sources;
+  for (unsigned i = 0; i < HRTF_VOICES; ++i) {
+    float angle = 2.0f * 3.14159265f * (float)i / HRTF_VOICES;
+    auto &src =
+        sources.emplace_back(std::make_unique<audio::Source>(*mixer, noise));
+    src->setLooping(true);
+    src->setGain(1.0f / HRTF_VOICES);
+    src->setPosition({4.0f * std::cos(angle), 0.0f, 4.0f * std::sin(angle)});
+    src->play();
+  }
+
+  std::vector<float> out(BLOCK_FRAMES * 2);
+  std::vector<double> times;
+  times.reserve(blocks);
+  for (std::size_t i = 0; i < WARMUP_BLOCKS + blocks; ++i) {
+    mixer->update();
+    auto start = Clock::now();
+    mixer->render(out.data(), BLOCK_FRAMES);
+    std::chrono::duration<double> taken = Clock::now() - start;
+    if (i >= WARMUP_BLOCKS) {
+      times.push_back(taken.count());
+    }
+  }
+
+  audio::MixerStats stats = mixer->stats();
+  std::sort(times.begin(), times.end());
+  double total = 0.0;
+  for (double t : times) {
+    total += t;
+  }
+  double block_seconds = (double)BLOCK_FRAMES / SAMPLE_RATE;
+  double mean = total / (double)times.size();
+  std::printf("%u %s voices, %s, %zu frame blocks, %s kernels, %u mixed\n",
+              HRTF_VOICES, compressed ? "compressed" : "PCM",
+              stats.hrtf ? "HRTF" : "panned (no SteamAudio)", BLOCK_FRAMES,
+              stats.kernels, stats.active_voices);
+  std::printf("  per block: mean %.3f ms, p99 %.3f ms, max %.3f ms\n",
+              mean * 1e3, times[times.size() * 99 / 100] * 1e3,
+              times.back() * 1e3);
+  std::printf("  %.1f%% of one core in real time\n",
+              mean / block_seconds * 100.0);
+  mixer->stopWorkers();
+}
+
+// Reports the time each block of convolution takes against the time it lasts,
+// with a stereo impulse response IMPULSE_SECONDS long
+static void bench_convolver(std::size_t blocks) {
+  audio::Sound impulse;
+  impulse.channels = 2;
+  impulse.rate = SAMPLE_RATE;
+  impulse.samples.resize((std::size_t)(IMPULSE_SECONDS * SAMPLE_RATE) * 2);
+  std::mt19937 rng(1);
+  std::normal_distribution<float> gaussian(0.0f, 1.0f);
+  for (std::size_t i = 0; i < impulse.samples.size(); ++i) {
+    float t = (float)(i / 2) / SAMPLE_RATE;
+    impulse.samples[i] = gaussian(rng) * std::exp(-2.3f * t);
+  }
+  audio::Convolver convolver(SAMPLE_RATE);
+  convolver.setImpulse(audio::partition_impulse(impulse, SAMPLE_RATE));
+
+  // Processed in place, so each block starts again from the same noise
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+  std::vector<float> noise(BLOCK_FRAMES * 2), buf(BLOCK_FRAMES * 2);
+  std::generate(noise.begin(), noise.end(), [&] { return dist(rng); });
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < blocks; ++i) {
+    std::copy(noise.begin(), noise.end(), buf.begin());
+    convolver.process(buf.data(), BLOCK_FRAMES);
+  }
+  std::chrono::duration<double> taken = Clock::now() - start;
+  double mean = taken.count() / (double)blocks;
+  std::printf("Convolution with a %.0f s impulse response, %zu frame "
+              "blocks:\n",
+              IMPULSE_SECONDS, BLOCK_FRAMES);
+  std::printf("  per block: mean %.3f ms\n", mean * 1e3);
+  std::printf("  %.1f%% of one core in real time\n",
+              mean / ((double)BLOCK_FRAMES / SAMPLE_RATE) * 100.0);
+}
+
+int main(int argc, char **argv) {
+  std::size_t blocks = 1000;
+  if (argc > 1) {
+    blocks = std::max<std::size_t>(1, std::strtoul(argv[1], nullptr, 10));
+  }
+  bench_kernels();
+  bench_hrtf(blocks, false);
+  bench_hrtf(blocks, true);
+  bench_convolver(blocks);
+  return EXIT_SUCCESS;
+}
@@ -1,11 +1,197 @@
+#include <cstdio>
 #include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include <lege.hpp>
 
-int main() {
+namespace fs = std::filesystem;
+
+static void usage() {
+  std::fputs("Usage:\n"
+             "  lege [--headless] [--render-audio <wav>] [archive]\n"
+             "      Run project.lua, reading files from archive if given.\n"
+             "      --headless runs without a window or video, E.G. for "
+             "servers\n"
+             "      --render-audio mixes audio into a WAV file as fast as "
+             "possible,\n"
+             "      instead of playing it\n"
+             "  lege pack [-z] <output> <file or directory>...\n"
+             "      Build an archive, compressing entries with -z\n"
+             "  lege cook [-r rate] [-l lufs] [-j threads] <output> "
+             "<file or directory>...\n"
+             "      Preprocess WAV and Ogg Vorbis files into a directory, "
+             "for the\n"
+             "      lege.cooked_audio option. -r is the mix rate (48000), -l "
+             "the\n"
+             "      loudness to normalize to (-18)\n"
+             "  lege bake <script> [archive]\n"
+             "      Run script with the project loaded, baking the acoustics "
+             "it gets\n"
+             "      with audio.acoustics(), for the lege.acoustics_cache "
+             "option\n",
+             stderr);
+}
+
+// Adds file, or every file in it if it's a directory, for which keep is true
+template <class F>
+static void add_files(std::vector<std::string> &files, const fs::path &path,
+                      F &&keep) {
+  if (fs::is_directory(path)) {
+    for (const auto &entry : fs::recursive_directory_iterator(path)) {
+      if (entry.is_regular_file() && keep(entry.path())) {
+        files.push_back(entry.path().generic_string());
+      }
+    }
+  } else {
+    files.push_back(path.generic_string());
+  }
+}
+
+// lege pack [-z] <output> <file or directory>...
+static int pack(int argc, char **argv) {
+  bool compress = false;
+  if (argc > 0 && std::string_view(argv[0]) == "-z") {
+    compress = true;
+    ++argv;
+    --argc;
+  }
+  if (argc < 2) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  // Directories are added recursively, entries are named by their relative
+  // path so that they can be loaded the same way as the loose files
+  // An old archive in a directory being packed isn't packed into the new one
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    add_files(files, argv[i], [&](const fs::path &path) {
+      std::error_code ec;
+      return !fs::equivalent(path, argv[0], ec);
+    });
+  }
+
+  lege::packArchive(argv[0], files, compress);
+  std::printf("Packed %zu files into %s\n", files.size(), argv[0]);
+  return EXIT_SUCCESS;
+}
+
+// lege cook [-r rate] [-l lufs] [-j threads] <output> <file or directory>...
+static int cook(int argc, char **argv) {
+  lege::CookOptions options;
+  while (argc > 1 && argv[0][0] == '-') {
+    std::string_view opt = argv[0];
+    char *end;
+    if (opt == "-r") {
+      options.rate = (unsigned)std::strtoul(argv[1], &end, 10);
+    } else if (opt == "-l") {
+      options.loudness = std::strtof(argv[1], &end);
+    } else if (opt == "-j") {
+      options.threads = (unsigned)std::strtoul(argv[1], &end, 10);
+    } else {
+      usage();
+      return EXIT_FAILURE;
+    }
+    if (*end || end == argv[1] || options.rate == 0) {
+      usage();
+      return EXIT_FAILURE;
+    }
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc < 2) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  // Only sounds are taken from directories, so a whole asset tree can be
+  // given
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    add_files(files, argv[i], [](const fs::path &path) {
+      auto ext = path.extension();
+      return ext == ".wav" || ext == ".WAV" || ext == ".ogg" || ext == ".OGG";
+    });
+  }
+
+  std::size_t cooked = lege::cookAudio(argv[0], files, options);
+  std::printf("Cooked %zu files into %s\n", cooked, argv[0]);
+  return EXIT_SUCCESS;
+}
+
+// lege bake <script> [archive]
+static int bake(int argc, char **argv) {
+  if (argc < 1 || argc > 2) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  // The script is run as the main module, so it can require the project's
+  // modules to find its levels' geometry
   lege::Engine engine;
+  engine.set("lege.headless", "true");
+  engine.set("lege.bake_acoustics", "true");
+  if (argc == 2) {
+    engine.mount(argv[1]);
+  }
   engine.loadProject("project.lua");
-  engine.run();
+  engine.loadFile(argv[0]);
+  engine.setup();
+  std::printf("Baked the acoustics %s uses\n", argv[0]);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  try {
+    if (argc > 1 && std::string_view(argv[1]) == "pack") {
+      return pack(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string_view(argv[1]) == "cook") {
+      return cook(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string_view(argv[1]) == "bake") {
+      return bake(argc - 2, argv + 2);
+    }
+
+    bool headless = false;
+    const char *render_audio = nullptr;
+    while (argc > 1) {
+      std::string_view arg = argv[1];
+      if (arg == "--headless") {
+        headless = true;
+      } else if (arg == "--render-audio" && argc > 2) {
+        render_audio = argv[2];
+        ++argv;
+        --argc;
+      } else {
+        break;
+      }
+      ++argv;
+      --argc;
+    }
+    if (argc > 2) {
+      usage();
+      return EXIT_FAILURE;
+    }
+
+    lege::Engine engine;
+    if (headless) {
+      engine.set("lege.headless", "true");
+    }
+    if (render_audio) {
+      engine.set("lege.audio_render", render_audio);
+    }
+    if (argc == 2) {
+      engine.mount(argv[1]);
+    }
+    engine.loadProject("project.lua");
+    engine.run();
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "lege: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,624 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fmt/core.h>
+#include <phonon.h>
+
+#include "audio/acoustics.hpp"
+
+namespace lege::audio {
+
+// The baked format is little-endian, and is used in place from the mapping
+static_assert(std::endian::native == std::endian::little,
+              "Baked acoustics are only supported on little-endian platforms");
+
+static constexpr char MAGIC[8] = {'L', 'E', 'G', 'E', 'A', 'C', 'O', '\x1a'};
+static constexpr std::uint32_t VERSION = 1;
+
+// Rays traced towards the area around each source to estimate how much of it
+// is occluded, and the radius of that area
+static constexpr int OCCLUSION_SAMPLES = 32;
+static constexpr float OCCLUSION_RADIUS = 0.5f;
+// Cells per axis in the grid used to find probes near a point
+static constexpr float MAX_GRID_DIM = 256.0f;
+
+// Followed by the probe positions and reverb times, 3 floats per probe, the
+// grid's cells as offsets into the list of probes in each cell, that list,
+// then 4 bytes per ordered pair of probes. Every section is 4 byte aligned
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t num_probes;
+  std::uint64_t hash;
+  float origin[3];
+  float cell_size;
+  std::uint32_t dims[3];
+  std::uint32_t reserved;
+};
+static_assert(sizeof(Header) == 56);
+
+namespace {
+
+// 64-bit FNV-1a, over raw bytes
+class Hasher {
+public:
+  void add(const void *data, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      m_hash ^= ((const unsigned char *)data)[i];
+      m_hash *= 0x100000001b3ull;
+    }
+  }
+  template <class T> void add(const std::vector<T> &v) {
+    std::uint64_t n = v.size();
+    add(&n, sizeof(n));
+    add(v.data(), v.size() * sizeof(T));
+  }
+  std::uint64_t hash() const { return m_hash; }
+
+private:
+  std::uint64_t m_hash = 0xcbf29ce484222325ull;
+};
+
+void check(IPLerror err, const char *what) {
+  if (err != IPL_STATUS_SUCCESS) {
+    throw std::runtime_error(
+        fmt::format("Could not {}: SteamAudio error {}", what, (int)err));
+  }
+}
+
+IPLCoordinateSpace3 at(glm::vec3 p) {
+  return {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, -1.0f},
+          {p.x, p.y, p.z}};
+}
+
+std::uint8_t quantize(float v) {
+  return (std::uint8_t)std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f);
+}
+
+// Owns the SteamAudio objects used while baking
+class Baker {
+public:
+  Baker() {
+    IPLContextSettings settings{};
+    settings.version = STEAMAUDIO_VERSION;
+    check(iplContextCreate(&settings, &m_context),
+          "create SteamAudio context");
+  }
+  ~Baker() {
+    releaseSimulator();
+    if (m_probes) {
+      iplProbeArrayRelease(&m_probes);
+    }
+    if (m_mesh) {
+      iplStaticMeshRelease(&m_mesh);
+    }
+    if (m_scene) {
+      iplSceneRelease(&m_scene);
+    }
+    iplContextRelease(&m_context);
+  }
+
+  // No copy
+  Baker(const Baker &) = delete;
+  Baker &operator=(const Baker &) = delete;
+
+  void buildScene(const AcousticGeometry &geometry);
+  std::vector<glm::vec3> placeProbes(const AcousticGeometry &geometry,
+                                     const BakeSettings &settings);
+  // Occlusion and transmission from every probe to every other
+  std::vector<std::uint8_t> bakeDirect(const std::vector<glm::vec3> &probes);
+  // Listener-centric reverb times at every probe
+  std::vector<float> bakeReverb(const std::vector<glm::vec3> &probes,
+                                const BakeSettings &settings);
+
+private:
+  void releaseSimulator();
+
+  IPLContext m_context = nullptr;
+  IPLScene m_scene = nullptr;
+  IPLStaticMesh m_mesh = nullptr;
+  IPLProbeArray m_probes = nullptr;
+  IPLSimulator m_simulator = nullptr;
+  std::vector<IPLSource> m_sources;
+};
+
+void Baker::releaseSimulator() {
+  for (auto &source : m_sources) {
+    if (source) {
+      iplSourceRelease(&source);
+    }
+  }
+  m_sources.clear();
+  if (m_simulator) {
+    iplSimulatorRelease(&m_simulator);
+  }
+}
+
+void Baker::buildScene(const AcousticGeometry &geometry) {
+  std::vector<IPLVector3> vertices;
+  vertices.reserve(geometry.vertices.size());
+  for (glm::vec3 v : geometry.vertices) {
+    vertices.push_back({v.x, v.y, v.z});
+  }
+  std::vector<IPLTriangle> triangles;
+  triangles.reserve(geometry.triangles.size());
+  for (const auto &t : geometry.triangles) {
+    triangles.push_back({{(IPLint32)t[0], (IPLint32)t[1], (IPLint32)t[2]}});
+  }
+  std::vector<IPLint32> material_indices(geometry.triangles.size(), 0);
+  std::copy(geometry.triangle_materials.begin(),
+            geometry.triangle_materials.end(), material_indices.begin());
+  std::vector<IPLMaterial> materials;
+  for (const auto &m : geometry.materials) {
+    materials.push_back({{m.absorption[0], m.absorption[1], m.absorption[2]},
+                         m.scattering,
+                         {m.transmission[0], m.transmission[1],
+                          m.transmission[2]}});
+  }
+  if (materials.empty()) {
+    AcousticMaterial m;
+    materials.push_back({{m.absorption[0], m.absorption[1], m.absorption[2]},
+                         m.scattering,
+                         {m.transmission[0], m.transmission[1],
+                          m.transmission[2]}});
+  }
+
+  IPLSceneSettings scene_settings{};
+  scene_settings.type = IPL_SCENETYPE_DEFAULT;
+  check(iplSceneCreate(m_context, &scene_settings, &m_scene),
+        "create acoustic scene");
+  IPLStaticMeshSettings mesh_settings{};
+  mesh_settings.numVertices = (IPLint32)vertices.size();
+  mesh_settings.numTriangles = (IPLint32)triangles.size();
+  mesh_settings.numMaterials = (IPLint32)materials.size();
+  mesh_settings.vertices = vertices.data();
+  mesh_settings.triangles = triangles.data();
+  mesh_settings.materialIndices = material_indices.data();
+  mesh_settings.materials = materials.data();
+  check(iplStaticMeshCreate(m_scene, &mesh_settings, &m_mesh),
+        "create acoustic mesh");
+  iplStaticMeshAdd(m_mesh, m_scene);
+  iplSceneCommit(m_scene);
+}
+
+std::vector<glm::vec3> Baker::placeProbes(const AcousticGeometry &geometry,
+                                          const BakeSettings &settings) {
+  glm::vec3 lo = geometry.vertices[0], hi = lo;
+  for (glm::vec3 v : geometry.vertices) {
+    lo = glm::min(lo, v);
+    hi = glm::max(hi, v);
+  }
+  // Leave room above the highest floor for its probes
+  hi.y += settings.height;
+
+  check(iplProbeArrayCreate(m_context, &m_probes), "create probe array");
+  IPLProbeGenerationParams params{};
+  params.type = IPL_PROBEGENERATIONTYPE_UNIFORMFLOOR;
+  params.spacing = settings.spacing;
+  params.height = settings.height;
+  // Maps the unit cube onto the geometry's bounds
+  glm::vec3 size = hi - lo;
+  params.transform.elements[0][0] = size.x;
+  params.transform.elements[1][1] = size.y;
+  params.transform.elements[2][2] = size.z;
+  params.transform.elements[0][3] = lo.x;
+  params.transform.elements[1][3] = lo.y;
+  params.transform.elements[2][3] = lo.z;
+  params.transform.elements[3][3] = 1.0f;
+  iplProbeArrayGenerateProbes(m_probes, m_scene, &params);
+
+  auto count = (std::size_t)iplProbeArrayGetNumProbes(m_probes);
+  if (count == 0) {
+    throw std::runtime_error("No floors to place acoustic probes on");
+  }
+  if (count > MAX_ACOUSTIC_PROBES) {
+    throw std::runtime_error(fmt::format(
+        "Too many acoustic probes ({}, the maximum is {}), increase spacing",
+        count, MAX_ACOUSTIC_PROBES));
+  }
+  std::vector<glm::vec3> probes(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    IPLSphere s = iplProbeArrayGetProbe(m_probes, (IPLint32)i);
+    probes[i] = {s.center.x, s.center.y, s.center.z};
+  }
+  return probes;
+}
+
+std::vector<std::uint8_t>
+Baker::bakeDirect(const std::vector<glm::vec3> &probes) {
+  const std::size_t count = probes.size();
+  IPLSimulationSettings settings{};
+  settings.flags = IPL_SIMULATIONFLAGS_DIRECT;
+  settings.sceneType = IPL_SCENETYPE_DEFAULT;
+  settings.maxNumOcclusionSamples = OCCLUSION_SAMPLES;
+  settings.maxNumSources = (IPLint32)count;
+  settings.numThreads =
+      (IPLint32)std::max(1u, std::thread::hardware_concurrency());
+  settings.samplingRate = 48000;
+  settings.frameSize = 1024;
+  check(iplSimulatorCreate(m_context, &settings, &m_simulator),
+        "create acoustic simulator");
+  iplSimulatorSetScene(m_simulator, m_scene);
+
+  // A source at every probe, all heard from each probe in turn
+  IPLSourceSettings source_settings{IPL_SIMULATIONFLAGS_DIRECT};
+  for (glm::vec3 p : probes) {
+    IPLSource &source = m_sources.emplace_back(nullptr);
+    check(iplSourceCreate(m_simulator, &source_settings, &source),
+          "create acoustic source");
+    iplSourceAdd(source, m_simulator);
+    IPLSimulationInputs inputs{};
+    inputs.flags = IPL_SIMULATIONFLAGS_DIRECT;
+    inputs.directFlags = (IPLDirectSimulationFlags)(
+        IPL_DIRECTSIMULATIONFLAGS_OCCLUSION |
+        IPL_DIRECTSIMULATIONFLAGS_TRANSMISSION);
+    inputs.source = at(p);
+    inputs.occlusionType = IPL_OCCLUSIONTYPE_VOLUMETRIC;
+    inputs.occlusionRadius = OCCLUSION_RADIUS;
+    inputs.numOcclusionSamples = OCCLUSION_SAMPLES;
+    iplSourceSetInputs(source, IPL_SIMULATIONFLAGS_DIRECT, &inputs);
+  }
+  iplSimulatorCommit(m_simulator);
+
+  std::vector<std::uint8_t> direct(count * count * 4);
+  for (std::size_t i = 0; i < count; ++i) {
+    IPLSimulationSharedInputs shared{};
+    shared.listener = at(probes[i]);
+    iplSimulatorSetSharedInputs(m_simulator, IPL_SIMULATIONFLAGS_DIRECT,
+                                &shared);
+    iplSimulatorRunDirect(m_simulator);
+    for (std::size_t j = 0; j < count; ++j) {
+      IPLSimulationOutputs outputs{};
+      iplSourceGetOutputs(m_sources[j], IPL_SIMULATIONFLAGS_DIRECT, &outputs);
+      std::uint8_t *d = &direct[(i * count + j) * 4];
+      d[0] = quantize(outputs.direct.occlusion);
+      for (int band = 0; band < 3; ++band) {
+        d[band + 1] = quantize(outputs.direct.transmission[band]);
+      }
+    }
+  }
+  releaseSimulator();
+  return direct;
+}
+
+std::vector<float> Baker::bakeReverb(const std::vector<glm::vec3> &probes,
+                                     const BakeSettings &settings) {
+  IPLSimulationSettings sim_settings{};
+  sim_settings.flags = IPL_SIMULATIONFLAGS_REFLECTIONS;
+  sim_settings.sceneType = IPL_SCENETYPE_DEFAULT;
+  sim_settings.reflectionType = IPL_REFLECTIONEFFECTTYPE_PARAMETRIC;
+  sim_settings.maxNumRays = (IPLint32)settings.rays;
+  sim_settings.numDiffuseSamples = 32;
+  sim_settings.maxDuration = settings.duration;
+  sim_settings.maxOrder = 1;
+  sim_settings.maxNumSources = 1;
+  sim_settings.numThreads =
+      (IPLint32)std::max(1u, std::thread::hardware_concurrency());
+  sim_settings.samplingRate = 48000;
+  sim_settings.frameSize = 1024;
+  check(iplSimulatorCreate(m_context, &sim_settings, &m_simulator),
+        "create acoustic simulator");
+  iplSimulatorSetScene(m_simulator, m_scene);
+  IPLSourceSettings source_settings{IPL_SIMULATIONFLAGS_REFLECTIONS};
+  IPLSource &source = m_sources.emplace_back(nullptr);
+  check(iplSourceCreate(m_simulator, &source_settings, &source),
+        "create acoustic source");
+  iplSourceAdd(source, m_simulator);
+  iplSimulatorCommit(m_simulator);
+
+  // With the source at the listener, reflections measure how the space
+  // around the listener reverberates, whatever is making the sound
+  std::vector<float> reverb(probes.size() * 3);
+  for (std::size_t i = 0; i < probes.size(); ++i) {
+    IPLSimulationInputs inputs{};
+    inputs.flags = IPL_SIMULATIONFLAGS_REFLECTIONS;
+    inputs.source = at(probes[i]);
+    inputs.reverbScale[0] = inputs.reverbScale[1] = inputs.reverbScale[2] =
+        1.0f;
+    iplSourceSetInputs(source, IPL_SIMULATIONFLAGS_REFLECTIONS, &inputs);
+    IPLSimulationSharedInputs shared{};
+    shared.listener = at(probes[i]);
+    shared.numRays = (IPLint32)settings.rays;
+    shared.numBounces = (IPLint32)settings.bounces;
+    shared.duration = settings.duration;
+    shared.order = 1;
+    shared.irradianceMinDistance = 1.0f;
+    iplSimulatorSetSharedInputs(m_simulator, IPL_SIMULATIONFLAGS_REFLECTIONS,
+                                &shared);
+    iplSimulatorRunReflections(m_simulator);
+    IPLSimulationOutputs outputs{};
+    iplSourceGetOutputs(source, IPL_SIMULATIONFLAGS_REFLECTIONS, &outputs);
+    std::copy_n(outputs.reflections.reverbTimes, 3, &reverb[i * 3]);
+  }
+  releaseSimulator();
+  return reverb;
+}
+
+void validate(const AcousticGeometry &geometry) {
+  if (geometry.vertices.empty() || geometry.triangles.empty()) {
+    throw std::runtime_error("Acoustic geometry has no triangles");
+  }
+  for (const auto &t : geometry.triangles) {
+    for (std::uint32_t v : t) {
+      if (v >= geometry.vertices.size()) {
+        throw std::runtime_error(
+            fmt::format("Acoustic geometry has no vertex {}", v));
+      }
+    }
+  }
+  if (!geometry.triangle_materials.empty() &&
+      geometry.triangle_materials.size() != geometry.triangles.size()) {
+    throw std::runtime_error(
+        "Acoustic geometry needs a material for every triangle");
+  }
+  std::size_t materials = std::max<std::size_t>(geometry.materials.size(), 1);
+  for (std::uint32_t m : geometry.triangle_materials) {
+    if (m >= materials) {
+      throw std::runtime_error(
+          fmt::format("Acoustic geometry has no material {}", m));
+    }
+  }
+}
+
+template <class T>
+void write(std::ofstream &out, const std::vector<T> &v) {
+  out.write((const char *)v.data(), (std::streamsize)(v.size() * sizeof(T)));
+}
+
+} // namespace
+
+std::uint64_t acoustics_hash(const AcousticGeometry &geometry,
+                             const BakeSettings &settings) {
+  Hasher h;
+  h.add(&VERSION, sizeof(VERSION));
+  h.add(geometry.vertices);
+  h.add(geometry.triangles);
+  h.add(geometry.triangle_materials);
+  h.add(geometry.materials);
+  h.add(&settings.spacing, sizeof(settings.spacing));
+  h.add(&settings.height, sizeof(settings.height));
+  h.add(&settings.rays, sizeof(settings.rays));
+  h.add(&settings.bounces, sizeof(settings.bounces));
+  h.add(&settings.duration, sizeof(settings.duration));
+  return h.hash();
+}
+
+void bake_acoustics(const AcousticGeometry &geometry,
+                    const BakeSettings &settings, const char *filename) {
+  validate(geometry);
+  Baker baker;
+  baker.buildScene(geometry);
+  std::vector<glm::vec3> probes = baker.placeProbes(geometry, settings);
+  std::vector<std::uint8_t> direct = baker.bakeDirect(probes);
+  std::vector<float> reverb = baker.bakeReverb(probes, settings);
+
+  // Bucket probes into a grid, so lookups only look at nearby ones. Cells are
+  // as small as the spacing, unless that would make too many of them
+  glm::vec3 lo = probes[0], hi = lo;
+  for (glm::vec3 p : probes) {
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  glm::vec3 extent = hi - lo;
+  float cell_size = std::max(
+      {settings.spacing, extent.x / (MAX_GRID_DIM - 1.0f),
+       extent.y / (MAX_GRID_DIM - 1.0f), extent.z / (MAX_GRID_DIM - 1.0f)});
+  std::uint32_t dims[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    dims[axis] = (std::uint32_t)(extent[axis] / cell_size) + 1;
+  }
+  auto cell_of = [&](glm::vec3 p) {
+    std::uint32_t c[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      c[axis] = std::min((std::uint32_t)((p[axis] - lo[axis]) / cell_size),
+                         dims[axis] - 1);
+    }
+    return ((std::size_t)c[2] * dims[1] + c[1]) * dims[0] + c[0];
+  };
+  std::vector<std::uint32_t> cell_start(
+      (std::size_t)dims[0] * dims[1] * dims[2] + 1, 0);
+  for (glm::vec3 p : probes) {
+    ++cell_start[cell_of(p) + 1];
+  }
+  for (std::size_t c = 1; c < cell_start.size(); ++c) {
+    cell_start[c] += cell_start[c - 1];
+  }
+  std::vector<std::uint32_t> cell_probes(probes.size());
+  std::vector<std::uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+  for (std::size_t i = 0; i < probes.size(); ++i) {
+    cell_probes[fill[cell_of(probes[i])]++] = (std::uint32_t)i;
+  }
+
+  Header hdr{};
+  std::memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+  hdr.version = VERSION;
+  hdr.num_probes = (std::uint32_t)probes.size();
+  hdr.hash = acoustics_hash(geometry, settings);
+  hdr.origin[0] = lo.x;
+  hdr.origin[1] = lo.y;
+  hdr.origin[2] = lo.z;
+  hdr.cell_size = cell_size;
+  std::copy_n(dims, 3, hdr.dims);
+
+  // Written under another name and moved into place, so a bake that fails
+  // part way never leaves a truncated file behind
+  std::string tmp = fmt::format("{}.tmp", filename);
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error(
+          fmt::format("Could not create \"{}\"", filename));
+    }
+    out.write((const char *)&hdr, sizeof(hdr));
+    write(out, probes);
+    write(out, reverb);
+    write(out, cell_start);
+    write(out, cell_probes);
+    write(out, direct);
+    out.close();
+    if (!out) {
+      std::filesystem::remove(tmp);
+      throw std::runtime_error(
+          fmt::format("Could not write to \"{}\"", filename));
+    }
+  }
+  std::filesystem::rename(tmp, filename);
+}
+
+BakedAcoustics::BakedAcoustics(const char *filename,
+                               std::uint64_t expected_hash)
+    : m_file(filename) {
+  auto invalid = [&] {
+    return std::runtime_error(
+        fmt::format("\"{}\" is not valid baked acoustics", filename));
+  };
+  Header hdr;
+  if (m_file.size() < sizeof(hdr)) {
+    throw invalid();
+  }
+  std::memcpy(&hdr, m_file.data(), sizeof(hdr));
+  if (std::memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      hdr.version != VERSION || hdr.num_probes == 0 ||
+      hdr.num_probes > MAX_ACOUSTIC_PROBES || !(hdr.cell_size > 0.0f) ||
+      hdr.dims[0] == 0 || hdr.dims[0] > MAX_GRID_DIM || hdr.dims[1] == 0 ||
+      hdr.dims[1] > MAX_GRID_DIM || hdr.dims[2] == 0 ||
+      hdr.dims[2] > MAX_GRID_DIM) {
+    throw invalid();
+  }
+  if (hdr.hash != expected_hash) {
+    throw std::runtime_error(
+        fmt::format("\"{}\" was baked from different geometry", filename));
+  }
+  const std::uint64_t p = hdr.num_probes;
+  const std::uint64_t cells = (std::uint64_t)hdr.dims[0] * hdr.dims[1] *
+                              hdr.dims[2];
+  if (m_file.size() != sizeof(hdr) + p * 6 * sizeof(float) +
+                           (cells + 1 + p) * sizeof(std::uint32_t) +
+                           p * p * 4) {
+    throw invalid();
+  }
+
+  m_num_probes = hdr.num_probes;
+  m_origin = {hdr.origin[0], hdr.origin[1], hdr.origin[2]};
+  m_cell_size = hdr.cell_size;
+  std::copy_n(hdr.dims, 3, m_dims.begin());
+  const char *data = m_file.data() + sizeof(hdr);
+  m_probes = (const float *)data;
+  m_reverb = m_probes + p * 3;
+  m_cell_start = (const std::uint32_t *)(m_reverb + p * 3);
+  m_cell_probes = m_cell_start + cells + 1;
+  m_direct = (const std::uint8_t *)(m_cell_probes + p);
+
+  // Check the grid once, so lookups can trust it
+  if (m_cell_start[0] != 0 || m_cell_start[cells] != p) {
+    throw invalid();
+  }
+  for (std::uint64_t c = 0; c < cells; ++c) {
+    if (m_cell_start[c] > m_cell_start[c + 1]) {
+      throw invalid();
+    }
+  }
+  for (std::uint64_t i = 0; i < p; ++i) {
+    if (m_cell_probes[i] >= p) {
+      throw invalid();
+    }
+  }
+}
+
+glm::vec3 BakedAcoustics::probe(std::size_t index) const {
+  const float *p = m_probes + index * 3;
+  return {p[0], p[1], p[2]};
+}
+
+ProbeWeights BakedAcoustics::weigh(glm::vec3 point) const {
+  // The nearest probes in the cells around the point's, closest first
+  ProbeWeights res;
+  std::array<float, 4> dists{};
+  glm::vec3 cell = glm::floor((point - m_origin) / m_cell_size);
+  int lo[3], hi[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    float c = std::clamp(cell[axis], -2.0f, (float)m_dims[axis] + 1.0f);
+    lo[axis] = std::max((int)c - 1, 0);
+    hi[axis] = std::min((int)c + 1, (int)m_dims[axis] - 1);
+  }
+  for (int z = lo[2]; z <= hi[2]; ++z) {
+    for (int y = lo[1]; y <= hi[1]; ++y) {
+      for (int x = lo[0]; x <= hi[0]; ++x) {
+        std::size_t c = ((std::size_t)z * m_dims[1] + y) * m_dims[0] + x;
+        for (auto i = m_cell_start[c]; i < m_cell_start[c + 1]; ++i) {
+          std::uint32_t index = m_cell_probes[i];
+          float dist = glm::length(probe(index) - point);
+          unsigned pos = res.count;
+          while (pos > 0 && dists[pos - 1] > dist) {
+            if (pos < 4) {
+              dists[pos] = dists[pos - 1];
+              res.probes[pos] = res.probes[pos - 1];
+            }
+            --pos;
+          }
+          if (pos < 4) {
+            dists[pos] = dist;
+            res.probes[pos] = index;
+            res.count = std::min(res.count + 1, 4u);
+          }
+        }
+      }
+    }
+  }
+
+  // Inverse distance weighting, so a point on a probe gets exactly its data
+  float total = 0.0f;
+  for (unsigned i = 0; i < res.count; ++i) {
+    res.weights[i] = 1.0f / std::max(dists[i], 1e-3f);
+    total += res.weights[i];
+  }
+  for (unsigned i = 0; i < res.count; ++i) {
+    res.weights[i] /= total;
+  }
+  return res;
+}
+
+DirectPath BakedAcoustics::direct(const ProbeWeights &listener,
+                                  const ProbeWeights &source) const {
+  if (listener.count == 0 || source.count == 0) {
+    return {};
+  }
+  float sums[4] = {};
+  for (unsigned i = 0; i < listener.count; ++i) {
+    const std::uint8_t *row = m_direct + listener.probes[i] * m_num_probes * 4;
+    for (unsigned j = 0; j < source.count; ++j) {
+      const std::uint8_t *d = row + source.probes[j] * 4;
+      float w = listener.weights[i] * source.weights[j];
+      for (int k = 0; k < 4; ++k) {
+        sums[k] += w * d[k];
+      }
+    }
+  }
+  DirectPath res;
+  res.occlusion = sums[0] / 255.0f;
+  for (int band = 0; band < 3; ++band) {
+    res.transmission[band] = sums[band + 1] / 255.0f;
+  }
+  return res;
+}
+
+std::array<float, 3>
+BakedAcoustics::reverbTimes(const ProbeWeights &point) const {
+  std::array<float, 3> res{};
+  for (unsigned i = 0; i < point.count; ++i) {
+    const float *r = m_reverb + point.probes[i] * 3;
+    for (int band = 0; band < 3; ++band) {
+      res[band] += point.weights[i] * r[band];
+    }
+  }
+  return res;
+}
+
+} // namespace lege::audio
@@ -0,0 +1,119 @@
+#ifndef LIBLEGE_AUDIO_ACOUSTICS_HPP
+#define LIBLEGE_AUDIO_ACOUSTICS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mapped_file.hpp"
+
+namespace lege::audio {
+
+// How a surface treats sound, per band: low, mid and high frequencies. The
+// defaults are SteamAudio's "generic" material
+struct AcousticMaterial {
+  std::array<float, 3> absorption{0.10f, 0.20f, 0.30f};
+  float scattering = 0.05f;
+  std::array<float, 3> transmission{0.100f, 0.050f, 0.030f};
+};
+
+// A level's static geometry, as a triangle mesh
+struct AcousticGeometry {
+  std::vector<glm::vec3> vertices;
+  std::vector<std::array<std::uint32_t, 3>> triangles;
+  // Per triangle index into materials. All triangles use the first material
+  // if empty
+  std::vector<std::uint32_t> triangle_materials;
+  // The default material if empty
+  std::vector<AcousticMaterial> materials;
+};
+
+struct BakeSettings {
+  // Distance between probes, which are placed above every floor
+  float spacing = 2.0f;
+  // Height of probes above the floor
+  float height = 1.5f;
+  // Rays traced from each probe to estimate its reverb
+  unsigned rays = 4096;
+  unsigned bounces = 16;
+  // Longest reverb that can be measured, in seconds
+  float duration = 1.0f;
+};
+
+// Probes are compared in pairs, so the table grows with the square of this
+inline constexpr std::size_t MAX_ACOUSTIC_PROBES = 2048;
+
+// Identifies baked data, from the geometry and settings it was baked with and
+// the version of the format
+std::uint64_t acoustics_hash(const AcousticGeometry &geometry,
+                             const BakeSettings &settings);
+
+// Places probes through the geometry and uses SteamAudio to simulate how
+// sound travels between every pair of them, and how each one reverberates,
+// then writes the results to filename. Takes a while, so do it ahead of time
+// or off the main thread. Throws if baking fails or there are more than
+// MAX_ACOUSTIC_PROBES probes
+void bake_acoustics(const AcousticGeometry &geometry,
+                    const BakeSettings &settings, const char *filename);
+
+// What happens to sound travelling straight between two points. Occlusion is
+// the fraction that gets around the geometry between them, and transmission
+// is the fraction of the rest that goes through it, per band
+struct DirectPath {
+  float occlusion = 1.0f;
+  std::array<float, 3> transmission{1.0f, 1.0f, 1.0f};
+
+  // Overall gain, ignoring how transmission colours the sound
+  float gain() const {
+    float t = (transmission[0] + transmission[1] + transmission[2]) / 3.0f;
+    return occlusion + (1.0f - occlusion) * t;
+  }
+};
+
+// Up to 4 probes near a point, and how much each contributes to it
+struct ProbeWeights {
+  std::array<std::uint32_t, 4> probes{};
+  std::array<float, 4> weights{};
+  unsigned count = 0;
+};
+
+// Baked acoustics, mapped from a file written by bake_acoustics(). Lookups
+// interpolate between the probes nearest each point, and don't allocate, so
+// they're cheap enough to do for every source every frame
+class BakedAcoustics {
+public:
+  // Throws if the file isn't valid baked acoustics, or its hash doesn't match
+  // expected_hash
+  BakedAcoustics(const char *filename, std::uint64_t expected_hash);
+
+  std::size_t probeCount() const { return m_num_probes; }
+  glm::vec3 probe(std::size_t index) const;
+
+  // Points with no probes nearby have no weights, and are treated as being
+  // out in the open
+  ProbeWeights weigh(glm::vec3 point) const;
+  DirectPath direct(const ProbeWeights &listener,
+                    const ProbeWeights &source) const;
+  // RT60 per band, in seconds
+  std::array<float, 3> reverbTimes(const ProbeWeights &point) const;
+
+private:
+  MappedFile m_file;
+  std::size_t m_num_probes;
+  glm::vec3 m_origin;
+  float m_cell_size;
+  std::array<std::uint32_t, 3> m_dims;
+  const float *m_probes;
+  const float *m_reverb;
+  const std::uint32_t *m_cell_start;
+  const std::uint32_t *m_cell_probes;
+  // 4 bytes per ordered pair of probes: occlusion, then transmission per band
+  const std::uint8_t *m_direct;
+};
+
+} // namespace lege::audio
+
+#endif
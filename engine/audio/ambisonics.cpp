@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "audio/ambisonics.hpp"
+#include "audio/spatializer.hpp"
+
+namespace lege::audio {
+
+void ambisonic_encode(glm::vec3 direction, unsigned order, float blend,
+                      float *coefficients) noexcept {
+  // Ambisonics has +x ahead, +y left and +z up
+  const float x = -direction.z, y = -direction.x, z = direction.y;
+  coefficients[0] = 1.0f;
+  if (order >= 1) {
+    const float k = std::sqrt(3.0f) * blend;
+    coefficients[1] = k * y;
+    coefficients[2] = k * z;
+    coefficients[3] = k * x;
+  }
+  if (order >= 2) {
+    const float k = std::sqrt(15.0f) * blend;
+    coefficients[4] = k * x * y;
+    coefficients[5] = k * y * z;
+    coefficients[6] = std::sqrt(5.0f) / 2.0f * blend * (3.0f * z * z - 1.0f);
+    coefficients[7] = k * x * z;
+    coefficients[8] = k / 2.0f * (x * x - y * y);
+  }
+}
+
+struct AmbisonicBed::Decoder {
+  IPLContext context = nullptr;
+  IPLHRTF hrtf = nullptr;
+  IPLAmbisonicsDecodeEffect effect = nullptr;
+
+  ~Decoder() {
+    if (effect) {
+      iplAmbisonicsDecodeEffectRelease(&effect);
+    }
+    if (hrtf) {
+      iplHRTFRelease(&hrtf);
+    }
+    if (context) {
+      iplContextRelease(&context);
+    }
+  }
+};
+
+AmbisonicBed::AmbisonicBed(const Spatializer &spatializer,
+                           unsigned sample_rate, unsigned order)
+    : m_order(order), m_frame_size(spatializer.frameSize()),
+      m_decoder(std::make_unique<Decoder>()) {
+  if (order < 1 || order > MAX_AMBISONIC_ORDER) {
+    throw std::runtime_error(fmt::format(
+        "Ambisonic order must be 1 to {}", MAX_AMBISONIC_ORDER));
+  }
+  // Hold on to the spatializer's context and HRTF, in case it goes first
+  m_decoder->context = iplContextRetain(spatializer.context());
+  m_decoder->hrtf = iplHRTFRetain(spatializer.hrtf());
+
+  IPLAudioSettings audio_settings{(IPLint32)sample_rate,
+                                  (IPLint32)m_frame_size};
+  IPLAmbisonicsDecodeEffectSettings settings{};
+  settings.speakerLayout.type = IPL_SPEAKERLAYOUTTYPE_STEREO;
+  settings.hrtf = m_decoder->hrtf;
+  settings.maxOrder = (IPLint32)order;
+  IPLerror err =
+      iplAmbisonicsDecodeEffectCreate(m_decoder->context, &audio_settings,
+                                      &settings, &m_decoder->effect);
+  if (err != IPL_STATUS_SUCCESS) {
+    throw std::runtime_error(fmt::format(
+        "Could not create ambisonics decoder: SteamAudio error {}", (int)err));
+  }
+  m_field.assign(channels() * m_frame_size, 0.0f);
+}
+
+// Out of line, where Decoder is complete
+AmbisonicBed::~AmbisonicBed() = default;
+
+void AmbisonicBed::clear() noexcept {
+  std::fill(m_field.begin(), m_field.end(), 0.0f);
+}
+
+void AmbisonicBed::encode(const float *in, const float *start,
+                          const float *end) noexcept {
+  const std::size_t n = m_frame_size;
+  for (unsigned c = 0; c < channels(); ++c) {
+    float *out = m_field.data() + c * n;
+    const float step = (end[c] - start[c]) / (float)n;
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] += in[i] * (start[c] + step * (float)(i + 1));
+    }
+  }
+}
+
+void AmbisonicBed::decode(float *left, float *right) noexcept {
+  float *in_channels[MAX_AMBISONIC_CHANNELS];
+  for (unsigned c = 0; c < channels(); ++c) {
+    in_channels[c] = m_field.data() + c * m_frame_size;
+  }
+  float *out_channels[] = {left, right};
+  IPLAudioBuffer in_buf{(IPLint32)channels(), (IPLint32)m_frame_size,
+                        in_channels};
+  IPLAudioBuffer out_buf{2, (IPLint32)m_frame_size, out_channels};
+
+  // Voices are encoded relative to the listener, so the bed never needs
+  // rotating
+  IPLAmbisonicsDecodeEffectParams params{};
+  params.order = (IPLint32)m_order;
+  params.hrtf = m_decoder->hrtf;
+  params.orientation = {{1.0f, 0.0f, 0.0f},
+                        {0.0f, 1.0f, 0.0f},
+                        {0.0f, 0.0f, -1.0f},
+                        {0.0f, 0.0f, 0.0f}};
+  params.binaural = IPL_TRUE;
+  iplAmbisonicsDecodeEffectApply(m_decoder->effect, &params, &in_buf,
+                                 &out_buf);
+}
+
+} // namespace lege::audio
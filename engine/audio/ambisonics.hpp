@@ -0,0 +1,70 @@
+#ifndef LIBLEGE_AUDIO_AMBISONICS_HPP
+#define LIBLEGE_AUDIO_AMBISONICS_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace lege::audio {
+
+class Spatializer;
+
+inline constexpr unsigned MAX_AMBISONIC_ORDER = 2;
+inline constexpr unsigned MAX_AMBISONIC_CHANNELS =
+    (MAX_AMBISONIC_ORDER + 1) * (MAX_AMBISONIC_ORDER + 1);
+
+constexpr unsigned ambisonic_channels(unsigned order) {
+  return (order + 1) * (order + 1);
+}
+
+// Fills coefficients with the gain of each channel of a plane wave from
+// direction in listener space (+x right, +y up, -z ahead), which must be
+// normalized. Channels are in ACN order with N3D normalization, as SteamAudio
+// expects. blend fades between omnidirectional (0) and fully directional (1)
+void ambisonic_encode(glm::vec3 direction, unsigned order, float blend,
+                      float *coefficients) noexcept;
+
+// A sound field that any number of mono voices can be encoded into, then
+// decoded binaurally through SteamAudio's HRTF once per block. Encoding a
+// voice costs a multiply-add per channel per sample, so a busy bed of ambient
+// sounds costs about as much as a single decode however many it holds.
+// Created on the main thread, then used only by the audio thread
+class AmbisonicBed {
+public:
+  // order is 1 or 2. Throws if the decoder can't be created
+  AmbisonicBed(const Spatializer &spatializer, unsigned sample_rate,
+               unsigned order);
+  ~AmbisonicBed();
+
+  // No copy
+  AmbisonicBed(const AmbisonicBed &) = delete;
+  AmbisonicBed &operator=(const AmbisonicBed &) = delete;
+
+  unsigned order() const { return m_order; }
+  unsigned channels() const { return ambisonic_channels(m_order); }
+
+  // Audio thread. Silences the bed, ready for a block to be encoded into it
+  void clear() noexcept;
+  // Audio thread. Adds a block of mono in, ramping linearly from the
+  // coefficients start to end across it so that moving voices don't step.
+  // Both hold channels() values, from ambisonic_encode()
+  void encode(const float *in, const float *start, const float *end) noexcept;
+  // Audio thread. Renders the bed to planar left and right
+  void decode(float *left, float *right) noexcept;
+
+private:
+  // The SteamAudio objects, kept out of this header
+  struct Decoder;
+
+  unsigned m_order;
+  std::size_t m_frame_size;
+  std::unique_ptr<Decoder> m_decoder;
+  // Planar, frame size samples per channel
+  std::vector<float> m_field;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <SDL.h>
+
+#include "audio/convolver.hpp"
+#include "audio/kernels.hpp"
+
+namespace lege::audio {
+
+// Overlap-save transforms a partition's worth of input along with the one
+// before it
+static constexpr std::size_t FFT_SIZE = CONVOLUTION_BLOCK * 2;
+// Worker threads for building impulse responses. Loading is mostly waiting on
+// files and transforms, and there are rarely many to do at once
+static constexpr std::size_t MAX_LOADER_THREADS = 2;
+
+std::shared_ptr<const ImpulseResponse>
+partition_impulse(const Sound &impulse, unsigned sample_rate) {
+  const std::size_t in_frames = impulse.frames();
+  if (in_frames == 0) {
+    throw std::runtime_error("Impulse response is empty");
+  }
+
+  // Resample each channel, linearly like the mixer. Mono impulse responses
+  // are used for both channels
+  const double step = (double)impulse.rate / sample_rate;
+  std::size_t frames = (std::size_t)((double)(in_frames - 1) / step) + 1;
+  frames = std::min(frames, (std::size_t)(MAX_IMPULSE_SECONDS * sample_rate));
+  std::vector<float> channels[2];
+  double energy[2] = {};
+  for (unsigned c = 0; c < 2; ++c) {
+    unsigned from = std::min(c, impulse.channels - 1);
+    channels[c].resize(frames);
+    for (std::size_t i = 0; i < frames; ++i) {
+      double pos = (double)i * step;
+      std::size_t i0 = (std::size_t)pos;
+      std::size_t i1 = std::min(i0 + 1, in_frames - 1);
+      float frac = (float)(pos - (double)i0);
+      float a = impulse.sample(i0 * impulse.channels + from);
+      float b = impulse.sample(i1 * impulse.channels + from);
+      channels[c][i] = a + (b - a) * frac;
+      energy[c] += (double)channels[c][i] * channels[c][i];
+    }
+  }
+
+  // Scaled here rather than per block: the inverse FFT isn't normalized, and
+  // separating the two channels' spectra doubles them
+  double loudest = std::max(energy[0], energy[1]);
+  if (loudest <= 0.0) {
+    throw std::runtime_error("Impulse response is silent");
+  }
+  const float scale = (float)(0.5 / FFT_SIZE / std::sqrt(loudest));
+
+  auto ir = std::make_shared<ImpulseResponse>();
+  ir->partitions = (frames + CONVOLUTION_BLOCK - 1) / CONVOLUTION_BLOCK;
+  ir->spectra.assign(ir->partitions * 2 * CONVOLUTION_BINS * 2, 0.0f);
+  Fft fft(FFT_SIZE);
+  std::vector<float> re(FFT_SIZE), im(FFT_SIZE);
+  for (std::size_t p = 0; p < ir->partitions; ++p) {
+    const std::size_t start = p * CONVOLUTION_BLOCK;
+    const std::size_t n = std::min(CONVOLUTION_BLOCK, frames - start);
+    for (unsigned c = 0; c < 2; ++c) {
+      std::fill(re.begin(), re.end(), 0.0f);
+      std::fill(im.begin(), im.end(), 0.0f);
+      for (std::size_t i = 0; i < n; ++i) {
+        re[i] = channels[c][start + i] * scale;
+      }
+      fft.forward(re.data(), im.data());
+      float *out = ir->spectrum(p, c);
+      std::copy_n(re.begin(), CONVOLUTION_BLOCK + 1, out);
+      std::copy_n(im.begin(), CONVOLUTION_BLOCK + 1, out + CONVOLUTION_BINS);
+    }
+  }
+  return ir;
+}
+
+Convolver::Convolver(unsigned sample_rate)
+    : Effect("convolution", sample_rate, PARAMS), m_fft(FFT_SIZE),
+      m_in_re(FFT_SIZE), m_in_im(FFT_SIZE), m_work_re(FFT_SIZE),
+      m_work_im(FFT_SIZE), m_out_re(CONVOLUTION_BLOCK),
+      m_out_im(CONVOLUTION_BLOCK), m_sum(2 * CONVOLUTION_BINS * 2) {}
+
+void Convolver::setImpulse(std::shared_ptr<const ImpulseResponse> impulse) {
+  m_history.assign(impulse->spectra.size(), 0.0f);
+  m_impulse = std::move(impulse);
+  m_state.store(READY, std::memory_order_release);
+}
+
+void Convolver::render(float *buf, std::size_t frames) noexcept {
+  const float wet = param(WET), dry = param(DRY);
+  if (state() != READY) {
+    for (std::size_t i = 0; i < frames * 2; ++i) {
+      buf[i] *= dry;
+    }
+    return;
+  }
+  for (std::size_t i = 0; i < frames; ++i) {
+    float l = buf[i * 2], r = buf[i * 2 + 1];
+    m_in_re[CONVOLUTION_BLOCK + m_fill] = l;
+    m_in_im[CONVOLUTION_BLOCK + m_fill] = r;
+    buf[i * 2] = l * dry + m_out_re[m_fill] * wet;
+    buf[i * 2 + 1] = r * dry + m_out_im[m_fill] * wet;
+    if (++m_fill == CONVOLUTION_BLOCK) {
+      convolve();
+      m_fill = 0;
+    }
+  }
+}
+
+void Convolver::convolve() noexcept {
+  const Kernels &k = kernels();
+  const ImpulseResponse &ir = *m_impulse;
+  const std::size_t bins = CONVOLUTION_BINS;
+  float *re = m_work_re.data(), *im = m_work_im.data();
+  std::copy(m_in_re.begin(), m_in_re.end(), re);
+  std::copy(m_in_im.begin(), m_in_im.end(), im);
+  m_fft.forward(re, im);
+
+  // Separate the two channels' spectra. Each is the spectrum of a real signal,
+  // so only the first half (and Nyquist) is kept
+  float *slot = m_history.data() + m_slot * 2 * bins * 2;
+  float *left = slot, *right = slot + bins * 2;
+  for (std::size_t b = 0; b <= CONVOLUTION_BLOCK; ++b) {
+    std::size_t mirror = (FFT_SIZE - b) & (FFT_SIZE - 1);
+    float ar = re[b], ai = im[b];
+    float br = re[mirror], bi = -im[mirror];
+    left[b] = ar + br;
+    left[bins + b] = ai + bi;
+    right[b] = ai - bi;
+    right[bins + b] = br - ar;
+  }
+
+  // Each partition of the impulse response meets the input from that many
+  // blocks ago
+  std::fill(m_sum.begin(), m_sum.end(), 0.0f);
+  float *sum_l = m_sum.data(), *sum_r = sum_l + bins * 2;
+  for (std::size_t p = 0; p < ir.partitions; ++p) {
+    std::size_t s = (m_slot + ir.partitions - p) % ir.partitions;
+    const float *x = m_history.data() + s * 2 * bins * 2;
+    const float *hl = ir.spectrum(p, 0), *hr = ir.spectrum(p, 1);
+    k.complex_mac(sum_l, sum_l + bins, x, x + bins, hl, hl + bins, bins);
+    k.complex_mac(sum_r, sum_r + bins, x + bins * 2, x + bins * 3, hr,
+                  hr + bins, bins);
+  }
+  m_slot = (m_slot + 1) % ir.partitions;
+
+  // Recombine them as left + i * right, mirroring the rest of the spectrum
+  for (std::size_t b = 0; b <= CONVOLUTION_BLOCK; ++b) {
+    float lr = sum_l[b], li = sum_l[bins + b];
+    float rr = sum_r[b], ri = sum_r[bins + b];
+    re[b] = lr - ri;
+    im[b] = li + rr;
+    if (b > 0 && b < CONVOLUTION_BLOCK) {
+      re[FFT_SIZE - b] = lr + ri;
+      im[FFT_SIZE - b] = rr - li;
+    }
+  }
+  m_fft.inverse(re, im);
+
+  // Only the second half is free of wrap around
+  std::copy_n(re + CONVOLUTION_BLOCK, CONVOLUTION_BLOCK, m_out_re.begin());
+  std::copy_n(im + CONVOLUTION_BLOCK, CONVOLUTION_BLOCK, m_out_im.begin());
+  std::copy_n(m_in_re.begin() + CONVOLUTION_BLOCK, CONVOLUTION_BLOCK,
+              m_in_re.begin());
+  std::copy_n(m_in_im.begin() + CONVOLUTION_BLOCK, CONVOLUTION_BLOCK,
+              m_in_im.begin());
+}
+
+ImpulseLoader::~ImpulseLoader() { stop(); }
+
+void ImpulseLoader::add(const std::shared_ptr<Convolver> &convolver,
+                        LoadFunc load) {
+  std::size_t queued;
+  {
+    std::lock_guard lock(m_mutex);
+    m_queue.emplace_back(convolver, std::move(load));
+    queued = m_queue.size();
+  }
+  if (m_threads.size() < std::min(queued, MAX_LOADER_THREADS)) {
+    m_threads.emplace_back([this](std::stop_token stop) { run(stop); });
+  }
+  m_cond.notify_one();
+}
+
+void ImpulseLoader::stop() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_queue.clear();
+  }
+  for (auto &thread : m_threads) {
+    thread.request_stop();
+  }
+  m_cond.notify_all();
+  m_threads.clear();
+}
+
+void ImpulseLoader::run(std::stop_token stop) {
+  while (true) {
+    std::pair<std::weak_ptr<Convolver>, LoadFunc> job;
+    {
+      std::unique_lock lock(m_mutex);
+      // wait() keeps returning true while anything is queued, even once a
+      // stop has been requested, so that has to be checked too
+      if (!m_cond.wait(lock, stop, [this] { return !m_queue.empty(); }) ||
+          stop.stop_requested()) {
+        return;
+      }
+      job = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+    // Don't keep the convolver alive while loading, in case it's dropped
+    unsigned sample_rate;
+    if (auto convolver = job.first.lock()) {
+      sample_rate = convolver->sampleRate();
+    } else {
+      continue;
+    }
+    std::shared_ptr<const ImpulseResponse> impulse;
+    try {
+      impulse = partition_impulse(*job.second(), sample_rate);
+    } catch (const std::exception &e) {
+      SDL_LogError(SDL_LOG_CATEGORY_AUDIO,
+                   "Could not load impulse response: %s", e.what());
+    }
+    if (auto convolver = job.first.lock()) {
+      if (impulse) {
+        convolver->setImpulse(std::move(impulse));
+      } else {
+        convolver->fail();
+      }
+    }
+  }
+}
+
+} // namespace lege::audio
@@ -0,0 +1,144 @@
+#ifndef LIBLEGE_AUDIO_CONVOLVER_HPP
+#define LIBLEGE_AUDIO_CONVOLVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "audio/effects.hpp"
+#include "audio/fft.hpp"
+#include "audio/sound.hpp"
+
+namespace lege::audio {
+
+// Frames per partition of an impulse response. The wet signal is this many
+// frames late, which is heard as a little pre-delay (about 11 ms at 48 kHz).
+// Halving it would halve that, but double the cost per frame
+inline constexpr std::size_t CONVOLUTION_BLOCK = 512;
+// Bins kept per partition: half the spectrum, plus the Nyquist bin, rounded up
+// to a whole number of vectors
+inline constexpr std::size_t CONVOLUTION_BINS = CONVOLUTION_BLOCK + 8;
+// Impulse responses are cut off after this long
+inline constexpr double MAX_IMPULSE_SECONDS = 10.0;
+
+// An impulse response cut into partitions of CONVOLUTION_BLOCK frames, each
+// transformed ready to be multiplied with. Immutable once built, so any number
+// of convolvers can share one
+struct ImpulseResponse {
+  std::size_t partitions = 0;
+  // For each partition, the left then right channel's spectrum, each as
+  // CONVOLUTION_BINS real parts followed by as many imaginary parts
+  std::vector<float> spectra;
+
+  float *spectrum(std::size_t partition, unsigned channel) {
+    return spectra.data() + (partition * 2 + channel) * CONVOLUTION_BINS * 2;
+  }
+  const float *spectrum(std::size_t partition, unsigned channel) const {
+    return spectra.data() + (partition * 2 + channel) * CONVOLUTION_BINS * 2;
+  }
+};
+
+// Resamples and partitions a mono or stereo impulse response. It's normalized
+// to unit energy, so long and short rooms are about as loud as each other.
+// Slow, so best done on a worker thread
+std::shared_ptr<const ImpulseResponse>
+partition_impulse(const Sound &impulse, unsigned sample_rate);
+
+// Convolves a bus with an impulse response, E.G. one recorded in a real room,
+// using uniformly partitioned overlap-save FFT convolution. Both channels are
+// transformed together, as the real and imaginary parts of one FFT.
+//
+// Until an impulse response is set, only the dry signal is heard
+class Convolver : public Effect {
+public:
+  enum State : std::uint8_t {
+    LOADING,
+    READY,
+    // The impulse response couldn't be loaded
+    FAILED,
+  };
+  enum { WET, DRY };
+
+  explicit Convolver(unsigned sample_rate);
+
+  State state() const { return m_state.load(std::memory_order_acquire); }
+  // Any thread, at most once
+  void setImpulse(std::shared_ptr<const ImpulseResponse> impulse);
+  void fail() { m_state.store(FAILED, std::memory_order_release); }
+
+protected:
+  void render(float *buf, std::size_t frames) noexcept override;
+
+private:
+  // Audio thread. Transforms the block just filled, and works out the next
+  // block of wet output
+  void convolve() noexcept;
+
+  static constexpr ParamInfo PARAMS[] = {
+      {"wet", 0.0f, 1.0f, 0.3f},
+      {"dry", 0.0f, 1.0f, 1.0f},
+  };
+
+  Fft m_fft;
+  // Set before the state becomes READY, and not touched after
+  std::shared_ptr<const ImpulseResponse> m_impulse;
+  std::atomic<State> m_state = LOADING;
+  // The last block of input and the one being filled, as left + i * right
+  std::vector<float> m_in_re;
+  std::vector<float> m_in_im;
+  std::vector<float> m_work_re;
+  std::vector<float> m_work_im;
+  // The wet output being played, while the next block of input is collected
+  std::vector<float> m_out_re;
+  std::vector<float> m_out_im;
+  // Spectra of past blocks of input, laid out like the impulse response's
+  // partitions. The newest is at m_slot
+  std::vector<float> m_history;
+  std::size_t m_slot = 0;
+  // The left then right channel's sum of products
+  std::vector<float> m_sum;
+  std::size_t m_fill = 0;
+};
+
+// Builds impulse responses for convolvers on worker threads, so that loading
+// them doesn't hold up the main thread
+class ImpulseLoader {
+public:
+  // Returns the impulse response to partition. Called on a worker thread, so
+  // it may block. Throws if it can't be loaded
+  using LoadFunc = std::function<std::shared_ptr<const Sound>()>;
+
+  ImpulseLoader() = default;
+  ~ImpulseLoader();
+
+  // No copy
+  ImpulseLoader(const ImpulseLoader &) = delete;
+  ImpulseLoader &operator=(const ImpulseLoader &) = delete;
+
+  // Starts threads as needed. Convolvers dropped before their turn are
+  // skipped. Errors are logged, and leave the convolver FAILED
+  void add(const std::shared_ptr<Convolver> &convolver, LoadFunc load);
+  // Joins the threads, abandoning anything still queued
+  void stop();
+
+private:
+  void run(std::stop_token stop);
+
+  std::mutex m_mutex;
+  std::condition_variable_any m_cond;
+  std::deque<std::pair<std::weak_ptr<Convolver>, LoadFunc>> m_queue;
+  // Must be last, so the threads are joined before the queue is destroyed
+  std::vector<std::jthread> m_threads;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+#include <SDL.h>
+#include <fmt/core.h>
+
+#include "audio/cook.hpp"
+#include "sdl/error.hpp"
+
+namespace fs = std::filesystem;
+namespace sdl = lege::sdl;
+
+namespace lege::audio {
+
+// Frames at the start of a sound that a loop end is matched against
+static constexpr std::size_t LOOP_MATCH = 64;
+
+namespace {
+
+// Direct form II transposed, in double precision so the K-weighting's low
+// cutoff stays accurate at high sample rates
+struct Biquad {
+  double b0, b1, b2, a1, a2;
+  double z1 = 0.0, z2 = 0.0;
+
+  double process(double x) {
+    double y = b0 * x + z1;
+    z1 = b1 * x - a1 * y + z2;
+    z2 = b2 * x - a2 * y;
+    return y;
+  }
+};
+
+// The two stages of BS.1770's K-weighting, a high shelf modelling the head
+// and a high pass, with coefficients derived for any sample rate
+Biquad shelf(unsigned rate) {
+  const double f0 = 1681.974450955533, gain = 3.999843853973347,
+               q = 0.7071752369554196;
+  const double k = std::tan(std::numbers::pi * f0 / rate);
+  const double vh = std::pow(10.0, gain / 20.0);
+  const double vb = std::pow(vh, 0.4996667741545416);
+  const double a0 = 1.0 + k / q + k * k;
+  return {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0,
+          (vh - vb * k / q + k * k) / a0, 2.0 * (k * k - 1.0) / a0,
+          (1.0 - k / q + k * k) / a0};
+}
+
+Biquad high_pass(unsigned rate) {
+  const double f0 = 38.13547087602444, q = 0.5003270373238773;
+  const double k = std::tan(std::numbers::pi * f0 / rate);
+  const double a0 = 1.0 + k / q + k * k;
+  return {1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0,
+          (1.0 - k / q + k * k) / a0};
+}
+
+double lufs(double mean_square) {
+  return -0.691 + 10.0 * std::log10(mean_square);
+}
+
+// 64-bit FNV-1a
+std::uint64_t hash_bytes(std::string_view data) {
+  std::uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : data) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+std::vector<float> resample(const Sound &sound, unsigned rate) {
+  // SDL's resampler is windowed sinc, far better than the linear
+  // interpolation the mixer can afford
+  SDL_AudioStream *stream =
+      SDL_NewAudioStream(AUDIO_F32SYS, (Uint8)sound.channels, (int)sound.rate,
+                         AUDIO_F32SYS, (Uint8)sound.channels, (int)rate);
+  if (!stream) {
+    throw sdl::Error("Could not create resampler");
+  }
+  std::unique_ptr<SDL_AudioStream, void (*)(SDL_AudioStream *)> closer(
+      stream, SDL_FreeAudioStream);
+  if (SDL_AudioStreamPut(stream, sound.samples.data(),
+                         (int)(sound.samples.size() * sizeof(float))) < 0 ||
+      SDL_AudioStreamFlush(stream) < 0) {
+    throw sdl::Error("Could not resample");
+  }
+  std::vector<float> out((std::size_t)SDL_AudioStreamAvailable(stream) /
+                         sizeof(float));
+  int got = SDL_AudioStreamGet(stream, out.data(),
+                               (int)(out.size() * sizeof(float)));
+  if (got < 0) {
+    throw sdl::Error("Could not resample");
+  }
+  // Whole frames only
+  out.resize((std::size_t)got / sizeof(float) / sound.channels *
+             sound.channels);
+  return out;
+}
+
+void cook_file(const std::string &output, CookResult &result,
+               const CookSettings &settings, unsigned thread) {
+  std::ifstream in(result.source, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Could not read file");
+  }
+  std::string data{std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>()};
+  auto sound = decode(data.data(), data.size(), result.source.c_str());
+  std::string cooked = encode_cooked(*cook(*sound, settings));
+
+  result.name = fmt::format("{:016x}.lsnd", hash_bytes(cooked));
+  fs::path path = fs::path(output) / result.name;
+  if (fs::exists(path)) {
+    return; // Cooked already, from this file or one just like it
+  }
+  // Written under another name and moved into place, so a cook that fails
+  // part way never leaves a truncated file behind. Named by thread, as
+  // others may be writing the same sound
+  fs::path tmp = path;
+  tmp += fmt::format(".{}.tmp", thread);
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  out.write(cooked.data(), (std::streamsize)cooked.size());
+  out.close();
+  if (!out) {
+    fs::remove(tmp);
+    throw std::runtime_error(
+        fmt::format("Could not write \"{}\"", path.generic_string()));
+  }
+  fs::rename(tmp, path);
+}
+
+} // namespace
+
+double measure_loudness(const Sound &sound) {
+  const unsigned channels = sound.channels;
+  const std::size_t frames = sound.frames();
+  constexpr double SILENT = -std::numeric_limits<double>::infinity();
+  if (frames == 0) {
+    return SILENT;
+  }
+
+  // Sums of squares over 100ms steps. Blocks are 4 steps, so overlap by 75%
+  const std::size_t step = std::max(sound.rate / 10, 1u);
+  std::vector<double> steps;
+  Biquad filters[2][2] = {{shelf(sound.rate), high_pass(sound.rate)},
+                          {shelf(sound.rate), high_pass(sound.rate)}};
+  double sum = 0.0, total = 0.0;
+  for (std::size_t i = 0; i < frames; ++i) {
+    for (unsigned c = 0; c < channels; ++c) {
+      double y = filters[c][0].process(sound.sample(i * channels + c));
+      y = filters[c][1].process(y);
+      sum += y * y;
+    }
+    if ((i + 1) % step == 0) {
+      steps.push_back(sum);
+      total += sum;
+      sum = 0.0;
+    }
+  }
+  std::vector<double> blocks;
+  for (std::size_t i = 0; i + 4 <= steps.size(); ++i) {
+    blocks.push_back((steps[i] + steps[i + 1] + steps[i + 2] + steps[i + 3]) /
+                     (double)(4 * step));
+  }
+  if (blocks.empty()) {
+    blocks.push_back((total + sum) / (double)frames);
+  }
+
+  // Gated twice: first absolutely, then relative to the loudness of what's
+  // left
+  auto gated_mean = [&](double gate) {
+    double sum = 0.0;
+    std::size_t n = 0;
+    for (double block : blocks) {
+      if (block > 0.0 && lufs(block) > gate) {
+        sum += block;
+        ++n;
+      }
+    }
+    return n ? sum / (double)n : 0.0;
+  };
+  double loudness = gated_mean(-70.0);
+  if (loudness == 0.0) {
+    return SILENT;
+  }
+  loudness = gated_mean(lufs(loudness) - 10.0);
+  return loudness > 0.0 ? lufs(loudness) : SILENT;
+}
+
+void find_loop_points(Sound &sound) {
+  const unsigned channels = sound.channels;
+  const std::size_t frames = sound.frames();
+  if (sound.loop_end || sound.isCompressed() || frames < LOOP_MATCH * 8) {
+    return;
+  }
+  const float *x = sound.samples.data();
+  auto at = [&](std::size_t frame, unsigned c) {
+    return (double)x[frame * channels + c];
+  };
+
+  // Looping the whole sound is fine if jumping from the end back to the
+  // start isn't much more of a jump than the sound usually makes. Compare
+  // against a prediction from the last two frames, so that a steep but smooth
+  // wave doesn't look like a click
+  double jump = 0.0, typical = 0.0;
+  for (unsigned c = 0; c < channels; ++c) {
+    double predicted = 2.0 * at(frames - 1, c) - at(frames - 2, c);
+    jump = std::max(jump, std::abs(at(0, c) - predicted));
+    for (std::size_t i = 2; i < frames; ++i) {
+      double error = at(i, c) - (2.0 * at(i - 1, c) - at(i - 2, c));
+      typical += error * error;
+    }
+  }
+  typical = std::sqrt(typical / (double)((frames - 2) * channels));
+  if (jump <= 3.0 * typical) {
+    return;
+  }
+
+  // Search the last 10% or 100ms for where the next few frames best match
+  // the first few, as jumping back from there is then nearly seamless. From
+  // the end backwards, so that ties cut off as little as possible
+  const std::size_t window =
+      std::min<std::size_t>(frames / 10, std::max(sound.rate / 10, 1u));
+  const std::size_t last = frames - LOOP_MATCH;
+  double best = std::numeric_limits<double>::infinity();
+  std::size_t best_end = frames;
+  for (std::size_t end = last; end + window >= last; --end) {
+    double cost = 0.0;
+    for (std::size_t k = 0; k < LOOP_MATCH && cost < best; ++k) {
+      for (unsigned c = 0; c < channels; ++c) {
+        double d = at(end + k, c) - at(k, c);
+        cost += d * d;
+      }
+    }
+    if (cost < best) {
+      best = cost;
+      best_end = end;
+    }
+  }
+  sound.loop_start = 0;
+  sound.loop_end = best_end;
+}
+
+std::shared_ptr<Sound> cook(const Sound &sound, const CookSettings &settings) {
+  auto out = std::make_shared<Sound>();
+  out->channels = sound.channels;
+  out->rate = settings.rate;
+  if (sound.rate == settings.rate) {
+    out->samples = sound.samples;
+    out->loop_start = sound.loop_start;
+    out->loop_end = sound.loop_end;
+  } else {
+    out->samples = resample(sound, settings.rate);
+    // Loop points the sound came with are kept in the same place
+    if (sound.loop_end) {
+      const double ratio = (double)settings.rate / sound.rate;
+      out->loop_start = (std::size_t)std::lround(sound.loop_start * ratio);
+      out->loop_end = std::min((std::size_t)std::lround(sound.loop_end * ratio),
+                               out->frames());
+      if (out->loop_start >= out->loop_end) {
+        out->loop_start = out->loop_end = 0;
+      }
+    }
+  }
+
+  double loudness = measure_loudness(*out);
+  if (std::isfinite(loudness)) {
+    float peak = 0.0f;
+    for (float x : out->samples) {
+      peak = std::max(peak, std::abs(x));
+    }
+    float gain = std::pow(10.0f, (settings.loudness - (float)loudness) / 20.0f);
+    const float ceiling = std::pow(10.0f, settings.peak / 20.0f);
+    if (peak * gain > ceiling) {
+      gain = ceiling / peak;
+    }
+    for (float &x : out->samples) {
+      x *= gain;
+    }
+  }
+
+  find_loop_points(*out);
+  return out;
+}
+
+std::vector<CookResult> cook_files(const std::string &output,
+                                   const std::vector<std::string> &files,
+                                   const CookSettings &settings) {
+  fs::create_directories(output);
+  std::vector<CookResult> results(files.size());
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    results[i].source = fs::path(files[i]).lexically_normal().generic_string();
+  }
+
+  // Workers take the next file until there are none left, so a few long
+  // sounds don't hold up the rest
+  unsigned num_threads = settings.threads;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min(num_threads, (unsigned)std::max<std::size_t>(
+                                          files.size(), 1));
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&](unsigned thread) {
+    for (std::size_t i; (i = next.fetch_add(1)) < results.size();) {
+      try {
+        cook_file(output, results[i], settings, thread);
+      } catch (const std::exception &e) {
+        results[i].name.clear();
+        results[i].error = e.what();
+      }
+    }
+  };
+  {
+    std::vector<std::jthread> threads;
+    threads.reserve(num_threads);
+    for (unsigned i = 1; i < num_threads; ++i) {
+      threads.emplace_back(worker, i);
+    }
+    worker(0);
+  }
+
+  // Files cooked before are kept in the index, so a directory can be cooked
+  // a bit at a time
+  fs::path index_path = fs::path(output) / COOKED_INDEX;
+  std::map<std::string, std::string> index;
+  if (std::ifstream in(index_path, std::ios::binary); in) {
+    std::string data{std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>()};
+    for (auto &[source, name] : parse_cooked_index(data.data(), data.size())) {
+      index.emplace(source, name);
+    }
+  }
+  for (const auto &result : results) {
+    if (!result.name.empty()) {
+      index[result.source] = result.name;
+    }
+  }
+  fs::path tmp = index_path;
+  tmp += ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  for (const auto &[source, name] : index) {
+    out << name << ' ' << source << '\n';
+  }
+  out.close();
+  if (!out) {
+    fs::remove(tmp);
+    throw std::runtime_error(fmt::format("Could not write \"{}\"",
+                                         index_path.generic_string()));
+  }
+  fs::rename(tmp, index_path);
+  return results;
+}
+
+std::unordered_map<std::string, std::string>
+parse_cooked_index(const char *data, std::size_t size) {
+  // A line per file: its cooked name, a space, then its source path
+  std::unordered_map<std::string, std::string> index;
+  std::string_view rest(data, size);
+  while (!rest.empty()) {
+    std::size_t eol = std::min(rest.find('\n'), rest.size());
+    std::string_view line = rest.substr(0, eol);
+    rest.remove_prefix(std::min(eol + 1, rest.size()));
+    std::size_t space = line.find(' ');
+    if (space == std::string_view::npos || space == 0) {
+      continue;
+    }
+    index.emplace(line.substr(space + 1), line.substr(0, space));
+  }
+  return index;
+}
+
+} // namespace lege::audio
@@ -0,0 +1,65 @@
+#ifndef LIBLEGE_AUDIO_COOK_HPP
+#define LIBLEGE_AUDIO_COOK_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "audio/sound.hpp"
+
+namespace lege::audio {
+
+// Maps each source path in a cooked directory to the file it was cooked into
+inline constexpr const char *COOKED_INDEX = "index.txt";
+
+struct CookSettings {
+  // The mix rate, which every sound is resampled to
+  unsigned rate = 48000;
+  // Integrated loudness to normalize to, in LUFS
+  float loudness = -18.0f;
+  // Highest peak allowed once normalized, in dBFS. Quiet sounds with loud
+  // transients are turned up less than loudness alone would ask for
+  float peak = -1.0f;
+  // 0 for one per CPU
+  unsigned threads = 0;
+};
+
+// Integrated loudness per ITU-R BS.1770, in LUFS: K-weighted, and gated so
+// that silence doesn't count. Sounds shorter than its 400ms blocks are
+// measured as a single block. -infinity if silent
+double measure_loudness(const Sound &sound);
+
+// Finds where a looping PCM sound should jump back to its start, if looping
+// the whole sound would click: the point near the end where the sound looks
+// most like its first few milliseconds. Loop points already set are kept
+void find_loop_points(Sound &sound);
+
+// Resamples a PCM sound to settings.rate, normalizes it, and finds its loop
+// points
+std::shared_ptr<Sound> cook(const Sound &sound, const CookSettings &settings);
+
+struct CookResult {
+  // Normalized source path
+  std::string source;
+  // Name of the cooked file in the output directory. Empty if it failed
+  std::string name;
+  std::string error;
+};
+
+// Decodes and cooks files in parallel into the output directory. Each is
+// written in the engine's own format, named by a hash of its contents so
+// that unchanged sounds keep their names and identical ones are stored once.
+// The directory's index is updated with every file that succeeded
+std::vector<CookResult> cook_files(const std::string &output,
+                                   const std::vector<std::string> &files,
+                                   const CookSettings &settings);
+
+// Reads a cooked directory's index, as source path to cooked file name
+std::unordered_map<std::string, std::string>
+parse_cooked_index(const char *data, std::size_t size);
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#define STB_VORBIS_HEADER_ONLY
+#include <stb_vorbis.c>
+
+#include "audio/decoder.hpp"
+#include "sdl/error.hpp"
+
+namespace sdl = lege::sdl;
+
+namespace lege::audio {
+
+std::size_t MemorySource::read(void *buf, std::size_t size) {
+  size = std::min(size, m_buf.size - m_pos);
+  std::memcpy(buf, m_buf.get() + m_pos, size);
+  m_pos += size;
+  return size;
+}
+
+void MemorySource::seek(std::uint64_t offset) {
+  m_pos = (std::size_t)std::min<std::uint64_t>(offset, m_buf.size);
+}
+
+FileSource::FileSource(const char *filename)
+    : m_rw(SDL_RWFromFile(filename, "rb")) {
+  if (!m_rw) {
+    throw sdl::Error(fmt::format("could not open file \"{}\"", filename));
+  }
+}
+
+FileSource::~FileSource() { SDL_RWclose(m_rw); }
+
+std::size_t FileSource::read(void *buf, std::size_t size) {
+  // SDL doesn't distinguish errors from the end of the file, so a failed read
+  // just ends the stream early
+  return SDL_RWread(m_rw, buf, 1, size);
+}
+
+void FileSource::seek(std::uint64_t offset) {
+  if (SDL_RWseek(m_rw, (Sint64)offset, RW_SEEK_SET) < 0) {
+    throw sdl::Error("Could not seek audio stream");
+  }
+}
+
+std::size_t ReadAhead::fill(std::size_t size) {
+  if (this->size() >= size || m_eof) {
+    return this->size();
+  }
+  // Move what's left to the front, then read as much as fits
+  if (m_start > 0) {
+    std::memmove(m_buf.data(), data(), this->size());
+    m_end -= m_start;
+    m_start = 0;
+  }
+  std::size_t capacity = std::max(size, BLOCK_SIZE) + BLOCK_SIZE;
+  if (m_buf.size() < capacity) {
+    m_buf.resize(capacity);
+  }
+  while (m_end < size && !m_eof) {
+    std::size_t n = m_src->read(m_buf.data() + m_end, m_buf.size() - m_end);
+    m_eof = n == 0;
+    m_end += n;
+  }
+  return this->size();
+}
+
+void ReadAhead::seek(std::uint64_t offset) {
+  // Short loops often land back in the buffer
+  if (offset >= m_offset - m_start && offset <= m_offset + size()) {
+    m_start = (std::size_t)(offset - (m_offset - m_start));
+    m_offset = offset;
+    return;
+  }
+  m_src->seek(offset);
+  m_start = m_end = 0;
+  m_offset = offset;
+  m_eof = false;
+}
+
+static std::uint16_t le16(const std::uint8_t *p) {
+  return (std::uint16_t)(p[0] | p[1] << 8);
+}
+
+static std::uint32_t le32(const std::uint8_t *p) {
+  return (std::uint32_t)p[0] | (std::uint32_t)p[1] << 8 |
+         (std::uint32_t)p[2] << 16 | (std::uint32_t)p[3] << 24;
+}
+
+namespace {
+
+class WavDecoder : public Decoder {
+public:
+  WavDecoder(std::unique_ptr<ByteSource> src, const char *name);
+
+  std::size_t read(float *out, std::size_t frames) override;
+  void rewind() override { m_in.seek(m_data_offset); }
+
+private:
+  enum Format : std::uint16_t {
+    PCM = 1,
+    FLOAT = 3,
+    EXTENSIBLE = 0xfffe,
+  };
+
+  void convert(const std::uint8_t *in, float *out, std::size_t samples);
+
+  ReadAhead m_in;
+  std::uint16_t m_format = 0;
+  std::uint16_t m_bits = 0;
+  std::uint16_t m_block_align = 0;
+  std::uint64_t m_data_offset = 0;
+  std::uint64_t m_data_end = 0;
+};
+
+WavDecoder::WavDecoder(std::unique_ptr<ByteSource> src, const char *name)
+    : m_in(std::move(src)) {
+  auto invalid = [name](const char *why) {
+    return std::runtime_error(
+        fmt::format("Could not decode \"{}\": {}", name, why));
+  };
+  // Skip the RIFF header, open_decoder() already checked it
+  m_in.fill(12);
+  m_in.consume(12);
+  bool have_fmt = false;
+  for (;;) {
+    if (m_in.fill(8) < 8) {
+      throw invalid("no data chunk");
+    }
+    const std::uint8_t *hdr = m_in.data();
+    std::uint32_t len = le32(hdr + 4);
+    bool is_fmt = std::memcmp(hdr, "fmt ", 4) == 0;
+    bool is_data = std::memcmp(hdr, "data", 4) == 0;
+    m_in.consume(8);
+    if (is_fmt) {
+      if (len < 16 || m_in.fill(len) < len) {
+        throw invalid("truncated fmt chunk");
+      }
+      const std::uint8_t *fmt = m_in.data();
+      m_format = le16(fmt);
+      m_channels = le16(fmt + 2);
+      m_rate = le32(fmt + 4);
+      m_block_align = le16(fmt + 12);
+      m_bits = le16(fmt + 14);
+      if (m_format == EXTENSIBLE && len >= 26) {
+        // The real format is the start of the sub-format GUID
+        m_format = le16(fmt + 24);
+      }
+      have_fmt = true;
+    } else if (is_data) {
+      if (!have_fmt) {
+        throw invalid("data chunk before fmt chunk");
+      }
+      m_data_offset = m_in.tell();
+      // Files that were still being written when they were copied often have
+      // a bogus length, so those are read until the end of the file
+      m_data_end = len == 0 || len == 0xffffffff
+                       ? std::numeric_limits<std::uint64_t>::max()
+                       : m_data_offset + len;
+      break;
+    }
+    // Chunks are padded to an even length
+    m_in.seek(m_in.tell() + len + (len & 1));
+  }
+
+  bool supported = (m_format == PCM && (m_bits == 8 || m_bits == 16 ||
+                                        m_bits == 24 || m_bits == 32)) ||
+                   (m_format == FLOAT && m_bits == 32);
+  if (!supported) {
+    throw invalid("unsupported sample format");
+  }
+  if (m_channels < 1 || m_channels > 2) {
+    throw invalid("only mono and stereo files can be streamed");
+  }
+  if (m_block_align != m_channels * m_bits / 8 || m_rate == 0) {
+    throw invalid("invalid fmt chunk");
+  }
+}
+
+std::size_t WavDecoder::read(float *out, std::size_t frames) {
+  std::size_t done = 0;
+  while (done < frames) {
+    std::size_t want = (std::size_t)std::min<std::uint64_t>(
+        frames - done, (m_data_end - m_in.tell()) / m_block_align);
+    std::size_t limit = std::max<std::size_t>(
+        ReadAhead::BLOCK_SIZE / m_block_align * m_block_align, m_block_align);
+    std::size_t avail =
+        m_in.fill(std::min(want * m_block_align, limit)) / m_block_align;
+    std::size_t n = std::min(want, avail);
+    if (n == 0) {
+      break;
+    }
+    convert(m_in.data(), out + done * m_channels, n * m_channels);
+    m_in.consume(n * m_block_align);
+    done += n;
+  }
+  return done;
+}
+
+void WavDecoder::convert(const std::uint8_t *in, float *out,
+                         std::size_t samples) {
+  switch (m_bits) {
+  case 8:
+    for (std::size_t i = 0; i < samples; ++i) {
+      out[i] = ((int)in[i] - 128) * (1.0f / 128.0f);
+    }
+    break;
+  case 16:
+    for (std::size_t i = 0; i < samples; ++i) {
+      out[i] = (std::int16_t)le16(in + i * 2) * (1.0f / 32768.0f);
+    }
+    break;
+  case 24:
+    for (std::size_t i = 0; i < samples; ++i) {
+      const std::uint8_t *p = in + i * 3;
+      // Shift into the top of an int32 to sign extend
+      std::int32_t v = (std::int32_t)((std::uint32_t)p[0] << 8 |
+                                      (std::uint32_t)p[1] << 16 |
+                                      (std::uint32_t)p[2] << 24);
+      out[i] = (float)v * (1.0f / 2147483648.0f);
+    }
+    break;
+  case 32:
+    for (std::size_t i = 0; i < samples; ++i) {
+      std::uint32_t v = le32(in + i * 4);
+      if (m_format == FLOAT) {
+        std::memcpy(&out[i], &v, sizeof(float));
+      } else {
+        out[i] = (float)(std::int32_t)v * (1.0f / 2147483648.0f);
+      }
+    }
+    break;
+  }
+}
+
+class VorbisDecoder : public Decoder {
+public:
+  VorbisDecoder(std::unique_ptr<ByteSource> src, const char *name);
+  ~VorbisDecoder();
+
+  std::size_t read(float *out, std::size_t frames) override;
+  void rewind() override;
+
+private:
+  ReadAhead m_in;
+  stb_vorbis *m_vorbis = nullptr;
+  std::uint64_t m_data_offset = 0;
+  // The last decoded Vorbis frame, which is planar
+  float **m_pending = nullptr;
+  int m_pending_frames = 0;
+  int m_pending_pos = 0;
+};
+
+VorbisDecoder::VorbisDecoder(std::unique_ptr<ByteSource> src,
+                             const char *name)
+    : m_in(std::move(src)) {
+  // The headers include the codebooks, which can be large, so keep reading
+  // until there's enough of them
+  for (std::size_t want = 4096;; want *= 2) {
+    std::size_t got = m_in.fill(want);
+    int used, error;
+    m_vorbis = stb_vorbis_open_pushdata(m_in.data(), (int)got, &used, &error,
+                                        nullptr);
+    if (m_vorbis) {
+      m_in.consume((std::size_t)used);
+      break;
+    }
+    if (error != VORBIS_need_more_data || got < want) {
+      throw std::runtime_error(fmt::format(
+          "Could not decode \"{}\": invalid Ogg Vorbis file", name));
+    }
+  }
+  stb_vorbis_info info = stb_vorbis_get_info(m_vorbis);
+  if (info.channels < 1 || info.channels > 2) {
+    stb_vorbis_close(m_vorbis);
+    throw std::runtime_error(fmt::format(
+        "Could not decode \"{}\": only mono and stereo files can be streamed",
+        name));
+  }
+  m_channels = (unsigned)info.channels;
+  m_rate = info.sample_rate;
+  m_data_offset = m_in.tell();
+}
+
+VorbisDecoder::~VorbisDecoder() { stb_vorbis_close(m_vorbis); }
+
+std::size_t VorbisDecoder::read(float *out, std::size_t frames) {
+  std::size_t done = 0;
+  while (done < frames) {
+    if (m_pending_pos < m_pending_frames) {
+      std::size_t n = std::min(frames - done,
+                               (std::size_t)(m_pending_frames - m_pending_pos));
+      for (std::size_t i = 0; i < n; ++i) {
+        for (unsigned c = 0; c < m_channels; ++c) {
+          out[(done + i) * m_channels + c] = m_pending[c][m_pending_pos + i];
+        }
+      }
+      m_pending_pos += (int)n;
+      done += n;
+      continue;
+    }
+
+    int channels;
+    int used = stb_vorbis_decode_frame_pushdata(
+        m_vorbis, m_in.data(), (int)m_in.size(), &channels, &m_pending,
+        &m_pending_frames);
+    m_pending_pos = 0;
+    if (used == 0 && m_pending_frames == 0) {
+      // Needs more data
+      std::size_t have = m_in.size();
+      if (m_in.fill(have + 4096) == have) {
+        break; // End of the file
+      }
+      continue;
+    }
+    m_in.consume((std::size_t)used);
+  }
+  return done;
+}
+
+void VorbisDecoder::rewind() {
+  m_in.seek(m_data_offset);
+  stb_vorbis_flush_pushdata(m_vorbis);
+  m_pending_frames = m_pending_pos = 0;
+}
+
+} // namespace
+
+std::unique_ptr<Decoder> open_decoder(std::unique_ptr<ByteSource> src,
+                                      const char *name) {
+  std::uint8_t magic[12] = {};
+  std::size_t got = 0;
+  while (got < sizeof(magic)) {
+    std::size_t n = src->read(magic + got, sizeof(magic) - got);
+    if (n == 0) {
+      break;
+    }
+    got += n;
+  }
+  src->seek(0);
+  if (got >= 12 && std::memcmp(magic, "RIFF", 4) == 0 &&
+      std::memcmp(magic + 8, "WAVE", 4) == 0) {
+    return std::make_unique<WavDecoder>(std::move(src), name);
+  }
+  if (got >= 4 && std::memcmp(magic, "OggS", 4) == 0) {
+    return std::make_unique<VorbisDecoder>(std::move(src), name);
+  }
+  throw std::runtime_error(
+      fmt::format("Could not decode \"{}\": unsupported format", name));
+}
+
+} // namespace lege::audio
@@ -0,0 +1,111 @@
+#ifndef LIBLEGE_AUDIO_DECODER_HPP
+#define LIBLEGE_AUDIO_DECODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <SDL.h>
+
+#include "file_buffer.hpp"
+
+namespace lege::audio {
+
+// Where a streamed file's encoded bytes come from. Errors are thrown
+class ByteSource {
+public:
+  virtual ~ByteSource() = default;
+
+  // Returns how many bytes were read, 0 at the end of the file
+  virtual std::size_t read(void *buf, std::size_t size) = 0;
+  virtual void seek(std::uint64_t offset) = 0;
+};
+
+// A file that's already in memory, E.G. mapped from an archive
+class MemorySource : public ByteSource {
+public:
+  explicit MemorySource(FileBuffer buf) : m_buf(std::move(buf)) {}
+
+  std::size_t read(void *buf, std::size_t size) override;
+  void seek(std::uint64_t offset) override;
+
+private:
+  FileBuffer m_buf;
+  std::size_t m_pos = 0;
+};
+
+// A file read from disk with SDL_rwops
+class FileSource : public ByteSource {
+public:
+  explicit FileSource(const char *filename);
+  ~FileSource();
+
+  // No copy
+  FileSource(const FileSource &) = delete;
+  FileSource &operator=(const FileSource &) = delete;
+
+  std::size_t read(void *buf, std::size_t size) override;
+  void seek(std::uint64_t offset) override;
+
+private:
+  SDL_RWops *m_rw;
+};
+
+// Buffers a ByteSource, reading ahead in large blocks so that decoders can
+// parse it in whatever size pieces suit them
+class ReadAhead {
+public:
+  // Bytes are read from the source this many at a time
+  static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+  explicit ReadAhead(std::unique_ptr<ByteSource> src) : m_src(std::move(src)) {}
+
+  // Tries to buffer at least size bytes, and returns how many are buffered.
+  // Less than size are only returned at the end of the file
+  std::size_t fill(std::size_t size);
+  const std::uint8_t *data() const { return m_buf.data() + m_start; }
+  std::size_t size() const { return m_end - m_start; }
+  void consume(std::size_t size) {
+    m_start += size;
+    m_offset += size;
+  }
+  // Offset in the file of data()
+  std::uint64_t tell() const { return m_offset; }
+  void seek(std::uint64_t offset);
+
+private:
+  std::unique_ptr<ByteSource> m_src;
+  std::vector<std::uint8_t> m_buf;
+  std::size_t m_start = 0, m_end = 0;
+  // Offset in the file of m_buf[m_start]
+  std::uint64_t m_offset = 0;
+  bool m_eof = false;
+};
+
+// Incrementally decodes a file to interleaved float PCM with 1 or 2 channels
+class Decoder {
+public:
+  virtual ~Decoder() = default;
+
+  unsigned channels() const { return m_channels; }
+  unsigned rate() const { return m_rate; }
+
+  // Decodes up to frames frames, and returns how many were decoded. Returns
+  // less than frames only at the end of the file
+  virtual std::size_t read(float *out, std::size_t frames) = 0;
+  // Go back to the start of the audio
+  virtual void rewind() = 0;
+
+protected:
+  unsigned m_channels = 0;
+  unsigned m_rate = 0;
+};
+
+// Detects the format from the start of the file. Throws if it can't be decoded
+std::unique_ptr<Decoder> open_decoder(std::unique_ptr<ByteSource> src,
+                                      const char *name);
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "audio/effects.hpp"
+
+namespace lege::audio {
+
+// How quickly parameters reach new values
+static constexpr float SMOOTHING_TIME = 0.01f;
+
+static float db_to_gain(float db) { return std::pow(10.0f, db / 20.0f); }
+
+// Feedback loops decay into denormals, which are very slow on most CPUs
+static float flush_denormal(float x) { return std::abs(x) < 1e-20f ? 0.0f : x; }
+
+bool Param::smooth(float coef) noexcept {
+  float target = this->target();
+  if (m_value == target) {
+    return false;
+  }
+  float next = m_value + (target - m_value) * coef;
+  // Snap once close enough, so that effects stop recalculating
+  if (std::abs(target - next) <= 1e-4f * std::max(1.0f, std::abs(target))) {
+    next = target;
+  }
+  m_value = next;
+  return true;
+}
+
+Effect::Effect(const char *kind, unsigned sample_rate,
+               std::span<const ParamInfo> params)
+    : m_sample_rate(sample_rate), m_kind(kind), m_info(params),
+      m_params(new Param[params.size()]),
+      m_smoothing(1.0f - std::exp(-(float)SMOOTHING_FRAMES /
+                                  (SMOOTHING_TIME * (float)sample_rate))) {
+  for (std::size_t i = 0; i < params.size(); ++i) {
+    m_params[i].reset(params[i].value);
+  }
+}
+
+int Effect::findParam(std::string_view name) const {
+  for (std::size_t i = 0; i < m_info.size(); ++i) {
+    if (name == m_info[i].name) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+void Effect::set(unsigned param, float value) {
+  const ParamInfo &info = m_info[param];
+  m_params[param].set(std::clamp(value, info.min, info.max));
+}
+
+void Effect::init(unsigned param, float value) {
+  const ParamInfo &info = m_info[param];
+  m_params[param].reset(std::clamp(value, info.min, info.max));
+}
+
+void Effect::process(float *buf, std::size_t frames) noexcept {
+  for (std::size_t done = 0; done < frames;) {
+    bool moved = !m_updated;
+    for (std::size_t i = 0; i < m_info.size(); ++i) {
+      moved |= m_params[i].smooth(m_smoothing);
+    }
+    if (moved) {
+      update();
+      m_updated = true;
+    }
+    std::size_t n = std::min(frames - done, SMOOTHING_FRAMES);
+    render(buf + done * 2, n);
+    done += n;
+  }
+}
+
+namespace {
+
+// Filters from Robert Bristow-Johnson's Audio EQ Cookbook
+class Biquad : public Effect {
+public:
+  enum Type {
+    LOWPASS,
+    HIGHPASS,
+    BANDPASS,
+    NOTCH,
+    PEAK,
+    LOWSHELF,
+    HIGHSHELF,
+  };
+  enum { FREQUENCY, Q, GAIN };
+
+  Biquad(const char *kind, Type type, unsigned sample_rate)
+      : Effect(kind, sample_rate, PARAMS), m_type(type) {}
+
+protected:
+  void update() noexcept override {
+    float nyquist = (float)m_sample_rate / 2.0f;
+    float freq = std::min(param(FREQUENCY), nyquist * 0.99f);
+    float w0 = 2.0f * std::numbers::pi_v<float> * freq / (float)m_sample_rate;
+    float cos = std::cos(w0);
+    float alpha = std::sin(w0) / (2.0f * param(Q));
+    // Only used by peak and shelf filters
+    float a = std::pow(10.0f, param(GAIN) / 40.0f);
+    float shelf = 2.0f * std::sqrt(a) * alpha;
+    float b0, b1, b2, a0, a1, a2;
+    switch (m_type) {
+    case LOWPASS:
+      b0 = b2 = (1.0f - cos) / 2.0f;
+      b1 = 1.0f - cos;
+      a0 = 1.0f + alpha, a1 = -2.0f * cos, a2 = 1.0f - alpha;
+      break;
+    case HIGHPASS:
+      b0 = b2 = (1.0f + cos) / 2.0f;
+      b1 = -(1.0f + cos);
+      a0 = 1.0f + alpha, a1 = -2.0f * cos, a2 = 1.0f - alpha;
+      break;
+    case BANDPASS:
+      b0 = alpha, b1 = 0.0f, b2 = -alpha;
+      a0 = 1.0f + alpha, a1 = -2.0f * cos, a2 = 1.0f - alpha;
+      break;
+    case NOTCH:
+      b0 = b2 = 1.0f;
+      b1 = -2.0f * cos;
+      a0 = 1.0f + alpha, a1 = -2.0f * cos, a2 = 1.0f - alpha;
+      break;
+    case PEAK:
+      b0 = 1.0f + alpha * a, b1 = -2.0f * cos, b2 = 1.0f - alpha * a;
+      a0 = 1.0f + alpha / a, a1 = -2.0f * cos, a2 = 1.0f - alpha / a;
+      break;
+    case LOWSHELF:
+      b0 = a * ((a + 1.0f) - (a - 1.0f) * cos + shelf);
+      b1 = 2.0f * a * ((a - 1.0f) - (a + 1.0f) * cos);
+      b2 = a * ((a + 1.0f) - (a - 1.0f) * cos - shelf);
+      a0 = (a + 1.0f) + (a - 1.0f) * cos + shelf;
+      a1 = -2.0f * ((a - 1.0f) + (a + 1.0f) * cos);
+      a2 = (a + 1.0f) + (a - 1.0f) * cos - shelf;
+      break;
+    case HIGHSHELF:
+    default:
+      b0 = a * ((a + 1.0f) + (a - 1.0f) * cos + shelf);
+      b1 = -2.0f * a * ((a - 1.0f) + (a + 1.0f) * cos);
+      b2 = a * ((a + 1.0f) + (a - 1.0f) * cos - shelf);
+      a0 = (a + 1.0f) - (a - 1.0f) * cos + shelf;
+      a1 = 2.0f * ((a - 1.0f) - (a + 1.0f) * cos);
+      a2 = (a + 1.0f) - (a - 1.0f) * cos - shelf;
+      break;
+    }
+    m_b0 = b0 / a0, m_b1 = b1 / a0, m_b2 = b2 / a0;
+    m_a1 = a1 / a0, m_a2 = a2 / a0;
+  }
+
+  void render(float *buf, std::size_t frames) noexcept override {
+    // Transposed direct form II, which copes best with changing coefficients
+    for (std::size_t i = 0; i < frames * 2; ++i) {
+      float *z = m_z[i & 1];
+      float x = buf[i];
+      float y = m_b0 * x + z[0];
+      z[0] = flush_denormal(m_b1 * x - m_a1 * y + z[1]);
+      z[1] = flush_denormal(m_b2 * x - m_a2 * y);
+      buf[i] = y;
+    }
+  }
+
+private:
+  static constexpr ParamInfo PARAMS[] = {
+      {"frequency", 10.0f, 20000.0f, 1000.0f},
+      {"q", 0.1f, 20.0f, 0.7071f},
+      {"gain", -24.0f, 24.0f, 0.0f},
+  };
+
+  Type m_type;
+  float m_b0 = 1.0f, m_b1 = 0.0f, m_b2 = 0.0f, m_a1 = 0.0f, m_a2 = 0.0f;
+  // Per channel filter state
+  float m_z[2][2] = {};
+};
+
+// Feed forward peak compressor, with both channels linked so the stereo image
+// doesn't move. A limiter is just a fast compressor with a very high ratio
+class Compressor : public Effect {
+public:
+  enum { THRESHOLD, RATIO, ATTACK, RELEASE, MAKEUP };
+
+  Compressor(const char *kind, std::span<const ParamInfo> params,
+             unsigned sample_rate)
+      : Effect(kind, sample_rate, params) {}
+
+  static constexpr ParamInfo COMPRESSOR_PARAMS[] = {
+      {"threshold", -60.0f, 0.0f, -18.0f},
+      {"ratio", 1.0f, 100.0f, 4.0f},
+      {"attack", 0.0001f, 1.0f, 0.005f},
+      {"release", 0.001f, 5.0f, 0.1f},
+      {"makeup", 0.0f, 24.0f, 0.0f},
+  };
+  static constexpr ParamInfo LIMITER_PARAMS[] = {
+      {"threshold", -60.0f, 0.0f, -1.0f},
+      {"ratio", 1.0f, 100.0f, 100.0f},
+      {"attack", 0.0001f, 1.0f, 0.0005f},
+      {"release", 0.001f, 5.0f, 0.05f},
+      {"makeup", 0.0f, 24.0f, 0.0f},
+  };
+
+protected:
+  void update() noexcept override {
+    float rate = (float)m_sample_rate;
+    m_attack = std::exp(-1.0f / (param(ATTACK) * rate));
+    m_release = std::exp(-1.0f / (param(RELEASE) * rate));
+    m_slope = 1.0f - 1.0f / param(RATIO);
+  }
+
+  void render(float *buf, std::size_t frames) noexcept override {
+    const float threshold = param(THRESHOLD);
+    const float makeup = param(MAKEUP);
+    for (std::size_t i = 0; i < frames; ++i) {
+      float peak = std::max(std::abs(buf[i * 2]), std::abs(buf[i * 2 + 1]));
+      float level = peak > 1e-6f ? 20.0f * std::log10(peak) : -120.0f;
+      // How many dB to take off
+      float reduction = std::max(level - threshold, 0.0f) * m_slope;
+      float coef = reduction > m_envelope ? m_attack : m_release;
+      m_envelope = reduction + coef * (m_envelope - reduction);
+      float gain = db_to_gain(makeup - m_envelope);
+      buf[i * 2] *= gain;
+      buf[i * 2 + 1] *= gain;
+    }
+  }
+
+private:
+  float m_attack = 0.0f, m_release = 0.0f, m_slope = 0.0f;
+  float m_envelope = 0.0f;
+};
+
+// Echoes, with the delay time interpolated so it can be changed smoothly
+class Delay : public Effect {
+public:
+  enum { TIME, FEEDBACK, MIX };
+  static constexpr float MAX_TIME = 2.0f;
+
+  explicit Delay(unsigned sample_rate)
+      : Effect("delay", sample_rate, PARAMS),
+        m_length((std::size_t)(MAX_TIME * sample_rate) + 2),
+        m_buf(m_length * 2, 0.0f) {}
+
+protected:
+  void render(float *buf, std::size_t frames) noexcept override {
+    const float delay = param(TIME) * (float)m_sample_rate;
+    const float feedback = param(FEEDBACK);
+    const float mix = param(MIX);
+    const std::size_t whole = (std::size_t)delay;
+    const float frac = delay - (float)whole;
+    for (std::size_t i = 0; i < frames; ++i) {
+      // Read between the frames delay and delay + 1 ago
+      std::size_t r0 = (m_pos + m_length - whole) % m_length;
+      std::size_t r1 = (r0 + m_length - 1) % m_length;
+      for (unsigned c = 0; c < 2; ++c) {
+        float a = m_buf[r0 * 2 + c];
+        float b = m_buf[r1 * 2 + c];
+        float echo = a + (b - a) * frac;
+        float x = buf[i * 2 + c];
+        m_buf[m_pos * 2 + c] = flush_denormal(x + echo * feedback);
+        buf[i * 2 + c] = x + (echo - x) * mix;
+      }
+      m_pos = (m_pos + 1) % m_length;
+    }
+  }
+
+private:
+  static constexpr ParamInfo PARAMS[] = {
+      {"time", 0.001f, MAX_TIME, 0.25f},
+      {"feedback", 0.0f, 0.95f, 0.3f},
+      {"mix", 0.0f, 1.0f, 0.3f},
+  };
+
+  std::size_t m_length;
+  std::vector<float> m_buf;
+  std::size_t m_pos = 0;
+};
+
+// Jezar's Freeverb: parallel damped comb filters into series allpasses, with
+// the right channel's delays slightly longer than the left's for width
+class Reverb : public Effect {
+public:
+  enum { ROOM_SIZE, DAMPING, WIDTH, WET, DRY };
+
+  explicit Reverb(unsigned sample_rate)
+      : Effect("reverb", sample_rate, PARAMS) {
+    // The tunings are for 44.1 kHz
+    float scale = (float)sample_rate / 44100.0f;
+    for (unsigned c = 0; c < 2; ++c) {
+      std::size_t spread = c * STEREO_SPREAD;
+      for (std::size_t i = 0; i < COMBS; ++i) {
+        m_combs[c][i].buf.resize(
+            std::max<std::size_t>(1, (COMB_TUNING[i] + spread) * scale));
+      }
+      for (std::size_t i = 0; i < ALLPASSES; ++i) {
+        m_allpasses[c][i].buf.resize(
+            std::max<std::size_t>(1, (ALLPASS_TUNING[i] + spread) * scale));
+      }
+    }
+  }
+
+protected:
+  void update() noexcept override {
+    m_feedback = param(ROOM_SIZE) * 0.28f + 0.7f;
+    m_damp = param(DAMPING) * 0.4f;
+    float wet = param(WET) * 3.0f;
+    m_wet1 = wet * (param(WIDTH) / 2.0f + 0.5f);
+    m_wet2 = wet * ((1.0f - param(WIDTH)) / 2.0f);
+  }
+
+  void render(float *buf, std::size_t frames) noexcept override {
+    const float dry = param(DRY);
+    for (std::size_t i = 0; i < frames; ++i) {
+      float in = (buf[i * 2] + buf[i * 2 + 1]) * 0.015f;
+      float out[2];
+      for (unsigned c = 0; c < 2; ++c) {
+        float sum = 0.0f;
+        for (Comb &comb : m_combs[c]) {
+          float y = comb.buf[comb.pos];
+          comb.store =
+              flush_denormal(y * (1.0f - m_damp) + comb.store * m_damp);
+          comb.buf[comb.pos] = in + comb.store * m_feedback;
+          comb.pos = (comb.pos + 1) % comb.buf.size();
+          sum += y;
+        }
+        for (Allpass &allpass : m_allpasses[c]) {
+          float y = allpass.buf[allpass.pos];
+          allpass.buf[allpass.pos] = flush_denormal(sum + y * 0.5f);
+          allpass.pos = (allpass.pos + 1) % allpass.buf.size();
+          sum = y - sum;
+        }
+        out[c] = sum;
+      }
+      buf[i * 2] = out[0] * m_wet1 + out[1] * m_wet2 + buf[i * 2] * dry;
+      buf[i * 2 + 1] = out[1] * m_wet1 + out[0] * m_wet2 + buf[i * 2 + 1] * dry;
+    }
+  }
+
+private:
+  static constexpr std::size_t COMBS = 8;
+  static constexpr std::size_t ALLPASSES = 4;
+  static constexpr std::size_t STEREO_SPREAD = 23;
+  static constexpr std::size_t COMB_TUNING[COMBS] = {1116, 1188, 1277, 1356,
+                                                     1422, 1491, 1557, 1617};
+  static constexpr std::size_t ALLPASS_TUNING[ALLPASSES] = {556, 441, 341,
+                                                            225};
+  static constexpr ParamInfo PARAMS[] = {
+      {"room_size", 0.0f, 1.0f, 0.5f}, {"damping", 0.0f, 1.0f, 0.5f},
+      {"width", 0.0f, 1.0f, 1.0f},     {"wet", 0.0f, 1.0f, 0.3f},
+      {"dry", 0.0f, 1.0f, 1.0f},
+  };
+
+  struct Comb {
+    std::vector<float> buf;
+    std::size_t pos = 0;
+    float store = 0.0f;
+  };
+  struct Allpass {
+    std::vector<float> buf;
+    std::size_t pos = 0;
+  };
+
+  std::array<std::array<Comb, COMBS>, 2> m_combs;
+  std::array<std::array<Allpass, ALLPASSES>, 2> m_allpasses;
+  float m_feedback = 0.0f, m_damp = 0.0f, m_wet1 = 0.0f, m_wet2 = 0.0f;
+};
+
+constexpr const char *EFFECT_KINDS[] = {
+    "lowpass",  "highpass",   "bandpass", "notch", "peak",   "lowshelf",
+    "highshelf", "compressor", "limiter",  "delay", "reverb",
+};
+
+} // namespace
+
+std::shared_ptr<Effect> make_effect(std::string_view kind,
+                                    unsigned sample_rate) {
+  // Biquads come first, in the same order as their types
+  for (int type = Biquad::LOWPASS; type <= Biquad::HIGHSHELF; ++type) {
+    if (kind == EFFECT_KINDS[type]) {
+      return std::make_shared<Biquad>(EFFECT_KINDS[type], (Biquad::Type)type,
+                                      sample_rate);
+    }
+  }
+  if (kind == "compressor") {
+    return std::make_shared<Compressor>(
+        "compressor", Compressor::COMPRESSOR_PARAMS, sample_rate);
+  } else if (kind == "limiter") {
+    return std::make_shared<Compressor>("limiter", Compressor::LIMITER_PARAMS,
+                                        sample_rate);
+  } else if (kind == "delay") {
+    return std::make_shared<Delay>(sample_rate);
+  } else if (kind == "reverb") {
+    return std::make_shared<Reverb>(sample_rate);
+  }
+  throw std::runtime_error(fmt::format("unknown effect \"{}\"", kind));
+}
+
+std::span<const char *const> effect_kinds() { return EFFECT_KINDS; }
+
+} // namespace lege::audio
@@ -0,0 +1,108 @@
+#ifndef LIBLEGE_AUDIO_EFFECTS_HPP
+#define LIBLEGE_AUDIO_EFFECTS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace lege::audio {
+
+// Parameters move towards new values over a few milliseconds, updated this
+// many frames at a time, so that changing them doesn't click
+inline constexpr std::size_t SMOOTHING_FRAMES = 32;
+
+struct ParamInfo {
+  const char *name;
+  float min;
+  float max;
+  float value;
+};
+
+class Bus;
+
+// A parameter set on the main thread and smoothed on the audio thread
+class Param {
+public:
+  // Jumps straight to value. Only before the audio thread sees the parameter
+  void reset(float value) {
+    m_target.store(value, std::memory_order_relaxed);
+    m_value = value;
+  }
+  void set(float value) { m_target.store(value, std::memory_order_relaxed); }
+  float target() const { return m_target.load(std::memory_order_relaxed); }
+
+  // Audio thread. Moves towards the target, and returns whether the value
+  // changed
+  bool smooth(float coef) noexcept;
+  float value() const { return m_value; }
+
+private:
+  std::atomic<float> m_target = 0.0f;
+  float m_value = 0.0f;
+};
+
+// A stereo effect, created on the main thread and run by the mixer as part of
+// a bus. Parameters can be set at any time from the main thread without
+// locking, and take effect smoothly
+class Effect {
+public:
+  Effect(const char *kind, unsigned sample_rate,
+         std::span<const ParamInfo> params);
+  virtual ~Effect() = default;
+
+  // No copy
+  Effect(const Effect &) = delete;
+  Effect &operator=(const Effect &) = delete;
+
+  const char *kind() const { return m_kind; }
+  unsigned sampleRate() const { return m_sample_rate; }
+  std::span<const ParamInfo> params() const { return m_info; }
+  // Index of the named parameter, or -1 if there isn't one
+  int findParam(std::string_view name) const;
+  // Clamps value to the parameter's range
+  void set(unsigned param, float value);
+  // Like set(), but jumps straight to the value rather than moving smoothly.
+  // Only before the effect is first added to a bus
+  void init(unsigned param, float value);
+  float get(unsigned param) const { return m_params[param].target(); }
+
+  // Audio thread. Processes interleaved stereo frames in place
+  void process(float *buf, std::size_t frames) noexcept;
+
+protected:
+  float param(unsigned index) const { return m_params[index].value(); }
+
+  // Audio thread. Called whenever parameters have moved, before render()
+  virtual void update() noexcept {}
+  // Audio thread. Processes at most SMOOTHING_FRAMES frames
+  virtual void render(float *buf, std::size_t frames) noexcept = 0;
+
+  unsigned m_sample_rate;
+
+private:
+  friend class Bus;
+
+  const char *m_kind;
+  std::span<const ParamInfo> m_info;
+  std::unique_ptr<Param[]> m_params;
+  float m_smoothing;
+  bool m_updated = false;
+  // The bus this effect is part of, if any. Main thread only
+  Bus *m_bus = nullptr;
+};
+
+// Creates an effect by kind: "lowpass", "highpass", "bandpass", "notch",
+// "peak", "lowshelf" or "highshelf" biquad filters, "compressor", "limiter",
+// "delay" or "reverb". Throws if the kind is unknown
+std::shared_ptr<Effect> make_effect(std::string_view kind,
+                                    unsigned sample_rate);
+
+// Every kind make_effect() accepts
+std::span<const char *const> effect_kinds();
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,55 @@
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+#include "audio/fft.hpp"
+
+namespace lege::audio {
+
+Fft::Fft(std::size_t size) : m_size(size), m_kernels(&kernels()) {
+  if (size < 2 || (size & (size - 1)) != 0) {
+    throw std::invalid_argument("FFT size must be a power of two");
+  }
+  unsigned bits = 0;
+  while ((std::size_t)1 << bits < size) {
+    ++bits;
+  }
+  for (std::uint32_t i = 0; i < size; ++i) {
+    std::uint32_t rev = 0;
+    for (unsigned b = 0; b < bits; ++b) {
+      rev |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    if (i < rev) {
+      m_swaps.emplace_back(i, rev);
+    }
+  }
+  // The pass combining groups of 2 * half starts at half - 1
+  m_tw_re.reserve(size - 1);
+  m_tw_im.reserve(size - 1);
+  for (std::size_t half = 1; half < size; half *= 2) {
+    for (std::size_t j = 0; j < half; ++j) {
+      double angle = -std::numbers::pi * (double)j / (double)half;
+      m_tw_re.push_back((float)std::cos(angle));
+      m_tw_im.push_back((float)std::sin(angle));
+    }
+  }
+}
+
+void Fft::forward(float *re, float *im) const noexcept {
+  for (auto [a, b] : m_swaps) {
+    std::swap(re[a], re[b]);
+    std::swap(im[a], im[b]);
+  }
+  for (std::size_t half = 1; half < m_size; half *= 2) {
+    m_kernels->fft_pass(re, im, m_size, half, m_tw_re.data() + half - 1,
+                        m_tw_im.data() + half - 1);
+  }
+}
+
+void Fft::inverse(float *re, float *im) const noexcept {
+  // Swapping the real and imaginary parts on the way in and out turns a
+  // forward transform into an inverse one
+  forward(im, re);
+}
+
+} // namespace lege::audio
@@ -0,0 +1,38 @@
+#ifndef LIBLEGE_AUDIO_FFT_HPP
+#define LIBLEGE_AUDIO_FFT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "audio/kernels.hpp"
+
+namespace lege::audio {
+
+// A complex FFT of a fixed power of two size, over separate arrays of real and
+// imaginary parts. Neither direction is scaled, so a round trip multiplies by
+// the size
+class Fft {
+public:
+  explicit Fft(std::size_t size);
+
+  std::size_t size() const { return m_size; }
+
+  // In place. Any number of threads can transform at once
+  void forward(float *re, float *im) const noexcept;
+  void inverse(float *re, float *im) const noexcept;
+
+private:
+  std::size_t m_size;
+  // Pairs of indices to swap to put the input in bit reversed order
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> m_swaps;
+  // Twiddles for each pass, one after another
+  std::vector<float> m_tw_re;
+  std::vector<float> m_tw_im;
+  const Kernels *m_kernels;
+};
+
+} // namespace lege::audio
+
+#endif
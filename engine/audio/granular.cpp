@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "audio/granular.hpp"
+
+namespace lege::audio {
+
+// So that a huge rate can't keep the audio thread busy starting grains that
+// would be skipped anyway
+static constexpr float MAX_RATE = 1000.0f;
+
+Granulator::Granulator(std::vector<std::shared_ptr<const Sound>> sounds,
+                       unsigned sample_rate, std::uint64_t seed)
+    : m_sounds(std::move(sounds)), m_sample_rate(sample_rate),
+      m_state(seed * 0x9e3779b97f4a7c15ull | 1) {}
+
+void Granulator::schedule(std::size_t frames) noexcept {
+  const EmitterParams &p = m_params;
+  const float rate = std::min(p.rate, MAX_RATE);
+  if (m_stopping || !(rate > 0.0f)) {
+    return;
+  }
+  while (m_countdown < (double)frames) {
+    auto pick = (std::size_t)(random() * (float)m_sounds.size());
+    const Sound &sound = *m_sounds[std::min(pick, m_sounds.size() - 1)];
+    float semitones = p.pitch_spread * (2.0f * random() - 1.0f);
+    double step = (double)std::max(p.pitch, 0.0f) *
+                  std::exp2(semitones / 12.0f) * sound.rate / m_sample_rate;
+    float gain = 1.0f - std::clamp(p.gain_spread, 0.0f, 1.0f) * random();
+    glm::vec3 offset{0.0f, 0.0f, 0.0f};
+    if (p.position_spread > 0.0f) {
+      // Uniform within a sphere, by picking points in the cube around it
+      // until one lands inside
+      do {
+        offset = {2.0f * random() - 1.0f, 2.0f * random() - 1.0f,
+                  2.0f * random() - 1.0f};
+      } while (glm::dot(offset, offset) > 1.0f);
+      offset *= p.position_spread;
+    }
+    // Grains that wouldn't move would never end
+    if (m_count < MAX_GRAINS && step > 0.0) {
+      m_grains[m_count++] = {&sound, 0.0, step, gain, p.position + offset,
+                             (std::size_t)m_countdown};
+    }
+    // Exponentially distributed gaps make grains arrive independently of
+    // each other, so there's no rhythm to hear
+    m_countdown -= std::log(1.0 - (double)random()) / rate * m_sample_rate;
+  }
+  m_countdown -= (double)frames;
+}
+
+void Granulator::collect() noexcept {
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < m_count; ++i) {
+    if (m_grains[i].sound) {
+      m_grains[kept++] = m_grains[i];
+    }
+  }
+  m_count = kept;
+}
+
+float Granulator::random() noexcept {
+  // xorshift64*, taking the top 24 bits as a float's mantissa
+  m_state ^= m_state >> 12;
+  m_state ^= m_state << 25;
+  m_state ^= m_state >> 27;
+  return (float)((m_state * 0x2545f4914f6cdd1dull) >> 40) * 0x1.0p-24f;
+}
+
+} // namespace lege::audio
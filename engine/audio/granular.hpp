@@ -0,0 +1,100 @@
+#ifndef LIBLEGE_AUDIO_GRANULAR_HPP
+#define LIBLEGE_AUDIO_GRANULAR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "audio/sound.hpp"
+
+namespace lege::audio {
+
+// Granular emitters playing at once
+inline constexpr unsigned MAX_EMITTERS = 32;
+// Grains playing at once per emitter. Grains due while there are this many
+// are skipped
+inline constexpr unsigned MAX_GRAINS = 64;
+
+struct EmitterParams {
+  // Grains started per second, on average. They start at random times, like
+  // raindrops, rather than on a beat
+  float rate = 10.0f;
+  float gain = 1.0f;
+  // Each grain is quieter than gain by a random fraction up to this
+  float gain_spread = 0.0f;
+  float pitch = 1.0f;
+  // Each grain is pitched up or down at random by up to this many semitones
+  float pitch_spread = 0.0f;
+  glm::vec3 position{0.0f, 0.0f, 0.0f};
+  // Each grain plays from a random point up to this far from position
+  float position_spread = 0.0f;
+  // Index of the bus the grains play into
+  std::uint8_t bus = 0;
+};
+
+// One sound from the pool, playing once
+struct Grain {
+  const Sound *sound;
+  // In frames of the sound
+  double cursor;
+  // How far it moves through the sound per output frame
+  double step;
+  float gain;
+  glm::vec3 position;
+  // Frames into the next block before it starts
+  std::size_t delay;
+};
+
+// Schedules the grains of a granular emitter: sounds picked at random from a
+// pool and started at random times, each with its own random gain, pitch and
+// position. Created on the main thread, then only used by the audio thread,
+// which plays however many grains are due without the main thread knowing
+// about any of them
+class Granulator {
+public:
+  // Keeps the sounds alive. There must be at least one, and none can be
+  // empty
+  Granulator(std::vector<std::shared_ptr<const Sound>> sounds,
+             unsigned sample_rate, std::uint64_t seed);
+
+  // No copy
+  Granulator(const Granulator &) = delete;
+  Granulator &operator=(const Granulator &) = delete;
+
+  // Audio thread. Only affects grains started after
+  void setParams(const EmitterParams &params) noexcept { m_params = params; }
+  const EmitterParams &params() const noexcept { return m_params; }
+
+  // Audio thread. Stops starting grains. The ones playing carry on to the end
+  void stop() noexcept { m_stopping = true; }
+  bool isFinished() const noexcept { return m_stopping && m_count == 0; }
+
+  // Audio thread. Starts the grains due in the next frames frames
+  void schedule(std::size_t frames) noexcept;
+  // Audio thread. Grains are ended by setting their sound to null
+  std::span<Grain> grains() noexcept { return {m_grains, m_count}; }
+  // Audio thread. Forgets ended grains
+  void collect() noexcept;
+
+private:
+  // Uniform in [0, 1)
+  float random() noexcept;
+
+  std::vector<std::shared_ptr<const Sound>> m_sounds;
+  unsigned m_sample_rate;
+  EmitterParams m_params;
+  std::uint64_t m_state;
+  // Frames until the next grain is due
+  double m_countdown = 0.0;
+  bool m_stopping = false;
+  Grain m_grains[MAX_GRAINS];
+  std::size_t m_count = 0;
+};
+
+} // namespace lege::audio
+
+#endif
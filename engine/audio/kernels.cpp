@@ -0,0 +1,83 @@
+#include <SDL.h>
+
+#include "audio/kernels.hpp"
+#include "audio/kernels_scalar.hpp"
+
+namespace lege::audio {
+
+#ifdef LEGE_X86_KERNELS
+// In kernels_sse2.cpp and kernels_avx2.cpp, which are built with those
+// instruction sets enabled
+extern const Kernels SSE2_KERNELS;
+extern const Kernels AVX2_KERNELS;
+#endif
+
+static void resample(float *out, const float *in, unsigned channels,
+                     double cursor, double step, std::size_t frames) {
+  scalar::resample(out, in, channels, cursor, step, 0, frames);
+}
+
+static void mix(float *out, const float *in, unsigned channels,
+                std::size_t frames, const float start[2], const float end[2],
+                std::size_t length) {
+  scalar::mix(out, in, channels, start, end, 1.0f / (float)length, 0, frames);
+}
+
+static void ramp(float *buf, std::size_t frames, float start, float end,
+                 std::size_t length) {
+  scalar::ramp(buf, start, end, 1.0f / (float)length, 0, frames);
+}
+
+static void add_planar(float *out, const float *left, const float *right,
+                       std::size_t frames) {
+  scalar::add_planar(out, left, right, 0, frames);
+}
+
+static void clamp(float *buf, std::size_t samples) {
+  scalar::clamp(buf, 0, samples);
+}
+
+static void to_s16(std::int16_t *out, const float *in, std::size_t samples) {
+  scalar::to_s16(out, in, 0, samples);
+}
+
+static void fft_pass(float *re, float *im, std::size_t n, std::size_t half,
+                     const float *tw_re, const float *tw_im) {
+  scalar::fft_pass(re, im, n, half, tw_re, tw_im);
+}
+
+static void complex_mac(float *acc_re, float *acc_im, const float *a_re,
+                        const float *a_im, const float *b_re,
+                        const float *b_im, std::size_t n) {
+  scalar::complex_mac(acc_re, acc_im, a_re, a_im, b_re, b_im, 0, n);
+}
+
+static void expand(float *out, const std::int8_t *codes, const float *scales,
+                   std::size_t blocks) {
+  scalar::expand(out, codes, scales, 0, blocks * EXPAND_BLOCK);
+}
+
+static const Kernels SCALAR_KERNELS{
+    "scalar", resample, mix, ramp, add_planar, clamp, to_s16, fft_pass,
+    complex_mac, expand,
+};
+
+std::vector<const Kernels *> supported_kernels() {
+  std::vector<const Kernels *> supported{&SCALAR_KERNELS};
+#ifdef LEGE_X86_KERNELS
+  if (SDL_HasSSE2()) {
+    supported.push_back(&SSE2_KERNELS);
+  }
+  if (SDL_HasAVX2()) {
+    supported.push_back(&AVX2_KERNELS);
+  }
+#endif
+  return supported;
+}
+
+const Kernels &kernels() {
+  static const Kernels &best = *supported_kernels().back();
+  return best;
+}
+
+} // namespace lege::audio
@@ -0,0 +1,65 @@
+#ifndef LIBLEGE_AUDIO_KERNELS_HPP
+#define LIBLEGE_AUDIO_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lege::audio {
+
+// Codes per block for the expand kernel
+inline constexpr std::size_t EXPAND_BLOCK = 64;
+
+// The inner loops of the mixer and effects. There's a scalar version of each
+// set, and vectorized ones for CPUs that support them, which produce exactly
+// the same output.
+//
+// Buffers are interleaved, with 1 or 2 channels. Gains are ramped linearly
+// across a block of `length` frames, reaching `start + (end - start) * (i + 1)
+// / length` at frame i, so a block can be mixed in several calls
+struct Kernels {
+  const char *name;
+
+  // Linearly interpolates frames from in, with frame i at cursor + i * step.
+  // Every frame this reads must be in in, including the one after the last
+  // position
+  void (*resample)(float *out, const float *in, unsigned channels,
+                   double cursor, double step, std::size_t frames);
+  // Adds in to stereo out, ramping the gain of each output channel. Mono input
+  // goes to both
+  void (*mix)(float *out, const float *in, unsigned channels,
+              std::size_t frames, const float start[2], const float end[2],
+              std::size_t length);
+  // Multiplies mono buf by a ramped gain
+  void (*ramp)(float *buf, std::size_t frames, float start, float end,
+               std::size_t length);
+  // Adds planar left and right to stereo out
+  void (*add_planar)(float *out, const float *left, const float *right,
+                     std::size_t frames);
+  // Clamps samples to [-1, 1]. NaNs become -1
+  void (*clamp)(float *buf, std::size_t samples);
+  // Clamps, scales and rounds to the nearest 16 bit sample
+  void (*to_s16)(std::int16_t *out, const float *in, std::size_t samples);
+  // One radix-2 pass of an FFT of n complex values, split into real and
+  // imaginary parts. Each group of 2 * half values is combined using the
+  // twiddles tw_re and tw_im[0, half)
+  void (*fft_pass)(float *re, float *im, std::size_t n, std::size_t half,
+                   const float *tw_re, const float *tw_im);
+  // Adds the complex products of a and b to acc
+  void (*complex_mac)(float *acc_re, float *acc_im, const float *a_re,
+                      const float *a_im, const float *b_re, const float *b_im,
+                      std::size_t n);
+  // Expands blocks of EXPAND_BLOCK signed byte codes to floats, multiplying
+  // each block by its scale
+  void (*expand)(float *out, const std::int8_t *codes, const float *scales,
+                 std::size_t blocks);
+};
+
+// Every set of kernels this CPU can run, slowest first
+std::vector<const Kernels *> supported_kernels();
+// The fastest set of kernels this CPU can run
+const Kernels &kernels();
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,227 @@
+#include <immintrin.h>
+
+#include "audio/kernels.hpp"
+#include "audio/kernels_scalar.hpp"
+
+namespace lege::audio {
+
+namespace {
+
+// Positions of 4 frames, split into the index of the frame before each and
+// how far past it they are
+struct Positions {
+  __m128i index;
+  __m128 frac;
+};
+
+Positions positions(__m256d base, __m256d steps, std::size_t first) {
+  __m256d n = _mm256_add_pd(_mm256_set1_pd((double)first),
+                            _mm256_setr_pd(0.0, 1.0, 2.0, 3.0));
+  __m256d pos = _mm256_add_pd(base, _mm256_mul_pd(n, steps));
+  __m128i index = _mm256_cvttpd_epi32(pos);
+  __m128 frac = _mm256_cvtpd_ps(_mm256_sub_pd(pos, _mm256_cvtepi32_pd(index)));
+  return {index, frac};
+}
+
+void resample(float *out, const float *in, unsigned channels, double cursor,
+              double step, std::size_t frames) {
+  const __m256d base = _mm256_set1_pd(cursor);
+  const __m256d steps = _mm256_set1_pd(step);
+  std::size_t i = 0;
+  if (channels == 1) {
+    for (; i + 8 <= frames; i += 8) {
+      Positions lo = positions(base, steps, i);
+      Positions hi = positions(base, steps, i + 4);
+      __m256i index = _mm256_setr_m128i(lo.index, hi.index);
+      __m256 frac = _mm256_setr_m128(lo.frac, hi.frac);
+      __m256 a = _mm256_i32gather_ps(in, index, 4);
+      __m256 b = _mm256_i32gather_ps(in + 1, index, 4);
+      __m256 v = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), frac));
+      _mm256_storeu_ps(out + i, v);
+    }
+  } else {
+    // Gather both channels of 4 frames, so each index is used twice
+    const __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i channel = _mm256_setr_epi32(0, 1, 0, 1, 0, 1, 0, 1);
+    for (; i + 4 <= frames; i += 4) {
+      Positions p = positions(base, steps, i);
+      __m256i index = _mm256_permutevar8x32_epi32(
+          _mm256_castsi128_si256(_mm_slli_epi32(p.index, 1)), dup);
+      index = _mm256_add_epi32(index, channel);
+      __m256 frac =
+          _mm256_permutevar8x32_ps(_mm256_castps128_ps256(p.frac), dup);
+      __m256 a = _mm256_i32gather_ps(in, index, 4);
+      __m256 b = _mm256_i32gather_ps(in + 2, index, 4);
+      __m256 v = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), frac));
+      _mm256_storeu_ps(out + i * 2, v);
+    }
+  }
+  scalar::resample(out, in, channels, cursor, step, i, frames);
+}
+
+void mix(float *out, const float *in, unsigned channels, std::size_t frames,
+         const float start[2], const float end[2], std::size_t length) {
+  const float inv = 1.0f / (float)length;
+  // Four stereo frames at a time, so each lane keeps to one output channel
+  const __m256 s = _mm256_setr_ps(start[0], start[1], start[0], start[1],
+                                  start[0], start[1], start[0], start[1]);
+  const __m256 d = _mm256_sub_ps(_mm256_setr_ps(end[0], end[1], end[0], end[1],
+                                                end[0], end[1], end[0], end[1]),
+                                 s);
+  const __m256 invs = _mm256_set1_ps(inv);
+  const __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+  __m256i n = _mm256_setr_epi32(1, 1, 2, 2, 3, 3, 4, 4);
+  const __m256i four = _mm256_set1_epi32(4);
+  std::size_t i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(n), invs);
+    __m256 gain = _mm256_add_ps(s, _mm256_mul_ps(d, t));
+    __m256 v;
+    if (channels == 1) {
+      v = _mm256_permutevar8x32_ps(
+          _mm256_castps128_ps256(_mm_loadu_ps(in + i)), dup);
+    } else {
+      v = _mm256_loadu_ps(in + i * 2);
+    }
+    __m256 o = _mm256_loadu_ps(out + i * 2);
+    _mm256_storeu_ps(out + i * 2, _mm256_add_ps(o, _mm256_mul_ps(v, gain)));
+    n = _mm256_add_epi32(n, four);
+  }
+  scalar::mix(out, in, channels, start, end, inv, i, frames);
+}
+
+void ramp(float *buf, std::size_t frames, float start, float end,
+          std::size_t length) {
+  const float inv = 1.0f / (float)length;
+  const __m256 s = _mm256_set1_ps(start);
+  const __m256 d = _mm256_sub_ps(_mm256_set1_ps(end), s);
+  const __m256 invs = _mm256_set1_ps(inv);
+  __m256i n = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8);
+  const __m256i eight = _mm256_set1_epi32(8);
+  std::size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(n), invs);
+    __m256 gain = _mm256_add_ps(s, _mm256_mul_ps(d, t));
+    _mm256_storeu_ps(buf + i, _mm256_mul_ps(_mm256_loadu_ps(buf + i), gain));
+    n = _mm256_add_epi32(n, eight);
+  }
+  scalar::ramp(buf, start, end, inv, i, frames);
+}
+
+void add_planar(float *out, const float *left, const float *right,
+                std::size_t frames) {
+  std::size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m256 l = _mm256_loadu_ps(left + i);
+    __m256 r = _mm256_loadu_ps(right + i);
+    // Interleaving works within 128 bit lanes, so put the halves back in order
+    __m256 lo = _mm256_unpacklo_ps(l, r);
+    __m256 hi = _mm256_unpackhi_ps(l, r);
+    float *o = out + i * 2;
+    _mm256_storeu_ps(o, _mm256_add_ps(_mm256_loadu_ps(o),
+                                      _mm256_permute2f128_ps(lo, hi, 0x20)));
+    _mm256_storeu_ps(o + 8,
+                     _mm256_add_ps(_mm256_loadu_ps(o + 8),
+                                   _mm256_permute2f128_ps(lo, hi, 0x31)));
+  }
+  scalar::add_planar(out, left, right, i, frames);
+}
+
+__m256 clamp(__m256 v) {
+  // Operand order matters, so that NaNs become -1 like the scalar version
+  v = _mm256_max_ps(v, _mm256_set1_ps(-1.0f));
+  return _mm256_min_ps(v, _mm256_set1_ps(1.0f));
+}
+
+void clamp(float *buf, std::size_t samples) {
+  std::size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    _mm256_storeu_ps(buf + i, clamp(_mm256_loadu_ps(buf + i)));
+  }
+  scalar::clamp(buf, i, samples);
+}
+
+void to_s16(std::int16_t *out, const float *in, std::size_t samples) {
+  const __m256 scale = _mm256_set1_ps(32767.0f);
+  std::size_t i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m256i lo = _mm256_cvtps_epi32(
+        _mm256_mul_ps(clamp(_mm256_loadu_ps(in + i)), scale));
+    __m256i hi = _mm256_cvtps_epi32(
+        _mm256_mul_ps(clamp(_mm256_loadu_ps(in + i + 8)), scale));
+    // Packing interleaves the 128 bit lanes, so swap the middle two back
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi),
+                                              _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *)(out + i), packed);
+  }
+  scalar::to_s16(out, in, i, samples);
+}
+
+void fft_pass(float *re, float *im, std::size_t n, std::size_t half,
+              const float *tw_re, const float *tw_im) {
+  // The first passes have groups too small to fill a vector
+  if (half < 8) {
+    scalar::fft_pass(re, im, n, half, tw_re, tw_im);
+    return;
+  }
+  for (std::size_t g = 0; g < n; g += half * 2) {
+    float *ar = re + g, *ai = im + g;
+    float *br = ar + half, *bi = ai + half;
+    for (std::size_t j = 0; j < half; j += 8) {
+      __m256 wr = _mm256_loadu_ps(tw_re + j);
+      __m256 wi = _mm256_loadu_ps(tw_im + j);
+      __m256 xr = _mm256_loadu_ps(br + j);
+      __m256 xi = _mm256_loadu_ps(bi + j);
+      __m256 tr = _mm256_sub_ps(_mm256_mul_ps(xr, wr), _mm256_mul_ps(xi, wi));
+      __m256 ti = _mm256_add_ps(_mm256_mul_ps(xr, wi), _mm256_mul_ps(xi, wr));
+      __m256 yr = _mm256_loadu_ps(ar + j);
+      __m256 yi = _mm256_loadu_ps(ai + j);
+      _mm256_storeu_ps(br + j, _mm256_sub_ps(yr, tr));
+      _mm256_storeu_ps(bi + j, _mm256_sub_ps(yi, ti));
+      _mm256_storeu_ps(ar + j, _mm256_add_ps(yr, tr));
+      _mm256_storeu_ps(ai + j, _mm256_add_ps(yi, ti));
+    }
+  }
+}
+
+void complex_mac(float *acc_re, float *acc_im, const float *a_re,
+                 const float *a_im, const float *b_re, const float *b_im,
+                 std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 ar = _mm256_loadu_ps(a_re + i);
+    __m256 ai = _mm256_loadu_ps(a_im + i);
+    __m256 br = _mm256_loadu_ps(b_re + i);
+    __m256 bi = _mm256_loadu_ps(b_im + i);
+    __m256 re = _mm256_sub_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+    __m256 im = _mm256_add_ps(_mm256_mul_ps(ar, bi), _mm256_mul_ps(ai, br));
+    re = _mm256_add_ps(_mm256_loadu_ps(acc_re + i), re);
+    im = _mm256_add_ps(_mm256_loadu_ps(acc_im + i), im);
+    _mm256_storeu_ps(acc_re + i, re);
+    _mm256_storeu_ps(acc_im + i, im);
+  }
+  scalar::complex_mac(acc_re, acc_im, a_re, a_im, b_re, b_im, i, n);
+}
+
+void expand(float *out, const std::int8_t *codes, const float *scales,
+            std::size_t blocks) {
+  for (std::size_t b = 0; b < blocks; ++b) {
+    const __m256 scale = _mm256_set1_ps(scales[b]);
+    for (std::size_t i = 0; i < EXPAND_BLOCK; i += 8) {
+      __m128i v = _mm_loadl_epi64((const __m128i *)(codes + i));
+      __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v));
+      _mm256_storeu_ps(out + i, _mm256_mul_ps(f, scale));
+    }
+    codes += EXPAND_BLOCK;
+    out += EXPAND_BLOCK;
+  }
+}
+
+} // namespace
+
+extern const Kernels AVX2_KERNELS{
+    "avx2", resample, mix, ramp, add_planar, clamp, to_s16, fft_pass,
+    complex_mac, expand,
+};
+
+} // namespace lege::audio
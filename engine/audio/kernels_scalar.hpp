@@ -0,0 +1,120 @@
+#ifndef LIBLEGE_AUDIO_KERNELS_SCALAR_HPP
+#define LIBLEGE_AUDIO_KERNELS_SCALAR_HPP
+
+// Scalar kernels over part of a buffer. These define what every other set of
+// kernels computes, and vectorized ones use them to finish off whatever
+// doesn't fill a vector. Only included by the kernel implementations
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "audio/kernels.hpp"
+
+namespace lege::audio::scalar {
+// Internal linkage, as each file including this can be built for a different
+// instruction set, and the linker mustn't pick an AVX2 copy for the scalar
+// kernels
+namespace {
+
+inline void resample(float *out, const float *in, unsigned channels,
+                     double cursor, double step, std::size_t begin,
+                     std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    double pos = cursor + (double)i * step;
+    std::size_t i0 = (std::size_t)pos;
+    float frac = (float)(pos - (double)i0);
+    for (unsigned c = 0; c < channels; ++c) {
+      float a = in[i0 * channels + c];
+      float b = in[(i0 + 1) * channels + c];
+      out[i * channels + c] = a + (b - a) * frac;
+    }
+  }
+}
+
+inline float ramp_gain(float start, float end, float inv, std::size_t i) {
+  return start + (end - start) * ((float)(i + 1) * inv);
+}
+
+inline void mix(float *out, const float *in, unsigned channels,
+                const float start[2], const float end[2], float inv,
+                std::size_t begin, std::size_t last) {
+  for (std::size_t i = begin; i < last; ++i) {
+    float l = in[i * channels];
+    float r = channels == 1 ? l : in[i * channels + 1];
+    out[i * 2] += l * ramp_gain(start[0], end[0], inv, i);
+    out[i * 2 + 1] += r * ramp_gain(start[1], end[1], inv, i);
+  }
+}
+
+inline void ramp(float *buf, float start, float end, float inv,
+                 std::size_t begin, std::size_t last) {
+  for (std::size_t i = begin; i < last; ++i) {
+    buf[i] *= ramp_gain(start, end, inv, i);
+  }
+}
+
+inline void add_planar(float *out, const float *left, const float *right,
+                       std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    out[i * 2] += left[i];
+    out[i * 2 + 1] += right[i];
+  }
+}
+
+// Written to match what max and min instructions do with NaNs
+inline float clamp(float x) {
+  x = x > -1.0f ? x : -1.0f;
+  return x < 1.0f ? x : 1.0f;
+}
+
+inline void clamp(float *buf, std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    buf[i] = clamp(buf[i]);
+  }
+}
+
+inline void to_s16(std::int16_t *out, const float *in, std::size_t begin,
+                   std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    out[i] = (std::int16_t)std::lrint(clamp(in[i]) * 32767.0f);
+  }
+}
+
+inline void fft_pass(float *re, float *im, std::size_t n, std::size_t half,
+                     const float *tw_re, const float *tw_im) {
+  for (std::size_t g = 0; g < n; g += half * 2) {
+    float *ar = re + g, *ai = im + g;
+    float *br = ar + half, *bi = ai + half;
+    for (std::size_t j = 0; j < half; ++j) {
+      float tr = br[j] * tw_re[j] - bi[j] * tw_im[j];
+      float ti = br[j] * tw_im[j] + bi[j] * tw_re[j];
+      br[j] = ar[j] - tr;
+      bi[j] = ai[j] - ti;
+      ar[j] = ar[j] + tr;
+      ai[j] = ai[j] + ti;
+    }
+  }
+}
+
+inline void complex_mac(float *acc_re, float *acc_im, const float *a_re,
+                        const float *a_im, const float *b_re,
+                        const float *b_im, std::size_t begin,
+                        std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+    acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+  }
+}
+
+inline void expand(float *out, const std::int8_t *codes, const float *scales,
+                   std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    out[i] = (float)codes[i] * scales[i / EXPAND_BLOCK];
+  }
+}
+
+} // namespace
+} // namespace lege::audio::scalar
+
+#endif
@@ -0,0 +1,226 @@
+#include <emmintrin.h>
+
+#include "audio/kernels.hpp"
+#include "audio/kernels_scalar.hpp"
+
+namespace lege::audio {
+
+namespace {
+
+// Positions of 2 frames, split into the index of the frame before each and
+// how far past it they are
+struct Positions {
+  __m128i index;
+  __m128 frac;
+};
+
+Positions positions(__m128d pos) {
+  __m128i index = _mm_cvttpd_epi32(pos);
+  __m128 frac = _mm_cvtpd_ps(_mm_sub_pd(pos, _mm_cvtepi32_pd(index)));
+  return {index, frac};
+}
+
+void resample(float *out, const float *in, unsigned channels, double cursor,
+              double step, std::size_t frames) {
+  const __m128d base = _mm_set1_pd(cursor);
+  const __m128d steps = _mm_set1_pd(step);
+  std::size_t i = 0;
+  if (channels == 1) {
+    for (; i + 4 <= frames; i += 4) {
+      __m128d n = _mm_set_pd((double)(i + 1), (double)i);
+      Positions lo = positions(_mm_add_pd(base, _mm_mul_pd(n, steps)));
+      n = _mm_add_pd(n, _mm_set1_pd(2.0));
+      Positions hi = positions(_mm_add_pd(base, _mm_mul_pd(n, steps)));
+      alignas(16) int index[4];
+      _mm_store_si128((__m128i *)index,
+                      _mm_unpacklo_epi64(lo.index, hi.index));
+      __m128 frac = _mm_movelh_ps(lo.frac, hi.frac);
+      __m128 a = _mm_set_ps(in[index[3]], in[index[2]], in[index[1]],
+                            in[index[0]]);
+      __m128 b = _mm_set_ps(in[index[3] + 1], in[index[2] + 1],
+                            in[index[1] + 1], in[index[0] + 1]);
+      __m128 v = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac));
+      _mm_storeu_ps(out + i, v);
+    }
+  } else {
+    for (; i + 2 <= frames; i += 2) {
+      __m128d n = _mm_set_pd((double)(i + 1), (double)i);
+      Positions p = positions(_mm_add_pd(base, _mm_mul_pd(n, steps)));
+      int i0 = _mm_cvtsi128_si32(p.index);
+      int i1 = _mm_cvtsi128_si32(_mm_srli_si128(p.index, 4));
+      // Both channels of each frame, then of the frame after it
+      __m128 a = _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(in + i0 * 2));
+      a = _mm_loadh_pi(a, (const __m64 *)(in + i1 * 2));
+      __m128 b =
+          _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(in + i0 * 2 + 2));
+      b = _mm_loadh_pi(b, (const __m64 *)(in + i1 * 2 + 2));
+      __m128 frac = _mm_unpacklo_ps(p.frac, p.frac);
+      __m128 v = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac));
+      _mm_storeu_ps(out + i * 2, v);
+    }
+  }
+  scalar::resample(out, in, channels, cursor, step, i, frames);
+}
+
+void mix(float *out, const float *in, unsigned channels, std::size_t frames,
+         const float start[2], const float end[2], std::size_t length) {
+  const float inv = 1.0f / (float)length;
+  // Two stereo frames at a time, so each lane keeps to one output channel
+  const __m128 s = _mm_setr_ps(start[0], start[1], start[0], start[1]);
+  const __m128 d = _mm_sub_ps(_mm_setr_ps(end[0], end[1], end[0], end[1]), s);
+  const __m128 invs = _mm_set1_ps(inv);
+  __m128i n = _mm_setr_epi32(1, 1, 2, 2);
+  const __m128i two = _mm_set1_epi32(2);
+  std::size_t i = 0;
+  for (; i + 2 <= frames; i += 2) {
+    __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(n), invs);
+    __m128 gain = _mm_add_ps(s, _mm_mul_ps(d, t));
+    __m128 v;
+    if (channels == 1) {
+      v = _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(in + i));
+      v = _mm_unpacklo_ps(v, v);
+    } else {
+      v = _mm_loadu_ps(in + i * 2);
+    }
+    __m128 o = _mm_loadu_ps(out + i * 2);
+    _mm_storeu_ps(out + i * 2, _mm_add_ps(o, _mm_mul_ps(v, gain)));
+    n = _mm_add_epi32(n, two);
+  }
+  scalar::mix(out, in, channels, start, end, inv, i, frames);
+}
+
+void ramp(float *buf, std::size_t frames, float start, float end,
+          std::size_t length) {
+  const float inv = 1.0f / (float)length;
+  const __m128 s = _mm_set1_ps(start);
+  const __m128 d = _mm_sub_ps(_mm_set1_ps(end), s);
+  const __m128 invs = _mm_set1_ps(inv);
+  __m128i n = _mm_setr_epi32(1, 2, 3, 4);
+  const __m128i four = _mm_set1_epi32(4);
+  std::size_t i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(n), invs);
+    __m128 gain = _mm_add_ps(s, _mm_mul_ps(d, t));
+    _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), gain));
+    n = _mm_add_epi32(n, four);
+  }
+  scalar::ramp(buf, start, end, inv, i, frames);
+}
+
+void add_planar(float *out, const float *left, const float *right,
+                std::size_t frames) {
+  std::size_t i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    __m128 l = _mm_loadu_ps(left + i);
+    __m128 r = _mm_loadu_ps(right + i);
+    float *o = out + i * 2;
+    _mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_unpacklo_ps(l, r)));
+    _mm_storeu_ps(o + 4,
+                  _mm_add_ps(_mm_loadu_ps(o + 4), _mm_unpackhi_ps(l, r)));
+  }
+  scalar::add_planar(out, left, right, i, frames);
+}
+
+__m128 clamp(__m128 v) {
+  // Operand order matters, so that NaNs become -1 like the scalar version
+  v = _mm_max_ps(v, _mm_set1_ps(-1.0f));
+  return _mm_min_ps(v, _mm_set1_ps(1.0f));
+}
+
+void clamp(float *buf, std::size_t samples) {
+  std::size_t i = 0;
+  for (; i + 4 <= samples; i += 4) {
+    _mm_storeu_ps(buf + i, clamp(_mm_loadu_ps(buf + i)));
+  }
+  scalar::clamp(buf, i, samples);
+}
+
+void to_s16(std::int16_t *out, const float *in, std::size_t samples) {
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  std::size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128i lo =
+        _mm_cvtps_epi32(_mm_mul_ps(clamp(_mm_loadu_ps(in + i)), scale));
+    __m128i hi =
+        _mm_cvtps_epi32(_mm_mul_ps(clamp(_mm_loadu_ps(in + i + 4)), scale));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+  }
+  scalar::to_s16(out, in, i, samples);
+}
+
+void fft_pass(float *re, float *im, std::size_t n, std::size_t half,
+              const float *tw_re, const float *tw_im) {
+  // The first passes have groups too small to fill a vector
+  if (half < 4) {
+    scalar::fft_pass(re, im, n, half, tw_re, tw_im);
+    return;
+  }
+  for (std::size_t g = 0; g < n; g += half * 2) {
+    float *ar = re + g, *ai = im + g;
+    float *br = ar + half, *bi = ai + half;
+    for (std::size_t j = 0; j < half; j += 4) {
+      __m128 wr = _mm_loadu_ps(tw_re + j);
+      __m128 wi = _mm_loadu_ps(tw_im + j);
+      __m128 xr = _mm_loadu_ps(br + j);
+      __m128 xi = _mm_loadu_ps(bi + j);
+      __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+      __m128 ti = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+      __m128 yr = _mm_loadu_ps(ar + j);
+      __m128 yi = _mm_loadu_ps(ai + j);
+      _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+      _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+      _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+      _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+    }
+  }
+}
+
+void complex_mac(float *acc_re, float *acc_im, const float *a_re,
+                 const float *a_im, const float *b_re, const float *b_im,
+                 std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 ar = _mm_loadu_ps(a_re + i);
+    __m128 ai = _mm_loadu_ps(a_im + i);
+    __m128 br = _mm_loadu_ps(b_re + i);
+    __m128 bi = _mm_loadu_ps(b_im + i);
+    __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+    __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+    re = _mm_add_ps(_mm_loadu_ps(acc_re + i), re);
+    im = _mm_add_ps(_mm_loadu_ps(acc_im + i), im);
+    _mm_storeu_ps(acc_re + i, re);
+    _mm_storeu_ps(acc_im + i, im);
+  }
+  scalar::complex_mac(acc_re, acc_im, a_re, a_im, b_re, b_im, i, n);
+}
+
+void expand(float *out, const std::int8_t *codes, const float *scales,
+            std::size_t blocks) {
+  for (std::size_t b = 0; b < blocks; ++b) {
+    const __m128 scale = _mm_set1_ps(scales[b]);
+    for (std::size_t i = 0; i < EXPAND_BLOCK; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(codes + i));
+      // Sign extend by unpacking each byte into the top of a wider lane, then
+      // shifting it back down
+      __m128i lo = _mm_unpacklo_epi8(v, v);
+      __m128i hi = _mm_unpackhi_epi8(v, v);
+      __m128i w[4] = {_mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+                      _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)};
+      for (int j = 0; j < 4; ++j) {
+        __m128 f = _mm_cvtepi32_ps(_mm_srai_epi32(w[j], 24));
+        _mm_storeu_ps(out + i + j * 4, _mm_mul_ps(f, scale));
+      }
+    }
+    codes += EXPAND_BLOCK;
+    out += EXPAND_BLOCK;
+  }
+}
+
+} // namespace
+
+extern const Kernels SSE2_KERNELS{
+    "sse2", resample, mix, ramp, add_planar, clamp, to_s16, fft_pass,
+    complex_mac, expand,
+};
+
+} // namespace lege::audio
@@ -0,0 +1,1507 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <numbers>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <SDL.h>
+
+#include "audio/kernels.hpp"
+#include "audio/mixer.hpp"
+#include "audio/spatializer.hpp"
+
+namespace lege::audio {
+
+// How long the main thread waits for room in a full command ring before
+// giving up on a command
+static constexpr std::chrono::milliseconds MAX_COMMAND_STALL{100};
+
+// Distance at which attenuation starts
+static constexpr float REFERENCE_DISTANCE = 1.0f;
+// How much louder a virtual source has to be than a real one to take its voice
+static constexpr float RANK_HYSTERESIS = 1.25f;
+// Changes to occlusion, and to where sources are heard from, smaller than
+// these aren't worth sending to the audio thread
+static constexpr float OCCLUSION_EPSILON = 0.01f;
+static constexpr float HEARD_EPSILON = 0.05f;
+// Sources closer than this are partly unspatialized, so they don't jump from
+// side to side as they pass through the listener
+static constexpr float SPATIAL_BLEND_DISTANCE = 0.25f;
+
+// Inverse distance attenuation
+static float attenuation(float dist) {
+  return dist <= REFERENCE_DISTANCE ? 1.0f : REFERENCE_DISTANCE / dist;
+}
+
+// Output gains for a sound of channels channels at gain, from pan -1 (left)
+// to 1 (right): an equal power pan for mono sounds, or a balance for stereo
+static void pan_gains(unsigned channels, float pan, float gain,
+                      float target[OUTPUT_CHANNELS]) {
+  if (channels == 1) {
+    float angle = (pan + 1.0f) * (std::numbers::pi_v<float> / 4.0f);
+    target[0] = gain * std::cos(angle);
+    target[1] = gain * std::sin(angle);
+  } else {
+    target[0] = gain * std::min(1.0f, 1.0f - pan);
+    target[1] = gain * std::min(1.0f, 1.0f + pan);
+  }
+}
+
+// The buses the audio thread runs. Built by the main thread whenever buses
+// change, and swapped in whole
+struct Graph {
+  struct Node {
+    std::uint8_t bus;
+    // The bus this one plays into. Unused for the master bus
+    std::uint8_t output;
+    std::uint32_t id;
+    float gain;
+    std::vector<std::shared_ptr<Effect>> effects;
+    std::shared_ptr<AmbisonicBed> bed;
+  };
+  // Every bus comes before the one it plays into, so the master bus is last
+  std::vector<Node> nodes;
+  std::array<bool, MAX_BUSES> present{};
+  // Per bus, by index. Null if it doesn't have one
+  std::array<AmbisonicBed *, MAX_BUSES> beds{};
+  Graph *next_retired = nullptr;
+};
+
+Bus::Bus(Mixer &mixer, std::uint8_t index, std::uint32_t id,
+         std::shared_ptr<Bus> output)
+    : m_mixer(mixer), m_index(index), m_id(id), m_output(std::move(output)) {
+  m_mixer.m_buses[index] = this;
+  m_mixer.m_graph_dirty = true;
+}
+
+Bus::~Bus() {
+  for (const auto &effect : m_effects) {
+    effect->m_bus = nullptr;
+  }
+  auto &dirty = m_mixer.m_dirty_buses;
+  dirty.erase(std::remove(dirty.begin(), dirty.end(), this), dirty.end());
+  m_mixer.m_buses[m_index] = nullptr;
+  m_mixer.m_graph_dirty = true;
+}
+
+void Bus::setGain(float gain) {
+  m_gain = gain;
+  m_mixer.markGainDirty(*this);
+}
+
+void Bus::setOutput(std::shared_ptr<Bus> output) {
+  if (isMaster()) {
+    throw std::runtime_error("The master bus can't play into another bus");
+  }
+  if (!output) {
+    output = m_mixer.master();
+  }
+  for (Bus *bus = output.get(); bus; bus = bus->m_output.get()) {
+    if (bus == this) {
+      throw std::runtime_error("A bus can't play into itself");
+    }
+  }
+  m_output = std::move(output);
+  m_mixer.m_graph_dirty = true;
+}
+
+void Bus::insertEffect(std::size_t index, std::shared_ptr<Effect> effect) {
+  if (effect->m_bus) {
+    throw std::runtime_error("Effect is already part of a bus");
+  }
+  effect->m_bus = this;
+  index = std::min(index, m_effects.size());
+  m_effects.insert(m_effects.begin() + (std::ptrdiff_t)index,
+                   std::move(effect));
+  m_mixer.m_graph_dirty = true;
+}
+
+bool Bus::removeEffect(const Effect &effect) {
+  auto it = std::find_if(m_effects.begin(), m_effects.end(),
+                         [&](const auto &e) { return e.get() == &effect; });
+  if (it == m_effects.end()) {
+    return false;
+  }
+  (*it)->m_bus = nullptr;
+  m_effects.erase(it);
+  m_mixer.m_graph_dirty = true;
+  return true;
+}
+
+void Bus::clearEffects() {
+  for (const auto &effect : m_effects) {
+    effect->m_bus = nullptr;
+  }
+  m_effects.clear();
+  m_mixer.m_graph_dirty = true;
+}
+
+void Bus::setAmbisonicOrder(unsigned order) {
+  if (order > MAX_AMBISONIC_ORDER) {
+    throw std::runtime_error("Ambisonic order must be 0, 1 or 2");
+  }
+  if (order != m_ambisonic_order) {
+    m_ambisonic_order = order;
+    m_bed = nullptr;
+    m_mixer.m_graph_dirty = true;
+  }
+}
+
+Source::Source(Mixer &mixer, std::shared_ptr<const Sound> sound)
+    : m_mixer(mixer), m_sound(std::move(sound)) {}
+
+Source::Source(Mixer &mixer, DecoderFactory open)
+    : m_mixer(mixer), m_open(std::move(open)) {}
+
+Source::~Source() {
+  stop();
+  if (m_block) {
+    m_block->unbind(m_block_index);
+  }
+}
+
+void Source::play() { playAt(0); }
+
+void Source::playAt(std::uint64_t frame) {
+  stop();
+  m_mixer.play(*this, frame);
+}
+
+void Source::stop() { m_mixer.stop(*this); }
+
+void Source::setGain(float gain) {
+  m_params.gain = gain;
+  m_mixer.markDirty(*this);
+}
+
+void Source::setPitch(float pitch) {
+  m_params.pitch = pitch;
+  m_mixer.markDirty(*this);
+}
+
+void Source::setPosition(glm::vec3 position) {
+  m_params.position = position;
+  m_mixer.markDirty(*this);
+}
+
+void Source::setLooping(bool looping) {
+  m_params.looping = looping;
+  m_mixer.markDirty(*this);
+}
+
+std::shared_ptr<Bus> Source::bus() const {
+  return m_bus ? m_bus : m_mixer.master();
+}
+
+void Source::setBus(std::shared_ptr<Bus> bus) {
+  m_params.bus = bus ? bus->m_index : 0;
+  m_bus = std::move(bus);
+  m_mixer.markDirty(*this);
+}
+
+ParamBlock::ParamBlock(Mixer &mixer, std::size_t size)
+    : m_mixer(mixer), m_params(size, BlockParams{1.0f, 1.0f, 0.0f, 0.0f, 0.0f}),
+      m_applied(m_params), m_sources(size, nullptr) {
+  m_mixer.m_param_blocks.push_back(this);
+}
+
+ParamBlock::~ParamBlock() {
+  for (Source *src : m_sources) {
+    if (src) {
+      src->m_block = nullptr;
+    }
+  }
+  auto &blocks = m_mixer.m_param_blocks;
+  blocks.erase(std::find(blocks.begin(), blocks.end(), this));
+}
+
+void ParamBlock::bind(std::size_t index, Source *src) {
+  if (index >= m_sources.size()) {
+    throw std::out_of_range("Parameter block entry out of range");
+  }
+  unbind(index);
+  if (!src) {
+    return;
+  }
+  if (src->m_block) {
+    src->m_block->unbind(src->m_block_index);
+  }
+  src->m_block = this;
+  src->m_block_index = index;
+  m_sources[index] = src;
+  const SourceParams &p = src->m_params;
+  m_params[index] = m_applied[index] = {p.gain, p.pitch, p.position.x,
+                                        p.position.y, p.position.z};
+}
+
+void ParamBlock::unbind(std::size_t index) {
+  if (Source *src = m_sources[index]) {
+    src->m_block = nullptr;
+    m_sources[index] = nullptr;
+  }
+}
+
+void ParamBlock::apply() {
+  for (std::size_t i = 0; i < m_sources.size(); ++i) {
+    Source *src = m_sources[i];
+    if (!src) {
+      continue;
+    }
+    BlockParams &entry = m_params[i];
+    BlockParams &applied = m_applied[i];
+    SourceParams &p = src->m_params;
+    if (std::memcmp(&entry, &applied, sizeof(BlockParams)) != 0) {
+      p.gain = entry.gain;
+      p.pitch = entry.pitch;
+      p.position = {entry.x, entry.y, entry.z};
+      m_mixer.markDirty(*src);
+    } else {
+      // Set some other way, E.G. through the source's own properties
+      entry = {p.gain, p.pitch, p.position.x, p.position.y, p.position.z};
+    }
+    applied = entry;
+  }
+}
+
+Emitter::Emitter(Mixer &mixer,
+                 std::vector<std::shared_ptr<const Sound>> sounds)
+    : m_mixer(mixer), m_sounds(std::move(sounds)) {
+  if (m_sounds.empty()) {
+    throw std::runtime_error("Granular emitters need at least one sound");
+  }
+  for (const auto &sound : m_sounds) {
+    if (!sound || sound->frames() == 0) {
+      throw std::runtime_error("Granular emitters can't play empty sounds");
+    }
+  }
+}
+
+Emitter::~Emitter() { stop(); }
+
+void Emitter::play() { m_mixer.play(*this); }
+
+void Emitter::stop() { m_mixer.stop(*this); }
+
+void Emitter::setRate(float rate) {
+  m_params.rate = rate;
+  m_mixer.markDirty(*this);
+}
+
+void Emitter::setGain(float gain) {
+  m_params.gain = gain;
+  m_mixer.markDirty(*this);
+}
+
+void Emitter::setGainSpread(float spread) {
+  m_params.gain_spread = spread;
+  m_mixer.markDirty(*this);
+}
+
+void Emitter::setPitch(float pitch) {
+  m_params.pitch = pitch;
+  m_mixer.markDirty(*this);
+}
+
+void Emitter::setPitchSpread(float semitones) {
+  m_params.pitch_spread = semitones;
+  m_mixer.markDirty(*this);
+}
+
+void Emitter::setPosition(glm::vec3 position) {
+  m_params.position = position;
+  m_mixer.markDirty(*this);
+}
+
+void Emitter::setPositionSpread(float distance) {
+  m_params.position_spread = distance;
+  m_mixer.markDirty(*this);
+}
+
+std::shared_ptr<Bus> Emitter::bus() const {
+  return m_bus ? m_bus : m_mixer.master();
+}
+
+void Emitter::setBus(std::shared_ptr<Bus> bus) {
+  m_params.bus = bus ? bus->m_index : 0;
+  m_bus = std::move(bus);
+  m_mixer.markDirty(*this);
+}
+
+// How many of the next `frames` frames, starting at cursor, interpolate
+// between two frames that are both before end
+static std::size_t whole_frames(double cursor, double step, std::size_t end,
+                                std::size_t frames) {
+  double room = (double)end - 1.0 - cursor;
+  if (room <= 0.0) {
+    return 0;
+  }
+  std::size_t n = frames;
+  if (step > 0.0 && room / step < (double)frames) {
+    n = (std::size_t)(room / step) + 1;
+  }
+  // In case of rounding, as the kernels mustn't read past end
+  while (n > 0 && (std::size_t)(cursor + (double)(n - 1) * step) + 1 >= end) {
+    --n;
+  }
+  return n;
+}
+
+Mixer::Mixer() : m_kernels(&kernels()) {
+  m_free_voices.reserve(MAX_VOICES);
+  m_dirty.reserve(MAX_VOICES);
+  m_dirty_emitters.reserve(MAX_EMITTERS);
+  // Hand out low indices first
+  for (unsigned i = MAX_VOICES; i-- > 0;) {
+    m_free_voices.push_back((std::uint16_t)i);
+  }
+  m_dirty_buses.reserve(MAX_BUSES);
+  m_master = std::shared_ptr<Bus>(new Bus(*this, 0, m_next_bus_id++, nullptr));
+  // The audio thread hasn't started, so it can be given the master bus
+  // directly
+  m_graph = new Graph;
+  m_graph->nodes.push_back({0, 0, m_master->m_id, 1.0f, {}, nullptr});
+  m_graph->present[0] = true;
+  m_bus_gains[0] = m_bus_targets[0] = 1.0f;
+  m_bus_ids[0] = m_master->m_id;
+  m_graph_dirty = false;
+}
+
+Mixer::~Mixer() {
+  // Sources must not outlive the mixer, but make sure none of them still
+  // point at it if they do
+  for (Source *src : m_playing) {
+    src->m_voice = -1;
+    src->m_playing_index = -1;
+  }
+  for (const EmitterSlot &slot : m_emitter_slots) {
+    if (slot.owner) {
+      slot.owner->m_slot = -1;
+    }
+  }
+  // The audio thread has stopped, so every graph is ours to free
+  while (auto ev = m_events.pop()) {
+    if (ev->type == Event::GRAPH_RETIRED) {
+      delete ev->graph;
+    }
+  }
+  while (auto cmd = m_commands.pop()) {
+    if (cmd->type == Command::SET_GRAPH) {
+      delete cmd->graph;
+    }
+  }
+  while (m_retired) {
+    delete std::exchange(m_retired, m_retired->next_retired);
+  }
+  delete m_graph;
+}
+
+void Mixer::start(unsigned sample_rate, std::size_t device_frames,
+                  bool realtime) {
+  m_sample_rate = sample_rate;
+  if (realtime) {
+    m_period_ticks =
+        SDL_GetPerformanceFrequency() * device_frames / sample_rate;
+  }
+  m_block = std::clamp<std::size_t>(device_frames, 1, MAX_BLOCK);
+  m_out_pos = m_block;
+  try {
+    m_spatializer =
+        std::make_unique<Spatializer>(sample_rate, m_block, MAX_VOICES);
+  } catch (const std::exception &e) {
+    SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "%s, falling back to panning",
+                e.what());
+  }
+}
+
+void Mixer::setListener(const Listener &listener) {
+  m_listener = listener;
+  m_listener_dirty = true;
+}
+
+void Mixer::markGainDirty(Bus &bus) {
+  if (!bus.m_gain_dirty) {
+    bus.m_gain_dirty = true;
+    m_dirty_buses.push_back(&bus);
+  }
+}
+
+std::shared_ptr<Bus> Mixer::createBus(std::shared_ptr<Bus> output) {
+  auto it = std::find(m_buses.begin() + 1, m_buses.end(), nullptr);
+  if (it == m_buses.end()) {
+    throw std::runtime_error("Too many audio buses");
+  }
+  if (!output) {
+    output = m_master;
+  }
+  auto index = (std::uint8_t)(it - m_buses.begin());
+  return std::shared_ptr<Bus>(
+      new Bus(*this, index, m_next_bus_id++, std::move(output)));
+}
+
+void Mixer::markDirty(Source &src) {
+  if (src.m_voice >= 0 && !src.m_dirty) {
+    src.m_dirty = true;
+    m_dirty.push_back((std::uint16_t)src.m_voice);
+  }
+}
+
+void Mixer::play(Emitter &emitter) {
+  if (!isStarted() || emitter.m_slot >= 0) {
+    return;
+  }
+  auto it = std::find_if(m_emitter_slots.begin(), m_emitter_slots.end(),
+                         [](const auto &slot) { return !slot.granulator; });
+  if (it == m_emitter_slots.end()) {
+    throw std::runtime_error("Too many granular emitters playing");
+  }
+  it->granulator = std::make_unique<Granulator>(emitter.m_sounds,
+                                                m_sample_rate, m_next_seed++);
+  it->owner = &emitter;
+  emitter.m_slot = (int)(it - m_emitter_slots.begin());
+
+  Command cmd{};
+  cmd.type = Command::PLAY_EMITTER;
+  cmd.voice = (std::uint16_t)emitter.m_slot;
+  cmd.granulator = it->granulator.get();
+  cmd.emitter = emitter.m_params;
+  send(cmd);
+  // Any pending changes went out with the command
+  emitter.m_dirty = false;
+}
+
+void Mixer::stop(Emitter &emitter) {
+  if (emitter.m_slot < 0) {
+    return;
+  }
+  // The slot stays reserved until the audio thread's last grain finishes
+  Command cmd{};
+  cmd.type = Command::STOP_EMITTER;
+  cmd.voice = (std::uint16_t)emitter.m_slot;
+  send(cmd);
+  m_emitter_slots[emitter.m_slot].owner = nullptr;
+  emitter.m_slot = -1;
+}
+
+void Mixer::markDirty(Emitter &emitter) {
+  if (emitter.m_slot >= 0 && !emitter.m_dirty) {
+    emitter.m_dirty = true;
+    m_dirty_emitters.push_back((std::uint8_t)emitter.m_slot);
+  }
+}
+
+void Mixer::setMaxVoices(unsigned voices) {
+  m_max_voices = std::clamp(voices, 1u, MAX_VOICES);
+}
+
+void Mixer::play(Source &src, std::uint64_t start) {
+  if (!isStarted() ||
+      (!src.m_open && (!src.m_sound || src.m_sound->frames() == 0))) {
+    return;
+  }
+  if (src.m_sound) {
+    ++src.m_sound->plays;
+  }
+  src.m_cursor = 0.0;
+  src.m_start = start;
+  src.m_playing_index = (int)m_playing.size();
+  m_playing.push_back(&src);
+  // Start straight away if there's room, so that one-shots don't wait for the
+  // next update()
+  if (m_real_voices < m_max_voices) {
+    promote(src, true);
+  }
+}
+
+void Mixer::stop(Source &src) {
+  if (src.m_playing_index < 0) {
+    return;
+  }
+  if (src.m_voice >= 0) {
+    demote(src);
+  }
+  removePlaying(src);
+}
+
+bool Mixer::promote(Source &src, [[maybe_unused]] bool timed) {
+  if (m_free_voices.empty()) {
+    return false;
+  }
+  std::uint16_t voice = m_free_voices.back();
+  m_free_voices.pop_back();
+  Slot &slot = m_slots[voice];
+  slot.owner = &src;
+  src.m_voice = voice;
+  ++m_real_voices;
+
+  // The audio thread fades the voice in if it resumes part way through a
+  // sound, so that it doesn't click
+  Command cmd{};
+  cmd.type = Command::PLAY;
+  cmd.voice = voice;
+  if (src.m_open) {
+    slot.stream = std::make_shared<Stream>(src.m_open, src.m_params.looping);
+    m_streamer.add(slot.stream);
+    cmd.stream = slot.stream.get();
+  } else {
+    slot.sound = src.m_sound;
+    cmd.sound = src.m_sound.get();
+    cmd.cursor = src.m_cursor;
+  }
+  cmd.start = src.m_start;
+  cmd.params = mixParams(src);
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  if (timed) {
+    cmd.input = m_input;
+  }
+  // Only the first sound a key press starts is timed. Until one actually
+  // starts, the press is kept for the next
+  if (send(cmd) && timed) {
+    m_input = 0;
+  }
+#else
+  send(cmd);
+#endif
+  // Any pending changes went out with the command
+  src.m_dirty = false;
+  return true;
+}
+
+void Mixer::demote(Source &src) {
+  // The slot stays reserved until the audio thread has faded the voice out
+  // and reports that it ended
+  Command cmd{};
+  cmd.type = Command::STOP;
+  cmd.voice = (std::uint16_t)src.m_voice;
+  send(cmd);
+  m_slots[src.m_voice].owner = nullptr;
+  src.m_voice = -1;
+  --m_real_voices;
+}
+
+void Mixer::removePlaying(Source &src) {
+  // Swap with the last one, order doesn't matter
+  Source *last = m_playing.back();
+  m_playing[src.m_playing_index] = last;
+  last->m_playing_index = src.m_playing_index;
+  m_playing.pop_back();
+  src.m_playing_index = -1;
+}
+
+float Mixer::audibility(const Source &src) const {
+  glm::vec3 position = src.m_routed ? src.m_heard : src.m_params.position;
+  float dist = glm::length(position - m_listener.position);
+  return src.m_params.gain * src.m_params.occlusion * attenuation(dist);
+}
+
+SourceParams Mixer::mixParams(const Source &src) const {
+  SourceParams params = src.m_params;
+  if (src.m_routed) {
+    params.position = src.m_heard;
+  }
+  return params;
+}
+
+void Mixer::updatePaths() {
+  ProbeWeights listener;
+  if (m_acoustics) {
+    listener = m_acoustics->weigh(m_listener.position);
+  }
+  for (Source *src : m_playing) {
+    bool dirty = false;
+    float occlusion = 1.0f;
+    std::optional<PropagationPath> path;
+    if (m_propagation) {
+      path = m_propagation->path(src->m_params.position, m_listener.position);
+    }
+    if (path && std::isinf(path->distance)) {
+      // There's no way around the walls
+      occlusion = 0.0f;
+      path.reset();
+    } else if (!path && m_acoustics) {
+      ProbeWeights source = m_acoustics->weigh(src->m_params.position);
+      occlusion = m_acoustics->direct(listener, source).gain();
+    }
+
+    if (path) {
+      // From the corner's direction, as far away as the path is long
+      glm::vec3 rel = path->apparent - m_listener.position;
+      float len = glm::length(rel);
+      glm::vec3 heard = path->apparent;
+      if (len > 0.0f) {
+        heard = m_listener.position + rel * (path->distance / len);
+      }
+      if (!src->m_routed || glm::length(heard - src->m_heard) > HEARD_EPSILON) {
+        src->m_heard = heard;
+        src->m_routed = true;
+        dirty = true;
+      }
+    } else if (src->m_routed) {
+      src->m_routed = false;
+      dirty = true;
+    }
+
+    float &current = src->m_params.occlusion;
+    // Always send reaching either end, so sources end up fully open or shut
+    if (std::abs(occlusion - current) > OCCLUSION_EPSILON ||
+        (occlusion != current && (occlusion == 0.0f || occlusion == 1.0f))) {
+      current = occlusion;
+      dirty = true;
+    }
+    if (dirty) {
+      markDirty(*src);
+    }
+  }
+}
+
+void Mixer::advanceCursors(std::uint64_t from, std::uint64_t to) {
+  // Every source keeps its own idea of where it's up to, so that it can carry
+  // on from the right place whenever it gets a voice. Voices are the
+  // authority on when sounds end while they have one
+  for (std::size_t i = 0; i < m_playing.size();) {
+    Source &src = *m_playing[i];
+    std::uint64_t begin = from;
+    if (src.m_start) {
+      if (src.m_start >= to) {
+        ++i;
+        continue; // Not started yet
+      }
+      // Possibly before from, if the source was scheduled in the past
+      begin = src.m_start;
+      src.m_start = 0;
+    }
+    if (src.m_open) {
+      ++i;
+      continue; // Streams always restart, there's nothing to track
+    }
+    const Sound &sound = *src.m_sound;
+    double length = (double)(src.m_params.looping ? sound.loopEnd()
+                                                  : sound.frames());
+    src.m_cursor += (double)(to - begin) *
+                    std::max(src.m_params.pitch, 0.0f) * sound.rate /
+                    m_sample_rate;
+    if (src.m_cursor >= length) {
+      if (src.m_params.looping) {
+        src.m_cursor = sound.wrap(src.m_cursor);
+      } else if (src.m_voice < 0) {
+        removePlaying(src); // Finished without ever being heard
+        continue;
+      } else {
+        src.m_cursor = length;
+      }
+    }
+    ++i;
+  }
+}
+
+void Mixer::rebalance() {
+  if (m_playing.size() <= m_max_voices) {
+    for (Source *src : m_playing) {
+      if (src->m_voice < 0 && !promote(*src)) {
+        break;
+      }
+    }
+    return;
+  }
+
+  // Rank by priority, then by how loud each source would be. Sources that
+  // already have a voice get a head start, so that two similarly loud
+  // sources don't keep swapping
+  m_ranked.clear();
+  for (Source *src : m_playing) {
+    float score = audibility(*src);
+    if (src->m_voice >= 0) {
+      score *= RANK_HYSTERESIS;
+    }
+    // Streams can't resume where they left off, so never take them away
+    int priority = src->m_open ? INT_MAX : src->m_priority;
+    m_ranked.push_back({priority, score, src});
+  }
+  auto louder = [](const Ranked &a, const Ranked &b) {
+    return a.priority != b.priority ? a.priority > b.priority
+                                    : a.score > b.score;
+  };
+  auto cutoff = m_ranked.begin() + m_max_voices;
+  std::nth_element(m_ranked.begin(), cutoff, m_ranked.end(), louder);
+  for (auto it = cutoff; it != m_ranked.end(); ++it) {
+    if (it->src->m_voice >= 0) {
+      demote(*it->src);
+    }
+  }
+  for (auto it = m_ranked.begin(); it != cutoff; ++it) {
+    if (it->src->m_voice < 0 && !promote(*it->src)) {
+      break;
+    }
+  }
+}
+
+void Mixer::flushParams() {
+  // Each changed source is sent once per frame, however many of its
+  // properties changed and however often. They all go in one batch, unless
+  // the audio thread hasn't finished with it since last time, in which case
+  // they get a command each
+  ParamBatch &batch = m_param_batches[m_next_batch];
+  bool batched = m_dirty.size() > 1 &&
+                 !batch.busy.load(std::memory_order_acquire);
+  // A busy batch may still be being read by the audio thread, so it's only
+  // touched once it's been seen free
+  if (batched) {
+    batch.count = 0;
+  }
+  for (std::uint16_t voice : m_dirty) {
+    Source *src = m_slots[voice].owner;
+    if (src && src->m_dirty && src->m_voice == voice) {
+      if (const auto &stream = m_slots[voice].stream) {
+        // Streams loop as they decode, not as they play
+        stream->setLooping(src->m_params.looping);
+      }
+      if (batched) {
+        batch.voices[batch.count] = voice;
+        batch.params[batch.count++] = mixParams(*src);
+      } else {
+        Command cmd{};
+        cmd.type = Command::SET_PARAMS;
+        cmd.voice = voice;
+        cmd.params = mixParams(*src);
+        send(cmd);
+      }
+      src->m_dirty = false;
+    }
+  }
+  m_dirty.clear();
+  if (batched && batch.count > 0) {
+    batch.busy.store(true, std::memory_order_relaxed);
+    Command cmd{};
+    cmd.type = Command::SET_PARAM_BATCH;
+    cmd.batch = &batch;
+    if (send(cmd)) {
+      m_next_batch ^= 1;
+    } else {
+      batch.busy.store(false, std::memory_order_relaxed);
+    }
+  }
+  for (std::uint8_t slot : m_dirty_emitters) {
+    Emitter *emitter = m_emitter_slots[slot].owner;
+    if (emitter && emitter->m_dirty) {
+      Command cmd{};
+      cmd.type = Command::SET_EMITTER;
+      cmd.voice = slot;
+      cmd.emitter = emitter->m_params;
+      send(cmd);
+      emitter->m_dirty = false;
+    }
+  }
+  m_dirty_emitters.clear();
+  if (m_listener_dirty && isStarted()) {
+    Command cmd{};
+    cmd.type = Command::SET_LISTENER;
+    cmd.listener = m_listener;
+    send(cmd);
+  }
+  m_listener_dirty = false;
+  for (Bus *bus : m_dirty_buses) {
+    bus->m_gain_dirty = false;
+    if (isStarted()) {
+      Command cmd{};
+      cmd.type = Command::SET_BUS_GAIN;
+      cmd.bus = bus->m_index;
+      cmd.gain = bus->m_gain;
+      send(cmd);
+    }
+  }
+  m_dirty_buses.clear();
+}
+
+void Mixer::flushGraph() {
+  if (!m_graph_dirty || !isStarted()) {
+    return;
+  }
+  // Order buses by how many hops they are from the master, furthest first, so
+  // each is processed before the bus it plays into
+  std::array<unsigned, MAX_BUSES> depth{};
+  std::vector<Bus *> order;
+  for (Bus *bus : m_buses) {
+    if (bus) {
+      for (Bus *out = bus->m_output.get(); out; out = out->m_output.get()) {
+        ++depth[bus->m_index];
+      }
+      order.push_back(bus);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](Bus *a, Bus *b) {
+    return depth[a->m_index] > depth[b->m_index];
+  });
+  auto graph = std::make_unique<Graph>();
+  graph->nodes.reserve(order.size());
+  for (Bus *bus : order) {
+    if (bus->m_ambisonic_order && !bus->m_bed && m_spatializer) {
+      try {
+        bus->m_bed = std::make_shared<AmbisonicBed>(
+            *m_spatializer, m_sample_rate, bus->m_ambisonic_order);
+      } catch (const std::exception &e) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "%s, falling back to panning",
+                    e.what());
+        // Don't try again every time the graph changes
+        bus->m_ambisonic_order = 0;
+      }
+    }
+    std::uint8_t output = bus->m_output ? bus->m_output->m_index : 0;
+    graph->nodes.push_back({bus->m_index, output, bus->m_id, bus->m_gain,
+                            bus->m_effects, bus->m_bed});
+    graph->present[bus->m_index] = true;
+    graph->beds[bus->m_index] = bus->m_bed.get();
+  }
+  Command cmd{};
+  cmd.type = Command::SET_GRAPH;
+  cmd.graph = graph.get();
+  // If it couldn't be sent, try again next frame
+  if (send(cmd)) {
+    graph.release();
+    m_graph_dirty = false;
+  }
+}
+
+bool Mixer::send(const Command &cmd) {
+  if (m_commands.push(cmd)) {
+    return true;
+  }
+  // The audio thread drains the ring at the start of every callback, so this
+  // only happens if thousands of commands are sent in one frame. Wait for it
+  // rather than letting voices and sources disagree
+  ++m_command_stalls;
+  auto deadline = std::chrono::steady_clock::now() + MAX_COMMAND_STALL;
+  while (!m_commands.push(cmd)) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      ++m_dropped_commands;
+      SDL_LogError(SDL_LOG_CATEGORY_AUDIO,
+                   "Audio command queue is full, dropping command");
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+void Mixer::update() {
+  while (auto ev = m_events.pop()) {
+    switch (ev->type) {
+    case Event::VOICE_ENDED: {
+      Slot &slot = m_slots[ev->voice];
+      if (Source *src = slot.owner) {
+        // Reached the end of the sound, or the stream failed
+        src->m_voice = -1;
+        --m_real_voices;
+        removePlaying(*src);
+      }
+      // Releases the sound or stream if nothing else holds it
+      slot = {};
+      m_free_voices.push_back(ev->voice);
+      break;
+    }
+    case Event::GRAPH_RETIRED:
+      // Releases effects that were removed from every bus
+      delete ev->graph;
+      break;
+    case Event::EMITTER_ENDED:
+      // Releases its sounds if nothing else holds them
+      m_emitter_slots[ev->voice] = {};
+      break;
+    }
+  }
+
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  while (auto timing = m_timing_ring.pop()) {
+    m_timings.add(*timing);
+  }
+  while (auto latency = m_latency_ring.pop()) {
+    m_timings.addLatency(*latency, m_sample_rate);
+  }
+#endif
+
+  // Before anything that depends on where sources are or how loud
+  for (ParamBlock *block : m_param_blocks) {
+    block->apply();
+  }
+
+  if (isStarted()) {
+    std::uint64_t frames = m_frames.load(std::memory_order_relaxed);
+    advanceCursors(m_last_update_frames, frames);
+    m_last_update_frames = frames;
+    updatePaths();
+    rebalance();
+  }
+  flushParams();
+  flushGraph();
+}
+
+MixerStats Mixer::stats() const {
+  MixerStats s;
+  double freq = (double)SDL_GetPerformanceFrequency();
+  s.callbacks = m_callbacks.load(std::memory_order_relaxed);
+  s.underruns = m_underruns.load(std::memory_order_relaxed);
+  s.stream_starvations =
+      m_stream_starvations.load(std::memory_order_relaxed);
+  s.frames = m_frames.load(std::memory_order_relaxed);
+  s.last_callback_time = m_last_ticks.load(std::memory_order_relaxed) / freq;
+  s.max_callback_time = m_max_ticks.load(std::memory_order_relaxed) / freq;
+  if (s.callbacks > 0) {
+    s.average_callback_time =
+        m_total_ticks.load(std::memory_order_relaxed) / freq / s.callbacks;
+  }
+  s.active_voices = MAX_VOICES - (unsigned)m_free_voices.size();
+  s.playing_sources = (unsigned)m_playing.size();
+  s.virtual_sources = (unsigned)m_playing.size() - m_real_voices;
+  s.max_voices = m_max_voices;
+  s.playing_emitters = (unsigned)std::count_if(
+      m_emitter_slots.begin(), m_emitter_slots.end(),
+      [](const auto &slot) { return slot.owner != nullptr; });
+  s.active_grains = m_active_grains.load(std::memory_order_relaxed);
+  s.hrtf = m_spatializer != nullptr;
+  s.kernels = m_kernels->name;
+  s.command_stalls = m_command_stalls;
+  s.dropped_commands = m_dropped_commands;
+  return s;
+}
+
+void Mixer::render(float *out, std::size_t frames) noexcept {
+  std::uint64_t start = SDL_GetPerformanceCounter();
+  bool underrun = false;
+  if (m_period_ticks && m_last_callback_start &&
+      start - m_last_callback_start > m_period_ticks * 2) {
+    // We were called late, so the device probably ran dry
+    underrun = true;
+  }
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  CallbackTiming timing{};
+  timing.interval = m_last_callback_start ? start - m_last_callback_start : 0;
+  timing.frames = (std::uint32_t)frames;
+  timing.commands = (std::uint32_t)m_commands.size();
+#endif
+  m_last_callback_start = start;
+
+  // Voices are mixed in fixed size blocks, as the spatializer needs. The
+  // device almost always asks for exactly one block, but if it doesn't, what
+  // it didn't take is kept for next time
+  for (std::size_t done = 0; done < frames;) {
+    if (m_out_pos == m_block) {
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+      m_block_position = done;
+#endif
+      renderBlock();
+      m_out_pos = 0;
+    }
+    std::size_t n = std::min(frames - done, m_block - m_out_pos);
+    std::memcpy(out + done * OUTPUT_CHANNELS,
+                m_out + m_out_pos * OUTPUT_CHANNELS,
+                n * OUTPUT_CHANNELS * sizeof(float));
+    m_out_pos += n;
+    done += n;
+  }
+
+  std::uint64_t ticks = SDL_GetPerformanceCounter() - start;
+  if (m_period_ticks && ticks > m_period_ticks) {
+    underrun = true;
+  }
+  if (underrun) {
+    m_underruns.fetch_add(1, std::memory_order_relaxed);
+  }
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  timing.ticks = ticks;
+  timing.buffered = (std::uint32_t)(m_block - m_out_pos);
+  timing.underrun = underrun;
+  if (!m_timing_ring.push(timing)) {
+    m_dropped_timings.fetch_add(1, std::memory_order_relaxed);
+  }
+#endif
+  m_callbacks.fetch_add(1, std::memory_order_relaxed);
+  m_frames.fetch_add(frames, std::memory_order_relaxed);
+  m_last_ticks.store(ticks, std::memory_order_relaxed);
+  m_total_ticks.fetch_add(ticks, std::memory_order_relaxed);
+  if (ticks > m_max_ticks.load(std::memory_order_relaxed)) {
+    m_max_ticks.store(ticks, std::memory_order_relaxed);
+  }
+}
+
+void Mixer::renderBlock() noexcept {
+  // Hand back any graphs there wasn't room for last time
+  retire(nullptr);
+  processCommands();
+  const Graph &graph = *m_graph;
+  const std::size_t samples = m_block * OUTPUT_CHANNELS;
+  for (const auto &node : graph.nodes) {
+    std::memset(m_bus_out[node.bus], 0, samples * sizeof(float));
+    if (node.bed) {
+      node.bed->clear();
+    }
+  }
+  for (std::uint16_t i = 0; i < MAX_VOICES; ++i) {
+    Voice &voice = m_voices[i];
+    if (voice.end_pending) {
+      endVoice(i);
+    } else if (voice.isActive()) {
+      // Sources routed to a bus this graph doesn't have play into the master
+      std::uint8_t bus = graph.present[voice.params.bus] ? voice.params.bus : 0;
+      mixVoice(i, m_bus_out[bus], graph.beds[bus], m_block);
+      if (!voice.isActive()) {
+        endVoice(i);
+      }
+    }
+  }
+  unsigned grains = 0;
+  for (std::uint16_t i = 0; i < MAX_EMITTERS; ++i) {
+    Granulator *granulator = m_granulators[i];
+    if (!granulator) {
+      continue;
+    }
+    std::uint8_t bus = granulator->params().bus;
+    bus = graph.present[bus] ? bus : 0;
+    mixGrains(*granulator, m_bus_out[bus], graph.beds[bus]);
+    grains += (unsigned)granulator->grains().size();
+    // If the event can't be sent, try again next block
+    if (granulator->isFinished() &&
+        m_events.push({Event::EMITTER_ENDED, i, nullptr})) {
+      m_granulators[i] = nullptr;
+    }
+  }
+  m_active_grains.store(grains, std::memory_order_relaxed);
+
+  // Buses are in order, so each has everything that plays into it by the time
+  // its effects run
+  std::memset(m_out, 0, samples * sizeof(float));
+  for (const auto &node : graph.nodes) {
+    float *buf = m_bus_out[node.bus];
+    if (node.bed) {
+      float *left = m_binaural, *right = m_binaural + MAX_BLOCK;
+      node.bed->decode(left, right);
+      m_kernels->add_planar(buf, left, right, m_block);
+    }
+    for (const auto &effect : node.effects) {
+      effect->process(buf, m_block);
+    }
+    float *out = node.bus == 0 ? m_out : m_bus_out[node.output];
+    const float start[OUTPUT_CHANNELS] = {m_bus_gains[node.bus],
+                                          m_bus_gains[node.bus]};
+    const float end[OUTPUT_CHANNELS] = {m_bus_targets[node.bus],
+                                        m_bus_targets[node.bus]};
+    m_kernels->mix(out, buf, OUTPUT_CHANNELS, m_block, start, end, m_block);
+    m_bus_gains[node.bus] = m_bus_targets[node.bus];
+  }
+  m_mixed += m_block;
+  m_kernels->clamp(m_out, samples);
+}
+
+void Mixer::processCommands() noexcept {
+  while (auto cmd = m_commands.pop()) {
+    Voice &voice = m_voices[cmd->voice];
+    switch (cmd->type) {
+    case Command::PLAY:
+      voice = {};
+      voice.sound = cmd->sound;
+      voice.stream = cmd->stream;
+      voice.cursor = cmd->cursor;
+      voice.start = cmd->start;
+      voice.params = cmd->params;
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+      voice.input = cmd->input;
+#endif
+      if (m_spatializer) {
+        m_spatializer->reset(cmd->voice);
+      }
+      if (voice.sound && voice.start && voice.start < m_mixed) {
+        // Late, so skip what should already have been heard. Sources started
+        // together then stay together
+        const Sound &sound = *voice.sound;
+        double length = (double)(voice.params.looping ? sound.loopEnd()
+                                                      : sound.frames());
+        voice.cursor += (double)(m_mixed - voice.start) * soundStep(voice);
+        if (voice.cursor >= length) {
+          if (!voice.params.looping) {
+            endVoice(cmd->voice);
+            break;
+          }
+          voice.cursor = sound.wrap(voice.cursor);
+        }
+      }
+      voice.fade_in = voice.cursor > 0.0;
+      break;
+    case Command::STOP:
+      voice.stopping = true;
+      break;
+    case Command::SET_PARAMS:
+      voice.params = cmd->params;
+      break;
+    case Command::SET_PARAM_BATCH:
+      for (std::uint16_t i = 0; i < cmd->batch->count; ++i) {
+        m_voices[cmd->batch->voices[i]].params = cmd->batch->params[i];
+      }
+      cmd->batch->busy.store(false, std::memory_order_release);
+      break;
+    case Command::SET_LISTENER:
+      m_audio_listener = cmd->listener;
+      break;
+    case Command::SET_GRAPH:
+      // Buses new to the audio thread start at their gain, rather than
+      // ramping from whichever bus had their index before
+      for (const auto &node : cmd->graph->nodes) {
+        if (m_bus_ids[node.bus] != node.id) {
+          m_bus_ids[node.bus] = node.id;
+          m_bus_gains[node.bus] = m_bus_targets[node.bus] = node.gain;
+        }
+      }
+      retire(std::exchange(m_graph, cmd->graph));
+      break;
+    case Command::SET_BUS_GAIN:
+      m_bus_targets[cmd->bus] = cmd->gain;
+      break;
+    case Command::PLAY_EMITTER:
+      m_granulators[cmd->voice] = cmd->granulator;
+      cmd->granulator->setParams(cmd->emitter);
+      break;
+    case Command::STOP_EMITTER:
+      // Null if the play command was dropped
+      if (Granulator *granulator = m_granulators[cmd->voice]) {
+        granulator->stop();
+      }
+      break;
+    case Command::SET_EMITTER:
+      if (Granulator *granulator = m_granulators[cmd->voice]) {
+        granulator->setParams(cmd->emitter);
+      }
+      break;
+    }
+  }
+}
+
+void Mixer::retire(Graph *graph) noexcept {
+  if (graph) {
+    graph->next_retired = m_retired;
+    m_retired = graph;
+  }
+  // Freeing a graph can free effects, so that's left to the main thread
+  while (m_retired) {
+    Graph *next = m_retired->next_retired;
+    Event ev{};
+    ev.type = Event::GRAPH_RETIRED;
+    ev.graph = m_retired;
+    if (!m_events.push(ev)) {
+      break;
+    }
+    m_retired = next;
+  }
+}
+
+void Mixer::endVoice(std::uint16_t index) noexcept {
+  Voice &voice = m_voices[index];
+  voice.sound = nullptr;
+  voice.stream = nullptr;
+  voice.end_pending = !m_events.push({Event::VOICE_ENDED, index, nullptr});
+}
+
+void Mixer::mixVoice(std::uint16_t index, float *out, AmbisonicBed *bed,
+                     std::size_t frames) noexcept {
+  Voice &voice = m_voices[index];
+  // Voices scheduled to start part way through this block are silent until
+  // then, and ones scheduled for later are left alone
+  std::size_t offset = 0;
+  if (voice.start > m_mixed) {
+    if (voice.stopping) {
+      voice.sound = nullptr;
+      voice.stream = nullptr;
+      return;
+    }
+    if (voice.start - m_mixed >= frames) {
+      return;
+    }
+    offset = (std::size_t)(voice.start - m_mixed);
+  }
+
+  unsigned channels;
+  std::size_t n;
+  bool ended = false;
+  if (voice.stream) {
+    Stream::State state = voice.stream->state();
+    if (state == Stream::FAILED ||
+        (state == Stream::OPENING && voice.stopping)) {
+      voice.stream = nullptr;
+      return;
+    }
+    if (state == Stream::OPENING) {
+      return; // Nothing to play yet
+    }
+    channels = voice.stream->channels();
+    n = resampleStream(voice, m_scratch + offset * channels, frames - offset,
+                       ended);
+  } else {
+    channels = voice.sound->channels;
+    n = resampleSound(voice, m_scratch + offset * channels, frames - offset,
+                      ended);
+  }
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  if (voice.input && n > 0) {
+    // Lost if the main thread hasn't kept up, like the callback timings
+    m_latency_ring.push({voice.input, m_last_callback_start,
+                         (std::uint32_t)(m_block_position + offset)});
+    voice.input = 0;
+  }
+#endif
+
+  // Work out where the voice should end up by the end of this block
+  float dist;
+  glm::vec3 dir = listenerDirection(voice.params.position, dist);
+  float gain = 0.0f;
+  if (!voice.stopping) {
+    gain = voice.params.gain * voice.params.occlusion * attenuation(dist);
+  }
+
+  if (channels == 1 && m_spatializer) {
+    // Mono sources go through the HRTF, on their own or as part of a bed.
+    // Apply the gain first, so that it's ramped smoothly, and zero whatever
+    // the voice didn't fill
+    const float start = voice.fade_in ? voice.gains[0] : gain;
+    m_kernels->ramp(m_scratch + offset, n, start, gain, frames - offset);
+    std::fill(m_scratch, m_scratch + offset, 0.0f);
+    std::fill(m_scratch + offset + n, m_scratch + frames, 0.0f);
+    // Sources right on top of the listener have no direction to come from
+    float blend = std::min(dist / SPATIAL_BLEND_DISTANCE, 1.0f);
+    if (bed) {
+      float encoding[MAX_AMBISONIC_CHANNELS];
+      ambisonic_encode(dir, bed->order(), blend, encoding);
+      bed->encode(m_scratch, voice.fade_in ? voice.encoding : encoding,
+                  encoding);
+      std::copy_n(encoding, bed->channels(), voice.encoding);
+    } else {
+      float *left = m_binaural, *right = m_binaural + MAX_BLOCK;
+      m_spatializer->apply(index, m_scratch, dir, blend, left, right);
+      m_kernels->add_planar(out, left, right, frames);
+    }
+    voice.gains[0] = voice.gains[1] = gain;
+  } else {
+    float target[OUTPUT_CHANNELS];
+    pan_gains(channels, dir.x, gain, target);
+
+    // Mix, ramping the gains across the whole block
+    const float *start = voice.fade_in ? voice.gains : target;
+    m_kernels->mix(out + offset * OUTPUT_CHANNELS,
+                   m_scratch + offset * channels, channels, n, start, target,
+                   frames - offset);
+    voice.gains[0] = target[0];
+    voice.gains[1] = target[1];
+  }
+
+  // Everything after the first block ramps from where the last one ended
+  voice.fade_in = true;
+  // A stopping voice has faded out by the end of its first block
+  if (ended || voice.stopping) {
+    voice.sound = nullptr;
+    voice.stream = nullptr;
+  }
+}
+
+void Mixer::mixGrains(Granulator &granulator, float *out,
+                      AmbisonicBed *bed) noexcept {
+  granulator.schedule(m_block);
+  const float emitter_gain = granulator.params().gain;
+  for (Grain &grain : granulator.grains()) {
+    const Sound &sound = *grain.sound;
+    const unsigned channels = sound.channels;
+    const std::size_t offset = std::exchange(grain.delay, 0);
+    const std::size_t n = whole_frames(grain.cursor, grain.step,
+                                       sound.frames(), m_block - offset);
+    // Grains are short, so their gain and direction are only updated once a
+    // block rather than ramped
+    float dist;
+    glm::vec3 dir = listenerDirection(grain.position, dist);
+    float gain = emitter_gain * grain.gain * attenuation(dist);
+    float *in = m_scratch + offset * channels;
+    resampleFrames(sound, in, grain.cursor, grain.step, n);
+    if (channels == 1 && bed) {
+      m_kernels->ramp(in, n, gain, gain, n);
+      std::fill(m_scratch, in, 0.0f);
+      std::fill(in + n, m_scratch + m_block, 0.0f);
+      float encoding[MAX_AMBISONIC_CHANNELS];
+      float blend = std::min(dist / SPATIAL_BLEND_DISTANCE, 1.0f);
+      ambisonic_encode(dir, bed->order(), blend, encoding);
+      bed->encode(m_scratch, encoding, encoding);
+    } else {
+      float target[OUTPUT_CHANNELS];
+      pan_gains(channels, dir.x, gain, target);
+      m_kernels->mix(out + offset * OUTPUT_CHANNELS, in, channels, n, target,
+                     target, n);
+    }
+    grain.cursor += (double)n * grain.step;
+    // Only the end of the sound stops a grain short of the block
+    if (offset + n < m_block) {
+      grain.sound = nullptr;
+    }
+  }
+  granulator.collect();
+}
+
+glm::vec3 Mixer::listenerDirection(glm::vec3 position,
+                                   float &dist) const noexcept {
+  glm::vec3 rel = position - m_audio_listener.position;
+  dist = glm::length(rel);
+  // In listener space: +x right, +y up, -z ahead
+  if (dist <= 0.0f) {
+    return {0.0f, 0.0f, -1.0f};
+  }
+  glm::vec3 forward = glm::normalize(m_audio_listener.forward);
+  glm::vec3 right = glm::normalize(glm::cross(forward, m_audio_listener.up));
+  glm::vec3 up = glm::cross(right, forward);
+  rel /= dist;
+  return {glm::dot(rel, right), glm::dot(rel, up), -glm::dot(rel, forward)};
+}
+
+double Mixer::soundStep(const Voice &voice) const noexcept {
+  return (double)std::max(voice.params.pitch, 0.0f) * voice.sound->rate /
+         m_sample_rate;
+}
+
+void Mixer::resampleFrames(const Sound &sound, float *out, double cursor,
+                           double step, std::size_t frames) noexcept {
+  const unsigned channels = sound.channels;
+  if (!sound.isCompressed()) {
+    m_kernels->resample(out, sound.samples.data(), channels, cursor, step,
+                        frames);
+    return;
+  }
+  // Expand as many of the blocks the frames need as fit, resample what they
+  // cover, and carry on from there. Any 2 blocks in a row fit, so each window
+  // covers at least a frame
+  static_assert(COMPRESSED_BLOCK == EXPAND_BLOCK);
+  constexpr std::size_t max_blocks =
+      std::extent_v<decltype(m_expanded)> / COMPRESSED_BLOCK;
+  static_assert(max_blocks >= 2);
+  const std::size_t block_frames = COMPRESSED_BLOCK / channels;
+  const std::size_t blocks = sound.scales.size();
+  std::size_t n = 0;
+  while (n < frames) {
+    const double pos = cursor + (double)n * step;
+    const std::size_t first = (std::size_t)pos / block_frames;
+    const std::size_t last = std::min(first + max_blocks, blocks);
+    const double rel = pos - (double)(first * block_frames);
+    std::size_t run = whole_frames(rel, step, (last - first) * block_frames,
+                                   frames - n);
+    if (run == 0) {
+      // Only possible through rounding. Better silence than reading past the
+      // end
+      std::fill(out + n * channels, out + frames * channels, 0.0f);
+      return;
+    }
+    // Only expand up to the block holding the last frame read
+    std::size_t end =
+        ((std::size_t)(rel + (double)(run - 1) * step) + 1) / block_frames + 1;
+    m_kernels->expand(m_expanded, sound.codes.data() + first * COMPRESSED_BLOCK,
+                      sound.scales.data() + first, end);
+    m_kernels->resample(out + n * channels, m_expanded, channels, rel, step,
+                        run);
+    n += run;
+  }
+}
+
+std::size_t Mixer::resampleSound(Voice &voice, float *out, std::size_t frames,
+                                 bool &ended) noexcept {
+  // Linear interpolation, wrapping around the loop points of looping sounds
+  const Sound &sound = *voice.sound;
+  const unsigned channels = sound.channels;
+  const bool looping = voice.params.looping;
+  const std::size_t length = looping ? sound.loopEnd() : sound.frames();
+  const double step = soundStep(voice);
+  double cursor = voice.cursor;
+  std::size_t n = 0;
+  while (n < frames) {
+    // Frames before the last one can be interpolated in bulk. Only the last
+    // one has to hold or wrap around to the loop start
+    std::size_t run = whole_frames(cursor, step, length, frames - n);
+    if (run > 0) {
+      resampleFrames(sound, out + n * channels, cursor, step, run);
+    } else {
+      std::size_t i0 = (std::size_t)cursor;
+      std::size_t i1 = looping ? sound.loop_start : i0;
+      float frac = (float)(cursor - (double)i0);
+      for (unsigned c = 0; c < channels; ++c) {
+        float a = sound.sample(i0 * channels + c);
+        float b = sound.sample(i1 * channels + c);
+        out[n * channels + c] = a + (b - a) * frac;
+      }
+      run = 1;
+    }
+    n += run;
+    cursor += (double)run * step;
+    if (cursor >= (double)length) {
+      if (!looping) {
+        ended = true;
+        break;
+      }
+      cursor = sound.wrap(cursor);
+    }
+  }
+  voice.cursor = cursor;
+  return n;
+}
+
+std::size_t Mixer::resampleStream(Voice &voice, float *out,
+                                  std::size_t frames, bool &ended) noexcept {
+  Stream &stream = *voice.stream;
+  // Check this before looking at the ring, so that if the stream has
+  // finished we know the ring holds everything that's left
+  const bool finished = stream.state() == Stream::FINISHED;
+  SampleRing &ring = stream.ring();
+  const unsigned channels = stream.channels();
+  const double step =
+      std::min((double)std::max(voice.params.pitch, 0.0f) * stream.rate() /
+                   m_sample_rate,
+               (double)MAX_STREAM_STEP);
+
+  // Looping is handled by the decoder, so the ring is just a window onto an
+  // endless run of frames. Peek at as many as this block could need
+  double cursor = voice.cursor;
+  const std::size_t available = ring.available() / channels;
+  const std::size_t needed = (std::size_t)(cursor + (frames - 1) * step) + 2;
+  const std::size_t got =
+      ring.peek(m_stream_in, std::min(needed, available) * channels) /
+      channels;
+
+  std::size_t n = whole_frames(cursor, step, got, frames);
+  m_kernels->resample(out, m_stream_in, channels, cursor, step, n);
+  cursor += (double)n * step;
+  for (; n < frames; ++n) {
+    std::size_t i0 = (std::size_t)cursor;
+    std::size_t i1 = i0 + 1;
+    if (i1 >= got) {
+      // Hold the very last frame, otherwise wait for the decoder
+      if (i0 >= got || !finished || got < available) {
+        break;
+      }
+      i1 = i0;
+    }
+    float frac = (float)(cursor - (double)i0);
+    for (unsigned c = 0; c < channels; ++c) {
+      float a = m_stream_in[i0 * channels + c];
+      float b = m_stream_in[i1 * channels + c];
+      out[n * channels + c] = a + (b - a) * frac;
+    }
+    cursor += step;
+  }
+  std::size_t consumed = std::min((std::size_t)cursor, got);
+  ring.consume(consumed * channels);
+  voice.cursor = cursor - (double)consumed;
+
+  if (n < frames) {
+    if (finished && got == available) {
+      ended = true;
+    } else if (voice.primed) {
+      m_stream_starvations.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  voice.primed |= n > 0;
+  return n;
+}
+
+} // namespace lege::audio
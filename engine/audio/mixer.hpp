@@ -0,0 +1,721 @@
+#ifndef LIBLEGE_AUDIO_MIXER_HPP
+#define LIBLEGE_AUDIO_MIXER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "audio/acoustics.hpp"
+#include "audio/ambisonics.hpp"
+#include "audio/convolver.hpp"
+#include "audio/effects.hpp"
+#include "audio/granular.hpp"
+#include "audio/propagation.hpp"
+#include "audio/ring.hpp"
+#include "audio/sound.hpp"
+#include "audio/stream.hpp"
+#include "audio/timings.hpp"
+
+namespace lege::audio {
+
+inline constexpr unsigned MAX_VOICES = 256;
+// How many sources are actually mixed by default. Any more are virtual
+inline constexpr unsigned DEFAULT_MAX_VOICES = 64;
+inline constexpr unsigned OUTPUT_CHANNELS = 2;
+// Longer callbacks are mixed in blocks of at most this many frames, so the
+// audio thread's scratch buffers can be fixed-size
+inline constexpr std::size_t MAX_BLOCK = 1024;
+// Streamed voices can't be played faster than this many times their sample
+// rate, as the ring would run dry
+inline constexpr std::size_t MAX_STREAM_STEP = 8;
+// Including the master bus
+inline constexpr unsigned MAX_BUSES = 32;
+
+class Mixer;
+class ParamBlock;
+class Spatializer;
+struct Graph;
+struct Kernels;
+
+struct SourceParams {
+  float gain = 1.0f;
+  float pitch = 1.0f;
+  glm::vec3 position{0.0f, 0.0f, 0.0f};
+  // How much of the source gets past the level's geometry to the listener.
+  // Set by the mixer from its acoustics, if it has any
+  float occlusion = 1.0f;
+  bool looping = false;
+  // Index of the bus the source plays into
+  std::uint8_t bus = 0;
+};
+
+struct Listener {
+  glm::vec3 position{0.0f, 0.0f, 0.0f};
+  glm::vec3 forward{0.0f, 0.0f, -1.0f};
+  glm::vec3 up{0.0f, 1.0f, 0.0f};
+};
+
+// A group of sources mixed together, E.G. music or speech, then run through a
+// chain of effects and into another bus, at a gain. Every bus ends up in the
+// mixer's master bus.
+//
+// Buses live on the main thread. Once per frame, if any of them changed, the
+// audio thread is sent a whole new graph of them to swap in, so it never sees
+// one half edited. Gains and effect parameters are sent separately, so that
+// they can change smoothly without a new graph
+class Bus {
+public:
+  ~Bus();
+
+  // No copy or move, the mixer refers to buses by address
+  Bus(const Bus &) = delete;
+  Bus &operator=(const Bus &) = delete;
+
+  bool isMaster() const { return m_index == 0; }
+  float gain() const { return m_gain; }
+  void setGain(float gain);
+
+  // Null for the master bus
+  const std::shared_ptr<Bus> &output() const { return m_output; }
+  // Throws if this is the master bus, or output feeds into this bus
+  void setOutput(std::shared_ptr<Bus> output);
+
+  // In processing order
+  const std::vector<std::shared_ptr<Effect>> &effects() const {
+    return m_effects;
+  }
+  // Throws if the effect is already part of a bus
+  void insertEffect(std::size_t index, std::shared_ptr<Effect> effect);
+  // Returns false if the effect isn't part of this bus
+  bool removeEffect(const Effect &effect);
+  void clearEffects();
+
+  // Above 0, mono sources on the bus are encoded into an ambisonic bed of
+  // this order, which is decoded through the HRTF once per block, rather
+  // than each being spatialized on its own. Much cheaper for lots of quiet
+  // ambient sources, at the cost of less precise directions. The bed is
+  // mixed before the bus's effects. If SteamAudio couldn't be initialized,
+  // they're panned as usual. Throws if order is above MAX_AMBISONIC_ORDER
+  unsigned ambisonicOrder() const { return m_ambisonic_order; }
+  void setAmbisonicOrder(unsigned order);
+
+private:
+  friend class Mixer;
+  friend class Source;
+  friend class Emitter;
+
+  Bus(Mixer &mixer, std::uint8_t index, std::uint32_t id,
+      std::shared_ptr<Bus> output);
+
+  Mixer &m_mixer;
+  std::uint8_t m_index;
+  // Unique for the mixer's lifetime, unlike the index, which is reused
+  std::uint32_t m_id;
+  std::shared_ptr<Bus> m_output;
+  std::vector<std::shared_ptr<Effect>> m_effects;
+  unsigned m_ambisonic_order = 0;
+  // Created by the mixer once it has started
+  std::shared_ptr<AmbisonicBed> m_bed;
+  float m_gain = 1.0f;
+  bool m_gain_dirty = false;
+};
+
+// A sound and how to play it. Sources live on the main thread. Any number can
+// play at once, but only the most audible ones occupy one of the mixer's
+// voices. The rest are virtual: they just keep track of where they're up to,
+// so that they carry on from the right place if they get a voice later
+class Source {
+public:
+  Source(Mixer &mixer, std::shared_ptr<const Sound> sound);
+  // Streams a file, opening it again each time the source plays
+  Source(Mixer &mixer, DecoderFactory open);
+  ~Source();
+
+  // No copy or move, the mixer refers to playing sources by address
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+
+  // Restarts the source if it's already playing
+  void play();
+  // Starts the source when the mixer's clock reaches frame, to the sample.
+  // Sounds scheduled in the past start part way through, as if they'd started
+  // on time. Streams can't skip ahead, so start as soon as they can
+  void playAt(std::uint64_t frame);
+  void stop();
+  bool isPlaying() const { return m_playing_index >= 0; }
+  // Playing, but not being mixed
+  bool isVirtual() const { return isPlaying() && m_voice < 0; }
+
+  bool isStreamed() const { return bool(m_open); }
+  // Null if streamed
+  const std::shared_ptr<const Sound> &sound() const { return m_sound; }
+  const SourceParams &params() const { return m_params; }
+
+  void setGain(float gain);
+  void setPitch(float pitch);
+  void setPosition(glm::vec3 position);
+  void setLooping(bool looping);
+  // The master bus if the source hasn't been routed elsewhere
+  std::shared_ptr<Bus> bus() const;
+  // Null routes the source to the master bus
+  void setBus(std::shared_ptr<Bus> bus);
+
+  // Sources with a higher priority always get voices before lower ones,
+  // however quiet they are
+  int priority() const { return m_priority; }
+  void setPriority(int priority) { m_priority = priority; }
+
+  // Null if not bound to a parameter block
+  ParamBlock *paramBlock() const { return m_block; }
+
+private:
+  friend class Mixer;
+  friend class ParamBlock;
+
+  Mixer &m_mixer;
+  std::shared_ptr<const Sound> m_sound;
+  DecoderFactory m_open;
+  SourceParams m_params;
+  // Null for the master bus
+  std::shared_ptr<Bus> m_bus;
+  int m_priority = 0;
+  // Index in Mixer::m_playing, or -1 if stopped
+  int m_playing_index = -1;
+  // Index of the voice playing this source, or -1 if stopped or virtual
+  int m_voice = -1;
+  // Estimated position in the sound, in frames
+  double m_cursor = 0.0;
+  // Frame of the mixer's clock the source is scheduled to start at, or 0 once
+  // it has started
+  std::uint64_t m_start = 0;
+  // Set if params changed since they were last sent to the audio thread
+  bool m_dirty = false;
+  // Where the source is mixed as if it were, when propagation routes its
+  // sound around walls
+  glm::vec3 m_heard{0.0f, 0.0f, 0.0f};
+  bool m_routed = false;
+  ParamBlock *m_block = nullptr;
+  std::size_t m_block_index = 0;
+};
+
+// One source's entry in a ParamBlock. Laid out for LuaJIT's FFI, which
+// scripts write it through, so must match the cdef in lege.audio
+struct BlockParams {
+  float gain;
+  float pitch;
+  float x, y, z;
+};
+
+// The parameters of many sources in one array, so that scripts can write them
+// in place rather than calling into C for every source. Once per frame,
+// Mixer::update() applies the entries that changed to the sources bound to
+// them, and reads back the ones that didn't, so that the array always shows
+// what each source is set to
+class ParamBlock {
+public:
+  ParamBlock(Mixer &mixer, std::size_t size);
+  ~ParamBlock();
+
+  // No copy or move, sources refer to their block by address, and scripts to
+  // its entries
+  ParamBlock(const ParamBlock &) = delete;
+  ParamBlock &operator=(const ParamBlock &) = delete;
+
+  std::size_t size() const { return m_params.size(); }
+  BlockParams *data() { return m_params.data(); }
+
+  // Binds src to entry index, replacing whatever was bound there, and sets
+  // the entry to src's params. A source can only be bound to one entry at a
+  // time, so it's unbound from any other first. Null leaves the entry
+  // unbound. Throws if index is out of range
+  void bind(std::size_t index, Source *src);
+  Source *source(std::size_t index) const { return m_sources.at(index); }
+
+private:
+  friend class Mixer;
+  friend class Source;
+
+  void unbind(std::size_t index);
+  void apply();
+
+  Mixer &m_mixer;
+  std::vector<BlockParams> m_params;
+  // As last applied, to tell which entries scripts changed
+  std::vector<BlockParams> m_applied;
+  std::vector<Source *> m_sources;
+};
+
+// A dense texture of short sounds, like rain or footsteps on gravel: grains
+// picked at random from a pool of sounds, each with a random gain, pitch and
+// position around the emitter's. Grains are started and mixed entirely on the
+// audio thread, so however many there are, the main thread only sends the
+// emitter's parameters when they change. Grains are panned, or spatialized
+// through their bus's ambisonic bed if it has one, and aren't occluded
+class Emitter {
+public:
+  // Throws if there are no sounds, or any are empty
+  Emitter(Mixer &mixer, std::vector<std::shared_ptr<const Sound>> sounds);
+  ~Emitter();
+
+  // No copy or move, the mixer refers to playing emitters by address
+  Emitter(const Emitter &) = delete;
+  Emitter &operator=(const Emitter &) = delete;
+
+  // Does nothing if already playing. Throws if MAX_EMITTERS are playing
+  void play();
+  // Grains already playing carry on to the end
+  void stop();
+  bool isPlaying() const { return m_slot >= 0; }
+
+  const std::vector<std::shared_ptr<const Sound>> &sounds() const {
+    return m_sounds;
+  }
+  const EmitterParams &params() const { return m_params; }
+
+  void setRate(float rate);
+  void setGain(float gain);
+  void setGainSpread(float spread);
+  void setPitch(float pitch);
+  void setPitchSpread(float semitones);
+  void setPosition(glm::vec3 position);
+  void setPositionSpread(float distance);
+  // The master bus if the emitter hasn't been routed elsewhere
+  std::shared_ptr<Bus> bus() const;
+  // Null routes the emitter to the master bus
+  void setBus(std::shared_ptr<Bus> bus);
+
+private:
+  friend class Mixer;
+
+  Mixer &m_mixer;
+  std::vector<std::shared_ptr<const Sound>> m_sounds;
+  EmitterParams m_params;
+  // Null for the master bus
+  std::shared_ptr<Bus> m_bus;
+  // Index in Mixer::m_emitter_slots, or -1 if stopped
+  int m_slot = -1;
+  // Set if params changed since they were last sent to the audio thread
+  bool m_dirty = false;
+};
+
+// Parameters for the voices whose sources changed in a frame, handed to the
+// audio thread in one command rather than one each. The mixer has two, so it
+// can fill one while the audio thread might still be reading the other
+struct ParamBatch {
+  std::uint16_t count = 0;
+  std::uint16_t voices[MAX_VOICES];
+  SourceParams params[MAX_VOICES];
+  // Set while the audio thread has it
+  std::atomic<bool> busy = false;
+};
+
+// Sent from the main thread to the audio thread
+struct Command {
+  enum Type : std::uint8_t {
+    PLAY,
+    STOP,
+    SET_PARAMS,
+    SET_LISTENER,
+    SET_GRAPH,
+    SET_BUS_GAIN,
+    PLAY_EMITTER,
+    STOP_EMITTER,
+    SET_EMITTER,
+    SET_PARAM_BATCH,
+  };
+
+  Type type;
+  // Or the emitter's slot, for emitter commands
+  std::uint16_t voice;
+  // One of these is set for PLAY
+  const Sound *sound;
+  Stream *stream;
+  // Where to start a sound, in frames
+  double cursor;
+  // Frame of the mixer's clock to start at, or 0 for straight away
+  std::uint64_t start;
+  SourceParams params;
+  Listener listener;
+  // For SET_GRAPH. The audio thread owns it until it's sent back
+  Graph *graph;
+  // For SET_BUS_GAIN
+  std::uint8_t bus;
+  float gain;
+  // For PLAY_EMITTER. The audio thread uses it until it reports the emitter
+  // ended
+  Granulator *granulator;
+  EmitterParams emitter;
+  // For SET_PARAM_BATCH. The audio thread clears its busy flag once applied,
+  // after which the main thread can refill it
+  ParamBatch *batch;
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  // For PLAY. When the key press that started it was made, or 0
+  std::uint64_t input;
+#endif
+};
+
+// Sent from the audio thread to the main thread
+struct Event {
+  enum Type : std::uint8_t {
+    // The voice has stopped, and can be reused
+    VOICE_ENDED,
+    // The audio thread has swapped graph out, and is done with it
+    GRAPH_RETIRED,
+    // The emitter has stopped and its last grain has finished, so its slot
+    // can be reused
+    EMITTER_ENDED,
+  };
+
+  Type type;
+  // Or the emitter's slot
+  std::uint16_t voice;
+  Graph *graph;
+};
+
+// Snapshot of the audio thread's counters
+struct MixerStats {
+  std::uint64_t callbacks = 0;
+  // Callbacks that started late, or took longer than the audio they produced
+  std::uint64_t underruns = 0;
+  // Blocks where a streamed voice ran out of decoded audio
+  std::uint64_t stream_starvations = 0;
+  std::uint64_t frames = 0;
+  // In seconds
+  double last_callback_time = 0.0;
+  double max_callback_time = 0.0;
+  double average_callback_time = 0.0;
+  // Voices mixing or fading out
+  unsigned active_voices = 0;
+  unsigned playing_sources = 0;
+  // Sources playing without a voice
+  unsigned virtual_sources = 0;
+  unsigned max_voices = 0;
+  unsigned playing_emitters = 0;
+  // Grains the emitters were playing at the end of the last callback
+  unsigned active_grains = 0;
+  // Whether mono sources are spatialized with an HRTF
+  bool hrtf = false;
+  // Name of the set of kernels mixing is vectorized with
+  const char *kernels = nullptr;
+  std::uint64_t command_stalls = 0;
+  std::uint64_t dropped_commands = 0;
+};
+
+// Mixes playing sources together on the audio thread.
+//
+// Everything except render() must only be called from the main thread. The
+// main thread talks to the audio thread by pushing Commands to a lock-free
+// ring, and the audio thread replies with Events on another. The audio thread
+// never locks or allocates: sounds are kept alive by the main thread until
+// the voice playing them reports that it has ended
+class Mixer {
+public:
+  Mixer();
+  ~Mixer();
+
+  // No copy
+  Mixer(const Mixer &) = delete;
+  Mixer &operator=(const Mixer &) = delete;
+
+  // Called once the output device is open, before it starts pulling audio.
+  // Until then sources don't play. Mono sources are spatialized with an HRTF
+  // if SteamAudio can be initialized, otherwise they're panned. When rendering
+  // offline rather than to a device, render() isn't expected to keep up with
+  // real time, so underruns aren't counted
+  void start(unsigned sample_rate, std::size_t device_frames,
+             bool realtime = true);
+  bool isStarted() const { return m_sample_rate != 0; }
+  unsigned sampleRate() const { return m_sample_rate; }
+
+  // The bus everything ends up in
+  const std::shared_ptr<Bus> &master() const { return m_master; }
+  // Creates a bus, which plays into the master bus if output is null. Throws
+  // if there are already MAX_BUSES
+  std::shared_ptr<Bus> createBus(std::shared_ptr<Bus> output = nullptr);
+  // Loads and partitions a convolver's impulse response on a worker thread
+  void loadImpulse(const std::shared_ptr<Convolver> &convolver,
+                   ImpulseLoader::LoadFunc load) {
+    m_impulse_loader.add(convolver, std::move(load));
+  }
+
+  // How many sources can be mixed at once, up to MAX_VOICES
+  void setMaxVoices(unsigned voices);
+  unsigned maxVoices() const { return m_max_voices; }
+
+  void setListener(const Listener &listener);
+  const Listener &listener() const { return m_listener; }
+
+  // Sources are occluded by the level's geometry according to these, until
+  // they're replaced or cleared with null
+  void setAcoustics(std::shared_ptr<const BakedAcoustics> acoustics) {
+    m_acoustics = std::move(acoustics);
+  }
+  const std::shared_ptr<const BakedAcoustics> &acoustics() const {
+    return m_acoustics;
+  }
+  // Sources on the grid are heard around its walls rather than through them,
+  // from as far away as the path around is long and from the direction of the
+  // last corner it turns. Sources with no path there are silent. Acoustics
+  // only occlude sources off the grid
+  void setPropagation(std::shared_ptr<PropagationGrid> grid) {
+    m_propagation = std::move(grid);
+  }
+  const std::shared_ptr<PropagationGrid> &propagation() const {
+    return m_propagation;
+  }
+
+  // How many frames have been sent to the device. Advances once per callback
+  std::uint64_t clock() const {
+    return m_frames.load(std::memory_order_relaxed);
+  }
+  // The earliest frame that sources scheduled now are sure to start on time,
+  // so that sources started together there stay in sync
+  std::uint64_t earliestStart() const { return clock() + 2 * m_block; }
+
+  // Sends this frame's parameter changes to the audio thread as one batch,
+  // and handles events from it. Called once per frame
+  void update();
+
+  // Stops decoding streams and loading impulse responses. Must be called
+  // before anything they read from is destroyed
+  void stopWorkers() {
+    m_streamer.stop();
+    m_impulse_loader.stop();
+  }
+
+  MixerStats stats() const;
+
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  // Histograms of recent callbacks, brought up to date by update()
+  const AudioTimings &timings() const { return m_timings; }
+  void clearTimings() { m_timings.clear(); }
+  // The next sound played is timed from a key pressed at this performance
+  // counter, or none if 0. Called on frames with a key press, before anything
+  // can react to it
+  void setInputTime(std::uint64_t ticks) { m_input = ticks; }
+  // Callbacks not recorded because update() wasn't called for too long
+  std::uint64_t droppedTimings() const {
+    return m_dropped_timings.load(std::memory_order_relaxed);
+  }
+#endif
+
+  // Audio thread only. Mixes interleaved stereo float frames into out
+  void render(float *out, std::size_t frames) noexcept;
+
+private:
+  friend class Bus;
+  friend class Source;
+  friend class Emitter;
+  friend class ParamBlock;
+
+  void play(Source &src, std::uint64_t start);
+  void stop(Source &src);
+  // If timed, the source is timed from the key press set by setInputTime(),
+  // as it's being started rather than given back a voice
+  bool promote(Source &src, bool timed = false);
+  void demote(Source &src);
+  void removePlaying(Source &src);
+  float audibility(const Source &src) const;
+  // Moves sources along by the frames the clock advanced between from and to
+  void advanceCursors(std::uint64_t from, std::uint64_t to);
+  // Works out where each playing source is heard from, and how occluded it
+  // is, from the listener's position
+  void updatePaths();
+  // The params a source is mixed with
+  SourceParams mixParams(const Source &src) const;
+  // Gives voices to the most audible sources
+  void rebalance();
+  void markDirty(Source &src);
+  void play(Emitter &emitter);
+  void stop(Emitter &emitter);
+  void markDirty(Emitter &emitter);
+  void flushParams();
+  void markGainDirty(Bus &bus);
+  // Sends a new graph if buses were added, removed or rearranged
+  void flushGraph();
+  // Returns false if the command had to be dropped
+  bool send(const Command &cmd);
+
+  // Main thread state
+  struct Slot {
+    std::shared_ptr<const Sound> sound;
+    std::shared_ptr<Stream> stream;
+    // Null once the source stopped or was destroyed
+    Source *owner = nullptr;
+  };
+  std::array<Slot, MAX_VOICES> m_slots;
+  std::vector<std::uint16_t> m_free_voices;
+  std::vector<Source *> m_playing;
+  unsigned m_real_voices = 0;
+  unsigned m_max_voices = DEFAULT_MAX_VOICES;
+  std::uint64_t m_last_update_frames = 0;
+  struct Ranked {
+    int priority;
+    float score;
+    Source *src;
+  };
+  std::vector<Ranked> m_ranked;
+  struct EmitterSlot {
+    // Null if the slot is free
+    std::unique_ptr<Granulator> granulator;
+    // Null once the emitter stopped or was destroyed
+    Emitter *owner = nullptr;
+  };
+  std::array<EmitterSlot, MAX_EMITTERS> m_emitter_slots;
+  std::vector<std::uint8_t> m_dirty_emitters;
+  std::vector<ParamBlock *> m_param_blocks;
+  ParamBatch m_param_batches[2];
+  // The batch to fill next
+  unsigned m_next_batch = 0;
+  // Each emitter's grains are seeded differently, so two emitters playing
+  // the same sounds don't play the same grains
+  std::uint64_t m_next_seed = 1;
+  Listener m_listener;
+  bool m_listener_dirty = false;
+  std::shared_ptr<const BakedAcoustics> m_acoustics;
+  std::shared_ptr<PropagationGrid> m_propagation;
+  // Voices whose sources changed this frame
+  std::vector<std::uint16_t> m_dirty;
+  std::uint64_t m_command_stalls = 0;
+  std::uint64_t m_dropped_commands = 0;
+  Streamer m_streamer;
+  ImpulseLoader m_impulse_loader;
+  // Live buses by index
+  std::array<Bus *, MAX_BUSES> m_buses{};
+  std::uint32_t m_next_bus_id = 1;
+  std::vector<Bus *> m_dirty_buses;
+  bool m_graph_dirty = false;
+  std::shared_ptr<Bus> m_master;
+
+  SpscRing<Command, 4096> m_commands;
+  SpscRing<Event, 1024> m_events;
+
+  // Audio thread state
+  struct Voice {
+    // Both are null if the voice is free
+    const Sound *sound = nullptr;
+    Stream *stream = nullptr;
+    // In frames of the sound. For streams, relative to the start of the ring
+    double cursor = 0.0;
+    SourceParams params;
+    // Per output channel gains reached at the end of the last block. Gains are
+    // ramped across each block to avoid clicks
+    float gains[OUTPUT_CHANNELS] = {0.0f, 0.0f};
+    // Ambisonic coefficients reached at the end of the last block, if the
+    // voice is encoded into a bed
+    float encoding[MAX_AMBISONIC_CHANNELS] = {};
+    // Frame of the mixer's clock to start at
+    std::uint64_t start = 0;
+    bool stopping = false;
+    // Set if the voice resumes part way through its sound, so has to fade in.
+    // Starting from the top doesn't, so that attacks stay sharp
+    bool fade_in = false;
+    // Set once a stream has started producing audio
+    bool primed = false;
+    // Set if the VOICE_ENDED event couldn't be sent yet
+    bool end_pending = false;
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+    // Key press it's timed from, until its first sample is mixed
+    std::uint64_t input = 0;
+#endif
+
+    bool isActive() const { return sound || stream; }
+  };
+
+  void renderBlock() noexcept;
+  void processCommands() noexcept;
+  // Hands a graph back to the main thread, or keeps it until there's room
+  void retire(Graph *graph) noexcept;
+  // Mono voices are encoded into bed instead of out, if there is one
+  void mixVoice(std::uint16_t index, float *out, AmbisonicBed *bed,
+                std::size_t frames) noexcept;
+  // Starts the grains due this block, and mixes every grain playing
+  void mixGrains(Granulator &granulator, float *out,
+                 AmbisonicBed *bed) noexcept;
+  // Unit vector towards position in listener space, and how far away it is
+  glm::vec3 listenerDirection(glm::vec3 position, float &dist) const noexcept;
+  // How far a voice playing a sound moves through it per output frame
+  double soundStep(const Voice &voice) const noexcept;
+  // Interpolates frames from sound like the resample kernel, expanding it
+  // first if it's compressed. Every frame read must be before the end
+  void resampleFrames(const Sound &sound, float *out, double cursor,
+                      double step, std::size_t frames) noexcept;
+  // Resample a voice into out, and return how many frames were produced
+  std::size_t resampleSound(Voice &voice, float *out, std::size_t frames,
+                            bool &ended) noexcept;
+  std::size_t resampleStream(Voice &voice, float *out, std::size_t frames,
+                             bool &ended) noexcept;
+  void endVoice(std::uint16_t index) noexcept;
+
+  std::array<Voice, MAX_VOICES> m_voices;
+  // By slot. Null if not playing
+  std::array<Granulator *, MAX_EMITTERS> m_granulators{};
+  Listener m_audio_listener;
+  // Clock frame at the start of the block being mixed
+  std::uint64_t m_mixed = 0;
+  Graph *m_graph;
+  // Graphs that couldn't be sent back yet, linked through Graph::next_retired
+  Graph *m_retired = nullptr;
+  // Per bus, by index: the gain reached at the end of the last block, the gain
+  // to ramp to, and the ID of the bus they belong to
+  std::array<float, MAX_BUSES> m_bus_gains{};
+  std::array<float, MAX_BUSES> m_bus_targets{};
+  std::array<std::uint32_t, MAX_BUSES> m_bus_ids{};
+  // What each bus mixes in a block
+  alignas(16) float m_bus_out[MAX_BUSES][MAX_BLOCK * OUTPUT_CHANNELS];
+  const Kernels *m_kernels;
+  alignas(16) float m_scratch[MAX_BLOCK * OUTPUT_CHANNELS];
+  // Planar left then right output of the spatializer
+  alignas(16) float m_binaural[MAX_BLOCK * 2];
+  // The last rendered block, and how much of it the device has taken
+  alignas(16) float m_out[MAX_BLOCK * OUTPUT_CHANNELS];
+  std::size_t m_out_pos = 0;
+  // Frames peeked from a stream's ring. Enough for a block at the highest
+  // playback speed
+  alignas(16) float m_stream_in[(MAX_BLOCK * MAX_STREAM_STEP + 2) *
+                                OUTPUT_CHANNELS];
+  // Blocks of a compressed sound, expanded to be resampled
+  alignas(16) float m_expanded[MAX_BLOCK * OUTPUT_CHANNELS];
+  std::uint64_t m_last_callback_start = 0;
+
+  // Written by the audio thread
+  std::atomic<std::uint64_t> m_callbacks = 0;
+  std::atomic<std::uint64_t> m_underruns = 0;
+  std::atomic<std::uint64_t> m_stream_starvations = 0;
+  std::atomic<std::uint64_t> m_frames = 0;
+  std::atomic<std::uint64_t> m_last_ticks = 0;
+  std::atomic<std::uint64_t> m_max_ticks = 0;
+  std::atomic<std::uint64_t> m_total_ticks = 0;
+  std::atomic<unsigned> m_active_grains = 0;
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  // A record of every callback, drained into m_timings by update(). Left out
+  // of builds without instrumentation, so that render() doesn't pay for it
+  SpscRing<CallbackTiming, 1024> m_timing_ring;
+  SpscRing<InputLatency, 64> m_latency_ring;
+  std::atomic<std::uint64_t> m_dropped_timings = 0;
+  AudioTimings m_timings;
+  // Audio thread. Frames of the current callback before the block being mixed
+  std::size_t m_block_position = 0;
+  // Main thread. See setInputTime()
+  std::uint64_t m_input = 0;
+#endif
+
+  // Set before the device starts, then read-only
+  unsigned m_sample_rate = 0;
+  // 0 when rendering offline
+  std::uint64_t m_period_ticks = 0;
+  // Frames mixed at a time
+  std::size_t m_block = MAX_BLOCK;
+  // Null if SteamAudio couldn't be initialized
+  std::unique_ptr<Spatializer> m_spatializer;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+#include "audio/propagation.hpp"
+
+namespace lege::audio {
+
+static constexpr float UNREACHABLE = std::numeric_limits<float>::infinity();
+static constexpr std::uint32_t NO_PARENT = 0xffffffffu;
+// Cells further apart than this along either axis are treated as out of
+// sight of each other, so that building a field over a big open grid doesn't
+// trace long lines from every cell. Paths across open space then turn
+// slightly every so often, which makes them at most a few percent longer
+static constexpr int MAX_SIGHT = 32;
+
+PropagationGrid::PropagationGrid(unsigned width, unsigned depth,
+                                 float cell_size, glm::vec3 origin)
+    : m_width(width), m_depth(depth), m_cell_size(cell_size),
+      m_origin(origin), m_range(UNREACHABLE) {
+  if (width == 0 || depth == 0 || width > 4096 || depth > 4096) {
+    throw std::runtime_error(
+        "Propagation grids must be 1 to 4096 cells a side");
+  }
+  if (!(cell_size > 0.0f)) {
+    throw std::runtime_error("Propagation grid cells must have a size");
+  }
+  m_open.assign((std::size_t)width * depth, 1);
+}
+
+void PropagationGrid::setOpen(unsigned x, unsigned z, bool open) {
+  std::uint32_t cell = index(x, z);
+  if (m_open[cell] == open) {
+    return;
+  }
+  m_open[cell] = open;
+
+  // Only fields that reached the cell or one next to it can change: closing
+  // it can only lengthen paths through it, and opening it can only shorten
+  // paths into it from its neighbours
+  unsigned x0 = x > 0 ? x - 1 : x, x1 = std::min(x + 1, m_width - 1);
+  unsigned z0 = z > 0 ? z - 1 : z, z1 = std::min(z + 1, m_depth - 1);
+  for (auto it = m_fields.begin(); it != m_fields.end();) {
+    bool reached = false;
+    for (unsigned nz = z0; nz <= z1 && !reached; ++nz) {
+      for (unsigned nx = x0; nx <= x1 && !reached; ++nx) {
+        reached = it->second.distance[index(nx, nz)] != UNREACHABLE;
+      }
+    }
+    if (reached) {
+      it = m_fields.erase(it);
+      ++m_invalidations;
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::optional<PropagationPath> PropagationGrid::path(glm::vec3 source,
+                                                     glm::vec3 listener) {
+  auto from = cellAt(source);
+  auto to = cellAt(listener);
+  if (!from || !to) {
+    return std::nullopt;
+  }
+  const Field &f = field(*from);
+  std::uint32_t corner = f.parent[*to];
+  if (corner == NO_PARENT) {
+    return PropagationPath{UNREACHABLE, source};
+  }
+  if (corner == *from) {
+    // In sight, so sound travels straight from the source
+    return PropagationPath{glm::length(listener - source), source};
+  }
+  // Keep the source's height, so corners don't move sounds up or down
+  glm::vec3 apparent = centre(corner);
+  apparent.y = source.y;
+  return PropagationPath{f.distance[corner] + glm::length(listener - apparent),
+                         apparent};
+}
+
+void PropagationGrid::setRange(float range) {
+  m_range = range > 0.0f ? range : UNREACHABLE;
+  m_invalidations += m_fields.size();
+  m_fields.clear();
+}
+
+void PropagationGrid::setMaxFields(std::size_t fields) {
+  m_max_fields = std::max<std::size_t>(fields, 1);
+  evict(m_max_fields);
+}
+
+PropagationStats PropagationGrid::stats() const {
+  PropagationStats s;
+  s.builds = m_builds;
+  s.invalidations = m_invalidations;
+  s.cached = m_fields.size();
+  return s;
+}
+
+std::optional<std::uint32_t> PropagationGrid::cellAt(glm::vec3 point) const {
+  float x = std::floor((point.x - m_origin.x) / m_cell_size);
+  float z = std::floor((point.z - m_origin.z) / m_cell_size);
+  if (!(x >= 0.0f && x < (float)m_width && z >= 0.0f && z < (float)m_depth)) {
+    return std::nullopt;
+  }
+  std::uint32_t cell = index((unsigned)x, (unsigned)z);
+  if (!m_open[cell]) {
+    return std::nullopt;
+  }
+  return cell;
+}
+
+glm::vec3 PropagationGrid::centre(std::uint32_t cell) const {
+  return m_origin + glm::vec3((float)(cell % m_width) + 0.5f, 0.0f,
+                              (float)(cell / m_width) + 0.5f) *
+                        m_cell_size;
+}
+
+bool PropagationGrid::lineOfSight(std::uint32_t from, std::uint32_t to) const {
+  int x = (int)(from % m_width), z = (int)(from / m_width);
+  int dx = (int)(to % m_width) - x, dz = (int)(to / m_width) - z;
+  int nx = std::abs(dx), nz = std::abs(dz);
+  if (nx > MAX_SIGHT || nz > MAX_SIGHT) {
+    return false;
+  }
+  int sx = dx > 0 ? 1 : -1, sz = dz > 0 ? 1 : -1;
+  auto open = [&](int cx, int cz) {
+    return m_open[index((unsigned)cx, (unsigned)cz)];
+  };
+  // Steps through every cell the line touches, whichever edge it crosses
+  // next. Lines through a corner need both cells beside it to be open
+  for (int ix = 0, iz = 0; ix < nx || iz < nz;) {
+    long decision = (long)(1 + 2 * ix) * nz - (long)(1 + 2 * iz) * nx;
+    if (decision == 0) {
+      if (!open(x + sx, z) || !open(x, z + sz)) {
+        return false;
+      }
+      x += sx;
+      z += sz;
+      ++ix;
+      ++iz;
+    } else if (decision < 0) {
+      x += sx;
+      ++ix;
+    } else {
+      z += sz;
+      ++iz;
+    }
+    if (!open(x, z)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PropagationGrid::evict(std::size_t keep) {
+  while (m_fields.size() > keep) {
+    auto lru = std::min_element(
+        m_fields.begin(), m_fields.end(), [](const auto &a, const auto &b) {
+          return a.second.last_used < b.second.last_used;
+        });
+    m_fields.erase(lru);
+  }
+}
+
+const PropagationGrid::Field &PropagationGrid::field(std::uint32_t source) {
+  ++m_lookups;
+  auto it = m_fields.find(source);
+  if (it == m_fields.end()) {
+    evict(m_max_fields - 1);
+    it = m_fields.try_emplace(source).first;
+    build(it->second, source);
+    ++m_builds;
+  }
+  it->second.last_used = m_lookups;
+  return it->second;
+}
+
+void PropagationGrid::build(Field &field, std::uint32_t source) const {
+  // Dijkstra over the 8 neighbours of each cell, except that a path may skip
+  // straight from a cell to its neighbour's parent when it can see it (Lazy
+  // Theta*). Paths then only turn at corners, so their lengths are close to
+  // the true shortest distance rather than a staircase's, and each cell's
+  // parent is the corner a listener there hears the sound come around.
+  // Neighbours are assumed to see their parents when queued, and only
+  // checked once they come off the queue, so each cell costs one line of
+  // sight check rather than one per neighbour
+  const std::size_t cells = m_open.size();
+  field.distance.assign(cells, UNREACHABLE);
+  field.parent.assign(cells, NO_PARENT);
+  std::vector<bool> done(cells, false);
+  using Entry = std::pair<float, std::uint32_t>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+  field.distance[source] = 0.0f;
+  field.parent[source] = source;
+  queue.push({0.0f, source});
+
+  auto dist = [&](std::uint32_t a, std::uint32_t b) {
+    float dx = (float)(a % m_width) - (float)(b % m_width);
+    float dz = (float)(a / m_width) - (float)(b / m_width);
+    return std::sqrt(dx * dx + dz * dz) * m_cell_size;
+  };
+  // Calls f with each open neighbour of cell that can be reached without
+  // cutting a corner diagonally through a wall
+  auto neighbours = [&](std::uint32_t cell, auto &&f) {
+    unsigned x = cell % m_width, z = cell / m_width;
+    for (int dz = -1; dz <= 1; ++dz) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        unsigned nx = x + dx, nz = z + dz;
+        if ((dx == 0 && dz == 0) || nx >= m_width || nz >= m_depth ||
+            !m_open[index(nx, nz)]) {
+          continue;
+        }
+        if (dx != 0 && dz != 0 &&
+            (!m_open[index(nx, z)] || !m_open[index(x, nz)])) {
+          continue;
+        }
+        f(index(nx, nz));
+      }
+    }
+  };
+
+  while (!queue.empty() && queue.top().first <= m_range) {
+    std::uint32_t cell = queue.top().second;
+    queue.pop();
+    if (done[cell]) {
+      continue;
+    }
+    std::uint32_t parent = field.parent[cell];
+    if (parent != cell && !lineOfSight(parent, cell)) {
+      // Come from whichever finished neighbour is closest instead
+      field.distance[cell] = UNREACHABLE;
+      neighbours(cell, [&](std::uint32_t next) {
+        float d = field.distance[next] + dist(next, cell);
+        if (done[next] && d < field.distance[cell]) {
+          field.distance[cell] = d;
+          field.parent[cell] = next;
+        }
+      });
+    }
+    done[cell] = true;
+    parent = field.parent[cell];
+    neighbours(cell, [&](std::uint32_t next) {
+      float d = field.distance[parent] + dist(parent, next);
+      if (!done[next] && d < field.distance[next]) {
+        field.distance[next] = d;
+        field.parent[next] = parent;
+        queue.push({d, next});
+      }
+    });
+  }
+  // Anything left was out of range
+  for (std::size_t cell = 0; cell < cells; ++cell) {
+    if (!done[cell]) {
+      field.distance[cell] = UNREACHABLE;
+      field.parent[cell] = NO_PARENT;
+    }
+  }
+}
+
+} // namespace lege::audio
@@ -0,0 +1,104 @@
+#ifndef LIBLEGE_AUDIO_PROPAGATION_HPP
+#define LIBLEGE_AUDIO_PROPAGATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace lege::audio {
+
+// How sound gets from a source to a listener around walls
+struct PropagationPath {
+  // Length of the shortest path between them, or infinity if there isn't one
+  float distance;
+  // Where the sound seems to come from: the last corner the path turns
+  // before reaching the listener, or the source if it's in sight
+  glm::vec3 apparent;
+};
+
+struct PropagationStats {
+  // Flow fields computed, including ones computed again after being
+  // invalidated or evicted
+  std::uint64_t builds = 0;
+  std::uint64_t invalidations = 0;
+  std::size_t cached = 0;
+};
+
+// A grid of open and walled cells on the x-z plane, which sound travels
+// through around walls rather than straight through them. Paths are found
+// with flow fields: one Dijkstra search from each source's cell covering the
+// whole grid, cached so that every later lookup from that cell is a table
+// lookup. Opening or closing a cell only throws away the fields that could
+// have reached it. Main thread only
+class PropagationGrid {
+public:
+  // Every cell starts open. Cell (x, z) covers origin + (x, 0, z) *
+  // cell_size to one cell further along each axis
+  PropagationGrid(unsigned width, unsigned depth, float cell_size = 1.0f,
+                  glm::vec3 origin = {0.0f, 0.0f, 0.0f});
+
+  unsigned width() const { return m_width; }
+  unsigned depth() const { return m_depth; }
+  float cellSize() const { return m_cell_size; }
+  glm::vec3 origin() const { return m_origin; }
+
+  bool isOpen(unsigned x, unsigned z) const { return m_open[index(x, z)]; }
+  void setOpen(unsigned x, unsigned z, bool open);
+
+  // Nullopt if either point is off the grid or inside a wall, in which case
+  // sound should travel straight between them
+  std::optional<PropagationPath> path(glm::vec3 source, glm::vec3 listener);
+
+  // How far sound can travel along a path. Sources further away are
+  // treated as having no path, and fields stop there, so they only cost as
+  // much to build as the area in range. Unlimited by default, or if range
+  // isn't positive
+  void setRange(float range);
+  float range() const { return m_range; }
+
+  // Least recently used fields are evicted past this many
+  void setMaxFields(std::size_t fields);
+  std::size_t maxFields() const { return m_max_fields; }
+  PropagationStats stats() const;
+
+private:
+  // Distances from one source cell to every other, and for each cell, the
+  // cell its path back to the source first turns at
+  struct Field {
+    std::vector<float> distance;
+    std::vector<std::uint32_t> parent;
+    std::uint64_t last_used;
+  };
+
+  std::uint32_t index(unsigned x, unsigned z) const { return z * m_width + x; }
+  // Index of the open cell containing point, if there is one
+  std::optional<std::uint32_t> cellAt(glm::vec3 point) const;
+  glm::vec3 centre(std::uint32_t cell) const;
+  // Whether a straight line between the centres of two cells only passes
+  // through open cells
+  bool lineOfSight(std::uint32_t from, std::uint32_t to) const;
+  // Evicts least recently used fields until there are at most keep
+  void evict(std::size_t keep);
+  const Field &field(std::uint32_t source);
+  void build(Field &field, std::uint32_t source) const;
+
+  unsigned m_width;
+  unsigned m_depth;
+  float m_cell_size;
+  glm::vec3 m_origin;
+  std::vector<std::uint8_t> m_open;
+  float m_range;
+  std::unordered_map<std::uint32_t, Field> m_fields;
+  std::size_t m_max_fields = 64;
+  std::uint64_t m_lookups = 0;
+  std::uint64_t m_builds = 0;
+  std::uint64_t m_invalidations = 0;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LIBLEGE_AUDIO_RING_HPP
+#define LIBLEGE_AUDIO_RING_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+namespace lege::audio {
+
+// Avoid false sharing between the producer's and consumer's indices
+inline constexpr std::size_t CACHE_LINE = 64;
+
+// A bounded, lock-free, single-producer single-consumer ring buffer. Neither
+// end ever blocks or allocates, so it is safe to use from the audio thread.
+// N must be a power of 2
+template <class T, std::size_t N> class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+  // Producer only. Returns false if the ring is full
+  bool push(const T &val) {
+    std::size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    m_buf[head & (N - 1)] = val;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns nullopt if the ring is empty
+  std::optional<T> pop() {
+    std::size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire)) {
+      return {};
+    }
+    T val = m_buf[tail & (N - 1)];
+    m_tail.store(tail + 1, std::memory_order_release);
+    return val;
+  }
+
+  // Approximate when called from a thread other than the producer or consumer
+  std::size_t size() const {
+    return m_head.load(std::memory_order_acquire) -
+           m_tail.load(std::memory_order_acquire);
+  }
+
+  static constexpr std::size_t capacity() { return N; }
+
+private:
+  alignas(CACHE_LINE) std::atomic<std::size_t> m_head = 0;
+  alignas(CACHE_LINE) std::atomic<std::size_t> m_tail = 0;
+  alignas(CACHE_LINE) std::array<T, N> m_buf;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef LIBLEGE_AUDIO_SAMPLE_RING_HPP
+#define LIBLEGE_AUDIO_SAMPLE_RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+#include "audio/ring.hpp"
+
+namespace lege::audio {
+
+// A lock-free single-producer single-consumer ring of samples, for moving
+// blocks of PCM between threads. Like SpscRing, except the capacity is chosen
+// at runtime and samples are written and read in bulk. The capacity is rounded
+// up to a power of 2
+class SampleRing {
+public:
+  explicit SampleRing(std::size_t capacity)
+      : m_capacity(std::bit_ceil(capacity)),
+        m_buf(std::make_unique<float[]>(m_capacity)) {}
+
+  // No copy
+  SampleRing(const SampleRing &) = delete;
+  SampleRing &operator=(const SampleRing &) = delete;
+
+  std::size_t capacity() const { return m_capacity; }
+
+  // Producer only
+  std::size_t space() const {
+    return m_capacity - (m_head.load(std::memory_order_relaxed) -
+                         m_tail.load(std::memory_order_acquire));
+  }
+
+  // Producer only. Returns how many samples were written
+  std::size_t write(const float *src, std::size_t count) {
+    std::size_t head = m_head.load(std::memory_order_relaxed);
+    count = std::min(count, space());
+    std::size_t start = head & (m_capacity - 1);
+    std::size_t first = std::min(count, m_capacity - start);
+    std::memcpy(m_buf.get() + start, src, first * sizeof(float));
+    std::memcpy(m_buf.get(), src + first, (count - first) * sizeof(float));
+    m_head.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer only
+  std::size_t available() const {
+    return m_head.load(std::memory_order_acquire) -
+           m_tail.load(std::memory_order_relaxed);
+  }
+
+  // Consumer only. Copies up to count samples without consuming them, and
+  // returns how many were copied
+  std::size_t peek(float *dst, std::size_t count) const {
+    count = std::min(count, available());
+    std::size_t start =
+        m_tail.load(std::memory_order_relaxed) & (m_capacity - 1);
+    std::size_t first = std::min(count, m_capacity - start);
+    std::memcpy(dst, m_buf.get() + start, first * sizeof(float));
+    std::memcpy(dst + first, m_buf.get(), (count - first) * sizeof(float));
+    return count;
+  }
+
+  // Consumer only. count must not be more than available()
+  void consume(std::size_t count) {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + count,
+                 std::memory_order_release);
+  }
+
+private:
+  alignas(CACHE_LINE) std::atomic<std::size_t> m_head = 0;
+  alignas(CACHE_LINE) std::atomic<std::size_t> m_tail = 0;
+  alignas(CACHE_LINE) const std::size_t m_capacity;
+  std::unique_ptr<float[]> m_buf;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <SDL.h>
+#include <fmt/core.h>
+
+#define STB_VORBIS_HEADER_ONLY
+#include <stb_vorbis.c>
+
+#include "audio/sound.hpp"
+#include "sdl/error.hpp"
+
+namespace sdl = lege::sdl;
+
+namespace lege::audio {
+
+// Cooked sounds are little-endian, and their samples are copied as they are
+static_assert(std::endian::native == std::endian::little,
+              "Cooked sounds are only supported on little-endian platforms");
+
+static constexpr char COOKED_MAGIC[8] = {'L', 'E', 'G', 'E',
+                                         'S', 'N', 'D', '\x1a'};
+static constexpr std::uint32_t COOKED_VERSION = 1;
+
+// Followed by frames * channels floats
+struct CookedHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t channels;
+  std::uint32_t rate;
+  std::uint32_t reserved;
+  std::uint64_t frames;
+  std::uint64_t loop_start;
+  std::uint64_t loop_end;
+};
+static_assert(sizeof(CookedHeader) == 48);
+
+static std::shared_ptr<const Sound> decode_wav(const char *data,
+                                               std::size_t size,
+                                               const char *name) {
+  SDL_AudioSpec spec;
+  Uint8 *buf;
+  Uint32 len;
+  if (!SDL_LoadWAV_RW(SDL_RWFromConstMem(data, (int)size), 1, &spec, &buf,
+                      &len)) {
+    throw sdl::Error(fmt::format("Could not decode \"{}\"", name));
+  }
+  std::unique_ptr<Uint8[], void (*)(Uint8 *)> wav(buf, SDL_FreeWAV);
+
+  // Convert to float, downmixing anything with more than 2 channels. The
+  // sample rate is left alone, voices resample as they play
+  auto sound = std::make_shared<Sound>();
+  sound->channels = spec.channels > 2 ? 2 : spec.channels;
+  sound->rate = (unsigned)spec.freq;
+  SDL_AudioCVT cvt;
+  if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+                        AUDIO_F32SYS, (Uint8)sound->channels, spec.freq) < 0) {
+    throw sdl::Error(fmt::format("Could not convert \"{}\"", name));
+  }
+  std::vector<Uint8> converted((std::size_t)len * cvt.len_mult);
+  std::memcpy(converted.data(), wav.get(), len);
+  cvt.buf = converted.data();
+  cvt.len = (int)len;
+  if (SDL_ConvertAudio(&cvt) < 0) {
+    throw sdl::Error(fmt::format("Could not convert \"{}\"", name));
+  }
+  sound->samples.resize((std::size_t)cvt.len_cvt / sizeof(float));
+  std::memcpy(sound->samples.data(), converted.data(),
+              sound->samples.size() * sizeof(float));
+  return sound;
+}
+
+static std::shared_ptr<const Sound> decode_vorbis(const char *data,
+                                                  std::size_t size,
+                                                  const char *name) {
+  int error;
+  stb_vorbis *vorbis = stb_vorbis_open_memory(
+      (const unsigned char *)data, (int)size, &error, nullptr);
+  if (!vorbis) {
+    throw std::runtime_error(fmt::format(
+        "Could not decode \"{}\": invalid Ogg Vorbis file", name));
+  }
+  std::unique_ptr<stb_vorbis, void (*)(stb_vorbis *)> closer(
+      vorbis, stb_vorbis_close);
+
+  stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+  if (info.channels < 1 || info.channels > 2) {
+    throw std::runtime_error(fmt::format(
+        "Could not decode \"{}\": only mono and stereo files are supported",
+        name));
+  }
+  auto sound = std::make_shared<Sound>();
+  sound->channels = (unsigned)info.channels;
+  sound->rate = info.sample_rate;
+  sound->samples.resize((std::size_t)stb_vorbis_stream_length_in_samples(
+                            vorbis) *
+                        sound->channels);
+  int frames = stb_vorbis_get_samples_float_interleaved(
+      vorbis, info.channels, sound->samples.data(),
+      (int)sound->samples.size());
+  sound->samples.resize((std::size_t)frames * sound->channels);
+  return sound;
+}
+
+static std::shared_ptr<const Sound> decode_cooked(const char *data,
+                                                  std::size_t size,
+                                                  const char *name) {
+  CookedHeader hdr;
+  std::memcpy(&hdr, data, sizeof(hdr));
+  if (hdr.version != COOKED_VERSION || hdr.channels < 1 || hdr.channels > 2 ||
+      hdr.rate == 0 ||
+      (size - sizeof(hdr)) / sizeof(float) / hdr.channels != hdr.frames ||
+      (size - sizeof(hdr)) % (sizeof(float) * hdr.channels) != 0 ||
+      hdr.loop_end > hdr.frames ||
+      (hdr.loop_end && hdr.loop_start >= hdr.loop_end) ||
+      (!hdr.loop_end && hdr.loop_start)) {
+    throw std::runtime_error(
+        fmt::format("Could not decode \"{}\": invalid cooked sound", name));
+  }
+  auto sound = std::make_shared<Sound>();
+  sound->channels = hdr.channels;
+  sound->rate = hdr.rate;
+  sound->loop_start = (std::size_t)hdr.loop_start;
+  sound->loop_end = (std::size_t)hdr.loop_end;
+  sound->samples.resize((std::size_t)hdr.frames * hdr.channels);
+  std::memcpy(sound->samples.data(), data + sizeof(hdr),
+              sound->samples.size() * sizeof(float));
+  return sound;
+}
+
+std::shared_ptr<const Sound> decode(const char *data, std::size_t size,
+                                    const char *name) {
+  if (size >= sizeof(CookedHeader) &&
+      std::memcmp(data, COOKED_MAGIC, sizeof(COOKED_MAGIC)) == 0) {
+    return decode_cooked(data, size, name);
+  }
+  if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 &&
+      std::memcmp(data + 8, "WAVE", 4) == 0) {
+    return decode_wav(data, size, name);
+  }
+  if (size >= 4 && std::memcmp(data, "OggS", 4) == 0) {
+    return decode_vorbis(data, size, name);
+  }
+  throw std::runtime_error(
+      fmt::format("Could not decode \"{}\": unsupported format", name));
+}
+
+std::string encode_cooked(const Sound &sound) {
+  CookedHeader hdr{};
+  std::memcpy(hdr.magic, COOKED_MAGIC, sizeof(COOKED_MAGIC));
+  hdr.version = COOKED_VERSION;
+  hdr.channels = sound.channels;
+  hdr.rate = sound.rate;
+  hdr.frames = sound.frames();
+  hdr.loop_start = sound.loop_start;
+  hdr.loop_end = sound.loop_end;
+  std::string out((const char *)&hdr, sizeof(hdr));
+  out.append((const char *)sound.samples.data(),
+             sound.samples.size() * sizeof(float));
+  return out;
+}
+
+std::shared_ptr<const Sound> compress(const Sound &sound) {
+  auto out = std::make_shared<Sound>();
+  out->channels = sound.channels;
+  out->rate = sound.rate;
+  out->loop_start = sound.loop_start;
+  out->loop_end = sound.loop_end;
+  out->compressed_frames = sound.frames();
+  const std::size_t samples = sound.samples.size();
+  const std::size_t blocks =
+      (samples + COMPRESSED_BLOCK - 1) / COMPRESSED_BLOCK;
+  out->codes.resize(blocks * COMPRESSED_BLOCK);
+  out->scales.resize(blocks);
+  for (std::size_t b = 0; b < blocks; ++b) {
+    const float *in = sound.samples.data() + b * COMPRESSED_BLOCK;
+    const std::size_t n =
+        std::min(COMPRESSED_BLOCK, samples - b * COMPRESSED_BLOCK);
+    // The loudest sample in each block gets the whole range. NaNs are
+    // ignored, and infinities clamped to 1
+    float peak = 0.0f;
+    for (std::size_t i = 0; i < n; ++i) {
+      float a = std::abs(in[i]);
+      peak = a > peak ? a : peak;
+    }
+    if (std::isinf(peak)) {
+      peak = 1.0f;
+    }
+    const float scale = peak / 127.0f;
+    out->scales[b] = scale;
+    if (scale == 0.0f) {
+      continue;
+    }
+    std::int8_t *codes = out->codes.data() + b * COMPRESSED_BLOCK;
+    for (std::size_t i = 0; i < n; ++i) {
+      float code = std::clamp(in[i] / scale, -127.0f, 127.0f);
+      codes[i] = std::isnan(code) ? 0 : (std::int8_t)std::lrint(code);
+    }
+  }
+  return out;
+}
+
+} // namespace lege::audio
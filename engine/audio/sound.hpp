@@ -0,0 +1,80 @@
+#ifndef LIBLEGE_AUDIO_SOUND_HPP
+#define LIBLEGE_AUDIO_SOUND_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lege::audio {
+
+// Interleaved samples of a compressed sound that share a scale
+inline constexpr std::size_t COMPRESSED_BLOCK = 64;
+
+// Decoded audio with 1 or 2 channels, either as PCM (interleaved 32-bit
+// floats) or compressed. Sounds are immutable once decoded, so any number of
+// voices can share one without synchronization
+struct Sound {
+  // Empty if compressed
+  std::vector<float> samples;
+  unsigned channels = 0;
+  unsigned rate = 0;
+  // In frames. Looping sounds jump back to loop_start when they reach
+  // loop_end, or the end of the sound if loop_end is 0
+  std::size_t loop_start = 0;
+  std::size_t loop_end = 0;
+  // A compressed sound keeps each sample as a signed byte, times a scale
+  // shared by each COMPRESSED_BLOCK samples: about a quarter of the size of
+  // PCM, with roughly 8 bits of precision relative to the loudest sample
+  // nearby. The mixer expands it a block at a time as it plays. Padded with
+  // silence to a whole block
+  std::vector<std::int8_t> codes;
+  std::vector<float> scales;
+  std::size_t compressed_frames = 0;
+  // How many times the sound has been played, as a hint for the sound cache.
+  // Main thread only
+  mutable std::uint32_t plays = 0;
+
+  bool isCompressed() const { return !codes.empty(); }
+  std::size_t frames() const {
+    return isCompressed() ? compressed_frames : samples.size() / channels;
+  }
+  std::size_t bytes() const {
+    return samples.size() * sizeof(float) + codes.size() +
+           scales.size() * sizeof(float);
+  }
+  std::size_t loopEnd() const { return loop_end ? loop_end : frames(); }
+  // Brings a cursor that has reached the loop end back into the loop
+  double wrap(double cursor) const {
+    return (double)loop_start +
+           std::fmod(cursor - (double)loop_start,
+                     (double)(loopEnd() - loop_start));
+  }
+  // In seconds
+  double duration() const { return rate ? (double)frames() / rate : 0.0; }
+  // A sample by its index in the interleaved samples, compressed or not
+  float sample(std::size_t index) const {
+    return isCompressed()
+               ? (float)codes[index] * scales[index / COMPRESSED_BLOCK]
+               : samples[index];
+  }
+};
+
+// Decode a whole file that has been loaded into memory. The format is detected
+// from its contents. Throws if it can't be decoded
+std::shared_ptr<const Sound> decode(const char *data, std::size_t size,
+                                    const char *name);
+
+// A PCM sound in the engine's own format, which decode() reads back without
+// any conversion: a header with the sound's rate and loop points, followed by
+// its samples as they are in memory
+std::string encode_cooked(const Sound &sound);
+
+// A compressed copy of a PCM sound
+std::shared_ptr<const Sound> compress(const Sound &sound);
+
+} // namespace lege::audio
+
+#endif
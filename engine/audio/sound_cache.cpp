@@ -0,0 +1,93 @@
+#include <exception>
+
+#include "audio/sound_cache.hpp"
+
+namespace lege::audio {
+
+// Uses of a compressed sound, by loads and plays, before it's promoted to PCM
+static constexpr std::uint32_t HOT_USES = 16;
+
+std::shared_ptr<const Sound> SoundCache::get(const std::string &path,
+                                             const LoadFunc &load) {
+  if (auto it = m_entries.find(path); it != m_entries.end()) {
+    ++m_hits;
+    Entry &entry = it->second;
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+    ++entry.hits;
+    if (entry.sound->isCompressed() && entry.promotable &&
+        entry.hits + entry.sound->plays >= HOT_USES) {
+      promote(entry, path, load);
+    }
+    return entry.sound;
+  }
+
+  ++m_misses;
+  auto sound = load(path.c_str());
+  if (!sound->isCompressed() && sound->duration() >= m_pcm_seconds) {
+    sound = compress(*sound);
+  }
+  // Make room first, so we never evict what we just loaded
+  trim(m_budget > sound->bytes() ? m_budget - sound->bytes() : 0);
+  auto [it, inserted] = m_entries.try_emplace(path, Entry{sound, {}});
+  m_lru.push_front(&*it);
+  it->second.lru = m_lru.begin();
+  m_resident += sound->bytes();
+  return sound;
+}
+
+void SoundCache::promote(Entry &entry, const std::string &path,
+                         const LoadFunc &load) {
+  std::shared_ptr<const Sound> sound;
+  try {
+    sound = load(path.c_str());
+  } catch (const std::exception &) {
+    entry.promotable = false;
+    return;
+  }
+  // Holding on to the compressed sound means trimming can't evict it
+  auto old = entry.sound;
+  std::size_t grown =
+      sound->bytes() > old->bytes() ? sound->bytes() - old->bytes() : 0;
+  trim(m_budget > grown ? m_budget - grown : 0);
+  m_resident = m_resident - old->bytes() + sound->bytes();
+  entry.sound = std::move(sound);
+  ++m_promotions;
+}
+
+void SoundCache::setBudget(std::size_t budget) {
+  m_budget = budget;
+  trim(budget);
+}
+
+void SoundCache::clear() { trim(0); }
+
+void SoundCache::trim(std::size_t budget) {
+  for (auto it = m_lru.end(); it != m_lru.begin() && m_resident > budget;) {
+    --it;
+    Node *node = *it;
+    if (node->second.sound.use_count() > 1) {
+      continue; // Still playing or held by Lua
+    }
+    m_resident -= node->second.sound->bytes();
+    ++m_evictions;
+    it = m_lru.erase(it);
+    m_entries.erase(node->first);
+  }
+}
+
+SoundCacheStats SoundCache::stats() const {
+  SoundCacheStats s;
+  s.hits = m_hits;
+  s.misses = m_misses;
+  s.evictions = m_evictions;
+  s.promotions = m_promotions;
+  s.entries = m_entries.size();
+  for (const auto &[path, entry] : m_entries) {
+    s.compressed += entry.sound->isCompressed();
+  }
+  s.resident_bytes = m_resident;
+  s.budget = m_budget;
+  return s;
+}
+
+} // namespace lege::audio
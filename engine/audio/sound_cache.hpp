@@ -0,0 +1,96 @@
+#ifndef LIBLEGE_AUDIO_SOUND_CACHE_HPP
+#define LIBLEGE_AUDIO_SOUND_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "audio/sound.hpp"
+
+namespace lege::audio {
+
+struct SoundCacheStats {
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+  std::uint64_t evictions = 0;
+  // Compressed sounds reloaded as PCM for being played often
+  std::uint64_t promotions = 0;
+  std::size_t entries = 0;
+  // Entries held compressed
+  std::size_t compressed = 0;
+  // Bytes of audio held by the cache, whether or not anything else uses it
+  std::size_t resident_bytes = 0;
+  std::size_t budget = 0;
+};
+
+// Decoded sounds by asset path, so each file is only decoded once however
+// often it's played. Sounds are shared immutably, and reference counted by
+// their shared_ptrs. When the cache grows past its budget, the least recently
+// used sounds that nothing else holds are dropped. Sounds still in use are
+// never dropped, so the budget can be exceeded while they are.
+//
+// Sounds at least pcmSeconds() long are compressed when loaded, as the bulk
+// of a big library is in its longer sounds, and short ones are played the
+// most. Compression is lossy, so pcmSeconds() is infinite unless it's set. A
+// compressed sound that turns out to be played often is loaded again as PCM
+// when it's next asked for, to save the mixer expanding it every time.
+//
+// Main thread only
+class SoundCache {
+public:
+  using LoadFunc = std::function<std::shared_ptr<const Sound>(const char *)>;
+
+  explicit SoundCache(std::size_t budget) : m_budget(budget) {}
+
+  // Returns the cached sound, or calls load and caches its result. Exceptions
+  // from load are passed on, and nothing is cached
+  std::shared_ptr<const Sound> get(const std::string &path,
+                                   const LoadFunc &load);
+
+  std::size_t budget() const { return m_budget; }
+  // Evicts immediately if the cache is now over budget
+  void setBudget(std::size_t budget);
+  // Drops every sound that nothing else holds
+  void clear();
+
+  double pcmSeconds() const { return m_pcm_seconds; }
+  // Only affects sounds loaded after. Infinity keeps everything as PCM
+  void setPcmSeconds(double seconds) { m_pcm_seconds = seconds; }
+
+  SoundCacheStats stats() const;
+
+private:
+  void trim(std::size_t budget);
+
+  struct Entry;
+  // Map nodes never move, so the LRU list can point at them
+  using Node = std::pair<const std::string, Entry>;
+  struct Entry {
+    std::shared_ptr<const Sound> sound;
+    // Position in m_lru
+    std::list<Node *>::iterator lru;
+    std::uint32_t hits = 0;
+    // Cleared if loading it again as PCM failed, so that isn't tried on
+    // every hit
+    bool promotable = true;
+  };
+  // Reloads a compressed entry as PCM. Keeps it compressed if that fails
+  void promote(Entry &entry, const std::string &path, const LoadFunc &load);
+
+  std::unordered_map<std::string, Entry> m_entries;
+  // Most recently used at the front
+  std::list<Node *> m_lru;
+  std::size_t m_budget;
+  std::size_t m_resident = 0;
+  double m_pcm_seconds = std::numeric_limits<double>::infinity();
+  std::uint64_t m_hits = 0, m_misses = 0, m_evictions = 0, m_promotions = 0;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "audio/spatializer.hpp"
+
+namespace lege::audio {
+
+static void check(IPLerror err, const char *what) {
+  if (err != IPL_STATUS_SUCCESS) {
+    throw std::runtime_error(
+        fmt::format("Could not {}: SteamAudio error {}", what, (int)err));
+  }
+}
+
+Spatializer::Spatializer(unsigned sample_rate, std::size_t frame_size,
+                         unsigned voices)
+    : m_frame_size(frame_size) {
+  try {
+    IPLContextSettings context_settings{};
+    context_settings.version = STEAMAUDIO_VERSION;
+    check(iplContextCreate(&context_settings, &m_context),
+          "create SteamAudio context");
+
+    IPLAudioSettings audio_settings{(IPLint32)sample_rate,
+                                    (IPLint32)frame_size};
+    IPLHRTFSettings hrtf_settings{};
+    hrtf_settings.type = IPL_HRTFTYPE_DEFAULT;
+    hrtf_settings.volume = 1.0f;
+    check(iplHRTFCreate(m_context, &audio_settings, &hrtf_settings, &m_hrtf),
+          "load HRTF");
+
+    IPLBinauralEffectSettings effect_settings{m_hrtf};
+    m_effects.resize(voices);
+    for (auto &effect : m_effects) {
+      check(iplBinauralEffectCreate(m_context, &audio_settings,
+                                    &effect_settings, &effect),
+            "create binaural effect");
+    }
+  } catch (...) {
+    release();
+    throw;
+  }
+}
+
+Spatializer::~Spatializer() { release(); }
+
+void Spatializer::release() {
+  for (auto &effect : m_effects) {
+    if (effect) {
+      iplBinauralEffectRelease(&effect);
+    }
+  }
+  m_effects.clear();
+  if (m_hrtf) {
+    iplHRTFRelease(&m_hrtf);
+  }
+  if (m_context) {
+    iplContextRelease(&m_context);
+  }
+}
+
+void Spatializer::reset(unsigned voice) noexcept {
+  iplBinauralEffectReset(m_effects[voice]);
+}
+
+void Spatializer::apply(unsigned voice, const float *in, glm::vec3 direction,
+                        float blend, float *left, float *right) noexcept {
+  // SteamAudio doesn't modify its input, it just isn't const-correct
+  float *in_channels[] = {const_cast<float *>(in)};
+  float *out_channels[] = {left, right};
+  IPLAudioBuffer in_buf{1, (IPLint32)m_frame_size, in_channels};
+  IPLAudioBuffer out_buf{2, (IPLint32)m_frame_size, out_channels};
+
+  IPLBinauralEffectParams params{};
+  params.direction = {direction.x, direction.y, direction.z};
+  // Sources move, so interpolating avoids audible steps between HRTF samples
+  params.interpolation = IPL_HRTFINTERPOLATION_BILINEAR;
+  params.spatialBlend = blend;
+  params.hrtf = m_hrtf;
+  iplBinauralEffectApply(m_effects[voice], &params, &in_buf, &out_buf);
+}
+
+} // namespace lege::audio
@@ -0,0 +1,50 @@
+#ifndef LIBLEGE_AUDIO_SPATIALIZER_HPP
+#define LIBLEGE_AUDIO_SPATIALIZER_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <phonon.h>
+
+namespace lege::audio {
+
+// Renders mono voices binaurally through SteamAudio's HRTF. Each voice has its
+// own binaural effect, created up front so the audio thread never allocates
+class Spatializer {
+public:
+  // Throws if SteamAudio can't be initialized
+  Spatializer(unsigned sample_rate, std::size_t frame_size, unsigned voices);
+  ~Spatializer();
+
+  // No copy
+  Spatializer(const Spatializer &) = delete;
+  Spatializer &operator=(const Spatializer &) = delete;
+
+  std::size_t frameSize() const { return m_frame_size; }
+  // For other effects rendered with the same HRTF. Retain them to keep them
+  // past the spatializer
+  IPLContext context() const { return m_context; }
+  IPLHRTF hrtf() const { return m_hrtf; }
+
+  // Audio thread. Clears a voice's filter history when it starts a new sound
+  void reset(unsigned voice) noexcept;
+
+  // Audio thread. Renders frameSize() samples of in to left and right, heard
+  // from direction in listener space (+x right, +y up, -z ahead). blend fades
+  // between unspatialized (0) and fully spatialized (1)
+  void apply(unsigned voice, const float *in, glm::vec3 direction, float blend,
+             float *left, float *right) noexcept;
+
+private:
+  void release();
+
+  std::size_t m_frame_size;
+  IPLContext m_context = nullptr;
+  IPLHRTF m_hrtf = nullptr;
+  std::vector<IPLBinauralEffect> m_effects;
+};
+
+} // namespace lege::audio
+
+#endif
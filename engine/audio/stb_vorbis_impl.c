@@ -0,0 +1,3 @@
+// Compiles stb_vorbis once. Everything else includes it with
+// STB_VORBIS_HEADER_ONLY defined
+#include <stb_vorbis.c>
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iterator>
+
+#include <SDL.h>
+
+#include "audio/stream.hpp"
+
+namespace lege::audio {
+
+// How often idle streams are checked for room in their rings
+static constexpr std::chrono::milliseconds IDLE_WAIT{5};
+
+bool Stream::service(float *scratch) {
+  State state = m_state.load(std::memory_order_relaxed);
+  if (state == FINISHED || state == FAILED) {
+    return false;
+  }
+  try {
+    if (state == OPENING) {
+      m_decoder = m_open();
+      m_channels = m_decoder->channels();
+      m_rate = m_decoder->rate();
+      std::size_t frames = std::max((std::size_t)(m_rate * BUFFER_SECONDS),
+                                    CHUNK_FRAMES * 2);
+      m_ring = std::make_unique<SampleRing>(frames * m_channels);
+      // Publishes the ring to the audio thread
+      m_state.store(DECODING, std::memory_order_release);
+    }
+
+    if (m_ring->space() < CHUNK_FRAMES * m_channels) {
+      return false;
+    }
+    std::size_t frames = m_decoder->read(scratch, CHUNK_FRAMES);
+    if (m_looping.load(std::memory_order_relaxed)) {
+      // Keeps wrapping around until the chunk is full, as a file may be
+      // shorter than one. A file with no frames at all ends the stream
+      while (frames < CHUNK_FRAMES) {
+        m_decoder->rewind();
+        std::size_t read = m_decoder->read(scratch + frames * m_channels,
+                                           CHUNK_FRAMES - frames);
+        if (read == 0) {
+          break;
+        }
+        frames += read;
+      }
+    }
+    m_ring->write(scratch, frames * m_channels);
+    if (frames < CHUNK_FRAMES) {
+      m_state.store(FINISHED, std::memory_order_release);
+    }
+  } catch (const std::exception &e) {
+    SDL_LogError(SDL_LOG_CATEGORY_AUDIO, "Could not stream audio: %s",
+                 e.what());
+    m_state.store(FAILED, std::memory_order_release);
+  }
+  return true;
+}
+
+Streamer::~Streamer() { stop(); }
+
+void Streamer::add(std::shared_ptr<Stream> stream) {
+  {
+    std::lock_guard lock(m_mutex);
+    m_added.push_back(std::move(stream));
+  }
+  if (!m_thread.joinable()) {
+    m_thread = std::jthread([this](std::stop_token stop) { run(stop); });
+  }
+  m_cond.notify_one();
+}
+
+void Streamer::stop() {
+  if (m_thread.joinable()) {
+    m_thread.request_stop();
+    m_cond.notify_all();
+    m_thread.join();
+  }
+  m_added.clear();
+}
+
+void Streamer::run(std::stop_token stop) {
+  std::vector<std::shared_ptr<Stream>> streams;
+  auto scratch = std::make_unique<float[]>(Stream::CHUNK_FRAMES * 2);
+  while (!stop.stop_requested()) {
+    {
+      std::unique_lock lock(m_mutex);
+      std::move(m_added.begin(), m_added.end(), std::back_inserter(streams));
+      m_added.clear();
+    }
+    // Only we hold streams that stopped playing, so they can be closed
+    std::erase_if(streams, [](const auto &s) { return s.use_count() == 1; });
+
+    bool busy = false;
+    for (const auto &stream : streams) {
+      busy |= stream->service(scratch.get());
+    }
+    if (!busy) {
+      std::unique_lock lock(m_mutex);
+      m_cond.wait_for(lock, stop, IDLE_WAIT,
+                      [this] { return !m_added.empty(); });
+    }
+  }
+}
+
+} // namespace lege::audio
@@ -0,0 +1,100 @@
+#ifndef LIBLEGE_AUDIO_STREAM_HPP
+#define LIBLEGE_AUDIO_STREAM_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "audio/decoder.hpp"
+#include "audio/sample_ring.hpp"
+
+namespace lege::audio {
+
+// Opens the file to stream. Called on the streaming thread, so it may block
+using DecoderFactory = std::function<std::unique_ptr<Decoder>()>;
+
+// One playback of a streamed file. The streaming thread decodes it a chunk at
+// a time into a ring, which the audio thread plays from, so only a fraction of
+// a second of it is ever decoded at once
+class Stream {
+public:
+  enum State : std::uint8_t {
+    // The file hasn't been opened yet
+    OPENING,
+    DECODING,
+    // Everything has been decoded, and only the ring is left to play
+    FINISHED,
+    // The file couldn't be opened or decoded
+    FAILED,
+  };
+
+  // Frames decoded at a time
+  static constexpr std::size_t CHUNK_FRAMES = 4096;
+  // How far ahead of the audio thread the decoder tries to stay
+  static constexpr double BUFFER_SECONDS = 0.5;
+
+  Stream(DecoderFactory open, bool looping)
+      : m_open(std::move(open)), m_looping(looping) {}
+
+  // Main thread
+  void setLooping(bool looping) {
+    m_looping.store(looping, std::memory_order_relaxed);
+  }
+
+  // Once this is DECODING or FINISHED, channels(), rate() and ring() are
+  // usable from the audio thread
+  State state() const { return m_state.load(std::memory_order_acquire); }
+  unsigned channels() const { return m_channels; }
+  unsigned rate() const { return m_rate; }
+  SampleRing &ring() { return *m_ring; }
+
+private:
+  friend class Streamer;
+
+  // Streaming thread. Returns true if there was anything to do
+  bool service(float *scratch);
+
+  DecoderFactory m_open;
+  std::unique_ptr<Decoder> m_decoder;
+  std::unique_ptr<SampleRing> m_ring;
+  unsigned m_channels = 0;
+  unsigned m_rate = 0;
+  std::atomic<bool> m_looping;
+  std::atomic<State> m_state = OPENING;
+};
+
+// Owns the thread that opens and decodes streams. Streams are dropped once
+// nothing else holds them
+class Streamer {
+public:
+  Streamer() = default;
+  ~Streamer();
+
+  // No copy
+  Streamer(const Streamer &) = delete;
+  Streamer &operator=(const Streamer &) = delete;
+
+  // Starts the thread on first use
+  void add(std::shared_ptr<Stream> stream);
+  // Joins the thread. Streams that are still playing stop getting new audio
+  void stop();
+
+private:
+  void run(std::stop_token stop);
+
+  std::mutex m_mutex;
+  std::condition_variable_any m_cond;
+  std::vector<std::shared_ptr<Stream>> m_added;
+  // Must be last, so the thread is joined before the queue is destroyed
+  std::jthread m_thread;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include <SDL.h>
+#include <fmt/core.h>
+
+#include "audio/timings.hpp"
+
+namespace lege::audio {
+
+// Upper bounds of the first histogram buckets, in milliseconds. Latencies
+// are much longer than callbacks
+static constexpr double FIRST_BUCKET_MS = 0.125;
+static constexpr double FIRST_LATENCY_BUCKET_MS = 1.0;
+static constexpr std::size_t BUCKETS = 10;
+// Width of the longest bar in a report
+static constexpr std::size_t BAR_WIDTH = 40;
+
+RollingHistogram::RollingHistogram(std::size_t window) : m_window(window) {
+  m_values.reserve(window);
+}
+
+void RollingHistogram::add(double value) {
+  if (m_values.size() < m_window) {
+    m_values.push_back(value);
+  } else {
+    m_values[m_next] = value;
+    m_next = (m_next + 1) % m_window;
+  }
+}
+
+void RollingHistogram::clear() {
+  m_values.clear();
+  m_next = 0;
+}
+
+double RollingHistogram::percentile(double p) const {
+  if (m_values.empty()) {
+    return 0.0;
+  }
+  std::vector<double> sorted = m_values;
+  auto rank = (std::size_t)std::ceil(std::clamp(p, 0.0, 1.0) *
+                                     (double)sorted.size());
+  auto nth = sorted.begin() + (std::ptrdiff_t)(rank ? rank - 1 : 0);
+  std::nth_element(sorted.begin(), nth, sorted.end());
+  return *nth;
+}
+
+double RollingHistogram::max() const {
+  if (m_values.empty()) {
+    return 0.0;
+  }
+  return *std::max_element(m_values.begin(), m_values.end());
+}
+
+std::vector<std::size_t> RollingHistogram::buckets(double first,
+                                                   std::size_t count) const {
+  std::vector<std::size_t> counts(count + 1, 0);
+  for (double value : m_values) {
+    std::size_t i = 0;
+    for (double bound = first; i < count && value >= bound; bound *= 2.0) {
+      ++i;
+    }
+    ++counts[i];
+  }
+  return counts;
+}
+
+AudioTimings::AudioTimings()
+    : m_tick_seconds(1.0 / (double)SDL_GetPerformanceFrequency()) {
+  m_underruns.reserve(TIMING_WINDOW);
+}
+
+void AudioTimings::add(const CallbackTiming &timing) {
+  m_callback_time.add((double)timing.ticks * m_tick_seconds);
+  if (timing.interval) {
+    m_interval.add((double)timing.interval * m_tick_seconds);
+  }
+  m_buffered.add((double)timing.buffered);
+  m_commands.add((double)timing.commands);
+  if (m_underruns.size() < TIMING_WINDOW) {
+    m_underruns.push_back(timing.underrun);
+  } else {
+    m_underruns[m_next_underrun] = timing.underrun;
+    m_next_underrun = (m_next_underrun + 1) % TIMING_WINDOW;
+  }
+  ++m_total;
+}
+
+void AudioTimings::addLatency(const InputLatency &latency,
+                              unsigned sample_rate) {
+  // Key presses are only timed to the millisecond, so one may seem to come
+  // after a callback that started just after it
+  double ticks = latency.callback > latency.input
+                     ? (double)(latency.callback - latency.input)
+                     : 0.0;
+  m_latency.add(ticks * m_tick_seconds +
+                (double)latency.position / sample_rate);
+}
+
+void AudioTimings::clear() {
+  m_callback_time.clear();
+  m_interval.clear();
+  m_buffered.clear();
+  m_commands.clear();
+  m_latency.clear();
+  m_underruns.clear();
+  m_next_underrun = 0;
+  m_total = 0;
+}
+
+std::size_t AudioTimings::underruns() const {
+  return (std::size_t)std::count(m_underruns.begin(), m_underruns.end(),
+                                 true);
+}
+
+static void append_row(std::string &out, const char *name,
+                       const RollingHistogram &h, double scale) {
+  fmt::format_to(std::back_inserter(out),
+                 "{:<16}{:>10.3f}{:>10.3f}{:>10.3f}\n", name,
+                 h.percentile(0.5) * scale, h.percentile(0.99) * scale,
+                 h.max() * scale);
+}
+
+static void append_histogram(std::string &out, const char *name,
+                             const RollingHistogram &h, double first_ms) {
+  std::vector<std::size_t> counts = h.buckets(first_ms / 1000.0, BUCKETS);
+  std::size_t most = *std::max_element(counts.begin(), counts.end());
+  fmt::format_to(std::back_inserter(out), "\n{} (ms):\n", name);
+  double bound = first_ms;
+  for (std::size_t i = 0; i < counts.size(); ++i, bound *= 2.0) {
+    std::size_t bar = most ? (counts[i] * BAR_WIDTH + most - 1) / most : 0;
+    if (i < BUCKETS) {
+      fmt::format_to(std::back_inserter(out), "  < {:<8g}", bound);
+    } else {
+      fmt::format_to(std::back_inserter(out), "  >= {:<7g}", bound / 2.0);
+    }
+    fmt::format_to(std::back_inserter(out), "{:#<{}} {}\n", "", bar,
+                   counts[i]);
+  }
+}
+
+std::string AudioTimings::report(std::uint64_t dropped) const {
+  std::string out = fmt::format(
+      "Audio callbacks: {} in window, {} recorded, {} underruns in window, "
+      "{} records dropped\n\n",
+      m_callback_time.count(), m_total, underruns(), dropped);
+  fmt::format_to(std::back_inserter(out), "{:<16}{:>10}{:>10}{:>10}\n", "",
+                 "p50", "p99", "max");
+  append_row(out, "callback (ms)", m_callback_time, 1000.0);
+  append_row(out, "interval (ms)", m_interval, 1000.0);
+  append_row(out, "buffered frames", m_buffered, 1.0);
+  append_row(out, "commands", m_commands, 1.0);
+  append_row(out, "latency (ms)", m_latency, 1000.0);
+  append_histogram(out, "Callback time", m_callback_time, FIRST_BUCKET_MS);
+  append_histogram(out, "Interval", m_interval, FIRST_BUCKET_MS);
+  if (m_latency.count()) {
+    append_histogram(out, "Key press to audio", m_latency,
+                     FIRST_LATENCY_BUCKET_MS);
+  }
+  return out;
+}
+
+} // namespace lege::audio
@@ -0,0 +1,110 @@
+#ifndef LIBLEGE_AUDIO_TIMINGS_HPP
+#define LIBLEGE_AUDIO_TIMINGS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lege::audio {
+
+// Callbacks the rolling histograms cover, about 40s at 48kHz in blocks of 512
+inline constexpr std::size_t TIMING_WINDOW = 4096;
+
+// What the audio thread records about one callback, when built with
+// LEGE_AUDIO_INSTRUMENTATION
+struct CallbackTiming {
+  // In ticks of SDL's performance counter. interval is since the previous
+  // callback started, or 0 for the first
+  std::uint64_t ticks;
+  std::uint64_t interval;
+  // Frames the device asked for
+  std::uint32_t frames;
+  // Frames mixed ahead and kept for the next callback
+  std::uint32_t buffered;
+  // Commands waiting for the audio thread when the callback started
+  std::uint32_t commands;
+  bool underrun;
+};
+
+// A sound started in the same frame as a key press, reaching the device.
+// Recorded for the first such sound only
+struct InputLatency {
+  // SDL's performance counter when the key was pressed
+  std::uint64_t input;
+  // And when the callback that mixed the sound's first sample started
+  std::uint64_t callback;
+  // Frames ahead of that sample in the callback's buffer
+  std::uint32_t position;
+};
+
+// The most recent values of one measurement, for percentiles and a
+// histogram of them
+class RollingHistogram {
+public:
+  explicit RollingHistogram(std::size_t window = TIMING_WINDOW);
+
+  // Replaces the oldest value once the window is full
+  void add(double value);
+  void clear();
+
+  // p in [0, 1], nearest rank. 0 if there are no values
+  double percentile(double p) const;
+  double max() const;
+  std::size_t count() const { return m_values.size(); }
+
+  // Values counted into buckets whose upper bounds double from first, with a
+  // last bucket for everything above
+  std::vector<std::size_t> buckets(double first, std::size_t count) const;
+
+private:
+  std::vector<double> m_values;
+  std::size_t m_window;
+  std::size_t m_next = 0;
+};
+
+// Histograms of the callback timings recorded by the audio thread. Only
+// touched by the main thread
+class AudioTimings {
+public:
+  AudioTimings();
+
+  void add(const CallbackTiming &timing);
+  void addLatency(const InputLatency &latency, unsigned sample_rate);
+  void clear();
+
+  // How long callbacks took, in seconds
+  const RollingHistogram &callbackTime() const { return m_callback_time; }
+  // Time between the starts of consecutive callbacks, in seconds
+  const RollingHistogram &interval() const { return m_interval; }
+  // Frames mixed ahead at the end of each callback
+  const RollingHistogram &buffered() const { return m_buffered; }
+  // Commands waiting at the start of each callback
+  const RollingHistogram &commands() const { return m_commands; }
+  // From a key press until the first sample of the sound it started is in
+  // the buffer handed to the device, in seconds. The device's own latency
+  // comes on top
+  const RollingHistogram &latency() const { return m_latency; }
+  // Underruns among the callbacks in the window
+  std::size_t underruns() const;
+  // Callbacks recorded since the last clear, including ones out of the window
+  std::uint64_t total() const { return m_total; }
+
+  // A plain text table of percentiles followed by histograms of the times
+  std::string report(std::uint64_t dropped) const;
+
+private:
+  double m_tick_seconds;
+  RollingHistogram m_callback_time;
+  RollingHistogram m_interval;
+  RollingHistogram m_buffered;
+  RollingHistogram m_commands;
+  RollingHistogram m_latency;
+  std::vector<bool> m_underruns;
+  std::size_t m_next_underrun = 0;
+  std::uint64_t m_total = 0;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <limits>
+
+#include <fmt/core.h>
+
+#include "audio/kernels.hpp"
+#include "audio/wav_writer.hpp"
+#include "sdl/error.hpp"
+
+namespace sdl = lege::sdl;
+
+namespace lege::audio {
+
+static constexpr std::size_t HEADER_SIZE = 44;
+// Samples converted at a time
+static constexpr std::size_t CHUNK_SAMPLES = 4096;
+
+static void put16(std::uint8_t *p, std::uint16_t v) {
+  p[0] = (std::uint8_t)v;
+  p[1] = (std::uint8_t)(v >> 8);
+}
+
+static void put32(std::uint8_t *p, std::uint32_t v) {
+  put16(p, (std::uint16_t)v);
+  put16(p + 2, (std::uint16_t)(v >> 16));
+}
+
+WavWriter::WavWriter(const char *filename, unsigned sample_rate,
+                     unsigned channels)
+    : m_rw(SDL_RWFromFile(filename, "wb")), m_sample_rate(sample_rate),
+      m_channels(channels), m_buf(CHUNK_SAMPLES) {
+  if (!m_rw) {
+    throw sdl::Error(fmt::format("could not create file \"{}\"", filename));
+  }
+  // Sizes are left at 0 until we know them
+  if (!writeHeader()) {
+    SDL_RWclose(m_rw);
+    throw sdl::Error(fmt::format("could not write to file \"{}\"", filename));
+  }
+}
+
+WavWriter::~WavWriter() {
+  if (m_rw) {
+    try {
+      close();
+    } catch (const std::exception &e) {
+      SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "%s", e.what());
+    }
+  }
+}
+
+void WavWriter::write(const float *samples, std::size_t frames) {
+  const Kernels &k = kernels();
+  std::size_t total = frames * m_channels;
+  for (std::size_t done = 0; done < total;) {
+    std::size_t n = std::min(total - done, CHUNK_SAMPLES);
+    k.to_s16(m_buf.data(), samples + done, n);
+    // WAV is little endian
+    if constexpr (SDL_BYTEORDER == SDL_BIG_ENDIAN) {
+      for (std::size_t i = 0; i < n; ++i) {
+        m_buf[i] = (std::int16_t)SDL_Swap16((Uint16)m_buf[i]);
+      }
+    }
+    if (SDL_RWwrite(m_rw, m_buf.data(), sizeof(std::int16_t), n) != n) {
+      throw sdl::Error("Could not write WAV file");
+    }
+    done += n;
+  }
+  m_frames += frames;
+}
+
+void WavWriter::close() {
+  bool ok = SDL_RWseek(m_rw, 0, RW_SEEK_SET) >= 0 && writeHeader();
+  ok = SDL_RWclose(m_rw) == 0 && ok;
+  m_rw = nullptr;
+  if (!ok) {
+    throw sdl::Error("Could not finish WAV file");
+  }
+}
+
+bool WavWriter::writeHeader() {
+  // Anything past what the header can describe is still written, but players
+  // will ignore it
+  const std::uint32_t block_align = m_channels * sizeof(std::int16_t);
+  const std::uint64_t data_size = std::min<std::uint64_t>(
+      m_frames * block_align,
+      std::numeric_limits<std::uint32_t>::max() - HEADER_SIZE);
+  std::uint8_t header[HEADER_SIZE];
+  std::copy_n("RIFF", 4, header);
+  put32(header + 4, (std::uint32_t)(HEADER_SIZE - 8 + data_size));
+  std::copy_n("WAVEfmt ", 8, header + 8);
+  put32(header + 16, 16);
+  put16(header + 20, 1); // PCM
+  put16(header + 22, (std::uint16_t)m_channels);
+  put32(header + 24, m_sample_rate);
+  put32(header + 28, m_sample_rate * block_align);
+  put16(header + 32, (std::uint16_t)block_align);
+  put16(header + 34, 16);
+  std::copy_n("data", 4, header + 36);
+  put32(header + 40, (std::uint32_t)data_size);
+  return SDL_RWwrite(m_rw, header, 1, HEADER_SIZE) == HEADER_SIZE;
+}
+
+} // namespace lege::audio
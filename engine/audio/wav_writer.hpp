@@ -0,0 +1,42 @@
+#ifndef LIBLEGE_AUDIO_WAV_WRITER_HPP
+#define LIBLEGE_AUDIO_WAV_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <SDL.h>
+
+namespace lege::audio {
+
+// Writes interleaved float frames to a 16 bit PCM WAV file. The header's sizes
+// are filled in once the writer is closed or destroyed
+class WavWriter {
+public:
+  WavWriter(const char *filename, unsigned sample_rate, unsigned channels);
+  ~WavWriter();
+
+  // No copy
+  WavWriter(const WavWriter &) = delete;
+  WavWriter &operator=(const WavWriter &) = delete;
+
+  void write(const float *samples, std::size_t frames);
+  // Fills in the header and closes the file. Throws if that fails, unlike the
+  // destructor. Nothing else can be called afterwards
+  void close();
+
+  std::uint64_t frames() const { return m_frames; }
+
+private:
+  bool writeHeader();
+
+  SDL_RWops *m_rw;
+  unsigned m_sample_rate;
+  unsigned m_channels;
+  std::uint64_t m_frames = 0;
+  std::vector<std::int16_t> m_buf;
+};
+
+} // namespace lege::audio
+
+#endif
@@ -6,18 +6,32 @@ namespace sdl = lege::sdl;
 
 namespace lege::engine {
 
-GameEngine::GameEngine() {
+// Default budget for decoded sounds
+static constexpr std::size_t SOUND_CACHE_BUDGET = 64 * 1024 * 1024;
+
+GameEngine::GameEngine(Profiler *profiler)
+    : m_profiler(profiler), m_sound_cache(SOUND_CACHE_BUDGET) {
+  Profiler::Scope timer(m_profiler, "sdl_init", "phase");
   setSDLLogPriority();
-  initSdlSubSystem(SDL_INIT_VIDEO);
-  m_win = SDL_CreateWindow("Loading...", SDL_WINDOWPOS_UNDEFINED,
-                           SDL_WINDOWPOS_UNDEFINED, 640, 480,
-                           SDL_WINDOW_HIDDEN | SDL_WINDOW_ALLOW_HIGHDPI);
-  if (m_win == nullptr) {
-    throw sdl::Error("Could not create window");
-  }
+  // Video is only initialized once we know we aren't headless, but events are
+  // always needed, E.G. so that SIGINT still quits
+  initSdlSubSystem(SDL_INIT_EVENTS);
 }
 
 GameEngine::~GameEngine() {
+  if (m_audio_dev) {
+    // Waits for the audio callback to return, so the mixer is safe to destroy
+    SDL_CloseAudioDevice(m_audio_dev);
+  }
+  if (m_audio_render) {
+    audio::MixerStats stats = m_mixer.stats();
+    double audio_time = (double)stats.frames / m_mixer.sampleRate();
+    double mix_time = stats.average_callback_time * stats.callbacks;
+    SDL_LogInfo(SDL_LOG_CATEGORY_AUDIO,
+                "Rendered %.3f s of audio in %.3f s (%.1fx real time)",
+                audio_time, mix_time,
+                mix_time > 0.0 ? audio_time / mix_time : 0.0);
+  }
   if (m_win) {
     SDL_DestroyWindow(m_win);
   }
@@ -36,17 +50,138 @@ void GameEngine::quitSdlSubSystem(Uint32 subsystems) {
   m_sdl_subsystems &= ~subsystems;
 }
 
-void GameEngine::setup() {}
+void GameEngine::createWindow() {
+  {
+    Profiler::Scope timer(m_profiler, "video_init", "phase");
+    initSdlSubSystem(SDL_INIT_VIDEO);
+  }
+  Profiler::Scope timer(m_profiler, "window_create", "phase");
+  m_win = SDL_CreateWindow("Loading...", SDL_WINDOWPOS_UNDEFINED,
+                           SDL_WINDOWPOS_UNDEFINED, 640, 480,
+                           SDL_WINDOW_HIDDEN | SDL_WINDOW_ALLOW_HIGHDPI);
+  if (m_win == nullptr) {
+    throw sdl::Error("Could not create window");
+  }
+}
+
+static void audio_callback(void *userdata, Uint8 *stream, int len) {
+  auto *mixer = static_cast<audio::Mixer *>(userdata);
+  mixer->render(reinterpret_cast<float *>(stream),
+                (std::size_t)len /
+                    (sizeof(float) * audio::OUTPUT_CHANNELS));
+}
+
+void GameEngine::openAudio() {
+  Profiler::Scope timer(m_profiler, "audio_init", "phase");
+  // A game without sound is still playable, so carry on without it
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+    SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO,
+                "Could not initialize SDL audio, continuing without sound: %s",
+                SDL_GetError());
+    return;
+  }
+  m_sdl_subsystems |= SDL_INIT_AUDIO;
+
+  SDL_AudioSpec want, have;
+  SDL_zero(want);
+  want.freq = 48000;
+  want.format = AUDIO_F32SYS;
+  want.channels = audio::OUTPUT_CHANNELS;
+  want.samples = 512;
+  want.callback = audio_callback;
+  want.userdata = &m_mixer;
+  m_audio_dev = SDL_OpenAudioDevice(nullptr, 0, &want, &have,
+                                    SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+                                        SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+  if (m_audio_dev == 0) {
+    SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO,
+                "Could not open audio device, continuing without sound: %s",
+                SDL_GetError());
+    return;
+  }
+  SDL_LogDebug(SDL_LOG_CATEGORY_AUDIO, "Opened audio device: %d Hz, %u frames",
+               have.freq, (unsigned)have.samples);
+  m_mixer.start((unsigned)have.freq, have.samples);
+  SDL_PauseAudioDevice(m_audio_dev, 0);
+}
+
+void GameEngine::renderAudioTo(const char *filename, unsigned sample_rate,
+                               std::size_t frames_per_tick) {
+  m_audio_render = std::make_unique<audio::WavWriter>(
+      filename, sample_rate, audio::OUTPUT_CHANNELS);
+  m_render_buf.resize(frames_per_tick * audio::OUTPUT_CHANNELS);
+  m_mixer.start(sample_rate, frames_per_tick, false);
+}
+
+void GameEngine::setup(bool headless) {
+  if (!headless) {
+    createWindow();
+    // Offline rendering needs no device, and has already started the mixer
+    if (!m_audio_render) {
+      openAudio();
+    }
+  }
+}
+
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+// Events are stamped in SDL_GetTicks() milliseconds, but the mixer times
+// callbacks with the performance counter. Counts the time the event waited
+// in the queue
+static std::uint64_t keyPressTime(Uint32 timestamp) {
+  std::uint64_t now = SDL_GetPerformanceCounter();
+  std::uint64_t waited = (std::uint64_t)(SDL_GetTicks() - timestamp) *
+                         SDL_GetPerformanceFrequency() / 1000;
+  return waited < now ? now - waited : 1;
+}
+#endif
 
 bool GameEngine::runOnce() {
   // Process SDL events
+  [[maybe_unused]] std::uint64_t input = 0;
   SDL_Event e;
   for (SDL_Event e; SDL_PollEvent(&e);) {
     switch (e.type) {
     case SDL_QUIT:
       return false; // Done
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+    case SDL_KEYDOWN:
+      if (!e.key.repeat && !input) {
+        input = keyPressTime(e.key.timestamp);
+      }
+      break;
+#endif
     }
   }
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  // Whatever the game plays first is taken to be its response to the first
+  // key pressed. Frames without a press leave the last one pending, as games
+  // often react a frame or more later
+  if (input) {
+    m_mixer.setInputTime(input);
+  }
+#endif
+  // Rendered audio has its own clock, which tweens keep to so that they
+  // line up with what's heard
+  float dt;
+  if (m_audio_render) {
+    dt = (float)(m_render_buf.size() / audio::OUTPUT_CHANNELS) /
+         (float)m_mixer.sampleRate();
+  } else {
+    std::uint64_t now = SDL_GetPerformanceCounter();
+    dt = m_last_tick ? (float)(now - m_last_tick) /
+                           (float)SDL_GetPerformanceFrequency()
+                     : 0.0f;
+    m_last_tick = now;
+  }
+  m_tweens.update(dt);
+  // Free voices the audio thread has finished with
+  m_mixer.update();
+  if (m_audio_render) {
+    // There's no audio thread, so the clock only moves when we mix
+    std::size_t frames = m_render_buf.size() / audio::OUTPUT_CHANNELS;
+    m_mixer.render(m_render_buf.data(), frames);
+    m_audio_render->write(m_render_buf.data(), frames);
+  }
   return true; // Not done
 }
 
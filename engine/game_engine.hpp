@@ -1,25 +1,66 @@
 #ifndef LIBLEGE_ENGINE_GAME_ENGINE_HPP
 #define LIBLEGE_ENGINE_GAME_ENGINE_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 #include <SDL.h>
 
+#include "audio/mixer.hpp"
+#include "audio/sound_cache.hpp"
+#include "audio/wav_writer.hpp"
+#include "profiler.hpp"
+#include "tween.hpp"
+
 namespace lege::engine {
 
 class GameEngine {
 public:
-  GameEngine();
+  // The profiler, if given, times SDL initialization and window creation
+  GameEngine(Profiler *profiler = nullptr);
   ~GameEngine();
 
   void initSdlSubSystem(Uint32 subsystems);
   void quitSdlSubSystem(Uint32 subsystems);
 
+  // Null when headless
   SDL_Window *getWindow() { return m_win; }
+  bool isHeadless() const { return m_win == nullptr; }
+
+  audio::Mixer &getMixer() { return m_mixer; }
+  audio::SoundCache &getSoundCache() { return m_sound_cache; }
+  // Advanced by runOnce(), before the mixer is updated so that tweened audio
+  // parameters are sent the same frame
+  Tweener &getTweens() { return m_tweens; }
 
-  void setup();
+  // Instead of opening an audio device, mix `frames_per_tick` frames of audio
+  // each time runOnce() is called, as fast as possible, and write them to a
+  // WAV file. Must be called before setup()
+  void renderAudioTo(const char *filename, unsigned sample_rate,
+                     std::size_t frames_per_tick);
+  bool isRenderingAudio() const { return m_audio_render != nullptr; }
+
+  // Headless engines never initialize SDL video or audio or create a window,
+  // so can run without a display or sound card
+  void setup(bool headless = false);
   [[nodiscard]] bool runOnce();
 
 private:
+  void createWindow();
+  void openAudio();
+
+  Profiler *m_profiler;
   SDL_Window *m_win = nullptr;
+  audio::Mixer m_mixer;
+  audio::SoundCache m_sound_cache;
+  Tweener m_tweens;
+  // Performance counter at the last runOnce(), or 0 before the first
+  std::uint64_t m_last_tick = 0;
+  SDL_AudioDeviceID m_audio_dev = 0;
+  std::unique_ptr<audio::WavWriter> m_audio_render;
+  std::vector<float> m_render_buf;
   Uint32 m_sdl_subsystems = 0;
 };
 
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "tween.hpp"
+
+namespace lege::engine {
+
+float ease(Easing easing, float t) noexcept {
+  constexpr float pi = std::numbers::pi_v<float>;
+  switch (easing) {
+  case Easing::LINEAR:
+    return t;
+  case Easing::IN_QUAD:
+    return t * t;
+  case Easing::OUT_QUAD:
+    return t * (2.0f - t);
+  case Easing::IN_OUT_QUAD:
+    return t < 0.5f ? 2.0f * t * t : 1.0f - 2.0f * (1.0f - t) * (1.0f - t);
+  case Easing::IN_CUBIC:
+    return t * t * t;
+  case Easing::OUT_CUBIC: {
+    float u = 1.0f - t;
+    return 1.0f - u * u * u;
+  }
+  case Easing::IN_OUT_CUBIC: {
+    float u = 1.0f - t;
+    return t < 0.5f ? 4.0f * t * t * t : 1.0f - 4.0f * u * u * u;
+  }
+  case Easing::IN_SINE:
+    return 1.0f - std::cos(t * pi / 2.0f);
+  case Easing::OUT_SINE:
+    return std::sin(t * pi / 2.0f);
+  case Easing::IN_OUT_SINE:
+    return (1.0f - std::cos(t * pi)) / 2.0f;
+  case Easing::IN_EXPO:
+    // Pinned at the ends, which the curve only approaches
+    return t <= 0.0f ? 0.0f : std::exp2(10.0f * t - 10.0f);
+  case Easing::OUT_EXPO:
+    return t >= 1.0f ? 1.0f : 1.0f - std::exp2(-10.0f * t);
+  case Easing::IN_OUT_EXPO:
+    if (t <= 0.0f || t >= 1.0f) {
+      return t <= 0.0f ? 0.0f : 1.0f;
+    }
+    return t < 0.5f ? std::exp2(20.0f * t - 10.0f) / 2.0f
+                    : 1.0f - std::exp2(10.0f - 20.0f * t) / 2.0f;
+  case Easing::SMOOTHSTEP:
+    return t * t * (3.0f - 2.0f * t);
+  }
+  return t;
+}
+
+Tweener::Id Tweener::start(float *target, float from, float to,
+                           float duration, Easing easing, float delay) {
+  return start(target, nullptr, from, to, duration, easing, delay);
+}
+
+Tweener::Id Tweener::start(void *object, TweenSetter set, float from,
+                           float to, float duration, Easing easing,
+                           float delay) {
+  auto [it, added] = m_by_target.try_emplace({object, set}, m_tweens.size());
+  if (added) {
+    m_tweens.emplace_back();
+  } else {
+    // Replaced in place, so no other indices move
+    Id old = m_tweens[it->second].id;
+    m_cancelled.push_back(old);
+    m_by_id.erase(old);
+  }
+  // Skip 0 when the ids wrap around, so that it can mean no tween
+  if (m_next_id == 0) {
+    ++m_next_id;
+  }
+  Id id = m_next_id++;
+  m_tweens[it->second] = {object,
+                          set,
+                          from,
+                          to,
+                          -std::max(delay, 0.0f),
+                          std::max(duration, 0.0f),
+                          id,
+                          easing};
+  m_by_id[id] = it->second;
+  return id;
+}
+
+bool Tweener::cancel(Id id) {
+  auto it = m_by_id.find(id);
+  if (it == m_by_id.end()) {
+    return false;
+  }
+  m_cancelled.push_back(id);
+  remove(it->second);
+  return true;
+}
+
+void Tweener::update(float dt) {
+  for (std::size_t i = 0; i < m_tweens.size();) {
+    Tween &t = m_tweens[i];
+    t.elapsed += dt;
+    if (t.elapsed < 0.0f) {
+      ++i;
+      continue;
+    }
+    bool done = t.elapsed >= t.duration;
+    float value = done ? t.to
+                       : t.from + (t.to - t.from) *
+                                      ease(t.easing, t.elapsed / t.duration);
+    if (t.set) {
+      t.set(t.object, value);
+    } else {
+      *static_cast<float *>(t.object) = value;
+    }
+    if (done) {
+      m_finished.push_back(t.id);
+      remove(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+void Tweener::drain(std::vector<Id> &finished, std::vector<Id> &cancelled) {
+  finished.clear();
+  cancelled.clear();
+  std::swap(finished, m_finished);
+  std::swap(cancelled, m_cancelled);
+}
+
+void Tweener::remove(std::size_t index) {
+  Tween &t = m_tweens[index];
+  m_by_id.erase(t.id);
+  m_by_target.erase({t.object, t.set});
+  if (index != m_tweens.size() - 1) {
+    t = m_tweens.back();
+    m_by_id[t.id] = index;
+    m_by_target[{t.object, t.set}] = index;
+  }
+  m_tweens.pop_back();
+}
+
+} // namespace lege::engine
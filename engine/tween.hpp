@@ -0,0 +1,103 @@
+#ifndef LIBLEGE_ENGINE_TWEEN_HPP
+#define LIBLEGE_ENGINE_TWEEN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lege::engine {
+
+enum class Easing : std::uint8_t {
+  LINEAR,
+  IN_QUAD,
+  OUT_QUAD,
+  IN_OUT_QUAD,
+  IN_CUBIC,
+  OUT_CUBIC,
+  IN_OUT_CUBIC,
+  IN_SINE,
+  OUT_SINE,
+  IN_OUT_SINE,
+  IN_EXPO,
+  OUT_EXPO,
+  IN_OUT_EXPO,
+  SMOOTHSTEP,
+};
+
+// Maps progress t in [0, 1] onto the curve, which also starts at 0 and ends
+// at 1
+float ease(Easing easing, float t) noexcept;
+
+// Called with a tween's value each frame, for targets that need to know when
+// they change, like an audio source's gain. Plain floats are written directly
+using TweenSetter = void (*)(void *object, float value);
+
+// Animates floats from one value to another over time, along an easing
+// curve. Every tween lives in one compact array, which update() sweeps
+// through once per frame, so thousands cost little more than a loop
+class Tweener {
+public:
+  using Id = std::uint32_t;
+
+  // Animates *target from `from` to `to` over duration seconds, after delay
+  // seconds. A target already being tweened has its old tween cancelled
+  Id start(float *target, float from, float to, float duration,
+           Easing easing = Easing::LINEAR, float delay = 0.0f);
+  // The same, but hands each value to set along with object
+  Id start(void *object, TweenSetter set, float from, float to,
+           float duration, Easing easing = Easing::LINEAR,
+           float delay = 0.0f);
+
+  // Returns false if the tween already ended
+  bool cancel(Id id);
+  bool isActive(Id id) const { return m_by_id.count(id) != 0; }
+  std::size_t size() const { return m_tweens.size(); }
+
+  // Advances every tween by dt seconds and sets its target. Tweens that reach
+  // the end are set to exactly their final value, and removed
+  void update(float dt);
+
+  // Moves out the tweens that ended since the last call: the ones that
+  // finished, then the ones cancelled, including those replaced by a newer
+  // tween on the same target
+  void drain(std::vector<Id> &finished, std::vector<Id> &cancelled);
+
+private:
+  struct Tween {
+    void *object;
+    // Null if object is a float to write to
+    TweenSetter set;
+    float from;
+    float to;
+    // Negative while delayed
+    float elapsed;
+    float duration;
+    Id id;
+    Easing easing;
+  };
+
+  struct TargetHash {
+    std::size_t operator()(const std::pair<void *, TweenSetter> &t) const {
+      return std::hash<void *>()(t.first) ^
+             (std::hash<void *>()((void *)t.second) << 1);
+    }
+  };
+
+  // Swaps the last tween into index
+  void remove(std::size_t index);
+
+  std::vector<Tween> m_tweens;
+  // Indices into m_tweens
+  std::unordered_map<Id, std::size_t> m_by_id;
+  std::unordered_map<std::pair<void *, TweenSetter>, std::size_t, TargetHash>
+      m_by_target;
+  std::vector<Id> m_finished;
+  std::vector<Id> m_cancelled;
+  Id m_next_id = 1;
+};
+
+} // namespace lege::engine
+
+#endif
@@ -14,11 +14,14 @@ void register_builtins(EngineImpl &e) {
   e.load((const char *)luaJIT_BC_c_libs, luaJIT_BC_c_libs_SIZE, "b",
          "lege.c_libs");
   e.load(luaopen_lege_log, "lege.log");
+  e.load(luaopen_lege_audio, "lege.audio");
   e.load(luaopen_lege_enum, "lege.enum");
+  e.load(luaopen_lege_profiler, "lege.profiler");
   e.load(luaopen_lege_readonly, "lege.readonly");
   e.load(luaopen_lege_strict, "lege.strict");
   e.load(luaopen_lege_struct, "lege.struct");
   e.load(luaopen_lege_task, "lege.task");
+  e.load(luaopen_lege_tween, "lege.tween");
   e.load(luaopen_lege_weak, "lege.weak");
   e.load(luaopen_lege_vec2, "lege.vec2");
   e.load(luaopen_lege_vec3, "lege.vec3");
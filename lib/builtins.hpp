@@ -4,12 +4,15 @@
 #include "engine.hpp"
 
 extern "C" {
+int luaopen_lege_audio(lua_State *L);
 int luaopen_lege_enum(lua_State *L);
 int luaopen_lege_log(lua_State *L);
+int luaopen_lege_profiler(lua_State *L);
 int luaopen_lege_readonly(lua_State *L);
 int luaopen_lege_strict(lua_State *L);
 int luaopen_lege_struct(lua_State *L);
 int luaopen_lege_task(lua_State *L);
+int luaopen_lege_tween(lua_State *L);
 int luaopen_lege_weak(lua_State *L);
 int luaopen_lege_vec2(lua_State *L);
 int luaopen_lege_vec3(lua_State *L);
@@ -21,6 +24,8 @@ namespace lege::modules {
 
 void register_types(lua_State *L);
 void register_builtins(EngineImpl &e);
+// Calls back and wakes tasks waiting for tweens that ended this frame
+void finish_tweens(lua_State *L);
 
 } // namespace lege::modules
 
@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+#include <lua.hpp>
+
+#include "compiler.hpp"
+#include "lua/state.hpp"
+
+namespace lua = lege::lua;
+
+namespace lege {
+
+static int write_bytecode(lua_State *, const void *p, std::size_t sz,
+                          void *ud) {
+  static_cast<std::string *>(ud)->append(static_cast<const char *>(p), sz);
+  return 0;
+}
+
+static void compile(lua_State *L, CompileJob &job,
+                    const Prefetcher::ReadFunc &read) {
+  FileBuffer src;
+  job.read_start = Profiler::Clock::now();
+  try {
+    src = read(job.filename.c_str());
+  } catch (const std::exception &e) {
+    job.error = e.what();
+    return;
+  }
+  job.compile_start = Profiler::Clock::now();
+
+  if (luaL_loadbufferx(L, src.get(), src.size, job.name.c_str(), "t") !=
+      LUA_OK) {
+    std::size_t len;
+    const char *msg = lua_tolstring(L, -1, &len);
+    job.error.assign(msg, len);
+  } else {
+    lua_dump(L, write_bytecode, &job.bytecode);
+  }
+  lua_settop(L, 0);
+  job.compile_end = Profiler::Clock::now();
+}
+
+void compile_parallel(std::vector<CompileJob> &jobs, unsigned num_threads,
+                      const Prefetcher::ReadFunc &read) {
+  if (jobs.empty()) {
+    return;
+  }
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min(num_threads, (unsigned)jobs.size());
+
+  // Workers take the next job until there are none left, so a few large
+  // modules don't hold up the rest
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&](unsigned thread) {
+    // Parsing doesn't need any libraries opened
+    lua::State L;
+    for (std::size_t i; (i = next.fetch_add(1)) < jobs.size();) {
+      jobs[i].thread = thread;
+      compile(L, jobs[i], read);
+    }
+  };
+
+  std::vector<std::jthread> threads;
+  threads.reserve(num_threads);
+  for (unsigned i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  // The calling thread does its share too
+  worker(0);
+}
+
+} // namespace lege
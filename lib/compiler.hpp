@@ -0,0 +1,32 @@
+#ifndef LIBLEGE_COMPILER_HPP
+#define LIBLEGE_COMPILER_HPP
+
+#include <string>
+#include <vector>
+
+#include "prefetcher.hpp"
+#include "profiler.hpp"
+
+namespace lege {
+
+struct CompileJob {
+  std::string name;
+  std::string filename;
+  // Filled in by compile_parallel(), only one of these is non-empty
+  std::string bytecode;
+  std::string error;
+  // When the file was read and parsed, and on which thread (0 = the caller's)
+  Profiler::Clock::time_point read_start, compile_start, compile_end;
+  unsigned thread = 0;
+};
+
+// Reads and compiles each job's file to bytecode on up to num_threads worker
+// threads, each with its own scratch Lua state. The results can then be loaded
+// into the main state with mode "b", which skips parsing entirely.
+// num_threads == 0 uses one thread per core
+void compile_parallel(std::vector<CompileJob> &jobs, unsigned num_threads,
+                      const Prefetcher::ReadFunc &read);
+
+} // namespace lege
+
+#endif
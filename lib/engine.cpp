@@ -1,12 +1,19 @@
+#include <cstdlib>
 #include <exception>
+#include <filesystem>
+#include <future>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <string_view>
 
 #include <SDL_rwops.h>
 #include <fmt/core.h>
 #include <lua.hpp>
 
+#include "audio/cook.hpp"
 #include "builtins.hpp"
+#include "compiler.hpp"
 #include "engine.hpp"
 #include "lege.hpp"
 #include "lua/helpers.hpp"
@@ -17,6 +24,52 @@ namespace sdl = lege::sdl;
 
 namespace lege {
 
+namespace {
+
+// Upvalue of the stub loaders registered by EngineImpl::loadModuleLazily()
+struct LazyModule {
+  std::string filename;
+  // Only valid if the module is being prefetched
+  std::future<FileBuffer> prefetched;
+};
+
+} // namespace
+
+// Pushes the compiled module, or an error message. Returns a Lua status code
+static int load_lazy_module(lua_State *L, EngineImpl *e, LazyModule *mod,
+                            const char *name) {
+  FileBuffer buf;
+  try {
+    // This also times waiting for the prefetcher
+    Profiler::Scope timer(e, name, "read");
+    // If prefetching failed, the future rethrows the error here
+    buf = mod->prefetched.valid() ? mod->prefetched.get()
+                                  : e->readFile(mod->filename.c_str());
+  } catch (const std::exception &ex) {
+    lua_pushstring(L, ex.what());
+    return LUA_ERRFILE;
+  }
+  Profiler::Scope timer(e, name, "compile");
+  return luaL_loadbufferx(L, buf.get(), buf.size, name, "t");
+}
+
+// Stored in package.preload in place of a module's main chunk. Compiles and
+// runs the module on its first `require`
+static int l_lazy_loader(lua_State *L) {
+  auto e = static_cast<EngineImpl *>(lua_touserdata(L, lua_upvalueindex(1)));
+  auto mod = static_cast<LazyModule *>(lua_touserdata(L, lua_upvalueindex(2)));
+  const char *name = luaL_checkstring(L, 1);
+  SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+               "Lazily loading module \"%s\" from file \"%s\"", name,
+               mod->filename.c_str());
+  if (load_lazy_module(L, e, mod, name) != LUA_OK) {
+    return lua_error(L);
+  }
+  lua_pushvalue(L, 1);
+  lua_call(L, 1, 1);
+  return 1;
+}
+
 Engine::Engine() : m_impl(new EngineImpl) {}
 
 Engine::~Engine() { delete m_impl; }
@@ -35,6 +88,8 @@ void Engine::loadFile(const char *filename, const char *mode,
   m_impl->loadFile(filename, mode, name);
 }
 
+void Engine::mount(const char *archive) { m_impl->mount(archive); }
+
 void Engine::loadProject(const char *projectfile) {
   m_impl->loadProject(projectfile);
 }
@@ -49,9 +104,53 @@ void Engine::run() {
   }
 }
 
-EngineImpl::EngineImpl() : GameEngine(), Runtime() {}
+void packArchive(const char *output, const std::vector<std::string> &files,
+                 bool compress) {
+  Archive::pack(output, files, compress);
+}
+
+std::size_t cookAudio(const char *output, const std::vector<std::string> &files,
+                      const CookOptions &options) {
+  audio::CookSettings settings;
+  settings.rate = options.rate;
+  settings.loudness = options.loudness;
+  settings.peak = options.peak;
+  settings.threads = options.threads;
+  auto results = audio::cook_files(output, files, settings);
+
+  std::size_t cooked = 0;
+  std::string errors;
+  for (const auto &result : results) {
+    if (result.error.empty()) {
+      ++cooked;
+    } else {
+      errors += fmt::format("\n  {}: {}", result.source, result.error);
+    }
+  }
+  if (!errors.empty()) {
+    throw std::runtime_error(
+        fmt::format("Could not cook {} of {} files:{}",
+                    results.size() - cooked, results.size(), errors));
+  }
+  return cooked;
+}
 
-EngineImpl::~EngineImpl() {}
+EngineImpl::EngineImpl() : Profiler(), GameEngine(this), Runtime(this) {
+  lua_pushlightuserdata(L, this);
+  lua_setfield(L, LUA_REGISTRYINDEX, LEGE_ENGINE_KEY);
+}
+
+EngineImpl::~EngineImpl() {
+  // Streams and impulse responses may be reading from our archives
+  getMixer().stopWorkers();
+}
+
+EngineImpl &EngineImpl::fromState(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LEGE_ENGINE_KEY);
+  auto e = static_cast<EngineImpl *>(lua_touserdata(L, -1));
+  lua_pop(L, 1);
+  return *e;
+}
 
 void EngineImpl::set(std::string_view option, std::string_view val) {
   // Get the options table
@@ -68,30 +167,77 @@ std::string EngineImpl::get(std::string_view option) {
   lua::push(L, option);
   lua_rawget(L, -2);
   std::string value;
-  lua::get(L, -1, value);
+  if (!lua_isnil(L, -1)) {
+    lua::get(L, -1, value);
+  }
   lua_pop(L, 2);
   return value;
 }
 
+bool EngineImpl::getFlag(std::string_view option) {
+  auto value = get(option);
+  return value == "true" || value == "1";
+}
+
+void EngineImpl::mount(const char *archive) {
+  m_archives.push_back(std::make_unique<Archive>(archive));
+  SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+               "Mounted archive \"%s\" with %zu entries", archive,
+               m_archives.back()->size());
+}
+
+FileBuffer EngineImpl::readFile(const char *filename) {
+  for (auto it = m_archives.rbegin(); it != m_archives.rend(); ++it) {
+    if (auto buf = (*it)->read(filename)) {
+      return std::move(*buf);
+    }
+  }
+
+  FileBuffer buf;
+  buf.data = {(char *)SDL_LoadFile(filename, &buf.size), SDL_free};
+  if (!buf.data) {
+    throw sdl::Error(fmt::format("could not load file \"{}\"", filename));
+  }
+  return buf;
+}
+
+std::string EngineImpl::soundPath(const char *filename) const {
+  if (!m_cooked_audio.empty()) {
+    auto name = std::filesystem::path(filename).lexically_normal();
+    if (auto it = m_cooked_audio.find(name.generic_string());
+        it != m_cooked_audio.end()) {
+      return fmt::format("{}/{}", m_cooked_dir, it->second);
+    }
+  }
+  return filename;
+}
+
+std::unique_ptr<audio::ByteSource> EngineImpl::openFile(const char *filename) {
+  for (auto it = m_archives.rbegin(); it != m_archives.rend(); ++it) {
+    if (auto buf = (*it)->read(filename)) {
+      return std::make_unique<audio::MemorySource>(std::move(*buf));
+    }
+  }
+  return std::make_unique<audio::FileSource>(filename);
+}
+
 void EngineImpl::loadFile(const char *filename, const char *mode,
                           const char *name) {
-  // Todo: investigate using mmap() here
-  std::size_t sz;
-  auto contents = (char *)SDL_LoadFile(filename, &sz);
-  if (!contents) {
-    throw sdl::Error(fmt::format("could not load chunk \"{}\"", filename));
-  }
-  // We do this instead of manual memory management to avoid leaking memory if
-  // load() throws an exception
-  std::unique_ptr<char[], void (*)(void *)> buf(contents, SDL_free);
-  load(buf.get(), sz, mode, name);
+  // FileBuffer frees the contents even if load() throws an exception
+  FileBuffer buf = readFile(filename);
+  load(buf.get(), buf.size, mode, name);
 }
 
 void EngineImpl::loadProject(const char *projectfile) {
+  auto timer = time("load_project");
+  FileBuffer manifest = readFile(projectfile);
+
   // Use an isolated, temporary environment:
   lua_newtable(L);
 
-  int res = luaL_loadfilex(L, projectfile, "t");
+  std::string chunkname = fmt::format("@{}", projectfile);
+  int res = luaL_loadbufferx(L, manifest.get(), manifest.size,
+                             chunkname.c_str(), "t");
   if (res != LUA_OK) {
     lua_replace(L, -2); // Replace environment table to keep stack balanced
     throw lua::Error(L,
@@ -113,7 +259,11 @@ void EngineImpl::loadProject(const char *projectfile) {
     for (lua_pushnil(L); lua_next(L, options_tbl); lua_pop(L, 1)) {
       std::string_view key, val;
       lua::get(L, -2, key);
-      lua::get(L, -1, val);
+      if (lua_isboolean(L, -1)) {
+        val = lua_toboolean(L, -1) ? "true" : "false";
+      } else {
+        lua::get(L, -1, val);
+      }
       // Prepend "lege." to all engine options so future extensions can have
       // other namespaces
       option = "lege.";
@@ -133,6 +283,7 @@ void EngineImpl::loadProject(const char *projectfile) {
         "Expected `modules` to be a table, got {}", luaL_typename(L, -1)));
   }
   int modules_tbl = lua_gettop(L);
+  std::vector<CompileJob> modules;
   std::string mod_name, file;
   for (lua_pushnil(L); lua_next(L, modules_tbl); lua_pop(L, 1)) {
     lua::get(L, -1, file);
@@ -159,38 +310,155 @@ void EngineImpl::loadProject(const char *projectfile) {
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
                  "Loading module \"%s\" from file \"%s\"", mod_name.c_str(),
                  file.c_str());
-    loadFile(file.c_str(), "t", mod_name.c_str());
+    auto &mod = modules.emplace_back();
+    mod.name = mod_name;
+    mod.filename = file;
   }
   lua_pop(L, 1);
 
   // Pop the environment table
   lua_pop(L, 1);
+
+  loadModules(modules);
+}
+
+void EngineImpl::loadModules(std::vector<CompileJob> &modules) {
+  if (getFlag("lege.lazy_modules")) {
+    for (const auto &mod : modules) {
+      loadModuleLazily(mod.filename.c_str(), mod.name.c_str());
+    }
+    return;
+  }
+
+  // Parsing is the expensive part, and is independent per module, so do it on
+  // worker threads. The main state then only has to load bytecode
+  auto threads = (unsigned)std::strtoul(get("lege.compile_threads").c_str(),
+                                        nullptr, 10);
+  compile_parallel(modules, threads,
+                   [this](const char *filename) { return readFile(filename); });
+  for (const auto &mod : modules) {
+    if (!mod.error.empty()) {
+      throw std::runtime_error(fmt::format("Could not load module \"{}\": {}",
+                                           mod.name, mod.error));
+    }
+    record({mod.name, "read", mod.read_start, mod.compile_start, mod.thread});
+    record(
+        {mod.name, "compile", mod.compile_start, mod.compile_end, mod.thread});
+    auto timer = time(mod.name, "load");
+    load(mod.bytecode.data(), mod.bytecode.size(), "b", mod.name.c_str());
+  }
+}
+
+void EngineImpl::loadModuleLazily(const char *filename, const char *name) {
+  LazyModule mod{filename, {}};
+  if (getFlag("lege.prefetch_modules")) {
+    if (!m_prefetcher) {
+      m_prefetcher = std::make_unique<Prefetcher>(
+          [this](const char *filename) { return readFile(filename); });
+    }
+    mod.prefetched = m_prefetcher->enqueue(filename);
+  }
+
+  // package.preload[name] = stub loader
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_replace(L, -2); // Replace package with package.preload
+  lua_pushlightuserdata(L, this);
+  lua::new_userdata<LazyModule>(L, std::move(mod));
+  lua_pushcclosure(L, l_lazy_loader, 2);
+  lua_setfield(L, -2, name);
+  lua_pop(L, 1);
 }
 
 void EngineImpl::setup() {
-  lege::modules::register_types(L);
-  lege::modules::register_builtins(*this);
+  {
+    auto timer = time("register_types");
+    lege::modules::register_types(L);
+  }
+  {
+    auto timer = time("register_builtins");
+    lege::modules::register_builtins(*this);
+  }
+
+  // Mix audio into a file rather than playing it, advancing a fixed amount of
+  // audio each frame, however long the frame took
+  if (auto path = get("lege.audio_render"); !path.empty()) {
+    auto rate = get("lege.audio_render_rate");
+    auto fps = get("lege.audio_render_fps");
+    unsigned long sample_rate =
+        rate.empty() ? 48000 : std::strtoul(rate.c_str(), nullptr, 10);
+    unsigned long ticks =
+        fps.empty() ? 60 : std::strtoul(fps.c_str(), nullptr, 10);
+    if (sample_rate == 0 || ticks == 0 || ticks > sample_rate) {
+      throw std::runtime_error(
+          "lege.audio_render_rate and lege.audio_render_fps must be positive, "
+          "with at least one frame of audio per tick");
+    }
+    renderAudioTo(path.c_str(), (unsigned)sample_rate, sample_rate / ticks);
+  }
+
+  // Creates the window, unless we're headless
+  GameEngine::setup(getFlag("lege.headless"));
 
-  // Register the `window` global
+  // Register the `window` global. When headless this is a null window, which
+  // ignores attempts to change it, so that scripts work the same either way
   lua::new_userdata<SDL_Window *>(L, getWindow());
   lua_setglobal(L, "window");
 
-  GameEngine::setup();
+  if (auto voices = get("lege.max_voices"); !voices.empty()) {
+    getMixer().setMaxVoices(
+        (unsigned)std::strtoul(voices.c_str(), nullptr, 10));
+  }
+  // Budget for decoded sounds, in MiB
+  if (auto budget = get("lege.sound_cache_mb"); !budget.empty()) {
+    getSoundCache().setBudget(
+        (std::size_t)std::strtoull(budget.c_str(), nullptr, 10) * 1024 *
+        1024);
+  }
+  // Sounds this long or longer are cached compressed
+  if (auto seconds = get("lege.sound_pcm_seconds"); !seconds.empty()) {
+    getSoundCache().setPcmSeconds(std::strtod(seconds.c_str(), nullptr));
+  }
+  // Sounds preprocessed by `lege cook`, loaded in place of the originals
+  if (auto dir = get("lege.cooked_audio"); !dir.empty()) {
+    auto index =
+        readFile(fmt::format("{}/{}", dir, audio::COOKED_INDEX).c_str());
+    m_cooked_audio = audio::parse_cooked_index(index.get(), index.size);
+    m_cooked_dir = std::move(dir);
+  }
 
   // This needs to be done before Runtime::setup(), so that the user has a
   // chance to change it
-  SDL_SetWindowTitle(getWindow(), get("lege.app_name").c_str());
+  if (!isHeadless()) {
+    SDL_SetWindowTitle(getWindow(), get("lege.app_name").c_str());
+  }
 
   Runtime::setup();
 
   // Everything's loaded, present the window
-  SDL_ShowWindow(getWindow());
+  if (!isHeadless()) {
+    auto timer = time("show_window");
+    SDL_ShowWindow(getWindow());
+  }
+
+  record({"startup", "phase", origin(), Clock::now()});
+  SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Startup took %.3f ms",
+               spans().back().duration() * 1e3);
+  if (const char *report = SDL_getenv("LEGE_PROFILE")) {
+    try {
+      writeJson(report);
+    } catch (const std::exception &e) {
+      SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "%s", e.what());
+    }
+  }
 }
 
 bool EngineImpl::runOnce() {
   if (!GameEngine::runOnce()) {
     return false;
   }
+  // Before tasks run, so that those woken by tweens run this frame
+  modules::finish_tweens(L);
   return Runtime::runOnce();
 }
 
@@ -1,33 +1,80 @@
 #ifndef LIBLEGE_ENGINE_HPP
 #define LIBLEGE_ENGINE_HPP
 
+#include <memory>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <SDL.h>
 #include <lua.hpp>
 
+#include "archive.hpp"
+#include "compiler.hpp"
+#include "file_buffer.hpp"
 #include "game_engine.hpp"
+#include "prefetcher.hpp"
+#include "profiler.hpp"
 #include "runtime.hpp"
 
+// Registry key of a light userdata pointing to the EngineImpl that owns a state
+#define LEGE_ENGINE_KEY "lege.engine"
+
 namespace lege {
 
-class EngineImpl : public engine::GameEngine, public Runtime {
+// Profiler comes first so it exists before the other bases are constructed,
+// letting them time their initialization
+class EngineImpl : public Profiler, public engine::GameEngine, public Runtime {
 public:
   EngineImpl();
   ~EngineImpl();
 
+  // For built-in modules
+  static EngineImpl &fromState(lua_State *L);
+
   void set(std::string_view option, std::string_view val);
   std::string get(std::string_view option);
+  // True if the option is set to "true" or "1"
+  bool getFlag(std::string_view option);
+
+  // Archives mounted later take precedence over earlier ones. Mount archives
+  // before loading anything, as readFile() may be called from other threads
+  void mount(const char *archive);
+
+  // Reads a whole file into memory, from a mounted archive if one contains it,
+  // otherwise using SDL_rwops
+  FileBuffer readFile(const char *filename);
+  // Opens a file for streaming. Files in mounted archives are read from
+  // memory, others are read incrementally from disk
+  std::unique_ptr<audio::ByteSource> openFile(const char *filename);
+  // Where to load a sound from: its cooked copy, if the "lege.cooked_audio"
+  // option names a directory it was cooked into, otherwise the file itself
+  std::string soundPath(const char *filename) const;
 
   // Uses SDL_rwops to load files
   void loadFile(const char *filename, const char *mode = "t",
                 const char *name = "main");
 
   void loadProject(const char *projectfile);
+  // Compiles modules now, in parallel, or registers stubs that load each one
+  // on its first `require` if the "lege.lazy_modules" option is set
+  void loadModules(std::vector<CompileJob> &modules);
 
   void setup();
   [[nodiscard]] bool runOnce();
   void run();
+
+private:
+  void loadModuleLazily(const char *filename, const char *name);
+
+  // Must outlive any FileBuffers read from them
+  std::vector<std::unique_ptr<Archive>> m_archives;
+  // Created on first use, if the "lege.prefetch_modules" option is set
+  std::unique_ptr<Prefetcher> m_prefetcher;
+  // Source paths to cooked file names, from the cooked directory's index
+  std::string m_cooked_dir;
+  std::unordered_map<std::string, std::string> m_cooked_audio;
 };
 
 } // namespace lege
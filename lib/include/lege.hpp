@@ -2,7 +2,9 @@
 #define LIBLEGE_LEGE_HPP
 
 #include <cstddef>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "lege_export.hpp"
 
@@ -22,6 +24,10 @@ public:
   void loadFile(const char *filename, const char *mode = "t",
                 const char *name = "main");
 
+  // Make the files in an archive built by packArchive() available to
+  // loadFile() and loadProject(), in preference to the filesystem
+  void mount(const char *archive);
+
   void loadProject(const char *projectfile);
 
   void setup();
@@ -32,6 +38,33 @@ private:
   EngineImpl *m_impl;
 };
 
+// Build an archive from the given files, optionally compressing them. Entries
+// are named by the path they were given by
+LEGE_EXPORT void packArchive(const char *output,
+                             const std::vector<std::string> &files,
+                             bool compress = false);
+
+struct CookOptions {
+  // The engine's mix rate
+  unsigned rate = 48000;
+  // Integrated loudness to normalize to, in LUFS
+  float loudness = -18.0f;
+  // Highest peak allowed once normalized, in dBFS
+  float peak = -1.0f;
+  // 0 for one per CPU
+  unsigned threads = 0;
+};
+
+// Preprocess audio files in parallel into a directory, to be loaded through
+// the "lege.cooked_audio" option: resampled to the mix rate, converted to the
+// engine's own sample format, normalized, and with loop points found. Files
+// are named by their contents, and listed in the directory's index.txt by the
+// path they were given by. Returns how many were cooked. Throws listing every
+// file that couldn't be, once the others are done
+LEGE_EXPORT std::size_t cookAudio(const char *output,
+                                  const std::vector<std::string> &files,
+                                  const CookOptions &options = {});
+
 } // namespace lege
 
 #endif
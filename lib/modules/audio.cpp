@@ -0,0 +1,2063 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <SDL.h>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <lua.hpp>
+
+#include "audio/acoustics.hpp"
+#include "audio/convolver.hpp"
+#include "audio/effects.hpp"
+#include "audio/mixer.hpp"
+#include "audio/propagation.hpp"
+#include "audio/sound.hpp"
+#include "engine.hpp"
+#include "lua/helpers.hpp"
+
+namespace audio = lege::audio;
+namespace lua = lege::lua;
+
+/**
+ * Sound playback.
+ * Sounds are decoded into memory with `load`, and played through sources,
+ * which set how loud, how fast and where in the world a sound plays. Long
+ * tracks like music should be streamed with `stream` instead, which decodes
+ * them a little at a time on a background thread while they play. Mixing
+ * happens on a dedicated audio thread, so playing sounds never waits for the
+ * sound card. When the engine is headless, or no audio device could be opened,
+ * everything here still works but sources never play.
+ *
+ * Setting the `audio_render` option to a file name (or running with
+ * `--render-audio`) mixes into a 16 bit WAV file instead of a sound card,
+ * headless or not. Each engine frame then mixes a fixed 1/60th of a second of
+ * audio (see the `audio_render_fps` and `audio_render_rate` options) as fast as
+ * possible, so mixes are reproducible and don't need a device.
+ *
+ * WAV and Ogg Vorbis files are supported, and are looked up in mounted
+ * archives first like Lua modules are.
+ *
+ * Sources play into buses, which group them so they can be turned up or down
+ * and run through effects together. Buses play into other buses, and all of
+ * them end up in the `master` bus. Effects are native, and run on the audio
+ * thread: biquad filters, a compressor and limiter, a delay, an algorithmic
+ * reverb, and convolution with recorded impulse responses.
+ * Changes to buses are applied on the audio thread all at once at the end of
+ * each frame, and gains and effect parameters change smoothly, so editing them
+ * while sounds play doesn't click.
+ *
+ * Dense textures of many short sounds, like rain or a crowd, are best played
+ * with an `emitter`, which starts grains on the audio thread rather than
+ * needing a source for each.
+ *
+ * Sources can be occluded by a level's geometry, using acoustics baked from
+ * it with SteamAudio by `lege bake`, loaded by `acoustics` and enabled with
+ * `set_acoustics`. In grid based games, sources can instead be heard around
+ * walls rather than through them, using a `grid` enabled with
+ * `set_propagation`.
+ *
+ * Loaded sounds are cached by path, so loading the same file again is cheap
+ * and shares its memory. Once the cache is over budget (64 MiB by default, or
+ * the `sound_cache_mb` option), the least recently loaded sounds that are no
+ * longer used anywhere are dropped. Setting the `sound_pcm_seconds` option
+ * keeps sounds at least that many seconds long compressed, in about a quarter
+ * of the memory, until they've been loaded or played 16 times; the next load
+ * after that decodes them again at full quality. Compression is lossy, with
+ * roughly 8 bits of precision, so it's off unless the option is set.
+ *
+ * Sounds can be preprocessed with `lege cook`, which resamples them to the mix
+ * rate, normalizes their loudness and finds loop points that don't click.
+ * Setting the `cooked_audio` option to the directory it wrote makes `load`
+ * read the cooked copies, by the same paths, without converting anything.
+ * @usage
+ * local audio = require "lege.audio"
+ * local vec3 = require "lege.vec3"
+ *
+ * local step = audio.load "sounds/step.wav"
+ * audio.play(step, 0.5)
+ *
+ * local music = audio.stream "music/theme.ogg"
+ * music.looping = true
+ * music.position = vec3(-2, 0, 0)
+ * music:play()
+ *
+ * local sfx = audio.bus()
+ * sfx:add(audio.effect("reverb", {room_size = 0.8, wet = 0.2}))
+ * step_source.bus = sfx
+ * @module lege.audio
+ */
+
+using SoundPtr = std::shared_ptr<const audio::Sound>;
+using BusPtr = std::shared_ptr<audio::Bus>;
+using EffectPtr = std::shared_ptr<audio::Effect>;
+using AcousticsPtr = std::shared_ptr<const audio::BakedAcoustics>;
+using GridPtr = std::shared_ptr<audio::PropagationGrid>;
+
+// Registry key of a table of sources started with audio.play(). They're kept
+// there until they finish, rather than being collected while still playing
+#define ONESHOTS_KEY "lege.audio.oneshots"
+// Entries in a parameter block, well beyond how many sources could be heard
+static constexpr lua_Integer MAX_PARAM_BLOCK = 65536;
+
+static audio::Mixer &get_mixer(lua_State *L) {
+  return lege::EngineImpl::fromState(L).getMixer();
+}
+
+static glm::vec3 check_vec3(lua_State *L, int index) {
+  return *lua::check_userdata<glm::vec3>(L, index);
+}
+
+static void push_vec3(lua_State *L, glm::vec3 v) {
+  lua::new_userdata<glm::vec3>(L, v);
+}
+
+// The sample rate effects run at. Without a device they never run, so any
+// rate will do
+static unsigned effect_rate(audio::Mixer &mixer) {
+  return mixer.isStarted() ? mixer.sampleRate() : 48000;
+}
+
+// Converts a time on the audio clock to the frame it falls on. Frame 0 means
+// straight away, so times at or before the start of the clock map to frame 1
+static std::uint64_t to_frame(audio::Mixer &mixer, lua_Number time) {
+  auto frame = std::llround(std::max(time, 0.0) * mixer.sampleRate());
+  return std::max<std::uint64_t>((std::uint64_t)frame, 1);
+}
+
+// Sounds
+
+static int l_sound_tostring(lua_State *L) {
+  const auto &sound = *lua::check_userdata<SoundPtr>(L, 1);
+  lua_pushfstring(L, "sound (%f s): %p", (lua_Number)sound->duration(),
+                  lua_topointer(L, 1));
+  return 1;
+}
+
+static int l_sound_index(lua_State *L) {
+  const auto &sound = *lua::check_userdata<SoundPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "duration") {
+    lua::push(L, (lua_Number)sound->duration());
+  } else if (prop == "frames") {
+    lua::push(L, (lua_Integer)sound->frames());
+  } else if (prop == "channels") {
+    lua::push(L, (lua_Integer)sound->channels);
+  } else if (prop == "rate") {
+    lua::push(L, (lua_Integer)sound->rate);
+  } else if (prop == "compressed") {
+    lua::push(L, sound->isCompressed());
+  } else if (prop == "bytes") {
+    lua::push(L, (lua_Integer)sound->bytes());
+  } else if (prop == "loop_start") {
+    lua::push(L, (lua_Integer)sound->loop_start);
+  } else if (prop == "loop_end") {
+    lua::push(L, (lua_Integer)sound->loopEnd());
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'sound' object",
+                      prop.data());
+  }
+  return 1;
+}
+
+// Sources
+
+static int l_source_tostring(lua_State *L) {
+  auto src = lua::check_userdata<audio::Source>(L, 1);
+  lua_pushfstring(L, "source (%s): %p",
+                  src->isPlaying() ? "playing" : "stopped",
+                  lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * A sound and how to play it.
+ * Sources have the fields:
+ *
+ * - gain: Volume multiplier, defaults to 1
+ * - pitch: Playback speed multiplier, defaults to 1
+ * - position: A `lege.vec3` position in the world, relative to the listener
+ *   set with `set_listener`. Sources further away than 1 unit get quieter.
+ *   Mono sounds are rendered binaurally through SteamAudio's HRTF, so are best
+ *   heard on headphones; stereo sounds are only balanced left and right
+ * - looping: Whether to loop forever, defaults to false
+ * - priority: Sources with a higher priority get voices before lower ones,
+ *   defaults to 0
+ * - playing: Whether the source is playing (read-only)
+ * - virtual: Whether the source is playing but not being heard, because
+ *   louder or higher priority sources are using all the voices (read-only)
+ * - sound: The sound being played, or nil if streamed (read-only)
+ * - bus: The `Bus` the source plays into, defaults to `master`. Setting it to
+ *   nil plays into `master`
+ *
+ * Changes made while the source is playing are sent to the audio thread
+ * together at the end of the frame, and take effect smoothly. A source stops
+ * if it is garbage collected.
+ * @type Source
+ */
+
+/**
+ * Start playing from the beginning, restarting if already playing.
+ * @function Source:play
+ */
+static int l_source_play(lua_State *L) {
+  lua::check_userdata<audio::Source>(L, 1)->play();
+  return 0;
+}
+
+/**
+ * Start playing at a time on the audio clock, to the sample.
+ * Same as `play_at`.
+ * @function Source:play_at
+ * @tparam number time In seconds, as returned by `clock`
+ */
+static int l_source_play_at(lua_State *L);
+
+/**
+ * Stop playing, fading out quickly to avoid a click.
+ * @function Source:stop
+ */
+static int l_source_stop(lua_State *L) {
+  lua::check_userdata<audio::Source>(L, 1)->stop();
+  return 0;
+}
+
+static int l_source_index(lua_State *L) {
+  auto src = lua::check_userdata<audio::Source>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  const auto &params = src->params();
+  if (prop == "gain") {
+    lua::push(L, (lua_Number)params.gain);
+  } else if (prop == "pitch") {
+    lua::push(L, (lua_Number)params.pitch);
+  } else if (prop == "position") {
+    push_vec3(L, params.position);
+  } else if (prop == "looping") {
+    lua_pushboolean(L, params.looping);
+  } else if (prop == "priority") {
+    lua::push(L, (lua_Integer)src->priority());
+  } else if (prop == "playing") {
+    lua_pushboolean(L, src->isPlaying());
+  } else if (prop == "virtual") {
+    lua_pushboolean(L, src->isVirtual());
+  } else if (prop == "sound") {
+    if (src->isStreamed()) {
+      lua_pushnil(L);
+    } else {
+      lua::new_userdata<SoundPtr>(L, src->sound());
+    }
+  } else if (prop == "bus") {
+    lua::new_userdata<BusPtr>(L, src->bus());
+  } else if (prop == "play") {
+    lua_pushcfunction(L, l_source_play);
+  } else if (prop == "play_at") {
+    lua_pushcfunction(L, l_source_play_at);
+  } else if (prop == "stop") {
+    lua_pushcfunction(L, l_source_stop);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'source' object",
+                      prop.data());
+  }
+  return 1;
+}
+
+static int l_source_newindex(lua_State *L) {
+  auto src = lua::check_userdata<audio::Source>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "gain") {
+    lua_Number gain;
+    src->setGain((float)lua::arg(L, 3, gain));
+  } else if (prop == "pitch") {
+    lua_Number pitch;
+    lua::arg(L, 3, pitch);
+    luaL_argcheck(L, pitch >= 0, 3, "pitch must not be negative");
+    src->setPitch((float)pitch);
+  } else if (prop == "position") {
+    src->setPosition(check_vec3(L, 3));
+  } else if (prop == "looping") {
+    bool looping;
+    src->setLooping(lua::arg(L, 3, looping));
+  } else if (prop == "priority") {
+    lua_Integer priority;
+    src->setPriority((int)lua::arg(L, 3, priority));
+  } else if (prop == "bus") {
+    if (lua_isnil(L, 3)) {
+      src->setBus(nullptr);
+    } else {
+      src->setBus(*lua::check_userdata<BusPtr>(L, 3));
+    }
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot set field '%s' on 'source' object",
+                      prop.data());
+  }
+  return 0;
+}
+
+/** @section end */
+
+// Buses
+
+static int l_bus_tostring(lua_State *L) {
+  const auto &bus = *lua::check_userdata<BusPtr>(L, 1);
+  lua_pushfstring(L, "bus (%s): %p", bus->isMaster() ? "master" : "sub",
+                  lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * A group of sources, and the effects they go through.
+ * Buses have the fields:
+ *
+ * - gain: Volume multiplier, defaults to 1
+ * - output: The bus this one plays into, defaults to `master`. Setting it to
+ *   nil plays into `master`. Raises an error if that would make a loop, or for
+ *   the master bus, which has no output
+ * - effects: A list of the bus's effects, in the order sound goes through them
+ *   (read-only, but see `Bus:add`)
+ * - ambisonic_order: 0, 1 or 2, defaults to 0. Above 0, mono sources on the
+ *   bus are mixed into a shared ambisonic sound field of that order, which is
+ *   spatialized once for the whole bus rather than once per source. Much
+ *   cheaper for lots of ambient sounds, like rain or a crowd, but their
+ *   directions are blurrier, more so at order 1
+ * - master: Whether this is the master bus (read-only)
+ *
+ * A bus is kept as long as it's referenced from Lua, or by a source or another
+ * bus.
+ * @type Bus
+ */
+
+/**
+ * Add an effect to the bus.
+ * An effect can only be part of one bus at a time.
+ * @function Bus:add
+ * @tparam Effect effect The effect to add
+ * @tparam[opt] integer index Where in the chain to put it, defaults to the end
+ * @raise If the effect is already part of a bus
+ */
+static int l_bus_add(lua_State *L) {
+  const auto &bus = *lua::check_userdata<BusPtr>(L, 1);
+  const auto &effect = *lua::check_userdata<EffectPtr>(L, 2);
+  lua_Integer index;
+  lua::opt_arg(L, 3, index, (lua_Integer)bus->effects().size() + 1);
+  luaL_argcheck(L, index >= 1, 3, "index must be at least 1");
+  try {
+    bus->insertEffect((std::size_t)(index - 1), effect);
+    return 0;
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+/**
+ * Remove an effect from the bus.
+ * @function Bus:remove
+ * @tparam Effect effect The effect to remove
+ * @treturn boolean Whether the effect was part of the bus
+ */
+static int l_bus_remove(lua_State *L) {
+  const auto &bus = *lua::check_userdata<BusPtr>(L, 1);
+  const auto &effect = *lua::check_userdata<EffectPtr>(L, 2);
+  lua_pushboolean(L, bus->removeEffect(*effect));
+  return 1;
+}
+
+/**
+ * Remove every effect from the bus.
+ * @function Bus:clear
+ */
+static int l_bus_clear(lua_State *L) {
+  (*lua::check_userdata<BusPtr>(L, 1))->clearEffects();
+  return 0;
+}
+
+static int l_bus_index(lua_State *L) {
+  const auto &bus = *lua::check_userdata<BusPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "gain") {
+    lua::push(L, (lua_Number)bus->gain());
+  } else if (prop == "output") {
+    if (bus->output()) {
+      lua::new_userdata<BusPtr>(L, bus->output());
+    } else {
+      lua_pushnil(L);
+    }
+  } else if (prop == "effects") {
+    const auto &effects = bus->effects();
+    lua_createtable(L, (int)effects.size(), 0);
+    for (std::size_t i = 0; i < effects.size(); ++i) {
+      lua::new_userdata<EffectPtr>(L, effects[i]);
+      lua_rawseti(L, -2, (int)i + 1);
+    }
+  } else if (prop == "ambisonic_order") {
+    lua::push(L, (lua_Integer)bus->ambisonicOrder());
+  } else if (prop == "master") {
+    lua_pushboolean(L, bus->isMaster());
+  } else if (prop == "add") {
+    lua_pushcfunction(L, l_bus_add);
+  } else if (prop == "remove") {
+    lua_pushcfunction(L, l_bus_remove);
+  } else if (prop == "clear") {
+    lua_pushcfunction(L, l_bus_clear);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'bus' object", prop.data());
+  }
+  return 1;
+}
+
+static int l_bus_newindex(lua_State *L) {
+  const auto &bus = *lua::check_userdata<BusPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "gain") {
+    lua_Number gain;
+    bus->setGain((float)lua::arg(L, 3, gain));
+  } else if (prop == "output") {
+    BusPtr output;
+    if (!lua_isnil(L, 3)) {
+      output = *lua::check_userdata<BusPtr>(L, 3);
+    }
+    try {
+      bus->setOutput(std::move(output));
+      return 0;
+    } catch (const std::exception &e) {
+      lua_pushstring(L, e.what());
+    }
+    return lua_error(L);
+  } else if (prop == "ambisonic_order") {
+    lua_Integer order;
+    lua::arg(L, 3, order);
+    luaL_argcheck(L, order >= 0 && order <= audio::MAX_AMBISONIC_ORDER, 3,
+                  "ambisonic order must be 0, 1 or 2");
+    bus->setAmbisonicOrder((unsigned)order);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot set field '%s' on 'bus' object", prop.data());
+  }
+  return 0;
+}
+
+/** @section end */
+
+// Effects
+
+static int l_effect_tostring(lua_State *L) {
+  const auto &effect = *lua::check_userdata<EffectPtr>(L, 1);
+  lua_pushfstring(L, "effect (%s): %p", effect->kind(), lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * A native DSP effect, created with `effect`.
+ * Effects have a read-only `kind` field, and a field for each of their
+ * parameters, which are clamped to their ranges when set:
+ *
+ * - lowpass, highpass, bandpass, notch, peak, lowshelf, highshelf: frequency
+ *   in Hz (1000), q (0.7071), and gain in dB for peak and shelf filters (0)
+ * - compressor and limiter: threshold in dB (-18, or -1 for limiter), ratio
+ *   (4, or 100), attack and release in seconds (0.005 and 0.1, or 0.0005 and
+ *   0.05), and makeup gain in dB (0). The limiter is a compressor with faster
+ *   settings
+ * - delay: time in seconds, up to 2 (0.25), feedback (0.3) and mix (0.3)
+ * - reverb: room_size (0.5), damping (0.5), width (1), wet (0.3) and dry (1),
+ *   all between 0 and 1
+ * - convolution: wet (0.3) and dry (1). See `convolver`
+ * @type Effect
+ */
+
+static int l_effect_index(lua_State *L) {
+  const auto &effect = *lua::check_userdata<EffectPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  auto convolver = dynamic_cast<audio::Convolver *>(effect.get());
+  if (prop == "kind") {
+    lua_pushstring(L, effect->kind());
+  } else if (prop == "state" && convolver) {
+    static const char *const STATES[] = {"loading", "ready", "failed"};
+    lua_pushstring(L, STATES[convolver->state()]);
+  } else if (int param = effect->findParam(prop); param >= 0) {
+    lua::push(L, (lua_Number)effect->get((unsigned)param));
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on '%s' effect", prop.data(),
+                      effect->kind());
+  }
+  return 1;
+}
+
+// Sets the parameter named by the key at key_index to the number after it.
+// Effects that have never been part of a bus start at initial values, rather
+// than moving to them
+static void set_param(lua_State *L, audio::Effect &effect, int key_index,
+                      bool initial = false) {
+  std::string_view prop;
+  lua::arg(L, key_index, prop);
+  int param = effect.findParam(prop);
+  if (param < 0) {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    luaL_error(L, "cannot set field '%s' on '%s' effect", prop.data(),
+               effect.kind());
+  }
+  lua_Number value;
+  lua::arg(L, key_index + 1, value);
+  if (initial) {
+    effect.init((unsigned)param, (float)value);
+  } else {
+    effect.set((unsigned)param, (float)value);
+  }
+}
+
+// Sets initial parameters from the table at index, if there is one
+static void set_params(lua_State *L, audio::Effect &effect, int index) {
+  if (lua_isnoneornil(L, index)) {
+    return;
+  }
+  lua_pushnil(L);
+  while (lua_next(L, index)) {
+    // Converting a number key to a string would confuse lua_next()
+    if (lua_type(L, -2) != LUA_TSTRING) {
+      luaL_argerror(L, index, "parameter names must be strings");
+    }
+    set_param(L, effect, lua_gettop(L) - 1, true);
+    lua_pop(L, 1);
+  }
+}
+
+static int l_effect_newindex(lua_State *L) {
+  set_param(L, **lua::check_userdata<EffectPtr>(L, 1), 2);
+  return 0;
+}
+
+/** @section end */
+
+// Acoustics
+
+static int l_acoustics_tostring(lua_State *L) {
+  const auto &acoustics = *lua::check_userdata<AcousticsPtr>(L, 1);
+  lua_pushfstring(L, "acoustics (%d probes): %p",
+                  (int)acoustics->probeCount(), lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * Acoustics baked from a level's geometry, created with `acoustics`.
+ * Acoustics have a read-only `probes` field: how many points sound was
+ * simulated between. Anywhere more than a few probe spacings from every probe
+ * is treated as out in the open.
+ * @type Acoustics
+ */
+
+/**
+ * Find out how much sound gets from one point to another.
+ * Sound is occluded when there's geometry in the way, but some of it is
+ * transmitted through, depending on the geometry's materials. The gain is
+ * what sources playing at source are multiplied by while the listener is at
+ * listener and these acoustics are set with `set_acoustics`.
+ * @function Acoustics:occlusion
+ * @tparam lege.vec3 listener Where the sound is heard
+ * @tparam lege.vec3 source Where the sound is made
+ * @treturn number The overall gain, between 0 and 1
+ * @treturn number The fraction of the sound that gets around the geometry
+ * @treturn number The fraction of the rest transmitted through it at low
+ * frequencies
+ * @treturn number The same at mid frequencies
+ * @treturn number The same at high frequencies
+ */
+static int l_acoustics_occlusion(lua_State *L) {
+  const auto &acoustics = *lua::check_userdata<AcousticsPtr>(L, 1);
+  audio::DirectPath path =
+      acoustics->direct(acoustics->weigh(check_vec3(L, 2)),
+                        acoustics->weigh(check_vec3(L, 3)));
+  lua::push(L, (lua_Number)path.gain());
+  lua::push(L, (lua_Number)path.occlusion);
+  for (float t : path.transmission) {
+    lua::push(L, (lua_Number)t);
+  }
+  return 5;
+}
+
+/**
+ * Find out how long sound reverberates around a point, E.G. to set up a
+ * reverb effect for wherever the listener is.
+ * @function Acoustics:reverb
+ * @tparam lege.vec3 point Where to look
+ * @treturn number The time reverb takes to fall by 60 dB at low frequencies,
+ * in seconds, or 0 out in the open
+ * @treturn number The same at mid frequencies
+ * @treturn number The same at high frequencies
+ */
+static int l_acoustics_reverb(lua_State *L) {
+  const auto &acoustics = *lua::check_userdata<AcousticsPtr>(L, 1);
+  for (float t : acoustics->reverbTimes(acoustics->weigh(check_vec3(L, 2)))) {
+    lua::push(L, (lua_Number)t);
+  }
+  return 3;
+}
+
+static int l_acoustics_index(lua_State *L) {
+  const auto &acoustics = *lua::check_userdata<AcousticsPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "probes") {
+    lua::push(L, (lua_Integer)acoustics->probeCount());
+  } else if (prop == "occlusion") {
+    lua_pushcfunction(L, l_acoustics_occlusion);
+  } else if (prop == "reverb") {
+    lua_pushcfunction(L, l_acoustics_reverb);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'acoustics' object",
+                      prop.data());
+  }
+  return 1;
+}
+
+/** @section end */
+
+// Propagation grids
+
+static int l_grid_tostring(lua_State *L) {
+  const auto &grid = *lua::check_userdata<GridPtr>(L, 1);
+  lua_pushfstring(L, "grid (%dx%d): %p", (int)grid->width(),
+                  (int)grid->depth(), lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * A grid of open and walled cells that sound travels through, created with
+ * `grid`.
+ * Grids have the fields:
+ *
+ * - width, depth: How many cells the grid has along x and z (read-only)
+ * - cell_size: How big each cell is (read-only)
+ * - range: How far sound can travel along a path before it's silent,
+ *   defaults to unlimited (math.huge). Smaller ranges make grids cheaper to
+ *   search
+ * - max_fields: How many source cells' paths are kept, defaults to 64
+ * - builds: How many times paths from a cell have been searched (read-only)
+ *
+ * The first time a source is heard from a cell, paths from there to every
+ * other cell are searched and kept, so from then on finding its path is a
+ * table lookup. Opening or closing a cell only throws away the searches that
+ * reached it.
+ * @type Grid
+ */
+
+// Checks a 1-based cell position at index and index + 1
+static std::pair<unsigned, unsigned>
+check_cell(lua_State *L, int index, const audio::PropagationGrid &g) {
+  lua_Integer x, z;
+  lua::arg(L, index, x);
+  lua::arg(L, index + 1, z);
+  luaL_argcheck(L, x >= 1 && x <= g.width(), index, "x is off the grid");
+  luaL_argcheck(L, z >= 1 && z <= g.depth(), index + 1, "z is off the grid");
+  return {(unsigned)x - 1, (unsigned)z - 1};
+}
+
+/**
+ * Open or wall off a cell, E.G. when a door opens or closes.
+ * @function Grid:set_open
+ * @tparam integer x The cell's column, from 1
+ * @tparam integer z The cell's row, from 1
+ * @tparam boolean open Whether sound can pass through the cell
+ */
+static int l_grid_set_open(lua_State *L) {
+  const auto &grid = *lua::check_userdata<GridPtr>(L, 1);
+  auto [x, z] = check_cell(L, 2, *grid);
+  luaL_checktype(L, 4, LUA_TBOOLEAN);
+  grid->setOpen(x, z, lua_toboolean(L, 4));
+  return 0;
+}
+
+/**
+ * Check whether a cell is open.
+ * @function Grid:is_open
+ * @tparam integer x The cell's column, from 1
+ * @tparam integer z The cell's row, from 1
+ * @treturn boolean Whether sound can pass through the cell
+ */
+static int l_grid_is_open(lua_State *L) {
+  const auto &grid = *lua::check_userdata<GridPtr>(L, 1);
+  auto [x, z] = check_cell(L, 2, *grid);
+  lua_pushboolean(L, grid->isOpen(x, z));
+  return 1;
+}
+
+/**
+ * Find how sound gets from one point to another around the grid's walls.
+ * @function Grid:path
+ * @tparam lege.vec3 source Where the sound is made
+ * @tparam lege.vec3 listener Where it's heard
+ * @treturn number How far the sound travels, or math.huge if it can't get
+ * there. Nil if either point is off the grid or inside a wall
+ * @treturn lege.vec3 Where the sound seems to come from: the last corner it
+ * comes around, or the source if the listener can see it
+ */
+static int l_grid_path(lua_State *L) {
+  const auto &grid = *lua::check_userdata<GridPtr>(L, 1);
+  auto path = grid->path(check_vec3(L, 2), check_vec3(L, 3));
+  if (!path) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua::push(L, (lua_Number)path->distance);
+  push_vec3(L, path->apparent);
+  return 2;
+}
+
+static int l_grid_index(lua_State *L) {
+  const auto &grid = *lua::check_userdata<GridPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "width") {
+    lua::push(L, (lua_Integer)grid->width());
+  } else if (prop == "depth") {
+    lua::push(L, (lua_Integer)grid->depth());
+  } else if (prop == "cell_size") {
+    lua::push(L, (lua_Number)grid->cellSize());
+  } else if (prop == "range") {
+    lua::push(L, (lua_Number)grid->range());
+  } else if (prop == "max_fields") {
+    lua::push(L, (lua_Integer)grid->maxFields());
+  } else if (prop == "builds") {
+    lua::push(L, (lua_Number)grid->stats().builds);
+  } else if (prop == "set_open") {
+    lua_pushcfunction(L, l_grid_set_open);
+  } else if (prop == "is_open") {
+    lua_pushcfunction(L, l_grid_is_open);
+  } else if (prop == "path") {
+    lua_pushcfunction(L, l_grid_path);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'grid' object",
+                      prop.data());
+  }
+  return 1;
+}
+
+static int l_grid_newindex(lua_State *L) {
+  const auto &grid = *lua::check_userdata<GridPtr>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "range") {
+    lua_Number range;
+    grid->setRange((float)lua::arg(L, 3, range));
+  } else if (prop == "max_fields") {
+    lua_Integer fields;
+    lua::arg(L, 3, fields);
+    luaL_argcheck(L, fields >= 1, 3, "must be at least 1");
+    grid->setMaxFields((std::size_t)fields);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot set field '%s' on 'grid' object",
+                      prop.data());
+  }
+  return 0;
+}
+
+/** @section end */
+
+// Emitters
+
+static int l_emitter_tostring(lua_State *L) {
+  auto emitter = lua::check_userdata<audio::Emitter>(L, 1);
+  lua_pushfstring(L, "emitter (%s): %p",
+                  emitter->isPlaying() ? "playing" : "stopped",
+                  lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * A granular emitter, for dense textures like rain, footsteps on gravel or
+ * crowds.
+ * While it plays, it keeps starting grains: sounds picked at random from its
+ * pool, at random times, each a little different. Grains are started and mixed
+ * on the audio thread, so hundreds a second cost no more than mixing them, and
+ * don't need a source each.
+ * Emitters have the fields:
+ *
+ * - rate: Grains started per second on average, defaults to 10, up to 1000
+ * - gain: Volume multiplier, defaults to 1
+ * - gain_spread: Each grain is quieter than `gain` by a random fraction up to
+ *   this, between 0 and 1, defaults to 0
+ * - pitch: Playback speed multiplier, defaults to 1
+ * - pitch_spread: Each grain is pitched up or down at random by up to this
+ *   many semitones, defaults to 0
+ * - position: A `lege.vec3` position in the world
+ * - position_spread: Each grain plays from a random point up to this far from
+ *   `position`, defaults to 0
+ * - bus: The `Bus` grains play into, defaults to `master`. Setting it to nil
+ *   plays into `master`. Grains are panned, or spatialized binaurally if the
+ *   bus has an `ambisonic_order`
+ * - playing: Whether the emitter is playing (read-only)
+ *
+ * Changes take effect on grains that start after them, at the end of the
+ * frame. Grains aren't occluded. An emitter stops if it is garbage collected.
+ * @type Emitter
+ */
+
+/**
+ * Start starting grains. Does nothing if already playing.
+ * @function Emitter:play
+ * @raise If 32 emitters are already playing
+ */
+static int l_emitter_play(lua_State *L) {
+  auto emitter = lua::check_userdata<audio::Emitter>(L, 1);
+  try {
+    emitter->play();
+    return 0;
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+/**
+ * Stop starting grains. Grains already playing carry on to the end.
+ * @function Emitter:stop
+ */
+static int l_emitter_stop(lua_State *L) {
+  lua::check_userdata<audio::Emitter>(L, 1)->stop();
+  return 0;
+}
+
+static int l_emitter_index(lua_State *L) {
+  auto emitter = lua::check_userdata<audio::Emitter>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  const auto &params = emitter->params();
+  if (prop == "rate") {
+    lua::push(L, (lua_Number)params.rate);
+  } else if (prop == "gain") {
+    lua::push(L, (lua_Number)params.gain);
+  } else if (prop == "gain_spread") {
+    lua::push(L, (lua_Number)params.gain_spread);
+  } else if (prop == "pitch") {
+    lua::push(L, (lua_Number)params.pitch);
+  } else if (prop == "pitch_spread") {
+    lua::push(L, (lua_Number)params.pitch_spread);
+  } else if (prop == "position") {
+    push_vec3(L, params.position);
+  } else if (prop == "position_spread") {
+    lua::push(L, (lua_Number)params.position_spread);
+  } else if (prop == "bus") {
+    lua::new_userdata<BusPtr>(L, emitter->bus());
+  } else if (prop == "playing") {
+    lua_pushboolean(L, emitter->isPlaying());
+  } else if (prop == "play") {
+    lua_pushcfunction(L, l_emitter_play);
+  } else if (prop == "stop") {
+    lua_pushcfunction(L, l_emitter_stop);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'emitter' object",
+                      prop.data());
+  }
+  return 1;
+}
+
+// Sets the field named by the key at key_index to the value after it
+static void set_emitter_field(lua_State *L, audio::Emitter &emitter,
+                              int key_index) {
+  std::string_view prop;
+  lua::arg(L, key_index, prop);
+  const int value = key_index + 1;
+  lua_Number n;
+  if (prop == "position") {
+    emitter.setPosition(check_vec3(L, value));
+  } else if (prop == "bus") {
+    if (lua_isnil(L, value)) {
+      emitter.setBus(nullptr);
+    } else {
+      emitter.setBus(*lua::check_userdata<BusPtr>(L, value));
+    }
+  } else if (prop == "rate") {
+    lua::arg(L, value, n);
+    luaL_argcheck(L, n >= 0, value, "rate must not be negative");
+    emitter.setRate((float)n);
+  } else if (prop == "gain") {
+    emitter.setGain((float)lua::arg(L, value, n));
+  } else if (prop == "gain_spread") {
+    lua::arg(L, value, n);
+    luaL_argcheck(L, n >= 0 && n <= 1, value,
+                  "gain spread must be between 0 and 1");
+    emitter.setGainSpread((float)n);
+  } else if (prop == "pitch") {
+    lua::arg(L, value, n);
+    luaL_argcheck(L, n > 0, value, "pitch must be positive");
+    emitter.setPitch((float)n);
+  } else if (prop == "pitch_spread") {
+    lua::arg(L, value, n);
+    luaL_argcheck(L, n >= 0, value, "pitch spread must not be negative");
+    emitter.setPitchSpread((float)n);
+  } else if (prop == "position_spread") {
+    lua::arg(L, value, n);
+    luaL_argcheck(L, n >= 0, value, "position spread must not be negative");
+    emitter.setPositionSpread((float)n);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    luaL_error(L, "cannot set field '%s' on 'emitter' object", prop.data());
+  }
+}
+
+static int l_emitter_newindex(lua_State *L) {
+  set_emitter_field(L, *lua::check_userdata<audio::Emitter>(L, 1), 2);
+  return 0;
+}
+
+/** @section end */
+
+// Parameter blocks
+
+// The FFI type of a parameter block's entries, which must match
+// audio::BlockParams
+static const char PARAMS_CDEF[] =
+    "typedef struct { float gain, pitch, x, y, z; } lege_source_params;";
+static_assert(sizeof(audio::BlockParams) == 5 * sizeof(float));
+
+static int l_param_block_tostring(lua_State *L) {
+  auto block = lua::check_userdata<audio::ParamBlock>(L, 1);
+  lua_pushfstring(L, "param block (%d): %p", (int)block->size(),
+                  lua_topointer(L, 1));
+  return 1;
+}
+
+/**
+ * An array of source parameters that scripts write to directly, for moving
+ * lots of sources every frame without calling into C for each one.
+ * Parameter blocks have the fields:
+ *
+ * - params: The entries, as a LuaJIT FFI array of structs with the fields
+ *   gain, pitch, x, y and z, indexed from 0. Writing to it costs no more
+ *   than writing to any other FFI array. Once per frame, entries that changed
+ *   are applied to the sources bound to them, and the rest are updated from
+ *   their sources, so they can be read too. The array must not be used once
+ *   the block is garbage collected
+ * - size: How many entries there are (read-only)
+ *
+ * Binding a source doesn't keep it alive. A source that is garbage collected
+ * leaves its entry unbound.
+ * @type ParamBlock
+ */
+
+/**
+ * Bind a source to an entry, which is then set to the source's parameters.
+ * A source can only be bound to one entry at a time.
+ * @function ParamBlock:bind
+ * @tparam integer index The entry, from 0 like `params`
+ * @tparam Source|nil source The source to bind, or nil to leave the entry
+ * unbound
+ */
+static int l_param_block_bind(lua_State *L) {
+  auto block = lua::check_userdata<audio::ParamBlock>(L, 1);
+  lua_Integer index;
+  lua::arg(L, 2, index);
+  luaL_argcheck(L, index >= 0 && (std::size_t)index < block->size(), 2,
+                "index out of range");
+  audio::Source *src = nullptr;
+  if (!lua_isnoneornil(L, 3)) {
+    src = lua::check_userdata<audio::Source>(L, 3);
+  }
+  block->bind((std::size_t)index, src);
+  return 0;
+}
+
+static int l_param_block_index(lua_State *L) {
+  auto block = lua::check_userdata<audio::ParamBlock>(L, 1);
+  std::string_view prop;
+  lua::arg(L, 2, prop);
+  if (prop == "params") {
+    lua_getfenv(L, 1);
+    lua_getfield(L, -1, "params");
+  } else if (prop == "size") {
+    lua::push(L, (lua_Integer)block->size());
+  } else if (prop == "bind") {
+    lua_pushcfunction(L, l_param_block_bind);
+  } else {
+    // prop.data() *is* nul-terminated because it came from a Lua string
+    return luaL_error(L, "cannot get field '%s' on 'param block' object",
+                      prop.data());
+  }
+  return 1;
+}
+
+/** @section end */
+
+// Reads a number field of the table at index into value, if it's set
+static void opt_field(lua_State *L, int index, const char *name,
+                      float &value) {
+  lua_getfield(L, index, name);
+  if (!lua_isnil(L, -1)) {
+    if (!lua_isnumber(L, -1)) {
+      luaL_error(L, "field '%s' must be a number", name);
+    }
+    value = (float)lua_tonumber(L, -1);
+  }
+  lua_pop(L, 1);
+}
+
+// Reads a per band field of the table at index, either one number for every
+// band or a list of 3, if it's set
+static void opt_bands(lua_State *L, int index, const char *name,
+                      std::array<float, 3> &bands) {
+  lua_getfield(L, index, name);
+  if (lua_isnumber(L, -1)) {
+    bands.fill((float)lua_tonumber(L, -1));
+  } else if (lua_istable(L, -1) && lua_objlen(L, -1) == 3) {
+    for (int i = 0; i < 3; ++i) {
+      lua_rawgeti(L, -1, i + 1);
+      if (!lua_isnumber(L, -1)) {
+        luaL_error(L, "field '%s' must be a list of 3 numbers", name);
+      }
+      bands[i] = (float)lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+  } else if (!lua_isnil(L, -1)) {
+    luaL_error(L, "field '%s' must be a number or a list of 3 numbers", name);
+  }
+  lua_pop(L, 1);
+}
+
+// Reads a list of 1-based indices from a field of the table at index, as
+// 0-based indices less than limit
+static std::vector<std::uint32_t> check_indices(lua_State *L, int index,
+                                                const char *name,
+                                                std::size_t limit) {
+  lua_getfield(L, index, name);
+  std::vector<std::uint32_t> res;
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return res;
+  }
+  luaL_argcheck(L, lua_istable(L, -1), index,
+                fmt::format("{} must be a list", name).c_str());
+  res.resize(lua_objlen(L, -1));
+  for (std::size_t i = 0; i < res.size(); ++i) {
+    lua_rawgeti(L, -1, (int)i + 1);
+    lua_Number n = lua_tonumber(L, -1);
+    if (!(n >= 1 && n <= (lua_Number)limit)) {
+      luaL_argerror(
+          L, index,
+          fmt::format("{} must be between 1 and {}", name, limit).c_str());
+    }
+    res[i] = (std::uint32_t)n - 1;
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return res;
+}
+
+static audio::AcousticGeometry check_geometry(lua_State *L, int index) {
+  luaL_checktype(L, index, LUA_TTABLE);
+  audio::AcousticGeometry geometry;
+  lua_getfield(L, index, "vertices");
+  luaL_argcheck(L, lua_istable(L, -1), index, "vertices must be a list");
+  geometry.vertices.resize(lua_objlen(L, -1));
+  for (std::size_t i = 0; i < geometry.vertices.size(); ++i) {
+    lua_rawgeti(L, -1, (int)i + 1);
+    auto v = lua::test_userdata<glm::vec3>(L, -1);
+    luaL_argcheck(L, v, index, "vertices must be a list of vec3s");
+    geometry.vertices[i] = *v;
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "materials");
+  if (!lua_isnil(L, -1)) {
+    luaL_argcheck(L, lua_istable(L, -1), index, "materials must be a list");
+    geometry.materials.resize(lua_objlen(L, -1));
+    for (std::size_t i = 0; i < geometry.materials.size(); ++i) {
+      lua_rawgeti(L, -1, (int)i + 1);
+      luaL_argcheck(L, lua_istable(L, -1), index,
+                    "materials must be a list of tables");
+      auto &m = geometry.materials[i];
+      int material = lua_gettop(L);
+      opt_bands(L, material, "absorption", m.absorption);
+      opt_field(L, material, "scattering", m.scattering);
+      opt_bands(L, material, "transmission", m.transmission);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+
+  auto indices =
+      check_indices(L, index, "triangles", geometry.vertices.size());
+  luaL_argcheck(L, indices.size() % 3 == 0, index,
+                "triangles must have 3 vertices each");
+  geometry.triangles.resize(indices.size() / 3);
+  for (std::size_t i = 0; i < geometry.triangles.size(); ++i) {
+    std::copy_n(&indices[i * 3], 3, geometry.triangles[i].begin());
+  }
+  geometry.triangle_materials =
+      check_indices(L, index, "triangle_materials",
+                    std::max<std::size_t>(geometry.materials.size(), 1));
+  return geometry;
+}
+
+static audio::BakeSettings opt_bake_settings(lua_State *L, int index) {
+  audio::BakeSettings settings;
+  if (lua_isnoneornil(L, index)) {
+    return settings;
+  }
+  luaL_checktype(L, index, LUA_TTABLE);
+  opt_field(L, index, "spacing", settings.spacing);
+  opt_field(L, index, "height", settings.height);
+  float rays = (float)settings.rays, bounces = (float)settings.bounces;
+  opt_field(L, index, "rays", rays);
+  opt_field(L, index, "bounces", bounces);
+  opt_field(L, index, "duration", settings.duration);
+  luaL_argcheck(L, settings.spacing > 0.0f, index, "spacing must be positive");
+  luaL_argcheck(L, rays >= 1.0f && bounces >= 1.0f, index,
+                "rays and bounces must be at least 1");
+  luaL_argcheck(L, settings.duration > 0.0f, index,
+                "duration must be positive");
+  settings.rays = (unsigned)rays;
+  settings.bounces = (unsigned)bounces;
+  return settings;
+}
+
+/**
+ * Load and decode a sound, or get it from the cache.
+ * @function load
+ * @tparam string filename The file to load
+ * @treturn Sound The decoded sound. Sounds have the read-only fields
+ * `duration` (in seconds), `frames`, `channels`, `rate`, `compressed`,
+ * `bytes` (the memory it uses), and `loop_start` and `loop_end` (in frames,
+ * where looping sources jump back from and to)
+ * @raise If the file could not be read or decoded
+ */
+static int l_load(lua_State *L) {
+  std::string filename(luaL_checkstring(L, 1));
+  auto &e = lege::EngineImpl::fromState(L);
+  SoundPtr sound;
+  try {
+    sound = e.getSoundCache().get(filename, [&e](const char *path) {
+      auto buf = e.readFile(e.soundPath(path).c_str());
+      return audio::decode(buf.get(), buf.size, path);
+    });
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  if (!sound) {
+    return lua_error(L);
+  }
+  lua::new_userdata<SoundPtr>(L, std::move(sound));
+  return 1;
+}
+
+/**
+ * Create a source that plays a sound.
+ * @function source
+ * @tparam Sound sound The sound to play
+ * @treturn Source A new, stopped source
+ */
+static int l_source(lua_State *L) {
+  const auto &sound = *lua::check_userdata<SoundPtr>(L, 1);
+  lua::new_userdata<audio::Source>(L, get_mixer(L), sound);
+  return 1;
+}
+
+/**
+ * Create a source that streams a file.
+ * The file is opened again each time the source is played, and only a
+ * fraction of a second of it is decoded ahead of what's playing, so memory use
+ * doesn't depend on how long it is. Errors opening or decoding the file are
+ * logged, and stop the source.
+ * @function stream
+ * @tparam string filename The file to stream
+ * @treturn Source A new, stopped source
+ */
+static int l_stream(lua_State *L) {
+  std::string filename(luaL_checkstring(L, 1));
+  auto &e = lege::EngineImpl::fromState(L);
+  lua::new_userdata<audio::Source>(L, e.getMixer(), [&e, filename] {
+    return audio::open_decoder(e.openFile(filename.c_str()), filename.c_str());
+  });
+  return 1;
+}
+
+/**
+ * Create a granular emitter.
+ * @function emitter
+ * @tparam {Sound,...} sounds The pool grains are picked from, usually short
+ * sounds like single raindrops or footsteps
+ * @tparam[opt] table params Fields to set. See `Emitter`
+ * @treturn Emitter A new, stopped emitter
+ * @raise If there are no sounds, or any are empty
+ * @usage
+ * local drops = {}
+ * for i = 1, 8 do
+ *   drops[i] = audio.load("sounds/rain/drop" .. i .. ".wav")
+ * end
+ * local rain = audio.emitter(drops, {
+ *   rate = 300, gain = 0.3, gain_spread = 0.8, pitch_spread = 3,
+ *   position_spread = 10,
+ * })
+ * rain:play()
+ */
+static int l_emitter(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  std::vector<SoundPtr> sounds(lua_objlen(L, 1));
+  luaL_argcheck(L, !sounds.empty(), 1, "must have at least one sound");
+  for (std::size_t i = 0; i < sounds.size(); ++i) {
+    lua_rawgeti(L, 1, (int)i + 1);
+    auto sound = lua::test_userdata<SoundPtr>(L, -1);
+    luaL_argcheck(L, sound, 1, "must be a list of sounds");
+    luaL_argcheck(L, (*sound)->frames() > 0, 1, "sounds must not be empty");
+    sounds[i] = *sound;
+    lua_pop(L, 1);
+  }
+  // Checked above, as the constructor throwing would leave the userdata's
+  // finalizer destroying an object that was never constructed
+  auto emitter =
+      lua::new_userdata<audio::Emitter>(L, get_mixer(L), std::move(sounds));
+  if (!lua_isnoneornil(L, 2)) {
+    lua_pushnil(L);
+    while (lua_next(L, 2)) {
+      // Converting a number key to a string would confuse lua_next()
+      if (lua_type(L, -2) != LUA_TSTRING) {
+        luaL_argerror(L, 2, "field names must be strings");
+      }
+      set_emitter_field(L, *emitter, lua_gettop(L) - 1);
+      lua_pop(L, 1);
+    }
+  }
+  return 1;
+}
+
+/**
+ * Create a block of source parameters for scripts to write to directly.
+ * @function param_block
+ * @tparam integer size How many sources it has room for
+ * @treturn ParamBlock A new block, with no sources bound
+ */
+static int l_param_block(lua_State *L) {
+  lua_Integer size;
+  lua::arg(L, 1, size);
+  luaL_argcheck(L, size >= 1 && size <= MAX_PARAM_BLOCK, 1,
+                "size out of range");
+  auto block = lua::new_userdata<audio::ParamBlock>(L, get_mixer(L),
+                                                    (std::size_t)size);
+  // Holds the FFI view of the entries
+  lua_createtable(L, 0, 1);
+  lua_getglobal(L, "require");
+  lua_pushliteral(L, "ffi");
+  lua_call(L, 1, 1);
+  lua_getfield(L, -1, "cast");
+  lua_pushliteral(L, "lege_source_params *");
+  lua_pushlightuserdata(L, block->data());
+  lua_call(L, 2, 1);
+  lua_setfield(L, -3, "params");
+  lua_pop(L, 1);
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+/**
+ * Play a sound once, without needing to keep a source around.
+ * @function play
+ * @tparam Sound sound The sound to play
+ * @tparam[opt=1] number gain Volume multiplier
+ * @treturn Source The source playing the sound
+ */
+static int l_play(lua_State *L) {
+  const auto &sound = *lua::check_userdata<SoundPtr>(L, 1);
+  lua_Number gain;
+  lua::opt_arg(L, 2, gain, 1.0);
+
+  // Forget finished one-shots
+  lua_getfield(L, LUA_REGISTRYINDEX, ONESHOTS_KEY);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pop(L, 1);
+    if (!lua::check_userdata<audio::Source>(L, -1)->isPlaying()) {
+      // Setting existing fields to nil during traversal is allowed
+      lua_pushvalue(L, -1);
+      lua_pushnil(L);
+      lua_rawset(L, -4);
+    }
+  }
+
+  auto src = lua::new_userdata<audio::Source>(L, get_mixer(L), sound);
+  src->setGain((float)gain);
+  src->play();
+  if (src->isPlaying()) {
+    lua_pushvalue(L, -1);
+    lua_pushboolean(L, true);
+    lua_rawset(L, -4);
+  }
+  return 1;
+}
+
+/**
+ * Get the time on the audio clock.
+ * The clock counts the audio sent to the sound card, so it advances in steps
+ * of one device buffer (usually about 10 ms) and is unaffected by frame rate
+ * hitches. When rendering offline it counts the audio rendered so far.
+ * @function clock
+ * @treturn number Seconds since audio started, or 0 if there is no audio
+ * device
+ */
+static int l_clock(lua_State *L) {
+  auto &mixer = get_mixer(L);
+  lua_Number time = 0.0;
+  if (mixer.isStarted()) {
+    time = (lua_Number)mixer.clock() / mixer.sampleRate();
+  }
+  lua::push(L, time);
+  return 1;
+}
+
+/**
+ * Start a source at a time on the audio clock, to the sample, however long
+ * frames take. Restarts the source if it's already playing. A time in the past
+ * starts the source part way through, as if it had started on time, so
+ * sources keep in step even if they're scheduled late. Streams start as soon
+ * as possible instead.
+ * @function play_at
+ * @tparam Source source The source to play
+ * @tparam number time In seconds, as returned by `clock`
+ * @usage
+ * -- A beat every half a second, whatever the frame rate
+ * local next_beat = audio.clock() + 0.1
+ * while true do
+ *   audio.play_at(beat, next_beat)
+ *   next_beat = next_beat + 0.5
+ *   -- Schedule each beat a little ahead
+ *   while audio.clock() < next_beat - 0.1 do
+ *     coroutine.yield()
+ *   end
+ * end
+ */
+static int l_source_play_at(lua_State *L) {
+  auto src = lua::check_userdata<audio::Source>(L, 1);
+  lua_Number time;
+  lua::arg(L, 2, time);
+  src->playAt(to_frame(get_mixer(L), time));
+  return 0;
+}
+
+/**
+ * Start several sources at exactly the same time.
+ * @function play_group
+ * @tparam {Source,...} sources The sources to play
+ * @tparam[opt] number time When to start them, in seconds on the audio clock.
+ * Defaults to the soonest time they're all sure to make
+ * @treturn number The time they start at, or nil if there is no audio device
+ */
+static int l_play_group(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  auto &mixer = get_mixer(L);
+  std::uint64_t frame;
+  if (lua_isnoneornil(L, 2)) {
+    frame = mixer.earliestStart();
+  } else {
+    lua_Number time;
+    lua::arg(L, 2, time);
+    frame = to_frame(mixer, time);
+  }
+  // Check them all first, so that either all of them play or none do
+  int count = (int)lua_objlen(L, 1);
+  for (int i = 1; i <= count; ++i) {
+    lua_rawgeti(L, 1, i);
+    if (!lua::test_userdata<audio::Source>(L, -1)) {
+      return luaL_argerror(L, 1, "expected a list of sources");
+    }
+    lua_pop(L, 1);
+  }
+  for (int i = 1; i <= count; ++i) {
+    lua_rawgeti(L, 1, i);
+    lua::test_userdata<audio::Source>(L, -1)->playAt(frame);
+    lua_pop(L, 1);
+  }
+  if (!mixer.isStarted()) {
+    lua_pushnil(L);
+  } else {
+    lua::push(L, (lua_Number)frame / mixer.sampleRate());
+  }
+  return 1;
+}
+
+/**
+ * Create a bus.
+ * @function bus
+ * @tparam[opt] Bus output The bus to play into, defaults to `master`
+ * @treturn Bus The new bus, with no effects
+ * @raise If there are already 32 buses, including `master`
+ */
+static int l_bus(lua_State *L) {
+  BusPtr output;
+  if (!lua_isnoneornil(L, 1)) {
+    output = *lua::check_userdata<BusPtr>(L, 1);
+  }
+  try {
+    lua::new_userdata<BusPtr>(L, get_mixer(L).createBus(std::move(output)));
+    return 1;
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+/**
+ * Create an effect, to add to a bus.
+ * @function effect
+ * @tparam string kind "lowpass", "highpass", "bandpass", "notch", "peak",
+ * "lowshelf", "highshelf", "compressor", "limiter", "delay" or "reverb"
+ * @tparam[opt] table params Parameters to set, by name. See `Effect`
+ * @treturn Effect The new effect
+ * @raise If the kind or a parameter is unknown
+ * @usage
+ * local muffle = audio.effect("lowpass", {frequency = 400})
+ * music_bus:add(muffle)
+ * -- Later, smoothly
+ * muffle.frequency = 20000
+ */
+static int l_effect(lua_State *L) {
+  std::string_view kind;
+  lua::arg(L, 1, kind);
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  EffectPtr effect;
+  try {
+    effect = audio::make_effect(kind, effect_rate(get_mixer(L)));
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  if (!effect) {
+    return lua_error(L);
+  }
+  set_params(L, **lua::new_userdata<EffectPtr>(L, std::move(effect)), 2);
+  return 1;
+}
+
+/**
+ * Create a convolution reverb, to add to a bus.
+ * Convolution plays sound through a recording of a real space: an impulse
+ * response, such as a balloon pop or sine sweep recorded in a cathedral. Mono
+ * and stereo impulse responses of up to 10 seconds are supported, and they
+ * are normalized so that rooms of any size are about as loud.
+ *
+ * The impulse response is loaded and prepared on a worker thread, so this
+ * returns straight away. Until it's ready, only the dry signal is heard.
+ * Errors loading it are logged, and leave the effect's `state` "failed".
+ *
+ * Convolution has the parameters wet (0.3) and dry (1), both between 0 and 1,
+ * and the wet signal is about 11 ms late. It costs the same however many
+ * sources play into the bus, so use one per bus rather than per source.
+ * @function convolver
+ * @tparam string|Sound impulse A file to load, or a loaded sound
+ * @tparam[opt] table params Parameters to set, by name
+ * @treturn Effect The new effect, of kind "convolution". It also has a
+ * read-only `state` field: "loading", "ready" or "failed"
+ * @usage
+ * local hall = audio.convolver("impulses/hall.ogg", {wet = 0.4})
+ * audio.master:add(hall)
+ */
+static int l_convolver(lua_State *L) {
+  auto &e = lege::EngineImpl::fromState(L);
+  audio::ImpulseLoader::LoadFunc load;
+  if (lua_type(L, 1) == LUA_TSTRING) {
+    std::string filename(lua_tostring(L, 1));
+    load = [&e, filename] {
+      auto buf = e.readFile(filename.c_str());
+      return audio::decode(buf.get(), buf.size, filename.c_str());
+    };
+  } else if (auto sound = lua::test_userdata<SoundPtr>(L, 1)) {
+    load = [sound = *sound] { return sound; };
+  } else {
+    return luaL_typerror(L, 1, "string or sound");
+  }
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  auto &mixer = e.getMixer();
+  auto convolver = std::make_shared<audio::Convolver>(effect_rate(mixer));
+  mixer.loadImpulse(convolver, std::move(load));
+  set_params(L, **lua::new_userdata<EffectPtr>(L, std::move(convolver)), 2);
+  return 1;
+}
+
+/**
+ * Get the baked acoustics for a level.
+ * Baking places probes above every upward facing surface, then SteamAudio
+ * simulates how sound travels between every pair of them, and how it
+ * reverberates around each. That can take minutes for big levels, so it's
+ * done ahead of time by `lege bake <script>`, which runs the script with the
+ * project loaded and bakes whatever acoustics it asks for. The results are
+ * saved to files named after a hash of the geometry and settings, in the
+ * directory set by the `acoustics_cache` option (the working directory by
+ * default), which games only map into memory. Changing the geometry or
+ * settings means baking them again.
+ *
+ * The geometry is a table with the fields:
+ *
+ * - vertices: A list of `lege.vec3`s
+ * - triangles: A flat list of indices into vertices, 3 per triangle, wound
+ *   anticlockwise seen from the front
+ * - materials (optional): A list of tables, each with absorption,
+ *   scattering and transmission fields between 0 and 1. Absorption and
+ *   transmission are either one number, or a list of 3 for low, mid and high
+ *   frequencies. Missing fields default to a generic material's
+ * - triangle_materials (optional): A list of indices into materials, one per
+ *   triangle. Defaults to the first material for every triangle
+ *
+ * The settings can have the fields spacing (2, in metres between probes),
+ * height (1.5, of probes above the floor), rays (4096) and bounces (16) traced
+ * to measure reverb, and duration (1, the longest reverb measured in seconds).
+ * There can be at most 2048 probes.
+ * @function acoustics
+ * @tparam table geometry The level's static geometry
+ * @tparam[opt] table settings How to bake it
+ * @treturn Acoustics The baked acoustics
+ * @raise If the geometry is invalid, or hasn't been baked with these settings
+ * @usage
+ * local level = audio.acoustics(level_geometry, {spacing = 3})
+ * audio.set_acoustics(level)
+ */
+static int l_acoustics(lua_State *L) {
+  audio::AcousticGeometry geometry = check_geometry(L, 1);
+  audio::BakeSettings settings = opt_bake_settings(L, 2);
+  std::uint64_t hash = audio::acoustics_hash(geometry, settings);
+  auto &engine = lege::EngineImpl::fromState(L);
+  std::string dir = engine.get("lege.acoustics_cache");
+  if (dir.empty()) {
+    dir = ".";
+  }
+  std::string filename = fmt::format("{}/{:016x}.acoustics", dir, hash);
+  try {
+    // Baking would stall the game for as long as it takes, so it's only done
+    // by `lege bake`, which sets this
+    if (!engine.getFlag("lege.bake_acoustics")) {
+      if (!std::filesystem::exists(filename)) {
+        throw std::runtime_error(
+            fmt::format("Acoustics haven't been baked to \"{}\", bake them "
+                        "with `lege bake`",
+                        filename));
+      }
+      lua::new_userdata<AcousticsPtr>(
+          L, std::make_shared<audio::BakedAcoustics>(filename.c_str(), hash));
+      return 1;
+    }
+    AcousticsPtr acoustics;
+    if (std::filesystem::exists(filename)) {
+      try {
+        acoustics =
+            std::make_shared<audio::BakedAcoustics>(filename.c_str(), hash);
+      } catch (const std::exception &e) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "%s, baking it again", e.what());
+      }
+    }
+    if (!acoustics) {
+      std::filesystem::create_directories(dir);
+      audio::bake_acoustics(geometry, settings, filename.c_str());
+      acoustics =
+          std::make_shared<audio::BakedAcoustics>(filename.c_str(), hash);
+    }
+    lua::new_userdata<AcousticsPtr>(L, std::move(acoustics));
+    return 1;
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+/**
+ * Set the acoustics sources are occluded by.
+ * Each frame, every playing source's gain is multiplied by how much of it
+ * gets past the geometry between it and the listener (see
+ * `Acoustics:occlusion`).
+ * @function set_acoustics
+ * @tparam Acoustics|nil acoustics The acoustics to use, or nil to stop
+ * occluding sources
+ */
+static int l_set_acoustics(lua_State *L) {
+  AcousticsPtr acoustics;
+  if (!lua_isnoneornil(L, 1)) {
+    acoustics = *lua::check_userdata<AcousticsPtr>(L, 1);
+  }
+  get_mixer(L).setAcoustics(std::move(acoustics));
+  return 0;
+}
+
+/**
+ * Create a grid for sound to travel through around walls.
+ * Every cell starts open. Cells lie on the x-z plane, so cell (x, z) covers
+ * from origin + (x - 1, 0, z - 1) * cell_size to one cell further along x
+ * and z, at any height.
+ * @function grid
+ * @tparam integer width Cells along x, up to 4096
+ * @tparam integer depth Cells along z, up to 4096
+ * @tparam[opt] number cell_size How big each cell is, defaults to 1
+ * @tparam[opt] lege.vec3 origin The corner of the first cell, defaults to
+ * (0, 0, 0)
+ * @treturn Grid The new grid
+ * @usage
+ * local grid = audio.grid(40, 30)
+ * for z = 1, 30 do grid:set_open(20, z, false) end -- A wall
+ * grid:set_open(20, 15, true) -- With a door in it
+ * audio.set_propagation(grid)
+ */
+static int l_grid(lua_State *L) {
+  lua_Integer width, depth;
+  lua_Number cell_size;
+  lua::arg(L, 1, width);
+  lua::arg(L, 2, depth);
+  lua::opt_arg(L, 3, cell_size, 1.0);
+  glm::vec3 origin{0.0f, 0.0f, 0.0f};
+  if (!lua_isnoneornil(L, 4)) {
+    origin = check_vec3(L, 4);
+  }
+  luaL_argcheck(L, width >= 1 && width <= 4096, 1,
+                "must be between 1 and 4096");
+  luaL_argcheck(L, depth >= 1 && depth <= 4096, 2,
+                "must be between 1 and 4096");
+  luaL_argcheck(L, cell_size > 0, 3, "must be positive");
+  lua::new_userdata<GridPtr>(
+      L, std::make_shared<audio::PropagationGrid>(
+             (unsigned)width, (unsigned)depth, (float)cell_size, origin));
+  return 1;
+}
+
+/**
+ * Set the grid sources are heard around the walls of.
+ * Each frame, every playing source on the grid is heard from the direction
+ * of the last corner its sound comes around, from as far away as the path
+ * around the walls is long (see `Grid:path`). Sources the listener can't be
+ * reached from are silent. Sources or listeners off the grid, or inside its
+ * walls, are heard straight through, and occluded by acoustics if they're
+ * set.
+ * @function set_propagation
+ * @tparam Grid|nil grid The grid to use, or nil to stop routing sources
+ */
+static int l_set_propagation(lua_State *L) {
+  GridPtr grid;
+  if (!lua_isnoneornil(L, 1)) {
+    grid = *lua::check_userdata<GridPtr>(L, 1);
+  }
+  get_mixer(L).setPropagation(std::move(grid));
+  return 0;
+}
+
+/**
+ * The bus every other bus and source plays into.
+ * @tfield Bus master
+ */
+
+/**
+ * Set where sounds are heard from.
+ * @function set_listener
+ * @tparam lege.vec3 position The listener's position
+ * @tparam[opt] lege.vec3 forward The direction the listener faces, defaults to
+ * (0, 0, -1)
+ * @tparam[opt] lege.vec3 up The listener's up direction, defaults to (0, 1, 0)
+ */
+static int l_set_listener(lua_State *L) {
+  audio::Listener listener;
+  listener.position = check_vec3(L, 1);
+  if (!lua_isnoneornil(L, 2)) {
+    listener.forward = check_vec3(L, 2);
+  }
+  if (!lua_isnoneornil(L, 3)) {
+    listener.up = check_vec3(L, 3);
+  }
+  get_mixer(L).setListener(listener);
+  return 0;
+}
+
+/**
+ * Set how many sources can be heard at once.
+ * When more sources are playing, only the highest priority and loudest ones
+ * are mixed, and the rest are virtual: they keep their place in their sounds,
+ * and fade in if they become audible enough. Streamed sources are never made
+ * virtual. Defaults to 64, or the `max_voices` option.
+ * @function set_max_voices
+ * @tparam integer voices Between 1 and 256
+ */
+static int l_set_max_voices(lua_State *L) {
+  lua_Integer voices;
+  lua::arg(L, 1, voices);
+  luaL_argcheck(L, voices >= 1 && voices <= audio::MAX_VOICES, 1,
+                "must be between 1 and 256");
+  get_mixer(L).setMaxVoices((unsigned)voices);
+  return 0;
+}
+
+/**
+ * Get the output sample rate.
+ * @function sample_rate
+ * @treturn number The sample rate in Hz, or nil if there is no audio device
+ */
+static int l_sample_rate(lua_State *L) {
+  auto &mixer = get_mixer(L);
+  if (!mixer.isStarted()) {
+    lua_pushnil(L);
+  } else {
+    lua::push(L, (lua_Integer)mixer.sampleRate());
+  }
+  return 1;
+}
+
+/**
+ * Get statistics about the audio thread.
+ * The returned table has the fields:
+ *
+ * - callbacks: How many times the audio device asked for audio
+ * - underruns: Callbacks that started late or took longer than the audio they
+ *   produced, either of which can be heard as a glitch
+ * - stream_starvations: Times a streamed source had to skip because its file
+ *   wasn't decoded in time
+ * - frames: Frames of audio rendered
+ * - last_callback_time, max_callback_time, average_callback_time: How long the
+ *   mixer took per callback, in seconds
+ * - active_voices: Voices mixing or fading out
+ * - playing_sources: Sources playing, including virtual ones
+ * - virtual_sources: Sources playing without a voice
+ * - max_voices: The limit set with `set_max_voices`
+ * - playing_emitters: Emitters playing
+ * - active_grains: Grains the emitters are playing
+ * - hrtf: Whether mono sources are spatialized with an HRTF, rather than
+ *   just panned
+ * - kernels: Which instruction set mixing is vectorized with: "avx2", "sse2"
+ *   or "scalar"
+ * - command_stalls: How often the main thread had to wait for the audio thread
+ *   to catch up with its commands
+ * - dropped_commands: Commands lost because it never caught up
+ * @function stats
+ * @treturn table The statistics
+ */
+static int l_stats(lua_State *L) {
+  audio::MixerStats stats = get_mixer(L).stats();
+  lua_createtable(L, 0, 17);
+  lua::push(L, (lua_Number)stats.callbacks);
+  lua_setfield(L, -2, "callbacks");
+  lua::push(L, (lua_Number)stats.underruns);
+  lua_setfield(L, -2, "underruns");
+  lua::push(L, (lua_Number)stats.stream_starvations);
+  lua_setfield(L, -2, "stream_starvations");
+  lua::push(L, (lua_Number)stats.frames);
+  lua_setfield(L, -2, "frames");
+  lua::push(L, stats.last_callback_time);
+  lua_setfield(L, -2, "last_callback_time");
+  lua::push(L, stats.max_callback_time);
+  lua_setfield(L, -2, "max_callback_time");
+  lua::push(L, stats.average_callback_time);
+  lua_setfield(L, -2, "average_callback_time");
+  lua::push(L, (lua_Integer)stats.active_voices);
+  lua_setfield(L, -2, "active_voices");
+  lua::push(L, (lua_Integer)stats.playing_sources);
+  lua_setfield(L, -2, "playing_sources");
+  lua::push(L, (lua_Integer)stats.virtual_sources);
+  lua_setfield(L, -2, "virtual_sources");
+  lua::push(L, (lua_Integer)stats.max_voices);
+  lua_setfield(L, -2, "max_voices");
+  lua::push(L, (lua_Integer)stats.playing_emitters);
+  lua_setfield(L, -2, "playing_emitters");
+  lua::push(L, (lua_Integer)stats.active_grains);
+  lua_setfield(L, -2, "active_grains");
+  lua_pushboolean(L, stats.hrtf);
+  lua_setfield(L, -2, "hrtf");
+  lua_pushstring(L, stats.kernels);
+  lua_setfield(L, -2, "kernels");
+  lua::push(L, (lua_Number)stats.command_stalls);
+  lua_setfield(L, -2, "command_stalls");
+  lua::push(L, (lua_Number)stats.dropped_commands);
+  lua_setfield(L, -2, "dropped_commands");
+  return 1;
+}
+
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+static void push_histogram(lua_State *L, const audio::RollingHistogram &h) {
+  lua_createtable(L, 0, 4);
+  lua::push(L, h.percentile(0.5));
+  lua_setfield(L, -2, "p50");
+  lua::push(L, h.percentile(0.99));
+  lua_setfield(L, -2, "p99");
+  lua::push(L, h.max());
+  lua_setfield(L, -2, "max");
+  lua::push(L, (lua_Number)h.count());
+  lua_setfield(L, -2, "count");
+}
+#endif
+
+/**
+ * Get rolling histograms of the last few thousand audio callbacks.
+ * The returned table has the fields:
+ *
+ * - callback_time: How long callbacks took, in seconds
+ * - interval: Time between the starts of consecutive callbacks, in seconds.
+ *   Anything much longer than a block of audio can be heard as a glitch
+ * - buffered: Frames mixed ahead and kept for the next callback
+ * - commands: Commands waiting for the audio thread when a callback started
+ * - latency: From a key press until the first sound played in the same frame
+ *   is handed to the audio device, in seconds. Only that one sound is timed,
+ *   so it measures how quickly the game can respond, not what it plays. The
+ *   device's own buffering comes on top
+ * - underruns: Callbacks in the window that were late or too slow
+ * - recorded: Callbacks recorded since the timings were last cleared
+ * - dropped: Callbacks not recorded because the game stopped updating for
+ *   several seconds
+ *
+ * The first five are tables with the fields p50, p99, max and count. Only
+ * available if the engine was built with the LEGE_AUDIO_INSTRUMENTATION CMake
+ * option, which is off by default.
+ * @function timings
+ * @treturn table|nil The timings, or nil if instrumentation was compiled out
+ */
+static int l_timings(lua_State *L) {
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  audio::Mixer &mixer = get_mixer(L);
+  const audio::AudioTimings &timings = mixer.timings();
+  lua_createtable(L, 0, 8);
+  push_histogram(L, timings.callbackTime());
+  lua_setfield(L, -2, "callback_time");
+  push_histogram(L, timings.interval());
+  lua_setfield(L, -2, "interval");
+  push_histogram(L, timings.buffered());
+  lua_setfield(L, -2, "buffered");
+  push_histogram(L, timings.commands());
+  lua_setfield(L, -2, "commands");
+  push_histogram(L, timings.latency());
+  lua_setfield(L, -2, "latency");
+  lua::push(L, (lua_Number)timings.underruns());
+  lua_setfield(L, -2, "underruns");
+  lua::push(L, (lua_Number)timings.total());
+  lua_setfield(L, -2, "recorded");
+  lua::push(L, (lua_Number)mixer.droppedTimings());
+  lua_setfield(L, -2, "dropped");
+#else
+  lua_pushnil(L);
+#endif
+  return 1;
+}
+
+/**
+ * Get the audio timings as a plain text report, with percentiles and
+ * histograms of the callback times and intervals.
+ * @function timings_report
+ * @treturn string|nil The report, or nil if instrumentation was compiled out
+ */
+static int l_timings_report(lua_State *L) {
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  audio::Mixer &mixer = get_mixer(L);
+  lua::push(L, mixer.timings().report(mixer.droppedTimings()));
+#else
+  lua_pushnil(L);
+#endif
+  return 1;
+}
+
+/**
+ * Write the audio timings report to a file.
+ * @function write_timings
+ * @tparam string filename The file to write to
+ * @raise If the file could not be written, or instrumentation was compiled
+ * out
+ */
+static int l_write_timings(lua_State *L) {
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  const char *filename = luaL_checkstring(L, 1);
+  audio::Mixer &mixer = get_mixer(L);
+  std::string report = mixer.timings().report(mixer.droppedTimings());
+  FILE *f = std::fopen(filename, "w");
+  if (!f) {
+    return luaL_error(L, "could not open \"%s\" for writing", filename);
+  }
+  bool ok = std::fwrite(report.data(), 1, report.size(), f) == report.size();
+  ok = std::fclose(f) == 0 && ok;
+  if (!ok) {
+    return luaL_error(L, "could not write timings to \"%s\"", filename);
+  }
+  return 0;
+#else
+  luaL_checkstring(L, 1);
+  return luaL_error(L, "audio instrumentation was compiled out");
+#endif
+}
+
+/**
+ * Forget the recorded audio timings, E.G. so that a level's report doesn't
+ * include loading it.
+ * @function clear_timings
+ */
+static int l_clear_timings(lua_State *L) {
+#ifdef LEGE_AUDIO_INSTRUMENTATION
+  get_mixer(L).clearTimings();
+#else
+  (void)L;
+#endif
+  return 0;
+}
+
+/**
+ * Get statistics about the sound cache.
+ * The returned table has the fields:
+ *
+ * - hits: Loads that found the sound already cached
+ * - misses: Loads that had to decode the file
+ * - evictions: Sounds dropped to stay within the budget
+ * - promotions: Compressed sounds decoded again for being used often
+ * - entries: Sounds in the cache
+ * - compressed: Sounds in the cache that are compressed
+ * - resident_bytes: Memory used by cached sounds, including ones in use
+ * - budget: The budget in bytes
+ * @function cache_stats
+ * @treturn table The statistics
+ */
+static int l_cache_stats(lua_State *L) {
+  audio::SoundCacheStats stats =
+      lege::EngineImpl::fromState(L).getSoundCache().stats();
+  lua_createtable(L, 0, 8);
+  lua::push(L, (lua_Number)stats.hits);
+  lua_setfield(L, -2, "hits");
+  lua::push(L, (lua_Number)stats.misses);
+  lua_setfield(L, -2, "misses");
+  lua::push(L, (lua_Number)stats.evictions);
+  lua_setfield(L, -2, "evictions");
+  lua::push(L, (lua_Number)stats.promotions);
+  lua_setfield(L, -2, "promotions");
+  lua::push(L, (lua_Number)stats.entries);
+  lua_setfield(L, -2, "entries");
+  lua::push(L, (lua_Number)stats.compressed);
+  lua_setfield(L, -2, "compressed");
+  lua::push(L, (lua_Number)stats.resident_bytes);
+  lua_setfield(L, -2, "resident_bytes");
+  lua::push(L, (lua_Number)stats.budget);
+  lua_setfield(L, -2, "budget");
+  return 1;
+}
+
+/**
+ * Change the sound cache's budget, evicting sounds if it's now over it.
+ * @function set_cache_budget
+ * @tparam number bytes The new budget
+ */
+static int l_set_cache_budget(lua_State *L) {
+  lua_Number bytes;
+  lua::arg(L, 1, bytes);
+  luaL_argcheck(L, bytes >= 0, 1, "budget must not be negative");
+  lege::EngineImpl::fromState(L).getSoundCache().setBudget(
+      (std::size_t)bytes);
+  return 0;
+}
+
+/**
+ * Drop every cached sound that isn't in use, E.G. between levels.
+ * @function clear_cache
+ */
+static int l_clear_cache(lua_State *L) {
+  lege::EngineImpl::fromState(L).getSoundCache().clear();
+  return 0;
+}
+
+static const luaL_Reg AUDIO_FUNCS[] = {
+    {"load", l_load},
+    {"source", l_source},
+    {"stream", l_stream},
+    {"emitter", l_emitter},
+    {"param_block", l_param_block},
+    {"play", l_play},
+    {"play_at", l_source_play_at},
+    {"play_group", l_play_group},
+    {"clock", l_clock},
+    {"bus", l_bus},
+    {"effect", l_effect},
+    {"convolver", l_convolver},
+    {"acoustics", l_acoustics},
+    {"set_acoustics", l_set_acoustics},
+    {"grid", l_grid},
+    {"set_propagation", l_set_propagation},
+    {"set_listener", l_set_listener},
+    {"set_max_voices", l_set_max_voices},
+    {"sample_rate", l_sample_rate},
+    {"stats", l_stats},
+    {"timings", l_timings},
+    {"timings_report", l_timings_report},
+    {"write_timings", l_write_timings},
+    {"clear_timings", l_clear_timings},
+    {"cache_stats", l_cache_stats},
+    {"set_cache_budget", l_set_cache_budget},
+    {"clear_cache", l_clear_cache},
+    {nullptr, nullptr},
+};
+
+static void set_metamethods(lua_State *L, lua_CFunction tostring,
+                            lua_CFunction index, lua_CFunction newindex) {
+  lua_pushcfunction(L, tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pushcfunction(L, index);
+  lua_setfield(L, -2, "__index");
+  if (newindex) {
+    lua_pushcfunction(L, newindex);
+    lua_setfield(L, -2, "__newindex");
+  }
+}
+
+extern "C" int luaopen_lege_audio(lua_State *L) {
+  // Positions are vec3s, so make sure their metatable is complete before we
+  // create any
+  lua_getglobal(L, "require");
+  lua_pushliteral(L, "lege.vec3");
+  lua_call(L, 1, 0);
+
+  lua::make_metatable<SoundPtr>(L);
+  set_metamethods(L, l_sound_tostring, l_sound_index, nullptr);
+  lua_pop(L, 1);
+  lua::make_metatable<audio::Source>(L);
+  set_metamethods(L, l_source_tostring, l_source_index, l_source_newindex);
+  lua_pop(L, 1);
+  lua::make_metatable<BusPtr>(L);
+  set_metamethods(L, l_bus_tostring, l_bus_index, l_bus_newindex);
+  lua_pop(L, 1);
+  lua::make_metatable<EffectPtr>(L);
+  set_metamethods(L, l_effect_tostring, l_effect_index, l_effect_newindex);
+  lua_pop(L, 1);
+  lua::make_metatable<AcousticsPtr>(L);
+  set_metamethods(L, l_acoustics_tostring, l_acoustics_index, nullptr);
+  lua_pop(L, 1);
+  lua::make_metatable<GridPtr>(L);
+  set_metamethods(L, l_grid_tostring, l_grid_index, l_grid_newindex);
+  lua_pop(L, 1);
+  lua::make_metatable<audio::Emitter>(L);
+  set_metamethods(L, l_emitter_tostring, l_emitter_index, l_emitter_newindex);
+  lua_pop(L, 1);
+  lua::make_metatable<audio::ParamBlock>(L);
+  set_metamethods(L, l_param_block_tostring, l_param_block_index, nullptr);
+  lua_pop(L, 1);
+
+  lua_getglobal(L, "require");
+  lua_pushliteral(L, "ffi");
+  lua_call(L, 1, 1);
+  lua_getfield(L, -1, "cdef");
+  lua_pushstring(L, PARAMS_CDEF);
+  lua_call(L, 1, 0);
+  lua_pop(L, 1);
+
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, ONESHOTS_KEY);
+
+  luaL_newlib(L, AUDIO_FUNCS);
+  lua::new_userdata<BusPtr>(L, get_mixer(L).master());
+  lua_setfield(L, -2, "master");
+  return 1;
+}
@@ -0,0 +1,135 @@
+#include <exception>
+
+#include <lua.hpp>
+
+#include "engine.hpp"
+#include "lua/helpers.hpp"
+
+namespace lua = lege::lua;
+
+/**
+ * Timing information about how the engine started up.
+ * Startup is split into phases (SDL initialization, window creation, opening
+ * the Lua libraries, loading the project, registering built-in modules, and
+ * running the main chunk), and each module's file read, compile and load
+ * times are recorded too. Lazily loaded modules are recorded when they are
+ * first required.
+ *
+ * Setting the `LEGE_PROFILE` environment variable to a file name writes the
+ * same information there as JSON once startup is complete, in the Chrome trace
+ * event format, so it can be viewed with chrome://tracing or
+ * [Perfetto][perfetto], or compared between releases.
+ *
+ * [perfetto]: <https://ui.perfetto.dev>
+ * @usage
+ * local log = require "lege.log"
+ * local profiler = require "lege.profiler"
+ *
+ * log.info(("Started in %.1f ms"):format(profiler.startup_time() * 1000))
+ * for _, span in ipairs(profiler.spans()) do
+ *   if span.category == "compile" then
+ *     print(span.name, span.duration)
+ *   end
+ * end
+ * @module lege.profiler
+ */
+
+static lege::Profiler &get_profiler(lua_State *L) {
+  return lege::EngineImpl::fromState(L);
+}
+
+static void push_span(lua_State *L, const lege::Profiler &profiler,
+                      const lege::Profiler::Span &span) {
+  lua_createtable(L, 0, 5);
+  lua::push(L, span.name);
+  lua_setfield(L, -2, "name");
+  lua::push(L, span.category);
+  lua_setfield(L, -2, "category");
+  lua::push(L, profiler.since_origin(span.start));
+  lua_setfield(L, -2, "start");
+  lua::push(L, span.duration());
+  lua_setfield(L, -2, "duration");
+  lua::push(L, (lua_Integer)span.thread);
+  lua_setfield(L, -2, "thread");
+}
+
+/**
+ * Get every recorded span.
+ * Each span is a table with the fields:
+ *
+ * - name: The phase or module name
+ * - category: "phase", or "read", "compile" or "load" for modules
+ * - start: When the span started, in seconds since the engine was created
+ * - duration: How long the span took, in seconds
+ * - thread: 0 for the main thread, otherwise the number of the worker thread
+ * @function spans
+ * @treturn table A sequence of spans, in the order they finished
+ */
+static int l_spans(lua_State *L) {
+  const auto &profiler = get_profiler(L);
+  const auto &spans = profiler.spans();
+  lua_createtable(L, (int)spans.size(), 0);
+  for (std::size_t i = 0; i < spans.size(); ++i) {
+    push_span(L, profiler, spans[i]);
+    lua_rawseti(L, -2, (int)i + 1);
+  }
+  return 1;
+}
+
+/**
+ * Get how long startup took, from creating the engine until the window was
+ * shown.
+ * @function startup_time
+ * @treturn number The startup time in seconds, or nil if startup hasn't
+ * finished
+ */
+static int l_startup_time(lua_State *L) {
+  for (const auto &span : get_profiler(L).spans()) {
+    if (span.name == "startup" && span.category == "phase") {
+      lua::push(L, span.duration());
+      return 1;
+    }
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+/**
+ * Get the recorded spans as a JSON string in the Chrome trace event format.
+ * @function report
+ * @treturn string The JSON report
+ */
+static int l_report(lua_State *L) {
+  lua::push(L, get_profiler(L).toJson());
+  return 1;
+}
+
+/**
+ * Write the JSON report to a file.
+ * @function write_report
+ * @tparam string filename The file to write to
+ * @raise If the file could not be written
+ */
+static int l_write_report(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  try {
+    get_profiler(L).writeJson(filename);
+    return 0;
+  } catch (const std::exception &e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+static const luaL_Reg PROFILER_FUNCS[] = {
+    {"spans", l_spans},
+    {"startup_time", l_startup_time},
+    {"report", l_report},
+    {"write_report", l_write_report},
+    {nullptr, nullptr},
+};
+
+extern "C" int luaopen_lege_profiler(lua_State *L) {
+  luaL_newlib(L, PROFILER_FUNCS);
+  return 1;
+}
@@ -0,0 +1,481 @@
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <lua.hpp>
+
+#include "audio/mixer.hpp"
+#include "builtins.hpp"
+#include "engine.hpp"
+#include "lua/error.hpp"
+#include "lua/helpers.hpp"
+#include "modules/task.hpp"
+
+namespace lua = lege::lua;
+namespace audio = lege::audio;
+using lege::engine::Easing;
+using lege::engine::Tweener;
+using lege::engine::TweenSetter;
+
+using BusPtr = std::shared_ptr<audio::Bus>;
+
+/**
+ * Animate numbers natively, rather than from a task each frame.
+ * A tween moves one number from where it is to a target value over time,
+ * along an easing curve. Every tween is advanced in one loop in C++ before
+ * each frame's tasks run, so thousands of them cost less than a single task
+ * waking up every frame. Nothing in Lua runs until a tween finishes, when
+ * its `on_done` callback is called and any tasks waiting for it are woken.
+ *
+ * A tween can target:
+ *
+ * - A component of a vec2, vec3 or vec4: "x", "y", "z" or "w"
+ * - An audio Source: "gain", "pitch", or a component of its position, "x",
+ *   "y" or "z"
+ * - An audio Bus: "gain"
+ * - An audio Emitter: "gain", "pitch" or "rate"
+ * - A float field of an FFI struct, such as an entry of an audio ParamBlock,
+ *   or an FFI pointer to a float with no field
+ *
+ * The target is kept alive until the tween ends, but FFI memory it points
+ * into isn't, so keep whatever owns that memory alive yourself. Starting a
+ * tween on a target that's already being tweened cancels the old one.
+ * @usage
+ * local audio = require "lege.audio"
+ * local task = require "lege.task"
+ * local tween = require "lege.tween"
+ *
+ * local music = audio.stream("music.ogg")
+ * music:play()
+ * task.spawn("fade out", function()
+ *   tween.wait(tween.to(music, "gain", 0, 2, {ease = "out_quad"}))
+ *   music:stop()
+ * end)
+ * @module lege.tween
+ */
+
+// Registry keys of tables indexed by tween ID: what each tween targets, to
+// keep it alive, its on_done callback, and lists of tasks waiting for it
+#define TARGETS_KEY "lege.tween.targets"
+#define CALLBACKS_KEY "lege.tween.callbacks"
+#define WAITERS_KEY "lege.tween.waiters"
+// Registry key of a function that finds the address of an FFI field
+#define FFI_ADDRESS_KEY "lege.tween.ffi_address"
+
+// In the order of engine::Easing
+static const char *const EASINGS[] = {
+    "linear",
+    "in_quad",
+    "out_quad",
+    "in_out_quad",
+    "in_cubic",
+    "out_cubic",
+    "in_out_cubic",
+    "in_sine",
+    "out_sine",
+    "in_out_sine",
+    "in_expo",
+    "out_expo",
+    "in_out_expo",
+    "smoothstep",
+    nullptr,
+};
+
+// Finds the address of a float field of an FFI struct, given a struct, a
+// reference to one, or a pointer to one. With no field, the cdata must
+// already point to a float
+static const char FFI_ADDRESS[] = R"(
+local ffi = require "ffi"
+local float_ptr = ffi.typeof("float *")
+return function(obj, field)
+  if field == nil then
+    return ffi.cast(float_ptr, obj)
+  end
+  local ok, offset = pcall(ffi.offsetof, obj, field)
+  if not (ok and offset) then
+    ok, offset = pcall(function() return ffi.offsetof(obj[0], field) end)
+  end
+  if not (ok and offset) then
+    error(("no field '%s' on %s"):format(field, tostring(ffi.typeof(obj))), 0)
+  end
+  return ffi.cast(float_ptr, ffi.cast("char *", obj) + offset)
+end
+)";
+
+static Tweener &get_tweens(lua_State *L) {
+  return lege::EngineImpl::fromState(L).getTweens();
+}
+
+template <int Axis> static void set_source_axis(void *src, float value) {
+  auto *source = static_cast<audio::Source *>(src);
+  glm::vec3 position = source->params().position;
+  position[Axis] = value;
+  source->setPosition(position);
+}
+
+static void set_source_gain(void *src, float value) {
+  static_cast<audio::Source *>(src)->setGain(value);
+}
+
+static void set_source_pitch(void *src, float value) {
+  static_cast<audio::Source *>(src)->setPitch(value);
+}
+
+static void set_bus_gain(void *bus, float value) {
+  static_cast<audio::Bus *>(bus)->setGain(value);
+}
+
+static void set_emitter_gain(void *emitter, float value) {
+  static_cast<audio::Emitter *>(emitter)->setGain(value);
+}
+
+static void set_emitter_pitch(void *emitter, float value) {
+  static_cast<audio::Emitter *>(emitter)->setPitch(value);
+}
+
+static void set_emitter_rate(void *emitter, float value) {
+  static_cast<audio::Emitter *>(emitter)->setRate(value);
+}
+
+struct Target {
+  void *object = nullptr;
+  // Null if object is a float to write directly
+  TweenSetter set = nullptr;
+  float current = 0.0f;
+};
+
+template <int N>
+static bool vec_target(lua_State *L, int index, std::string_view field,
+                       Target &target) {
+  auto vec = lua::test_userdata<glm::vec<N, float>>(L, index);
+  if (!vec) {
+    return false;
+  }
+  static constexpr std::string_view AXES = "xyzw";
+  std::size_t axis = field.size() == 1 ? AXES.find(field[0]) : AXES.npos;
+  if (axis >= (std::size_t)N) {
+    luaL_argerror(L, index + 1, "must be a component of the vector");
+  }
+  target.object = &(*vec)[(int)axis];
+  target.current = (*vec)[(int)axis];
+  return true;
+}
+
+// Works out what the target and field at index and index + 1 refer to
+static Target check_target(lua_State *L, int index) {
+  Target target;
+#ifdef LUAJIT_VERSION
+  // 10 = cdata, see lua::get_cdata()
+  if (lua_type(L, index) == 10) {
+    lua_getfield(L, LUA_REGISTRYINDEX, FFI_ADDRESS_KEY);
+    lua_pushvalue(L, index);
+    lua_pushvalue(L, index + 1);
+    lua_call(L, 2, 1);
+    float *ptr = *lua::get_cdata<float *>(L, -1);
+    lua_pop(L, 1);
+    target.object = ptr;
+    target.current = *ptr;
+    return target;
+  }
+#endif
+  std::string_view field;
+  lua::arg(L, index + 1, field);
+  if (vec_target<2>(L, index, field, target) ||
+      vec_target<3>(L, index, field, target) ||
+      vec_target<4>(L, index, field, target)) {
+    return target;
+  }
+  if (auto src = lua::test_userdata<audio::Source>(L, index)) {
+    const audio::SourceParams &params = src->params();
+    target.object = src;
+    if (field == "gain") {
+      target.set = set_source_gain;
+      target.current = params.gain;
+    } else if (field == "pitch") {
+      target.set = set_source_pitch;
+      target.current = params.pitch;
+    } else if (field == "x") {
+      target.set = set_source_axis<0>;
+      target.current = params.position.x;
+    } else if (field == "y") {
+      target.set = set_source_axis<1>;
+      target.current = params.position.y;
+    } else if (field == "z") {
+      target.set = set_source_axis<2>;
+      target.current = params.position.z;
+    } else {
+      luaL_argerror(L, index + 1, "sources can tween gain, pitch, x, y or z");
+    }
+    return target;
+  }
+  if (auto bus = lua::test_userdata<BusPtr>(L, index)) {
+    luaL_argcheck(L, field == "gain", index + 1, "buses can only tween gain");
+    target.object = bus->get();
+    target.set = set_bus_gain;
+    target.current = (*bus)->gain();
+    return target;
+  }
+  if (auto emitter = lua::test_userdata<audio::Emitter>(L, index)) {
+    const audio::EmitterParams &params = emitter->params();
+    target.object = emitter;
+    if (field == "gain") {
+      target.set = set_emitter_gain;
+      target.current = params.gain;
+    } else if (field == "pitch") {
+      target.set = set_emitter_pitch;
+      target.current = params.pitch;
+    } else if (field == "rate") {
+      target.set = set_emitter_rate;
+      target.current = params.rate;
+    } else {
+      luaL_argerror(L, index + 1, "emitters can tween gain, pitch or rate");
+    }
+    return target;
+  }
+  luaL_argerror(L, index, "cannot be tweened");
+  return target;
+}
+
+// Sets registry[key][id] to the value on top of the stack, and pops it
+static void set_by_id(lua_State *L, const char *key, Tweener::Id id) {
+  lua_getfield(L, LUA_REGISTRYINDEX, key);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, (int)id);
+  lua_pop(L, 1);
+}
+
+/**
+ * Start tweening a number.
+ * @function to
+ * @param target What to tween, see above
+ * @tparam string|nil field Which of the target's numbers to tween
+ * @tparam number to The value to end at
+ * @tparam number duration How long to take, in seconds. 0 jumps to the end on
+ * the next frame
+ * @tparam[opt] table options Any of:
+ *
+ * - from: The value to start at, defaults to the current value
+ * - ease: The easing curve: "linear" (the default), "in_quad", "out_quad",
+ *   "in_out_quad", "in_cubic", "out_cubic", "in_out_cubic", "in_sine",
+ *   "out_sine", "in_out_sine", "in_expo", "out_expo", "in_out_expo" or
+ *   "smoothstep". "in" curves start slowly, and "out" curves end slowly
+ * - delay: Seconds to wait before starting, defaults to 0
+ * - on_done: A function to call once the tween has finished. It isn't called
+ *   if the tween is cancelled
+ * @treturn integer The tween's ID
+ */
+static int l_to(lua_State *L) {
+  lua_Number to, duration;
+  lua::arg(L, 3, to);
+  lua::arg(L, 4, duration);
+  // NaN would get past clamping to 0, and neither it nor infinity would ever
+  // finish. Checked as a float, as very large numbers overflow to infinity
+  luaL_argcheck(L, std::isfinite((float)duration), 4, "must be finite");
+  if (!lua_isnoneornil(L, 5)) {
+    luaL_checktype(L, 5, LUA_TTABLE);
+  }
+  lua_settop(L, 5);
+  Target target = check_target(L, 1);
+
+  float from = target.current;
+  Easing easing = Easing::LINEAR;
+  float delay = 0.0f;
+  bool has_callback = false;
+  if (lua_istable(L, 5)) {
+    lua_getfield(L, 5, "from");
+    if (!lua_isnil(L, -1)) {
+      luaL_argcheck(L, lua_isnumber(L, -1), 5, "from must be a number");
+      from = (float)lua_tonumber(L, -1);
+    }
+    lua_getfield(L, 5, "ease");
+    if (!lua_isnil(L, -1)) {
+      const char *name = lua_tostring(L, -1);
+      int i = 0;
+      while (EASINGS[i] && !(name && std::strcmp(EASINGS[i], name) == 0)) {
+        ++i;
+      }
+      luaL_argcheck(L, EASINGS[i], 5, "unknown easing");
+      easing = (Easing)i;
+    }
+    lua_getfield(L, 5, "delay");
+    if (!lua_isnil(L, -1)) {
+      luaL_argcheck(L, lua_isnumber(L, -1), 5, "delay must be a number");
+      delay = (float)lua_tonumber(L, -1);
+      luaL_argcheck(L, std::isfinite(delay), 5, "delay must be finite");
+    }
+    lua_getfield(L, 5, "on_done");
+    if (!lua_isnil(L, -1)) {
+      luaL_argcheck(L, lua_isfunction(L, -1), 5, "on_done must be a function");
+      has_callback = true;
+    }
+  }
+
+  Tweener::Id id = get_tweens(L).start(target.object, target.set, from,
+                                       (float)to, (float)duration, easing,
+                                       delay);
+  if (has_callback) {
+    lua_getfield(L, 5, "on_done");
+    set_by_id(L, CALLBACKS_KEY, id);
+  }
+  lua_pushvalue(L, 1);
+  set_by_id(L, TARGETS_KEY, id);
+  lua::push(L, (lua_Integer)id);
+  return 1;
+}
+
+/**
+ * Stop a tween where it is. Its `on_done` callback isn't called, but tasks
+ * waiting for it are woken.
+ * @function cancel
+ * @tparam integer id The tween
+ * @treturn boolean Whether it was still running
+ */
+static int l_cancel(lua_State *L) {
+  lua_Integer id;
+  lua::arg(L, 1, id);
+  lua_pushboolean(L, get_tweens(L).cancel((Tweener::Id)id));
+  return 1;
+}
+
+/**
+ * Check whether a tween is still running, including waiting out its delay.
+ * @function active
+ * @tparam integer id The tween
+ * @treturn boolean Whether it's running
+ */
+static int l_active(lua_State *L) {
+  lua_Integer id;
+  lua::arg(L, 1, id);
+  lua_pushboolean(L, get_tweens(L).isActive((Tweener::Id)id));
+  return 1;
+}
+
+/**
+ * Block the current task until a tween finishes or is cancelled.
+ * Returns straight away if it already has.
+ * @function wait
+ * @tparam integer id The tween
+ * @raise If called from outside a task
+ */
+static int l_wait(lua_State *L) {
+  lua_Integer id;
+  lua::arg(L, 1, id);
+  if (!get_tweens(L).isActive((Tweener::Id)id)) {
+    return 0;
+  }
+  lege::task::push_current(L);
+  if (lua_isnil(L, -1)) {
+    return luaL_error(L, "can only wait for a tween from a task");
+  }
+  lua_getfield(L, LUA_REGISTRYINDEX, WAITERS_KEY);
+  lua_rawgeti(L, -1, (int)id);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, (int)id);
+  }
+  lua_pushvalue(L, -3);
+  lua_rawseti(L, -2, (int)lua_objlen(L, -2) + 1);
+  return lege::task::block(L);
+}
+
+/**
+ * Count the tweens running.
+ * @function count
+ * @treturn integer How many there are
+ */
+static int l_count(lua_State *L) {
+  lua::push(L, (lua_Integer)get_tweens(L).size());
+  return 1;
+}
+
+static const luaL_Reg TWEEN_FUNCS[] = {
+    {"to", l_to},
+    {"cancel", l_cancel},
+    {"active", l_active},
+    {"wait", l_wait},
+    {"count", l_count},
+    {nullptr, nullptr},
+};
+
+namespace lege::modules {
+
+void finish_tweens(lua_State *L) {
+  static thread_local std::vector<Tweener::Id> finished, cancelled;
+  EngineImpl::fromState(L).getTweens().drain(finished, cancelled);
+  if (finished.empty() && cancelled.empty()) {
+    return;
+  }
+  int top = lua_gettop(L);
+  lua_getfield(L, LUA_REGISTRYINDEX, TARGETS_KEY);
+  lua_getfield(L, LUA_REGISTRYINDEX, CALLBACKS_KEY);
+  lua_getfield(L, LUA_REGISTRYINDEX, WAITERS_KEY);
+  const int targets = top + 1, callbacks = top + 2, waiters = top + 3;
+  // Callbacks may start tweens of their own, so take them all first
+  std::size_t num_callbacks = 0;
+  for (const auto *ids : {&finished, &cancelled}) {
+    bool done = ids == &finished;
+    for (Tweener::Id id : *ids) {
+      lua_pushnil(L);
+      lua_rawseti(L, targets, (int)id);
+      lua_rawgeti(L, waiters, (int)id);
+      if (!lua_isnil(L, -1)) {
+        for (int i = 1, n = (int)lua_objlen(L, -1); i <= n; ++i) {
+          lua_rawgeti(L, -1, i);
+          task::wake(L, -1);
+          lua_pop(L, 1);
+        }
+        lua_pushnil(L);
+        lua_rawseti(L, waiters, (int)id);
+      }
+      lua_pop(L, 1);
+      luaL_checkstack(L, 1, "too many tweens finished at once");
+      lua_rawgeti(L, callbacks, (int)id);
+      if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        continue;
+      }
+      lua_pushnil(L);
+      lua_rawseti(L, callbacks, (int)id);
+      if (done) {
+        ++num_callbacks;
+      } else {
+        lua_pop(L, 1);
+      }
+    }
+  }
+  // Called in the order they finished
+  for (std::size_t i = 0; i < num_callbacks; ++i) {
+    lua_pushvalue(L, waiters + 1 + (int)i);
+    if (lua_pcall(L, 0, 0, 0) != 0) {
+      throw lua::Error(L, "Error in tween callback");
+    }
+  }
+  lua_settop(L, top);
+}
+
+} // namespace lege::modules
+
+extern "C" int luaopen_lege_tween(lua_State *L) {
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, TARGETS_KEY);
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, CALLBACKS_KEY);
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, WAITERS_KEY);
+#ifdef LUAJIT_VERSION
+  if (luaL_loadbuffer(L, FFI_ADDRESS, sizeof(FFI_ADDRESS) - 1,
+                      "=lege.tween") != 0) {
+    return lua_error(L);
+  }
+  lua_call(L, 0, 1);
+  lua_setfield(L, LUA_REGISTRYINDEX, FFI_ADDRESS_KEY);
+#endif
+
+  luaL_newlib(L, TWEEN_FUNCS);
+  return 1;
+}
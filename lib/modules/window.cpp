@@ -8,8 +8,15 @@ namespace lua = lege::lua;
 
 namespace lege::modules {
 
+// The window is null when the engine is headless. Reading its properties then
+// gives defaults, and changing them does nothing
+
 static int l_tostring(lua_State *L) {
   auto win = *lua::check_userdata<SDL_Window *>(L, 1);
+  if (!win) {
+    lua_pushfstring(L, "headless window: %p", lua_topointer(L, 1));
+    return 1;
+  }
   const char *title = SDL_GetWindowTitle(win);
   lua_pushfstring(L, "window '%s': %p", title, lua_topointer(L, 1));
   return 1;
@@ -17,13 +24,17 @@ static int l_tostring(lua_State *L) {
 
 static int l_show(lua_State *L) {
   auto win = *lua::check_userdata<SDL_Window *>(L, 1);
-  SDL_ShowWindow(win);
+  if (win) {
+    SDL_ShowWindow(win);
+  }
   return 0;
 }
 
 static int l_hide(lua_State *L) {
   auto win = *lua::check_userdata<SDL_Window *>(L, 1);
-  SDL_HideWindow(win);
+  if (win) {
+    SDL_HideWindow(win);
+  }
   return 0;
 }
 
@@ -32,12 +43,14 @@ static int l_index(lua_State *L) {
   std::string_view prop;
   lua::arg(L, 2, prop);
   if (prop == "title") {
-    lua_pushstring(L, SDL_GetWindowTitle(win));
+    lua_pushstring(L, win ? SDL_GetWindowTitle(win) : "");
   } else if (prop == "id") {
-    lua_pushnumber(L, (lua_Number)SDL_GetWindowID(win));
+    lua_pushnumber(L, win ? (lua_Number)SDL_GetWindowID(win) : 0);
   } else if (prop == "shown") {
-    Uint32 flags = SDL_GetWindowFlags(win);
+    Uint32 flags = win ? SDL_GetWindowFlags(win) : 0;
     lua_pushboolean(L, (flags & SDL_WINDOW_SHOWN) != 0);
+  } else if (prop == "headless") {
+    lua_pushboolean(L, win == nullptr);
   } else if (prop == "show") {
     lua_pushcfunction(L, l_show);
   } else if (prop == "hide") {
@@ -56,10 +69,15 @@ static int l_newindex(lua_State *L) {
   lua::arg(L, 2, prop);
   if (prop == "title") {
     const char *title = luaL_checkstring(L, 3);
-    SDL_SetWindowTitle(win, title);
+    if (win) {
+      SDL_SetWindowTitle(win, title);
+    }
   } else if (prop == "shown") {
     bool shown;
-    if (lua::arg(L, 3, shown)) {
+    lua::arg(L, 3, shown);
+    if (!win) {
+      // Headless, nothing to do
+    } else if (shown) {
       SDL_ShowWindow(win);
     } else {
       SDL_HideWindow(win);
@@ -0,0 +1,49 @@
+#include <exception>
+
+#include "prefetcher.hpp"
+
+namespace lege {
+
+Prefetcher::Prefetcher(ReadFunc read)
+    : m_read(std::move(read)),
+      m_thread([this](std::stop_token stop) { run(stop); }) {}
+
+Prefetcher::~Prefetcher() {
+  m_thread.request_stop();
+  m_cond.notify_all();
+}
+
+std::future<FileBuffer> Prefetcher::enqueue(std::string filename) {
+  std::promise<FileBuffer> promise;
+  auto future = promise.get_future();
+  {
+    std::lock_guard lock(m_mutex);
+    m_queue.emplace_back(std::move(filename), std::move(promise));
+  }
+  m_cond.notify_one();
+  return future;
+}
+
+void Prefetcher::run(std::stop_token stop) {
+  std::unique_lock lock(m_mutex);
+  // wait() keeps returning true while anything is queued, even once a stop
+  // has been requested, so that has to be checked too
+  while (m_cond.wait(lock, stop, [this] { return !m_queue.empty(); }) &&
+         !stop.stop_requested()) {
+    auto [filename, promise] = std::move(m_queue.front());
+    m_queue.pop_front();
+
+    // Don't hold the lock while doing I/O
+    lock.unlock();
+    try {
+      promise.set_value(m_read(filename.c_str()));
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+    lock.lock();
+  }
+  // Anything still queued is abandoned, its futures will report a broken
+  // promise
+}
+
+} // namespace lege
@@ -0,0 +1,46 @@
+#ifndef LIBLEGE_PREFETCHER_HPP
+#define LIBLEGE_PREFETCHER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "file_buffer.hpp"
+
+namespace lege {
+
+// Reads files on a background thread, in the order they were requested, so
+// that they're (hopefully) already in memory by the time they're needed
+class Prefetcher {
+public:
+  using ReadFunc = std::function<FileBuffer(const char *filename)>;
+
+  Prefetcher(ReadFunc read);
+  ~Prefetcher();
+
+  // No copy
+  Prefetcher(const Prefetcher &) = delete;
+  Prefetcher &operator=(const Prefetcher &) = delete;
+
+  // The returned future holds any exception thrown while reading the file
+  std::future<FileBuffer> enqueue(std::string filename);
+
+private:
+  void run(std::stop_token stop);
+
+  ReadFunc m_read;
+  std::mutex m_mutex;
+  std::condition_variable_any m_cond;
+  std::deque<std::pair<std::string, std::promise<FileBuffer>>> m_queue;
+  // Must be last, so the thread is joined before the queue is destroyed
+  std::jthread m_thread;
+};
+
+} // namespace lege
+
+#endif
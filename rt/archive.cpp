@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+
+#include <fmt/core.h>
+
+#include "archive.hpp"
+#include "compress.hpp"
+
+namespace lege {
+
+// The on-disk format is little-endian, and is used in place from the mapping
+static_assert(std::endian::native == std::endian::little,
+              "Archives are only supported on little-endian platforms");
+
+static constexpr char MAGIC[8] = {'L', 'E', 'G', 'E', 'P', 'A', 'K', '\x1a'};
+static constexpr std::uint32_t VERSION = 1;
+
+static constexpr std::uint32_t ENTRY_COMPRESSED = 1;
+// Set in a block's size when it is stored uncompressed
+static constexpr std::uint32_t BLOCK_RAW = 0x80000000u;
+
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t num_entries;
+  std::uint64_t toc_offset;
+  std::uint64_t toc_size;
+  char reserved[32];
+};
+static_assert(sizeof(Header) == 64);
+
+struct Archive::Entry {
+  std::uint64_t hash;
+  std::uint64_t offset;
+  std::uint64_t stored_size;
+  std::uint64_t size;
+  // Relative to the start of the names following the entries in the TOC
+  std::uint32_t name_offset;
+  std::uint32_t name_len;
+  std::uint32_t flags;
+  std::uint32_t reserved;
+};
+
+// 64-bit FNV-1a
+static std::uint64_t hash_path(std::string_view path) {
+  std::uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : path) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static std::size_t pad_to(std::size_t n, std::size_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+std::string Archive::normalize(std::string_view path) {
+  std::string res(path);
+  std::replace(res.begin(), res.end(), '\\', '/');
+  while (res.starts_with("./")) {
+    res.erase(0, 2);
+  }
+  return res;
+}
+
+Archive::Archive(const char *filename)
+    : m_filename(filename), m_file(filename) {
+  static_assert(sizeof(Entry) == 48);
+  m_data = m_file.data();
+  m_size = m_file.size();
+
+  // Validate the header and TOC bounds, so that lookups only need to check
+  // individual entries
+  Header hdr;
+  if (m_size < sizeof(hdr)) {
+    throw std::runtime_error(
+        fmt::format("\"{}\" is too small to be an archive", filename));
+  }
+  std::memcpy(&hdr, m_data, sizeof(hdr));
+  if (std::memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      hdr.version != VERSION || hdr.toc_offset > m_size ||
+      hdr.toc_size > m_size - hdr.toc_offset ||
+      hdr.toc_offset % alignof(Entry) != 0 ||
+      (std::uint64_t)hdr.num_entries * sizeof(Entry) > hdr.toc_size) {
+    throw std::runtime_error(
+        fmt::format("\"{}\" is not a valid archive", filename));
+  }
+  m_toc = m_data + hdr.toc_offset;
+  m_num_entries = hdr.num_entries;
+}
+
+const Archive::Entry *Archive::find(std::string_view path) const {
+  std::string norm = normalize(path);
+  std::uint64_t h = hash_path(norm);
+  auto entries = (const Entry *)m_toc;
+  auto end = entries + m_num_entries;
+  const char *names = m_toc + m_num_entries * sizeof(Entry);
+  const char *toc_end =
+      m_toc + ((const Header *)m_data)->toc_size; // Bounds checked on open
+
+  auto it = std::lower_bound(
+      entries, end, h, [](const Entry &e, std::uint64_t h) { return e.hash < h; });
+  for (; it != end && it->hash == h; ++it) {
+    const char *name = names + it->name_offset;
+    if (it->name_offset > (std::size_t)(toc_end - names) ||
+        it->name_len > (std::size_t)(toc_end - name)) {
+      continue; // Corrupt entry
+    }
+    if (std::string_view(name, it->name_len) == norm) {
+      return it;
+    }
+  }
+  return nullptr;
+}
+
+bool Archive::contains(std::string_view path) const {
+  return find(path) != nullptr;
+}
+
+std::optional<FileBuffer> Archive::read(std::string_view path) const {
+  const Entry *e = find(path);
+  if (!e) {
+    return {};
+  }
+  if (e->offset > m_size || e->stored_size > m_size - e->offset) {
+    throw std::runtime_error(fmt::format(
+        "Entry \"{}\" in archive \"{}\" is corrupt", path, m_filename));
+  }
+  const char *data = m_data + e->offset;
+
+  FileBuffer buf;
+  if (!(e->flags & ENTRY_COMPRESSED)) {
+    // Zero-copy: the archive owns the memory
+    buf.data = {(char *)data, [](void *) {}};
+    buf.size = e->stored_size;
+    return buf;
+  }
+
+  auto corrupt = [&] {
+    return std::runtime_error(fmt::format(
+        "Compressed entry \"{}\" in archive \"{}\" is corrupt", path,
+        m_filename));
+  };
+  // Block table: u32 number of blocks, then the stored size of each block
+  std::uint32_t num_blocks;
+  if (e->stored_size < sizeof(num_blocks)) {
+    throw corrupt();
+  }
+  std::memcpy(&num_blocks, data, sizeof(num_blocks));
+  std::size_t table_size = sizeof(num_blocks) * (1 + (std::size_t)num_blocks);
+  if (table_size > e->stored_size ||
+      num_blocks != pad_to(e->size, BLOCK_SIZE) / BLOCK_SIZE) {
+    throw corrupt();
+  }
+
+  buf.data.reset((char *)std::malloc(e->size ? e->size : 1));
+  if (!buf.data) {
+    throw std::bad_alloc();
+  }
+  buf.size = e->size;
+  const char *block = data + table_size;
+  const char *const stored_end = data + e->stored_size;
+  char *out = buf.data.get();
+  for (std::uint32_t i = 0; i < num_blocks; ++i) {
+    std::uint32_t stored;
+    std::memcpy(&stored, data + sizeof(num_blocks) * (1 + i), sizeof(stored));
+    bool raw = stored & BLOCK_RAW;
+    stored &= ~BLOCK_RAW;
+    std::size_t expected = std::min(BLOCK_SIZE, e->size - i * BLOCK_SIZE);
+    if (stored > (std::size_t)(stored_end - block)) {
+      throw corrupt();
+    }
+    if (raw) {
+      if (stored != expected) {
+        throw corrupt();
+      }
+      std::memcpy(out, block, stored);
+    } else if (compress::decompress_block(block, stored, out, expected) !=
+               expected) {
+      throw corrupt();
+    }
+    block += stored;
+    out += expected;
+  }
+  return buf;
+}
+
+// Compress data as independent blocks, prefixed with the block table
+static std::string compress_entry(const std::string &data) {
+  std::uint32_t num_blocks =
+      (std::uint32_t)(pad_to(data.size(), Archive::BLOCK_SIZE) /
+                      Archive::BLOCK_SIZE);
+  std::string res(sizeof(num_blocks) * (1 + (std::size_t)num_blocks), '\0');
+  std::memcpy(res.data(), &num_blocks, sizeof(num_blocks));
+
+  std::string block(compress::bound(Archive::BLOCK_SIZE), '\0');
+  for (std::uint32_t i = 0; i < num_blocks; ++i) {
+    const char *src = data.data() + i * Archive::BLOCK_SIZE;
+    std::size_t len =
+        std::min(Archive::BLOCK_SIZE, data.size() - i * Archive::BLOCK_SIZE);
+    std::uint32_t stored =
+        (std::uint32_t)compress::compress_block(src, len, block.data());
+    if (stored >= len) {
+      // Incompressible, store it raw
+      res.append(src, len);
+      stored = (std::uint32_t)len | BLOCK_RAW;
+    } else {
+      res.append(block.data(), stored);
+    }
+    std::memcpy(res.data() + sizeof(num_blocks) * (1 + i), &stored,
+                sizeof(stored));
+  }
+  return res;
+}
+
+void Archive::pack(const char *output, const std::vector<std::string> &files,
+                   bool compress) {
+  std::ofstream out(output, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error(
+        fmt::format("Could not create archive \"{}\"", output));
+  }
+  std::vector<std::pair<Entry, std::string>> entries;
+  entries.reserve(files.size());
+  std::unordered_set<std::string> seen;
+
+  // Header is written last, once the TOC location is known
+  std::size_t pos = PAGE_SIZE;
+  out.seekp((std::streamoff)pos);
+  for (const auto &file : files) {
+    // The output may be in a directory being packed, and is empty by now
+    if (std::error_code ec; std::filesystem::equivalent(file, output, ec)) {
+      continue;
+    }
+    std::string name = normalize(file);
+    if (!seen.insert(name).second) {
+      throw std::runtime_error(
+          fmt::format("Duplicate archive entry \"{}\"", name));
+    }
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+      throw std::runtime_error(fmt::format("Could not read \"{}\"", file));
+    }
+    std::string data{std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>()};
+
+    Entry e{};
+    e.hash = hash_path(name);
+    e.offset = pos;
+    e.size = data.size();
+    if (compress) {
+      std::string packed = compress_entry(data);
+      if (packed.size() < data.size()) {
+        data = std::move(packed);
+        e.flags |= ENTRY_COMPRESSED;
+      }
+    }
+    e.stored_size = data.size();
+    out.write(data.data(), (std::streamsize)data.size());
+    pos = pad_to(pos + data.size(), PAGE_SIZE);
+    out.seekp((std::streamoff)pos);
+    entries.emplace_back(e, std::move(name));
+  }
+
+  std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+    return std::tie(a.first.hash, a.second) < std::tie(b.first.hash, b.second);
+  });
+
+  std::string names;
+  for (auto &[e, name] : entries) {
+    e.name_offset = (std::uint32_t)names.size();
+    e.name_len = (std::uint32_t)name.size();
+    names += name;
+  }
+  for (const auto &[e, name] : entries) {
+    out.write((const char *)&e, sizeof(e));
+  }
+  out.write(names.data(), (std::streamsize)names.size());
+
+  Header hdr{};
+  std::memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+  hdr.version = VERSION;
+  hdr.num_entries = (std::uint32_t)entries.size();
+  hdr.toc_offset = pos;
+  hdr.toc_size = entries.size() * sizeof(Entry) + names.size();
+  out.seekp(0);
+  out.write((const char *)&hdr, sizeof(hdr));
+  if (!out.flush()) {
+    throw std::runtime_error(
+        fmt::format("Could not write archive \"{}\"", output));
+  }
+}
+
+} // namespace lege
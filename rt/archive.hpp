@@ -0,0 +1,67 @@
+#ifndef LIBLEGE_ARCHIVE_HPP
+#define LIBLEGE_ARCHIVE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "file_buffer.hpp"
+#include "mapped_file.hpp"
+
+namespace lege {
+
+// A read-only, memory-mapped LEGE archive (.lpk).
+//
+// Layout: a 64 byte header, then each entry's data starting on a page
+// boundary, then the table of contents. The TOC is sorted by the 64-bit FNV-1a
+// hash of each entry's path, so lookups are a binary search without touching
+// the names of other entries. Entries are stored either raw, or as a sequence
+// of independently compressed 64 KiB blocks.
+class Archive {
+public:
+  static constexpr std::size_t PAGE_SIZE = 4096;
+  static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+  explicit Archive(const char *filename);
+
+  // No copy
+  Archive(const Archive &) = delete;
+  Archive &operator=(const Archive &) = delete;
+
+  // Raw entries are returned as zero-copy views into the mapping, which stay
+  // valid for as long as the archive does. Compressed entries are decompressed
+  // into a new buffer. Returns nullopt if there is no such entry
+  std::optional<FileBuffer> read(std::string_view path) const;
+  bool contains(std::string_view path) const;
+
+  std::size_t size() const { return m_num_entries; }
+  const std::string &filename() const { return m_filename; }
+
+  // Write an archive containing the given files, which are stored under the
+  // path they were given by. The output itself is skipped if it's among them
+  static void pack(const char *output, const std::vector<std::string> &files,
+                   bool compress = false);
+
+  // Canonical form of an entry path: forward slashes, no leading "./"
+  static std::string normalize(std::string_view path);
+
+private:
+  struct Entry;
+
+  const Entry *find(std::string_view path) const;
+
+  std::string m_filename;
+  MappedFile m_file;
+  // The whole mapping
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  const char *m_toc = nullptr;
+  std::size_t m_num_entries = 0;
+};
+
+} // namespace lege
+
+#endif
@@ -0,0 +1,158 @@
+#include <cstdint>
+#include <cstring>
+
+#include "compress.hpp"
+
+namespace lege::compress {
+
+static constexpr std::size_t MIN_MATCH = 4;
+// The format requires the last 5 bytes to be literals, and no match may start
+// within the last 12 bytes
+static constexpr std::size_t LAST_LITERALS = 5;
+static constexpr std::size_t MF_LIMIT = 12;
+static constexpr std::size_t MAX_OFFSET = 65535;
+static constexpr int HASH_BITS = 12;
+
+static inline std::uint32_t read32(const char *p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline std::uint32_t hash(std::uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes a length that didn't fit in its 4 bit token field
+static inline char *write_length(char *op, std::size_t len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = (char)255;
+  }
+  *op++ = (char)len;
+  return op;
+}
+
+static char *write_sequence(char *op, const char *literals, std::size_t nlit,
+                            std::size_t offset, std::size_t match_len) {
+  char *token = op++;
+  std::uint8_t t = nlit >= 15 ? 15 << 4 : (std::uint8_t)(nlit << 4);
+  if (nlit >= 15) {
+    op = write_length(op, nlit - 15);
+  }
+  std::memcpy(op, literals, nlit);
+  op += nlit;
+  if (match_len) {
+    *op++ = (char)(offset & 0xff);
+    *op++ = (char)(offset >> 8);
+    std::size_t ml = match_len - MIN_MATCH;
+    t |= ml >= 15 ? 15 : (std::uint8_t)ml;
+    if (ml >= 15) {
+      op = write_length(op, ml - 15);
+    }
+  }
+  *token = (char)t;
+  return op;
+}
+
+std::size_t compress_block(const char *src, std::size_t src_size, char *dst) {
+  const char *ip = src, *anchor = src;
+  const char *const end = src + src_size;
+  char *op = dst;
+
+  if (src_size > MF_LIMIT) {
+    std::uint32_t table[1 << HASH_BITS] = {};
+    const char *const match_limit = end - MF_LIMIT;
+    const char *const copy_limit = end - LAST_LITERALS;
+    // Positions are stored +1 so that 0 means "empty"
+    for (; ip < match_limit;) {
+      std::uint32_t h = hash(read32(ip));
+      const char *ref = table[h] ? src + table[h] - 1 : nullptr;
+      table[h] = (std::uint32_t)(ip - src) + 1;
+      if (!ref || (std::size_t)(ip - ref) > MAX_OFFSET ||
+          read32(ref) != read32(ip)) {
+        ++ip;
+        continue;
+      }
+      // Extend the match forwards
+      std::size_t len = MIN_MATCH;
+      while (ip + len < copy_limit && ref[len] == ip[len]) {
+        ++len;
+      }
+      op = write_sequence(op, anchor, (std::size_t)(ip - anchor),
+                          (std::size_t)(ip - ref), len);
+      ip += len;
+      anchor = ip;
+    }
+  }
+
+  // Remaining literals
+  return (std::size_t)(
+      write_sequence(op, anchor, (std::size_t)(end - anchor), 0, 0) - dst);
+}
+
+// Reads a length continued in extra bytes, returns false on overrun
+static inline bool read_length(const std::uint8_t *&ip,
+                               const std::uint8_t *end, std::size_t &len) {
+  std::uint8_t b;
+  do {
+    if (ip >= end) {
+      return false;
+    }
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+std::size_t decompress_block(const char *src, std::size_t src_size, char *dst,
+                             std::size_t dst_capacity) {
+  auto ip = (const std::uint8_t *)src;
+  const auto end = ip + src_size;
+  char *op = dst;
+  char *const op_end = dst + dst_capacity;
+
+  while (ip < end) {
+    std::uint8_t token = *ip++;
+
+    std::size_t nlit = token >> 4;
+    if (nlit == 15 && !read_length(ip, end, nlit)) {
+      return 0;
+    }
+    if (nlit > (std::size_t)(end - ip) || nlit > (std::size_t)(op_end - op)) {
+      return 0;
+    }
+    std::memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+
+    if (ip == end) {
+      break; // The last sequence has no match
+    }
+
+    if (end - ip < 2) {
+      return 0;
+    }
+    std::size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (std::size_t)(op - dst)) {
+      return 0;
+    }
+    std::size_t len = token & 15;
+    if (len == 15 && !read_length(ip, end, len)) {
+      return 0;
+    }
+    len += MIN_MATCH;
+    if (len > (std::size_t)(op_end - op)) {
+      return 0;
+    }
+    // Matches may overlap their own output, so copy byte by byte
+    const char *ref = op - offset;
+    for (std::size_t i = 0; i < len; ++i) {
+      op[i] = ref[i];
+    }
+    op += len;
+  }
+  return (std::size_t)(op - dst);
+}
+
+} // namespace lege::compress
@@ -0,0 +1,26 @@
+#ifndef LIBLEGE_COMPRESS_HPP
+#define LIBLEGE_COMPRESS_HPP
+
+#include <cstddef>
+
+namespace lege::compress {
+
+// A small LZ77 block codec using the LZ4 block format. It is used for archive
+// entries, where decompression speed matters much more than ratio
+
+// Worst-case size of compressing `size` bytes
+static inline std::size_t bound(std::size_t size) {
+  return size + size / 255 + 16;
+}
+
+// Returns the compressed size, dst must hold at least bound(src_size) bytes
+std::size_t compress_block(const char *src, std::size_t src_size, char *dst);
+
+// Returns the decompressed size, or 0 if the input is corrupt or would
+// overflow dst
+std::size_t decompress_block(const char *src, std::size_t src_size, char *dst,
+                             std::size_t dst_capacity);
+
+} // namespace lege::compress
+
+#endif
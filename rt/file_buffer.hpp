@@ -0,0 +1,22 @@
+#ifndef LIBLEGE_FILE_BUFFER_HPP
+#define LIBLEGE_FILE_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+
+namespace lege {
+
+// The contents of a file loaded into memory. Whoever fills the buffer sets the
+// function used to free it: std::free() by default, SDL_free() for
+// SDL_LoadFile(), or a no-op for views into a memory-mapped archive
+struct FileBuffer {
+  std::unique_ptr<char[], void (*)(void *)> data{nullptr, std::free};
+  std::size_t size = 0;
+
+  const char *get() const { return data.get(); }
+};
+
+} // namespace lege
+
+#endif
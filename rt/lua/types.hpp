@@ -75,7 +75,7 @@ T *new_userdata(lua_State *L, Args &&...args) {
   make_metatable<T>(L);
   lua_setmetatable(L, -2);
 
-  return new (ptr) T(std::forward<Args...>(args...));
+  return new (ptr) T(std::forward<Args>(args)...);
 }
 
 template <class T, class... Args>
@@ -89,7 +89,7 @@ T *new_userdata_mt(lua_State *L, const char *metatable, Args &&...args) {
     ptr = align_up(ptr, alignof(T));
   }
   luaL_setmetatable(L, metatable);
-  return new (ptr) T(std::forward<Args...>(args...));
+  return new (ptr) T(std::forward<Args>(args)...);
 }
 
 template <class T, class... Args>
@@ -104,7 +104,7 @@ T *new_userdata_mt(lua_State *L, int metatable_index, Args &&...args) {
   }
   lua_pushvalue(L, metatable_index);
   lua_setmetatable(L, -2);
-  return new (ptr) T(std::forward<Args...>(args...));
+  return new (ptr) T(std::forward<Args>(args)...);
 }
 
 static inline TableView new_table(lua_State *L, int narr = 0, int nrec = 0) {
@@ -0,0 +1,96 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.hpp"
+
+namespace lege {
+
+MappedFile::MappedFile(const char *filename) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error(fmt::format("Could not open \"{}\"", filename));
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw std::runtime_error(
+        fmt::format("Could not get size of \"{}\"", filename));
+  }
+  m_size = (std::size_t)size.QuadPart;
+  if (m_size == 0) {
+    // Empty files can't be mapped, and there's nothing to map anyway
+    CloseHandle(file);
+    return;
+  }
+  m_file = file;
+  m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mapping) {
+    m_data = (const char *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+  }
+  if (!m_data) {
+    if (m_mapping) {
+      CloseHandle(m_mapping);
+    }
+    CloseHandle(file);
+    throw std::runtime_error(fmt::format("Could not map \"{}\"", filename));
+  }
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error(fmt::format("Could not open \"{}\": {}", filename,
+                                         std::strerror(errno)));
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error(fmt::format("Could not stat \"{}\": {}", filename,
+                                         std::strerror(err)));
+  }
+  m_size = (std::size_t)st.st_size;
+  if (m_size == 0) {
+    // Empty files can't be mapped, and there's nothing to map anyway
+    close(fd);
+    return;
+  }
+  void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno;
+  // The mapping keeps its own reference to the file
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error(fmt::format("Could not map \"{}\": {}", filename,
+                                         std::strerror(err)));
+  }
+  m_data = (const char *)data;
+#endif
+}
+
+MappedFile::~MappedFile() {
+  if (!m_data) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(m_data);
+  CloseHandle(m_mapping);
+  CloseHandle(m_file);
+#else
+  munmap((void *)m_data, m_size);
+#endif
+}
+
+} // namespace lege
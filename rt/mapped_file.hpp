@@ -0,0 +1,35 @@
+#ifndef LIBLEGE_MAPPED_FILE_HPP
+#define LIBLEGE_MAPPED_FILE_HPP
+
+#include <cstddef>
+
+namespace lege {
+
+// A whole file mapped read-only into memory. Pages are only read from disk
+// when they're touched, and are shared with anything else mapping the file
+class MappedFile {
+public:
+  // Throws if the file can't be opened or mapped
+  explicit MappedFile(const char *filename);
+  ~MappedFile();
+
+  // No copy
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Null if the file is empty
+  const char *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+private:
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+#ifdef _WIN32
+  void *m_file = nullptr;
+  void *m_mapping = nullptr;
+#endif
+};
+
+} // namespace lege
+
+#endif
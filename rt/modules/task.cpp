@@ -189,31 +189,7 @@ static int l_spawn(lua_State *L) {
   return 1;
 }
 
-static int l_block(lua_State *L) {
-  if (!lua_isyieldable(L)) {
-    return luaL_error(L, "Cannot block the main task");
-  }
-
-  lua_settop(L, 0);
-
-  // false == don't pop the global environment
-  get_current_task(L, false);
-
-  // global_env.pending[current_task] = nil
-  lua_pushliteral(L, "pending");
-  lua_rawget(L, -3);
-  lua_pushvalue(L, -2); // Current task
-  lua_pushnil(L);
-  lua_rawset(L, -3);
-
-  lua_pushliteral(L, "blocked");
-  lua_rawget(L, -4);    // global_env
-  lua_pushvalue(L, -3); // Current task
-  lua_pushboolean(L, true);
-  lua_rawset(L, -3);
-
-  return lua_yield(L, 0);
-}
+static int l_block(lua_State *L) { return lege::task::block(L); }
 
 static const luaL_Reg TASK_FUNCS[]{{"get_support_tables", l_get_support_tables},
                                    {"current", l_current},
@@ -249,6 +225,78 @@ static void make_support_tables(lua_State *L) {
   }
 }
 
+namespace lege::task {
+
+int block(lua_State *L) {
+  if (!lua_isyieldable(L)) {
+    return luaL_error(L, "Cannot block the main task");
+  }
+  lua_settop(L, 0);
+  push_current(L);
+  if (lua_isnil(L, 1)) {
+    return luaL_error(L, "Cannot block outside a task");
+  }
+
+  // global_env.pending[current_task] = nil
+  luaL_getmetatable(L, LEGE_TASK_ENV_NAME);
+  lua_pushliteral(L, "pending");
+  lua_rawget(L, 2);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  lua_rawset(L, -3);
+
+  // global_env.blocked[current_task] = true
+  lua_pushliteral(L, "blocked");
+  lua_rawget(L, 2);
+  lua_pushvalue(L, 1);
+  lua_pushboolean(L, true);
+  lua_rawset(L, -3);
+
+  lua_settop(L, 0);
+  return lua_yield(L, 0);
+}
+
+void wake(lua_State *L, int index) {
+  index = lua::absindex(L, index);
+  luaL_getmetatable(L, LEGE_TASK_ENV_NAME);
+  lua_pushliteral(L, "blocked");
+  lua_rawget(L, -2);
+  lua_pushvalue(L, index);
+  lua_rawget(L, -2);
+  bool blocked = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  if (blocked) {
+    // global_env.blocked[task] = nil
+    lua_pushvalue(L, index);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+
+    // global_env.pending[task] = true
+    lua_pushliteral(L, "pending");
+    lua_rawget(L, -3);
+    lua_pushvalue(L, index);
+    lua_pushboolean(L, true);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+}
+
+void push_current(lua_State *L) {
+  luaL_getmetatable(L, LEGE_TASK_ENV_NAME);
+  if (lua_isnil(L, -1)) {
+    return; // No tasks have been made
+  }
+  lua_pushliteral(L, "by_thread");
+  lua_rawget(L, -2);
+  lua_pushthread(L);
+  lua_rawget(L, -2);
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+}
+
+} // namespace lege::task
+
 extern "C" int luaopen_lege_task(lua_State *L) {
   weak::require(L);
   luaL_newlibtable(L, TASK_FUNCS);
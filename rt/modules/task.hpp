@@ -1,7 +1,24 @@
 #ifndef LIBLEGE_TASK_HPP
 #define LIBLEGE_TASK_HPP
 
+#include <lua.hpp>
+
 #define LEGE_TASK_ENV_NAME "lege.task.env"
 #define LEGE_TASK_MT_NAME "lege.task.mt"
 
+namespace lege::task {
+
+// Blocks the running task until it is woken. Yields, so must be returned
+// from a C function. Raises an error outside a task
+int block(lua_State *L);
+
+// Schedules the blocked task at index to run again. Does nothing if it isn't
+// blocked. Must not be called while the runtime is running tasks
+void wake(lua_State *L, int index);
+
+// Pushes the running task, or nil outside one
+void push_current(lua_State *L);
+
+} // namespace lege::task
+
 #endif
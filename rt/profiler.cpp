@@ -0,0 +1,72 @@
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "profiler.hpp"
+
+namespace lege {
+
+Profiler::Scope::~Scope() {
+  if (m_profiler) {
+    m_profiler->record(
+        {std::move(m_name), std::move(m_category), m_start, Clock::now()});
+  }
+}
+
+static void append_json_string(std::string &out, std::string_view str) {
+  out += '"';
+  for (char c : str) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      if ((unsigned char)c < 0x20) {
+        out += fmt::format("\\u{:04x}", (unsigned)c);
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+std::string Profiler::toJson() const {
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  for (const auto &span : m_spans) {
+    if (!first) {
+      out += ',';
+    }
+    first = false;
+    // Complete events, timestamps are in microseconds
+    out += "\n{\"name\":";
+    append_json_string(out, span.name);
+    out += ",\"cat\":";
+    append_json_string(out, span.category);
+    out += fmt::format(",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":"
+                       "0,\"tid\":{}}}",
+                       since_origin(span.start) * 1e6, span.duration() * 1e6,
+                       span.thread);
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+void Profiler::writeJson(const char *filename) const {
+  std::ofstream out(filename, std::ios::trunc);
+  out << toJson();
+  if (!out.flush()) {
+    throw std::runtime_error(
+        fmt::format("Could not write profile to \"{}\"", filename));
+  }
+}
+
+} // namespace lege
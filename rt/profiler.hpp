@@ -0,0 +1,76 @@
+#ifndef LIBLEGE_PROFILER_HPP
+#define LIBLEGE_PROFILER_HPP
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lege {
+
+// Records how long named spans of work took, used for the startup report.
+// Not thread safe: other threads time their own work, and it's recorded from
+// the main thread afterwards
+class Profiler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Span {
+    std::string name;
+    // E.G. "phase" for startup phases, or "read" / "compile" / "load" for
+    // modules
+    std::string category;
+    Clock::time_point start, end;
+    // 0 is the main thread, worker threads are numbered from 1
+    unsigned thread = 0;
+
+    // In seconds
+    double duration() const {
+      return std::chrono::duration<double>(end - start).count();
+    }
+  };
+
+  // Records a span covering its lifetime. Does nothing if the profiler is null
+  class Scope {
+  public:
+    Scope(Profiler *profiler, std::string name, std::string category)
+        : m_profiler(profiler), m_name(std::move(name)),
+          m_category(std::move(category)), m_start(Clock::now()) {}
+    ~Scope();
+
+    // No copy
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    Profiler *m_profiler;
+    std::string m_name, m_category;
+    Clock::time_point m_start;
+  };
+
+  Profiler() : m_origin(Clock::now()) {}
+
+  [[nodiscard]] Scope time(std::string name, std::string category = "phase") {
+    return Scope(this, std::move(name), std::move(category));
+  }
+  void record(Span span) { m_spans.push_back(std::move(span)); }
+
+  const std::vector<Span> &spans() const { return m_spans; }
+  Clock::time_point origin() const { return m_origin; }
+  // Seconds between the profiler's creation and t
+  double since_origin(Clock::time_point t) const {
+    return std::chrono::duration<double>(t - m_origin).count();
+  }
+
+  // Chrome trace event format, viewable in chrome://tracing or Perfetto
+  std::string toJson() const;
+  void writeJson(const char *filename) const;
+
+private:
+  Clock::time_point m_origin;
+  std::vector<Span> m_spans;
+};
+
+} // namespace lege
+
+#endif
@@ -15,7 +15,7 @@ namespace lua = lege::lua;
 
 namespace lege {
 
-Runtime::Runtime() : L() {
+Runtime::Runtime(Profiler *profiler) : L(), m_profiler(profiler) {
   // Check that the loaded libuv is compatible with the version we were compiled
   // with
   unsigned uvLibVersion = uv_version();
@@ -35,6 +35,7 @@ Runtime::Runtime() : L() {
         fmt::format("Could not initialize event loop: {}", uv_strerror(res)));
   }
 
+  Profiler::Scope timer(m_profiler, "lua_openlibs", "phase");
   luaL_openlibs(L);
 }
 
@@ -85,6 +86,7 @@ void Runtime::load(lua_CFunction cfunc, std::string_view name) {
 }
 
 void Runtime::setup() {
+  Profiler::Scope timer(m_profiler, "run_main", "phase");
   lua_getfield(L, LUA_REGISTRYINDEX, "main");
   if (lua_type(L, -1) != LUA_TFUNCTION) {
     throw std::runtime_error("Main chunk not loaded");
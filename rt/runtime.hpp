@@ -6,12 +6,15 @@
 #include <uv.h>
 
 #include "lua/state.hpp"
+#include "profiler.hpp"
 
 namespace lege {
 
 class Runtime {
 public:
-  Runtime();
+  // The profiler, if given, times opening the Lua libraries and running the
+  // main chunk
+  Runtime(Profiler *profiler = nullptr);
   ~Runtime();
 
   void load(const char *buf, std::size_t size, const char *mode,
@@ -26,6 +29,7 @@ public:
 protected:
   uv_loop_t m_loop;
   lua::State L;
+  Profiler *m_profiler;
 };
 
 } // namespace lege
@@ -0,0 +1,216 @@
+// Checks the archive block codec round-trips and rejects corrupt blocks
+// without reading or writing out of bounds, and that packed archives read back
+// what was packed
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "archive.hpp"
+#include "compress.hpp"
+
+namespace compress = lege::compress;
+namespace fs = std::filesystem;
+using lege::Archive;
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+static void fail(const std::string &msg) {
+  std::printf("%s\n", msg.c_str());
+  ++failures;
+}
+
+static std::string random_bytes(std::size_t size) {
+  std::string s(size, '\0');
+  for (char &c : s) {
+    c = (char)(rng() & 0xff);
+  }
+  return s;
+}
+
+// Words from a small vocabulary, so there's plenty to match
+static std::string text(std::size_t size) {
+  static const char *const WORDS[] = {"local ", "function ", "end\n",
+                                      "return ", "self", "(x, y)", " = ",
+                                      "nil", "\t"};
+  std::string s;
+  while (s.size() < size) {
+    s += WORDS[rng() % std::size(WORDS)];
+  }
+  s.resize(size);
+  return s;
+}
+
+// Decompresses into a buffer of exactly capacity bytes, copying src to one of
+// exactly its size first, so that a sanitizer catches any overrun
+static std::size_t decompress(const std::string &src, std::size_t capacity,
+                              std::string *out = nullptr) {
+  auto in = std::make_unique<char[]>(src.size() ? src.size() : 1);
+  std::memcpy(in.get(), src.data(), src.size());
+  auto dst = std::make_unique<char[]>(capacity ? capacity : 1);
+  std::size_t n =
+      compress::decompress_block(in.get(), src.size(), dst.get(), capacity);
+  if (out) {
+    out->assign(dst.get(), n);
+  }
+  return n;
+}
+
+static std::string compress_string(const std::string &data) {
+  std::string block(compress::bound(data.size()), '\0');
+  block.resize(compress::compress_block(data.data(), data.size(),
+                                        block.data()));
+  return block;
+}
+
+static void test_round_trip(const char *name, const std::string &data) {
+  std::string block = compress_string(data);
+  if (block.size() > compress::bound(data.size())) {
+    fail(std::string(name) + ": compressed past the bound");
+  }
+  std::string out;
+  if (decompress(block, data.size(), &out) != data.size() || out != data) {
+    fail(std::string(name) + ": didn't round-trip");
+  }
+}
+
+static void test_codec() {
+  test_round_trip("empty", "");
+  for (std::size_t size : {1, 5, 12, 13, 17, 100, 4096, 65536, 1 << 20}) {
+    test_round_trip("text", text(size));
+    test_round_trip("random", random_bytes(size));
+    test_round_trip("zeros", std::string(size, '\0'));
+  }
+
+  // Every truncation of a block loses output, and none may overrun
+  std::string data = text(5000);
+  std::string block = compress_string(data);
+  for (std::size_t len = 0; len < block.size(); ++len) {
+    if (decompress(block.substr(0, len), data.size()) >= data.size()) {
+      fail("truncated block decompressed in full");
+      break;
+    }
+  }
+  // A buffer too small for the output is refused
+  if (decompress(block, data.size() - 1) != 0) {
+    fail("decompressed past the end of the output");
+  }
+  // Random corruption must be caught or decode to something in bounds
+  for (int i = 0; i < 2000; ++i) {
+    std::string bad = block;
+    for (int j = 0; j < 4; ++j) {
+      bad[rng() % bad.size()] = (char)(rng() & 0xff);
+    }
+    decompress(bad, data.size());
+  }
+
+  struct Corrupt {
+    const char *name;
+    std::string block;
+  };
+  const Corrupt corrupt[] = {
+      // 4 literals then a match with offset 0
+      {"zero offset", std::string("\x40" "abcd" "\x00\x00", 7)},
+      // A match reaching back before the start of the output
+      {"offset before start", std::string("\x40" "abcd" "\x05\x00", 7)},
+      // A literal length continued past the end of the input
+      {"literal length overrun", std::string("\xf0\xff\xff", 3)},
+      // More literals than there is input
+      {"literals overrun", std::string("\x80" "abc", 4)},
+      // A match offset cut off
+      {"offset overrun", std::string("\x40" "abcd" "\x01", 6)},
+      // A match length continued past the end of the input
+      {"match length overrun", std::string("\x4f" "abcd" "\x01\x00\xff", 8)},
+  };
+  for (const Corrupt &c : corrupt) {
+    if (decompress(c.block, 1024) != 0) {
+      fail(std::string(c.name) + ": corrupt block accepted");
+    }
+  }
+  // A match longer than the output has room for
+  if (decompress(std::string("\x4f" "abcd" "\x01\x00\x10", 8), 16) != 0) {
+    fail("match overflowing the output accepted");
+  }
+}
+
+static void write_file(const fs::path &path, const std::string &data) {
+  fs::create_directories(path.parent_path());
+  std::ofstream(path, std::ios::binary).write(data.data(),
+                                              (std::streamsize)data.size());
+}
+
+static void test_archive(const fs::path &dir, bool compressed) {
+  const std::vector<std::pair<std::string, std::string>> contents = {
+      {"main.lua", text(3000)},
+      {"lib/big.lua", text(3 * Archive::BLOCK_SIZE + 123)},
+      {"sounds/noise.raw", random_bytes(Archive::BLOCK_SIZE + 7)},
+      {"empty.txt", ""},
+  };
+  fs::remove_all(dir);
+  std::vector<std::string> files;
+  for (const auto &[name, data] : contents) {
+    write_file(dir / name, data);
+    files.push_back((dir / name).generic_string());
+  }
+  // A stale archive in the directory being packed, as `lege pack` would find
+  fs::path output = dir / "game.lpk";
+  write_file(output, "stale");
+  files.push_back(output.generic_string());
+
+  try {
+    Archive::pack(output.string().c_str(), files, compressed);
+    Archive archive(output.string().c_str());
+    if (archive.size() != contents.size()) {
+      fail("archive holds " + std::to_string(archive.size()) + " entries, " +
+           "expected " + std::to_string(contents.size()));
+    }
+    for (const auto &[name, data] : contents) {
+      auto buf = archive.read((dir / name).generic_string());
+      if (!buf || buf->size != data.size() ||
+          std::memcmp(buf->get(), data.data(), data.size()) != 0) {
+        fail(name + ": didn't read back what was packed");
+      }
+    }
+    if (archive.contains(output.generic_string()) ||
+        archive.read("missing.lua")) {
+      fail("archive has entries that weren't packed");
+    }
+  } catch (const std::exception &e) {
+    fail(std::string("pack and mount failed: ") + e.what());
+  }
+
+  // Archives cut short are refused when opened
+  std::string bytes;
+  {
+    std::ifstream in(output, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  for (std::size_t len : {std::size_t(0), std::size_t(10), bytes.size() / 2}) {
+    write_file(output, bytes.substr(0, len));
+    try {
+      Archive archive(output.string().c_str());
+      fail("archive truncated to " + std::to_string(len) + " bytes opened");
+    } catch (const std::exception &) {
+    }
+  }
+  fs::remove_all(dir);
+}
+
+int main() {
+  test_codec();
+  fs::path dir = fs::temp_directory_path() / "lege-test-archive";
+  test_archive(dir, false);
+  test_archive(dir, true);
+  if (failures) {
+    std::printf("%d archive checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
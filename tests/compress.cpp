@@ -0,0 +1,126 @@
+// Checks that compressed sounds keep enough quality, and that every set of
+// kernels expands them back exactly as Sound::sample() reads them
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "audio/kernels.hpp"
+#include "audio/sound.hpp"
+
+namespace audio = lege::audio;
+
+static constexpr unsigned RATE = 48000;
+// Signal to noise ratio every test signal must keep. Each sample is kept to
+// about 8 bits of its block's peak, which is about 50 dB for a full block
+static constexpr double MIN_SNR_DB = 40.0;
+
+static int failures = 0;
+
+// An odd number of frames of f(frame, channel), so the last block is padded
+template <class F>
+static audio::Sound make_sound(unsigned channels, F &&f) {
+  audio::Sound sound;
+  sound.channels = channels;
+  sound.rate = RATE;
+  sound.loop_start = 100;
+  sound.loop_end = RATE - 100;
+  const std::size_t frames = RATE + 37;
+  sound.samples.resize(frames * channels);
+  for (std::size_t i = 0; i < frames; ++i) {
+    for (unsigned c = 0; c < channels; ++c) {
+      sound.samples[i * channels + c] = f(i, c);
+    }
+  }
+  return sound;
+}
+
+static void test_quality(const char *name, const audio::Sound &pcm) {
+  auto compressed = audio::compress(pcm);
+  if (!compressed->isCompressed() || compressed->frames() != pcm.frames() ||
+      compressed->channels != pcm.channels ||
+      compressed->loop_start != pcm.loop_start ||
+      compressed->loop_end != pcm.loop_end) {
+    std::printf("%s: compressed sound doesn't match the original's format\n",
+                name);
+    ++failures;
+    return;
+  }
+  double signal = 0.0, noise = 0.0;
+  for (std::size_t i = 0; i < pcm.samples.size(); ++i) {
+    double error = (double)compressed->sample(i) - pcm.samples[i];
+    signal += (double)pcm.samples[i] * pcm.samples[i];
+    noise += error * error;
+  }
+  double snr = noise > 0.0 ? 10.0 * std::log10(signal / noise) : INFINITY;
+  std::printf("%s: %.1f dB SNR, %zu bytes from %zu\n", name, snr,
+              compressed->bytes(), pcm.bytes());
+  if (snr < MIN_SNR_DB) {
+    std::printf("%s: SNR is below %.0f dB\n", name, MIN_SNR_DB);
+    ++failures;
+  }
+}
+
+static void test_expand(const char *name, const audio::Sound &pcm) {
+  auto compressed = audio::compress(pcm);
+  const std::size_t samples = compressed->codes.size();
+  std::vector<float> expected(samples);
+  for (std::size_t i = 0; i < samples; ++i) {
+    expected[i] = compressed->sample(i);
+  }
+  for (const audio::Kernels *k : audio::supported_kernels()) {
+    std::vector<float> actual(samples);
+    k->expand(actual.data(), compressed->codes.data(),
+              compressed->scales.data(), compressed->scales.size());
+    if (std::memcmp(expected.data(), actual.data(),
+                    samples * sizeof(float)) != 0) {
+      std::printf("%s: %s expand differs from Sound::sample()\n", name,
+                  k->name);
+      ++failures;
+    }
+  }
+}
+
+int main() {
+  const float two_pi = 2.0f * 3.14159265f;
+  std::mt19937 rng(1);
+  std::normal_distribution<float> gaussian(0.0f, 0.2f);
+
+  auto sine = make_sound(1, [&](std::size_t i, unsigned) {
+    return 0.5f * std::sin(two_pi * 440.0f * (float)i / RATE);
+  });
+  // Blocks are scaled to their own peak, so quiet sounds keep their quality
+  auto quiet = make_sound(1, [&](std::size_t i, unsigned) {
+    return 0.001f * std::sin(two_pi * 440.0f * (float)i / RATE);
+  });
+  auto noise = make_sound(
+      2, [&](std::size_t, unsigned) { return gaussian(rng); });
+  // A plucked string, decaying by 60 dB over the sound
+  auto decay = make_sound(2, [&](std::size_t i, unsigned c) {
+    float t = (float)i / RATE;
+    return std::exp(-6.9f * t) *
+           std::sin(two_pi * (220.0f + 3.0f * (float)c) * t);
+  });
+  // Loud transients over a quiet tone, in the same blocks
+  auto clicks = make_sound(1, [&](std::size_t i, unsigned) {
+    float tone = 0.05f * std::sin(two_pi * 440.0f * (float)i / RATE);
+    return i % 1000 < 3 ? 0.9f : tone;
+  });
+
+  test_quality("sine", sine);
+  test_quality("quiet sine", quiet);
+  test_quality("noise", noise);
+  test_quality("decay", decay);
+  test_quality("clicks", clicks);
+  test_expand("noise", noise);
+  test_expand("decay", decay);
+
+  if (failures) {
+    std::printf("%d compression checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
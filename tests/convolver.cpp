@@ -0,0 +1,140 @@
+// Checks that the convolver's wet output matches direct convolution with the
+// normalized impulse response, delayed by a block, for impulse responses
+// spanning several partitions. Also checks that stopping the impulse loader
+// abandons whatever is still queued
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "audio/convolver.hpp"
+
+namespace audio = lege::audio;
+
+static constexpr unsigned RATE = 48000;
+// Largest difference from direct convolution allowed, relative to the RMS of
+// the expected output
+static constexpr double MAX_ERROR = 1e-4;
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+// Decaying noise, like a room's tail
+static std::shared_ptr<audio::Sound> make_impulse(unsigned channels,
+                                                  std::size_t frames) {
+  std::normal_distribution<float> gaussian(0.0f, 1.0f);
+  auto sound = std::make_shared<audio::Sound>();
+  sound->channels = channels;
+  sound->rate = RATE;
+  sound->samples.resize(frames * channels);
+  for (std::size_t i = 0; i < frames; ++i) {
+    float decay = std::exp(-4.0f * (float)i / (float)frames);
+    for (unsigned c = 0; c < channels; ++c) {
+      sound->samples[i * channels + c] = gaussian(rng) * decay;
+    }
+  }
+  return sound;
+}
+
+static void test_convolution(unsigned channels, std::size_t ir_frames) {
+  auto impulse = make_impulse(channels, ir_frames);
+  audio::Convolver convolver(RATE);
+  convolver.init(audio::Convolver::WET, 1.0f);
+  convolver.init(audio::Convolver::DRY, 0.0f);
+  convolver.setImpulse(audio::partition_impulse(*impulse, RATE));
+
+  const std::size_t frames = ir_frames + 6 * audio::CONVOLUTION_BLOCK;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> in(frames * 2);
+  for (float &s : in) {
+    s = dist(rng);
+  }
+  // In uneven chunks, so blocks are filled across calls
+  std::vector<float> out = in;
+  for (std::size_t i = 0, n = 0; i < frames; i += n) {
+    n = std::min<std::size_t>(1 + rng() % 700, frames - i);
+    convolver.process(out.data() + i * 2, n);
+  }
+
+  // The impulse response is scaled to unit energy in its louder channel
+  double energy[2] = {};
+  for (unsigned c = 0; c < 2; ++c) {
+    const unsigned from = std::min(c, channels - 1);
+    for (std::size_t k = 0; k < ir_frames; ++k) {
+      double h = impulse->samples[k * channels + from];
+      energy[c] += h * h;
+    }
+  }
+  const double scale = 1.0 / std::sqrt(std::max(energy[0], energy[1]));
+
+  double max_error = 0.0, power = 0.0;
+  for (std::size_t n = 0; n < frames; ++n) {
+    for (unsigned c = 0; c < 2; ++c) {
+      const unsigned from = std::min(c, channels - 1);
+      double expected = 0.0;
+      if (n >= audio::CONVOLUTION_BLOCK) {
+        std::size_t m = n - audio::CONVOLUTION_BLOCK;
+        for (std::size_t k = 0; k < ir_frames && k <= m; ++k) {
+          expected += impulse->samples[k * channels + from] *
+                      in[(m - k) * 2 + c];
+        }
+        expected *= scale;
+      }
+      max_error = std::max(max_error, std::abs(out[n * 2 + c] - expected));
+      power += expected * expected;
+    }
+  }
+  double rms = std::sqrt(power / (double)(frames * 2));
+  std::printf("%u channel %zu frame impulse: max error %.2e of RMS %.3f\n",
+              channels, ir_frames, max_error, rms);
+  if (!(max_error <= MAX_ERROR * rms)) {
+    std::printf("  differs from direct convolution\n");
+    ++failures;
+  }
+}
+
+static void test_loader_stop() {
+  constexpr int JOBS = 20;
+  std::atomic<int> loaded = 0;
+  auto impulse = make_impulse(1, 100);
+  std::vector<std::shared_ptr<audio::Convolver>> convolvers;
+  audio::ImpulseLoader loader;
+  for (int i = 0; i < JOBS; ++i) {
+    auto &convolver = convolvers.emplace_back(
+        std::make_shared<audio::Convolver>(RATE));
+    loader.add(convolver, [&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      ++loaded;
+      return impulse;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  loader.stop();
+  // Only the loads already running when it stopped may have finished
+  std::printf("Impulse loader stopped after %d of %d loads\n", loaded.load(),
+              JOBS);
+  if (loaded > 2) {
+    std::printf("  kept loading after being stopped\n");
+    ++failures;
+  }
+}
+
+int main() {
+  // Shorter than a partition, exactly two, and a few with a partial last one
+  test_convolution(2, 300);
+  test_convolution(2, 2 * audio::CONVOLUTION_BLOCK);
+  test_convolution(2, 3 * audio::CONVOLUTION_BLOCK + 123);
+  test_convolution(1, 5 * audio::CONVOLUTION_BLOCK + 7);
+  test_loader_stop();
+  if (failures) {
+    std::printf("%d convolver checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
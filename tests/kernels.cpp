@@ -0,0 +1,173 @@
+// Checks that every set of kernels this CPU supports produces exactly the
+// same output as the scalar ones, on random input of odd lengths so that the
+// vectorized loops' tails are covered too
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "audio/kernels.hpp"
+
+namespace audio = lege::audio;
+
+// Random cases tried per kernel
+static constexpr int ITERATIONS = 500;
+static constexpr std::size_t MAX_FRAMES = 1100;
+// Resampling reads from up to MAX_CURSOR + MAX_FRAMES * MAX_STEP + 1
+static constexpr double MAX_CURSOR = 100.0;
+static constexpr double MAX_STEP = 8.0;
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+static float random_sample() {
+  return std::uniform_real_distribution<float>(-1.5f, 1.5f)(rng);
+}
+
+static std::vector<float> random_samples(std::size_t count) {
+  std::vector<float> samples(count);
+  for (float &s : samples) {
+    s = random_sample();
+  }
+  return samples;
+}
+
+// Reports the first sample where expected and actual differ, bit for bit
+template <class T>
+static void check(const audio::Kernels &k, const char *kernel,
+                  const std::vector<T> &expected,
+                  const std::vector<T> &actual, std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    if (std::memcmp(&expected[i], &actual[i], sizeof(T)) != 0) {
+      std::printf("%s %s: sample %zu of %zu is %g, expected %g\n", k.name,
+                  kernel, i, count, (double)actual[i], (double)expected[i]);
+      ++failures;
+      return;
+    }
+  }
+}
+
+static void test_mixing(const audio::Kernels &s, const audio::Kernels &k) {
+  std::vector<float> in = random_samples(
+      ((std::size_t)(MAX_CURSOR + MAX_FRAMES * MAX_STEP) + 2) * 2);
+  std::vector<float> left = random_samples(MAX_FRAMES);
+  std::vector<float> right = random_samples(MAX_FRAMES);
+  for (int it = 0; it < ITERATIONS; ++it) {
+    unsigned channels = 1 + it % 2;
+    std::size_t frames = rng() % MAX_FRAMES;
+    double cursor =
+        std::uniform_real_distribution<double>(0.0, MAX_CURSOR)(rng);
+    double step = std::uniform_real_distribution<double>(0.0, MAX_STEP)(rng);
+    if (it % 7 == 0) {
+      step = 1.0;
+    }
+
+    std::vector<float> expected(MAX_FRAMES * 2), actual(MAX_FRAMES * 2);
+    s.resample(expected.data(), in.data(), channels, cursor, step, frames);
+    k.resample(actual.data(), in.data(), channels, cursor, step, frames);
+    check(k, "resample", expected, actual, frames * channels);
+
+    float start[2] = {random_sample(), random_sample()};
+    float end[2] = {random_sample(), random_sample()};
+    std::size_t length = frames + rng() % 5 + 1;
+    expected = actual = random_samples(MAX_FRAMES * 2);
+    s.mix(expected.data(), in.data(), channels, frames, start, end, length);
+    k.mix(actual.data(), in.data(), channels, frames, start, end, length);
+    check(k, "mix", expected, actual, frames * 2);
+
+    expected = actual = random_samples(MAX_FRAMES);
+    s.ramp(expected.data(), frames, start[0], end[0], length);
+    k.ramp(actual.data(), frames, start[0], end[0], length);
+    check(k, "ramp", expected, actual, frames);
+
+    expected = actual = random_samples(MAX_FRAMES * 2);
+    s.add_planar(expected.data(), left.data(), right.data(), frames);
+    k.add_planar(actual.data(), left.data(), right.data(), frames);
+    check(k, "add_planar", expected, actual, frames * 2);
+
+    // Out of range, NaN and infinite samples have to be clamped the same way
+    std::vector<float> loud = random_samples(frames * 2);
+    for (std::size_t i = 0; i < loud.size(); ++i) {
+      loud[i] *= 2.0f;
+      if (i % 97 == 0) {
+        loud[i] = std::numeric_limits<float>::quiet_NaN();
+      } else if (i % 89 == 0) {
+        loud[i] = -std::numeric_limits<float>::infinity();
+      }
+    }
+    std::vector<std::int16_t> expected16(frames * 2), actual16(frames * 2);
+    s.to_s16(expected16.data(), loud.data(), frames * 2);
+    k.to_s16(actual16.data(), loud.data(), frames * 2);
+    check(k, "to_s16", expected16, actual16, frames * 2);
+
+    expected = actual = loud;
+    s.clamp(expected.data(), frames * 2);
+    k.clamp(actual.data(), frames * 2);
+    check(k, "clamp", expected, actual, frames * 2);
+  }
+}
+
+static void test_fft(const audio::Kernels &s, const audio::Kernels &k) {
+  for (std::size_t n = 2; n <= 4096; n *= 2) {
+    for (std::size_t half = 1; half < n; half *= 2) {
+      std::vector<float> tw_re = random_samples(half);
+      std::vector<float> tw_im = random_samples(half);
+      std::vector<float> re = random_samples(n), im = random_samples(n);
+      std::vector<float> re2 = re, im2 = im;
+      s.fft_pass(re.data(), im.data(), n, half, tw_re.data(), tw_im.data());
+      k.fft_pass(re2.data(), im2.data(), n, half, tw_re.data(),
+                 tw_im.data());
+      check(k, "fft_pass re", re, re2, n);
+      check(k, "fft_pass im", im, im2, n);
+    }
+  }
+
+  for (int it = 0; it < ITERATIONS; ++it) {
+    std::size_t n = rng() % MAX_FRAMES;
+    std::vector<float> a_re = random_samples(n), a_im = random_samples(n);
+    std::vector<float> b_re = random_samples(n), b_im = random_samples(n);
+    std::vector<float> acc_re = random_samples(n), acc_im = random_samples(n);
+    std::vector<float> acc_re2 = acc_re, acc_im2 = acc_im;
+    s.complex_mac(acc_re.data(), acc_im.data(), a_re.data(), a_im.data(),
+                  b_re.data(), b_im.data(), n);
+    k.complex_mac(acc_re2.data(), acc_im2.data(), a_re.data(), a_im.data(),
+                  b_re.data(), b_im.data(), n);
+    check(k, "complex_mac re", acc_re, acc_re2, n);
+    check(k, "complex_mac im", acc_im, acc_im2, n);
+  }
+}
+
+static void test_expand(const audio::Kernels &s, const audio::Kernels &k) {
+  for (int it = 0; it < ITERATIONS; ++it) {
+    std::size_t blocks = rng() % 33;
+    std::vector<std::int8_t> codes(blocks * audio::EXPAND_BLOCK);
+    for (std::int8_t &c : codes) {
+      c = (std::int8_t)((int)(rng() % 255) - 127);
+    }
+    std::vector<float> scales = random_samples(blocks);
+    std::vector<float> expected(codes.size()), actual(codes.size());
+    s.expand(expected.data(), codes.data(), scales.data(), blocks);
+    k.expand(actual.data(), codes.data(), scales.data(), blocks);
+    check(k, "expand", expected, actual, codes.size());
+  }
+}
+
+int main() {
+  std::vector<const audio::Kernels *> supported = audio::supported_kernels();
+  const audio::Kernels &scalar = *supported.front();
+  for (const audio::Kernels *k : supported) {
+    std::printf("Testing %s kernels\n", k->name);
+    test_mixing(scalar, *k);
+    test_fft(scalar, *k);
+    test_expand(scalar, *k);
+  }
+  if (failures) {
+    std::printf("%d kernels differ from the scalar ones\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+// Checks that a key press stays pending across frames without one until a
+// sound actually starts, and that only that sound's latency is recorded
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <SDL.h>
+
+#include "audio/mixer.hpp"
+#include "audio/sound.hpp"
+
+namespace audio = lege::audio;
+
+static constexpr unsigned RATE = 48000;
+static constexpr std::size_t BLOCK_FRAMES = 512;
+
+static int failures = 0;
+
+static void check_latencies(const audio::Mixer &mixer, std::size_t expected,
+                            const char *after) {
+  std::size_t count = mixer.timings().latency().count();
+  if (count != expected) {
+    std::printf("%zu latencies recorded after %s, expected %zu\n", count, after,
+                expected);
+    ++failures;
+  }
+}
+
+int main() {
+  auto mixer = std::make_unique<audio::Mixer>();
+  mixer->start(RATE, BLOCK_FRAMES, false);
+  auto sound = std::make_shared<audio::Sound>();
+  sound->channels = 1;
+  sound->rate = RATE;
+  sound->samples.assign(RATE / 10, 0.25f);
+  audio::Source first(*mixer, sound), second(*mixer, sound);
+  std::vector<float> out(BLOCK_FRAMES * 2);
+
+  // A frame with a key press that plays nothing, then one with no press
+  mixer->setInputTime(SDL_GetPerformanceCounter());
+  for (int frame = 0; frame < 2; ++frame) {
+    mixer->update();
+    mixer->render(out.data(), BLOCK_FRAMES);
+  }
+  mixer->update();
+  check_latencies(*mixer, 0, "no sound played");
+
+  // The next sound started is timed from the press
+  first.play();
+  mixer->update();
+  mixer->render(out.data(), BLOCK_FRAMES);
+  mixer->update();
+  check_latencies(*mixer, 1, "playing a sound");
+
+  // And the press is used up, so later sounds aren't
+  second.play();
+  mixer->update();
+  mixer->render(out.data(), BLOCK_FRAMES);
+  mixer->update();
+  check_latencies(*mixer, 1, "playing another sound");
+
+  mixer->stopWorkers();
+  if (failures) {
+    std::printf("%d latency checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}